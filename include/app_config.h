@@ -5,6 +5,64 @@
 // #define MQTT_INSECURE // Uncomment to disable SSL certificate verification
 // #define USE_WIFI_CONNECTION // Uncomment to use WiFi connection instead of GSM for testing
 #define USE_DUMMY_GPS_DATA // Uncomment to publish dummy GPS data for testing
-#define PUBLISH_INTERVAL 0 // Publish interval in milliseconds
+#define USE_UBX_PROTOCOL // Comment out to keep the receiver's default NMEA output and decode it with TinyGPSPlus
+#define ENABLE_DIAGNOSTICS // Comment out to compile out the pipeline timing and the diagnostics topic
+#define PUBLISH_INTERVAL 0 // Minimum interval between captured fixes in milliseconds
+#define MOTION_MIN_DISTANCE 25.0f // Publish a fix after moving this many meters
+#define MOTION_MIN_HEADING_CHANGE 20.0f // Publish a fix after turning this many degrees
+#define MOTION_HEADING_MIN_SPEED 5.0f // Ignore the course below this speed in km/h
+#define MOTION_STOPPED_SPEED 3.0f // Below this speed in km/h the vehicle is parked and only the heartbeat is published
+#define MOTION_FAST_SPEED 60.0f // From this speed in km/h fixes may be published more often
+#define MOTION_SLOW_MIN_INTERVAL 5000 // Minimum interval between fixes below MOTION_FAST_SPEED in milliseconds
+#define MOTION_FAST_MIN_INTERVAL 1000 // Minimum interval between fixes from MOTION_FAST_SPEED in milliseconds
+#define MOTION_HEARTBEAT_INTERVAL 60000 // Publish a fix at least this often, even when nothing changed, in milliseconds
+#define TRACK_TOLERANCE 10.0f // Drop fixes within this many meters of the track predicted from the last published fix, 0 to publish every distance fix
+#define FIX_BUFFER_CAPACITY 32 // Number of fixes buffered while waiting to be published
+#define FIX_QUEUE_CAPACITY 128 // Fixes queued between the GPS task and loop(), a power of two covering CONNECTION_MAX_STALL at MOTION_FAST_MIN_INTERVAL
+#define GPS_TASK_CORE 0 // Core running GPS decoding, loop() runs network and crypto work on core 1
+#define GPS_TASK_PRIORITY 2 // FreeRTOS priority of the GPS task
+#define GPS_TASK_STACK_SIZE 4096 // Stack size of the GPS task in bytes
+#define GPS_TASK_POLL_INTERVAL 5 // Delay between reads of the GPS UART in milliseconds
+#define GPS_RX_BUFFER_SIZE 1024 // Size of the GPS UART receive buffer in bytes
+#define GPS_READ_CHUNK_SIZE 128 // Bytes read from the GPS UART at once
+#define GPS_UBX_RATE 5 // Navigation rate in Hz with UBX output, at most 5 on the NEO-6M
+#define GPS_UBX_ACK_TIMEOUT 500 // Wait this many milliseconds for the receiver to acknowledge a UBX configuration message
+#define GPS_UBX_RETRY_INTERVAL 30000 // Retry a failed UBX configuration from the GPS task after this many milliseconds
+#define GPS_SOURCE GPS_SOURCE_UART // Input of the GPS task: GPS_SOURCE_UART, GPS_SOURCE_REPLAY or GPS_SOURCE_SYNTHETIC, fixes from the last two are marked dummy
+#define GPS_REPLAY_PATH "/littlefs/replay.nmea" // NMEA or UBX capture replayed with GPS_SOURCE_REPLAY
+#define GPS_SOURCE_SPEED 1.0f // Pace of a replayed or synthetic source, 1 for real time, N for N times faster
+#define GPS_SYNTHETIC_RATE 5 // Epochs per second of GPS_SOURCE_SYNTHETIC, NMEA or UBX following USE_UBX_PROTOCOL
+#define GPS_SYNTHETIC_SEED 1 // Seed of the GPS_SOURCE_SYNTHETIC route, the same seed drives the same route
+#define FIX_BATCH_SIZE 5 // Publish as soon as this many fixes are buffered
+#define FIX_BATCH_MAX_AGE 5000 // Publish once the oldest buffered fix is this old, in milliseconds
+#define PAYLOAD_FORMAT PAYLOAD_FORMAT_HEX_LEGACY // Wire encoding of encrypted payloads: PAYLOAD_FORMAT_BINARY, PAYLOAD_FORMAT_BASE64, PAYLOAD_FORMAT_HEX or PAYLOAD_FORMAT_HEX_LEGACY, switch only once the backend decodes the prefixed frames
+#define KEYSTREAM_PREFETCH_STEP 256 // Keystream bytes generated ahead of the next publish per idle loop() pass
+#define FIX_ENCODING FIX_ENCODING_JSON // Encoding of the fix before encryption: FIX_ENCODING_JSON, FIX_ENCODING_BINARY or FIX_ENCODING_COLUMNAR
+#define CONNECTION_BACKOFF_INITIAL 1000 // Delay before retrying a failed connection step in milliseconds, doubled after every failure
+#define CONNECTION_BACKOFF_MAX 60000 // Upper bound of the connection retry delay in milliseconds
+#define CONNECTION_BACKOFF_JITTER 25 // Random spread of each retry delay in percent
+#define CONNECTION_CHECK_INTERVAL 1000 // Minimum time between link status checks in milliseconds
+#define NETWORK_CONNECT_TIMEOUT 60000 // Give up waiting for network registration after this many milliseconds
+#define GPRS_CONNECT_TIMEOUT 30000 // Give up on a GPRS attempt after this many milliseconds
+#define WIFI_CONNECT_TIMEOUT 20000 // Give up on a WiFi attempt after this many milliseconds
+#define MQTT_CONNECT_TIMEOUT 15000 // Give up on an MQTT attempt after this many milliseconds
+#define MQTT_SOCKET_TIMEOUT 5 // PubSubClient wait for CONNACK and other broker replies in seconds, does not bound the TCP connect
+#define MQTT_TCP_CONNECT_TIMEOUT 10 // Timeout of the TCP connect to the broker over GSM in seconds, TinyGSM defaults to 75
+#define CONNECTION_MAX_STALL 120000 // Longest a blocking connect step may hold up loop() in milliseconds, TinyGSM's gprsConnect() waits up to 60-85 s per AT command
+#define FIX_LOG_DIR "/littlefs/fixlog" // Directory of the store-and-forward log on the LittleFS partition
+#define FIX_LOG_SEGMENT_SIZE 16384 // Size of one log segment file in bytes
+#define FIX_LOG_MAX_SEGMENTS 8 // Log segments kept on flash, the oldest is dropped when full
+#define FIX_LOG_REPLAY_BATCH 32 // Maximum number of logged fixes per replayed message
+#define FIX_LOG_REPLAY_INTERVAL 1000 // Minimum interval between replayed messages in milliseconds
+#define CLOCK_STEP_THRESHOLD 2000 // Step the fix clock instead of slewing it when GPS time is off by more than this many milliseconds
+#define CLOCK_MAX_SLEW 100 // Largest correction of the fix clock per GPS time update in milliseconds
+#define HEAP_MONITOR_INTERVAL 60000 // Log free heap, largest free block and lowest free heap this often in milliseconds
+#define LOG_TASK_PRIORITY 1 // FreeRTOS priority of the task printing the log, just above idle
+#define LOG_TASK_STACK_SIZE 3072 // Stack size of the log task in bytes
+#define LOG_DRAIN_INTERVAL 20 // Delay between checks of an empty log in milliseconds
+#define DIAGNOSTICS_INTERVAL 300000 // Publish a pipeline timing snapshot to MQTT_DIAGNOSTICS_TOPIC this often in milliseconds
+#define GPS_TIME_LATENCY 0 // Delay between a GPS time and the end of the NMEA sentence or UBX epoch carrying it in milliseconds, depends on the baud rate
+// #define USE_DEVICE_KEYS // Uncomment to encrypt with the key scripts/device_key.py derives for MQTT_CLIENT_ID and publish to MQTT_TOPIC/MQTT_CLIENT_ID
+// #define PRINT_PLAIN_JSON // Uncomment to print the plain JSON payload before encryption
 
 #endif // APP_CONFIG_H)
\ No newline at end of file
@@ -8,6 +8,21 @@
 #define MQTT_CLIENT_ID "lokatrack-gps-1"
 #define MQTT_USERNAME "lokatrack-gps-1"
 #define MQTT_PASSWORD "lokatrack"
+#define MQTT_BUFFER_SIZE 1024 // PubSubClient packet buffer size in bytes
+
+// Devices with their own key publish to a per-device topic so the backend knows which key to use
+#if defined(USE_DEVICE_KEYS)
+#define MQTT_PUBLISH_TOPIC MQTT_TOPIC "/" MQTT_CLIENT_ID
+#else
+#define MQTT_PUBLISH_TOPIC MQTT_TOPIC
+#endif
+
+// Largest payload that fits in the packet buffer next to the fixed header and topic
+#define MQTT_MAX_PAYLOAD_SIZE (MQTT_BUFFER_SIZE - 5 - 2 - (sizeof(MQTT_PUBLISH_TOPIC) - 1))
+
+// Pipeline timing snapshots are published in plain JSON to their own per-device topic, away from the fixes
+#define MQTT_DIAGNOSTICS_TOPIC MQTT_TOPIC "/diagnostics/" MQTT_CLIENT_ID
+#define MQTT_MAX_DIAGNOSTICS_SIZE (MQTT_BUFFER_SIZE - 5 - 2 - (sizeof(MQTT_DIAGNOSTICS_TOPIC) - 1))
 const char *MQTT_CA_CERT = R"EOF(
 -----BEGIN CERTIFICATE-----
 MIIDrzCCApegAwIBAgIQCDvgVpBCRrGhdWrJWZHHSjANBgkqhkiG9w0BAQUFADBh
@@ -5,5 +5,7 @@
 #define NTP_SERVER "time.nist.gov" // NTP server address
 #define GMT_OFFSET 0               // GMT offset in seconds
 #define DST_OFFSET 0               // Daylight Saving Time offset in seconds (set to 0 for UTC)
+#define NTP_SYNC_TIMEOUT 10000     // Give up waiting for the WiFi NTP sync after this many milliseconds
+#define NTP_FALLBACK_DELAY 45000   // Only sync with NTP if GPS time has not arrived this many milliseconds after boot, 0 to always sync
 
 #endif // NTP_CONFIG_H
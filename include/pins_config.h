@@ -4,7 +4,8 @@
 // GPS Neo6M pins
 #define GPS_RX_PIN 25 // Connect to TX of GPS module
 #define GPS_TX_PIN 26 // Connect to RX of GPS module
-#define GPS_BAUD 9600
+#define GPS_BAUD 9600       // Power-on baud rate of the receiver
+#define GPS_UBX_BAUD 115200 // Baud rate the receiver is switched to for UBX output
 
 // SIM800L pins
 #define GSM_RX_PIN 32  // Connect to TX of SIM800L module
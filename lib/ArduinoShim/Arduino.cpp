@@ -0,0 +1,366 @@
+#include "Arduino.h"
+#include <stdarg.h>
+#include <chrono>
+#include <thread>
+
+HostSerial Serial;
+
+static const std::chrono::steady_clock::time_point startTime = std::chrono::steady_clock::now();
+
+// State of the pseudo-random generator behind random()
+static uint32_t randomState = 0x2545F491;
+
+String::String(const char *cstr) : buffer(nullptr), capacity(0), len(0)
+{
+    concat(cstr);
+}
+
+String::String(const char *cstr, size_t length) : buffer(nullptr), capacity(0), len(0)
+{
+    concat(cstr, length);
+}
+
+String::String(const String &other) : buffer(nullptr), capacity(0), len(0)
+{
+    concat(other);
+}
+
+String::String(String &&other) noexcept : buffer(other.buffer), capacity(other.capacity), len(other.len)
+{
+    other.buffer = nullptr;
+    other.capacity = 0;
+    other.len = 0;
+}
+
+String::String(char c) : buffer(nullptr), capacity(0), len(0)
+{
+    concat(c);
+}
+
+String::String(int value, unsigned char base) : String((long)value, base)
+{
+}
+
+String::String(unsigned int value, unsigned char base) : String((unsigned long)value, base)
+{
+}
+
+String::String(long value, unsigned char base) : buffer(nullptr), capacity(0), len(0)
+{
+    char text[72];
+    snprintf(text, sizeof(text), base == HEX ? "%lx" : "%ld", value);
+    concat(text);
+}
+
+String::String(unsigned long value, unsigned char base) : buffer(nullptr), capacity(0), len(0)
+{
+    char text[72];
+    snprintf(text, sizeof(text), base == HEX ? "%lx" : "%lu", value);
+    concat(text);
+}
+
+String::String(double value, unsigned int decimalPlaces) : buffer(nullptr), capacity(0), len(0)
+{
+    char text[72];
+    snprintf(text, sizeof(text), "%.*f", (int)decimalPlaces, value);
+    concat(text);
+}
+
+String::~String()
+{
+    free(buffer);
+}
+
+String &String::operator=(const String &other)
+{
+    if (this != &other)
+    {
+        len = 0;
+        if (buffer != nullptr)
+        {
+            buffer[0] = '\0';
+        }
+        concat(other);
+    }
+    return *this;
+}
+
+String &String::operator=(String &&other) noexcept
+{
+    if (this != &other)
+    {
+        free(buffer);
+        buffer = other.buffer;
+        capacity = other.capacity;
+        len = other.len;
+        other.buffer = nullptr;
+        other.capacity = 0;
+        other.len = 0;
+    }
+    return *this;
+}
+
+String &String::operator=(const char *cstr)
+{
+    // Assigning a null pointer releases the buffer, like the Arduino String
+    if (cstr == nullptr)
+    {
+        invalidate();
+        return *this;
+    }
+    len = 0;
+    if (buffer != nullptr)
+    {
+        buffer[0] = '\0';
+    }
+    concat(cstr);
+    return *this;
+}
+
+void String::invalidate()
+{
+    free(buffer);
+    buffer = nullptr;
+    capacity = 0;
+    len = 0;
+}
+
+bool String::reserve(size_t size)
+{
+    if (buffer != nullptr && capacity >= size)
+    {
+        return true;
+    }
+
+    char *grown = (char *)realloc(buffer, size + 1);
+    if (grown == nullptr)
+    {
+        return false;
+    }
+    if (buffer == nullptr)
+    {
+        grown[0] = '\0';
+    }
+    buffer = grown;
+    capacity = size;
+    return true;
+}
+
+bool String::concat(const char *cstr)
+{
+    if (cstr == nullptr)
+    {
+        return false;
+    }
+    return concat(cstr, strlen(cstr));
+}
+
+bool String::concat(const char *cstr, size_t length)
+{
+    if (cstr == nullptr)
+    {
+        return false;
+    }
+    if (!reserve(len + length))
+    {
+        return false;
+    }
+    memmove(buffer + len, cstr, length);
+    len += length;
+    buffer[len] = '\0';
+    return true;
+}
+
+char &String::operator[](size_t index)
+{
+    static char dummy;
+    if (index >= len)
+    {
+        dummy = 0;
+        return dummy;
+    }
+    return buffer[index];
+}
+
+int String::indexOf(char c, size_t from) const
+{
+    if (from >= len)
+    {
+        return -1;
+    }
+    const char *found = (const char *)memchr(buffer + from, c, len - from);
+    return found != nullptr ? (int)(found - buffer) : -1;
+}
+
+int String::indexOf(const char *str, size_t from) const
+{
+    if (from >= len || str == nullptr)
+    {
+        return -1;
+    }
+    const char *found = strstr(buffer + from, str);
+    return found != nullptr ? (int)(found - buffer) : -1;
+}
+
+String String::substring(size_t from, size_t to) const
+{
+    if (from > to)
+    {
+        size_t swap = from;
+        from = to;
+        to = swap;
+    }
+    if (from >= len)
+    {
+        return String();
+    }
+    if (to > len)
+    {
+        to = len;
+    }
+    return String(buffer + from, to - from);
+}
+
+String operator+(const String &lhs, const String &rhs)
+{
+    String result(lhs);
+    result.concat(rhs);
+    return result;
+}
+
+String operator+(const String &lhs, const char *rhs)
+{
+    String result(lhs);
+    result.concat(rhs);
+    return result;
+}
+
+String operator+(const char *lhs, const String &rhs)
+{
+    String result(lhs);
+    result.concat(rhs);
+    return result;
+}
+
+size_t Print::write(const uint8_t *data, size_t size)
+{
+    size_t written = 0;
+    while (size-- > 0)
+    {
+        written += write(*data++);
+    }
+    return written;
+}
+
+size_t Print::print(long value, int base)
+{
+    return print(String(value, (unsigned char)base));
+}
+
+size_t Print::print(unsigned long value, int base)
+{
+    return print(String(value, (unsigned char)base));
+}
+
+size_t Print::print(long long value, int base)
+{
+    char text[72];
+    snprintf(text, sizeof(text), base == HEX ? "%llx" : "%lld", value);
+    return print(text);
+}
+
+size_t Print::print(unsigned long long value, int base)
+{
+    char text[72];
+    snprintf(text, sizeof(text), base == HEX ? "%llx" : "%llu", value);
+    return print(text);
+}
+
+size_t Print::print(double value, int digits)
+{
+    char text[72];
+    snprintf(text, sizeof(text), "%.*f", digits, value);
+    return print(text);
+}
+
+size_t Print::printf(const char *format, ...)
+{
+    char text[256];
+    va_list args;
+    va_start(args, format);
+    int n = vsnprintf(text, sizeof(text), format, args);
+    va_end(args);
+    if (n < 0)
+    {
+        return 0;
+    }
+    if ((size_t)n < sizeof(text))
+    {
+        return write((const uint8_t *)text, n);
+    }
+
+    // Longer output goes through a temporary heap buffer, like the ESP32 core
+    char *longText = (char *)malloc(n + 1);
+    if (longText == nullptr)
+    {
+        return 0;
+    }
+    va_start(args, format);
+    vsnprintf(longText, n + 1, format, args);
+    va_end(args);
+    size_t written = write((const uint8_t *)longText, n);
+    free(longText);
+    return written;
+}
+
+unsigned long millis()
+{
+    return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - startTime).count();
+}
+
+unsigned long micros()
+{
+    return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - startTime).count();
+}
+
+void delay(unsigned long ms)
+{
+    std::this_thread::sleep_for(std::chrono::milliseconds(ms));
+}
+
+void delayMicroseconds(unsigned int us)
+{
+    std::this_thread::sleep_for(std::chrono::microseconds(us));
+}
+
+long random(long howBig)
+{
+    if (howBig <= 0)
+    {
+        return 0;
+    }
+
+    // xorshift32
+    randomState ^= randomState << 13;
+    randomState ^= randomState >> 17;
+    randomState ^= randomState << 5;
+    return randomState % howBig;
+}
+
+long random(long howSmall, long howBig)
+{
+    if (howSmall >= howBig)
+    {
+        return howSmall;
+    }
+    return random(howBig - howSmall) + howSmall;
+}
+
+void randomSeed(unsigned long seed)
+{
+    // Arduino ignores a zero seed, and xorshift would get stuck on a zero state
+    if ((uint32_t)seed != 0)
+    {
+        randomState = (uint32_t)seed;
+    }
+}
@@ -0,0 +1,170 @@
+#ifndef ARDUINO_SHIM_H
+#define ARDUINO_SHIM_H
+
+// Minimal subset of the Arduino core for host (native) builds.
+// Only what the libraries in lib/, TinyGPSPlus and the host tools in src/ use is provided.
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <math.h>
+
+typedef uint8_t byte;
+typedef bool boolean;
+
+#define DEC 10
+#define HEX 16
+
+#define PI 3.1415926535897932384626433832795
+#define TWO_PI 6.283185307179586476925286766559
+#define radians(deg) ((deg) * (PI / 180.0))
+#define degrees(rad) ((rad) * (180.0 / PI))
+#define sq(x) ((x) * (x))
+
+/**
+ * Heap-backed string with the same growth behavior as the Arduino String
+ * (malloc/realloc, one allocation per capacity change)
+ */
+class String
+{
+public:
+    String(const char *cstr = "");
+    String(const char *cstr, size_t length);
+    String(const String &other);
+    String(String &&other) noexcept;
+    explicit String(char c);
+    explicit String(int value, unsigned char base = DEC);
+    explicit String(unsigned int value, unsigned char base = DEC);
+    explicit String(long value, unsigned char base = DEC);
+    explicit String(unsigned long value, unsigned char base = DEC);
+    explicit String(double value, unsigned int decimalPlaces = 2);
+    ~String();
+
+    String &operator=(const String &other);
+    String &operator=(String &&other) noexcept;
+    String &operator=(const char *cstr);
+
+    bool reserve(size_t size);
+    size_t length() const { return len; }
+    const char *c_str() const { return buffer != nullptr ? buffer : ""; }
+
+    bool concat(const String &other) { return concat(other.c_str(), other.len); }
+    bool concat(const char *cstr);
+    bool concat(const char *cstr, size_t length);
+    bool concat(char c) { return concat(&c, 1); }
+    bool concat(int value) { return concat(String(value)); }
+    bool concat(unsigned int value) { return concat(String(value)); }
+    bool concat(long value) { return concat(String(value)); }
+    bool concat(unsigned long value) { return concat(String(value)); }
+
+    String &operator+=(const String &other) { concat(other); return *this; }
+    String &operator+=(const char *cstr) { concat(cstr); return *this; }
+    String &operator+=(char c) { concat(c); return *this; }
+
+    char charAt(size_t index) const { return index < len ? buffer[index] : 0; }
+    char operator[](size_t index) const { return charAt(index); }
+    char &operator[](size_t index);
+
+    bool equals(const String &other) const { return len == other.len && memcmp(c_str(), other.c_str(), len) == 0; }
+    bool equals(const char *cstr) const { return strcmp(c_str(), cstr != nullptr ? cstr : "") == 0; }
+    bool operator==(const String &other) const { return equals(other); }
+    bool operator==(const char *cstr) const { return equals(cstr); }
+    bool operator!=(const String &other) const { return !equals(other); }
+    bool operator!=(const char *cstr) const { return !equals(cstr); }
+
+    int indexOf(char c, size_t from = 0) const;
+    int indexOf(const char *str, size_t from = 0) const;
+    int indexOf(const String &str, size_t from = 0) const { return indexOf(str.c_str(), from); }
+    String substring(size_t from) const { return substring(from, len); }
+    String substring(size_t from, size_t to) const;
+    long toInt() const { return buffer != nullptr ? atol(buffer) : 0; }
+    double toDouble() const { return buffer != nullptr ? atof(buffer) : 0; }
+
+    friend String operator+(const String &lhs, const String &rhs);
+    friend String operator+(const String &lhs, const char *rhs);
+    friend String operator+(const char *lhs, const String &rhs);
+
+private:
+    void invalidate();
+
+    char *buffer;
+    size_t capacity;
+    size_t len;
+};
+
+/**
+ * Byte sink with the Arduino print helpers
+ */
+class Print
+{
+public:
+    virtual ~Print() {}
+    virtual size_t write(uint8_t c) = 0;
+    virtual size_t write(const uint8_t *data, size_t size);
+    size_t write(const char *str) { return str != nullptr ? write((const uint8_t *)str, strlen(str)) : 0; }
+    size_t write(const char *data, size_t size) { return write((const uint8_t *)data, size); }
+
+    size_t print(const char *str) { return write(str); }
+    size_t print(const String &str) { return write((const uint8_t *)str.c_str(), str.length()); }
+    size_t print(char c) { return write((uint8_t)c); }
+    size_t print(int value, int base = DEC) { return print((long)value, base); }
+    size_t print(unsigned int value, int base = DEC) { return print((unsigned long)value, base); }
+    size_t print(long value, int base = DEC);
+    size_t print(unsigned long value, int base = DEC);
+    size_t print(long long value, int base = DEC);
+    size_t print(unsigned long long value, int base = DEC);
+    size_t print(double value, int digits = 2);
+
+    size_t println() { return write("\r\n"); }
+    template <typename T>
+    size_t println(const T &value) { return print(value) + println(); }
+    template <typename T>
+    size_t println(const T &value, int format) { return print(value, format) + println(); }
+
+    size_t printf(const char *format, ...) __attribute__((format(printf, 2, 3)));
+};
+
+/**
+ * Byte source with the Print helpers, as implemented by the serial ports
+ */
+class Stream : public Print
+{
+public:
+    virtual int available() = 0;
+    virtual int read() = 0;
+    virtual int peek() = 0;
+    virtual void flush() {}
+};
+
+/**
+ * Serial port backed by the process's standard output
+ */
+class HostSerial : public Stream
+{
+public:
+    void begin(unsigned long baud) { (void)baud; }
+    void end() {}
+    int available() override { return 0; }
+    int read() override { return -1; }
+    int peek() override { return -1; }
+    void flush() override { fflush(stdout); }
+    size_t write(uint8_t c) override { return fputc(c, stdout) == EOF ? 0 : 1; }
+    size_t write(const uint8_t *data, size_t size) override { return fwrite(data, 1, size, stdout); }
+    using Print::write;
+    operator bool() const { return true; }
+};
+
+extern HostSerial Serial;
+
+unsigned long millis();
+unsigned long micros();
+void delay(unsigned long ms);
+void delayMicroseconds(unsigned int us);
+
+long random(long howBig);
+long random(long howSmall, long howBig);
+void randomSeed(unsigned long seed);
+
+#endif // ARDUINO_SHIM_H
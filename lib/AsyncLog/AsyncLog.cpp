@@ -0,0 +1,213 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "AsyncLog.h"
+
+#define LOG_RING_MASK (LOG_RING_CAPACITY - 1)
+
+AsyncLog asyncLog;
+
+AsyncLog::AsyncLog()
+    : writePosition(0), readPosition(0), written(0), dropped(0), truncated(0), highWater(0), reportedDrops(0)
+{
+    for (uint32_t i = 0; i < LOG_RING_CAPACITY; i++)
+    {
+        records[i].sequence.store(i, std::memory_order_relaxed);
+    }
+}
+
+/**
+ * Format and log a message
+ *
+ * @param level LOG_LEVEL_* of the message
+ * @param format printf() format of the message, without a trailing newline
+ */
+void AsyncLog::printf(uint8_t level, const char *format, ...)
+{
+    va_list args;
+    va_start(args, format);
+    vprintf(level, format, args);
+    va_end(args);
+}
+
+/**
+ * Format and log a message
+ *
+ * @param level LOG_LEVEL_* of the message
+ * @param format printf() format of the message, without a trailing newline
+ * @param args Arguments of the format
+ */
+void AsyncLog::vprintf(uint8_t level, const char *format, va_list args)
+{
+    char line[LOG_LINE_SIZE];
+    int length = vsnprintf(line, sizeof(line), format, args);
+    if (length < 0)
+    {
+        return;
+    }
+    if ((size_t)length >= sizeof(line))
+    {
+        truncated.fetch_add(1, std::memory_order_relaxed);
+        length = sizeof(line) - 1;
+    }
+    write(level, line, length);
+}
+
+/**
+ * Log a message as it is, e.g. a payload, without the LOG_LINE_SIZE limit
+ *
+ * @param level LOG_LEVEL_* of the message
+ * @param text Text of the message, without a trailing newline
+ * @param length Length of the text in bytes
+ * @return true if the message was queued, false if it was dropped
+ */
+bool AsyncLog::write(uint8_t level, const char *text, size_t length)
+{
+    size_t count = length == 0 ? 1 : (length + LOG_RECORD_TEXT_SIZE - 1) / LOG_RECORD_TEXT_SIZE;
+    uint32_t position;
+    if (!reserve(count, &position))
+    {
+        dropped.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+
+    uint32_t time = millis();
+    for (size_t i = 0; i < count; i++, position++)
+    {
+        LogRecord &record = records[position & LOG_RING_MASK];
+        size_t part = length < LOG_RECORD_TEXT_SIZE ? length : LOG_RECORD_TEXT_SIZE;
+        record.time = time;
+        record.level = level;
+        record.flags = (i == 0 ? LOG_RECORD_FIRST : 0) | (i == count - 1 ? LOG_RECORD_LAST : 0);
+        record.length = part;
+        memcpy(record.text, text, part);
+        text += part;
+        length -= part;
+
+        // Hand the record over to the drain task
+        record.sequence.store(position + 1, std::memory_order_release);
+    }
+    written.fetch_add(1, std::memory_order_relaxed);
+    return true;
+}
+
+/**
+ * Reserve consecutive records
+ *
+ * @param count Number of records
+ * @param position Set to the position of the first record
+ * @return true if the records were reserved, false if the ring is too full
+ */
+bool AsyncLog::reserve(size_t count, uint32_t *position)
+{
+    if (count > LOG_RING_CAPACITY)
+    {
+        return false;
+    }
+
+    uint32_t start = writePosition.load(std::memory_order_relaxed);
+    for (;;)
+    {
+        // The drain task frees records in order, so the last one being free means they all are
+        uint32_t last = start + count - 1;
+        uint32_t sequence = records[last & LOG_RING_MASK].sequence.load(std::memory_order_acquire);
+        int32_t difference = (int32_t)(sequence - last);
+        if (difference < 0)
+        {
+            return false;
+        }
+        if (difference > 0)
+        {
+            // Another task reserved the records first
+            start = writePosition.load(std::memory_order_relaxed);
+        }
+        else if (writePosition.compare_exchange_weak(start, start + count, std::memory_order_relaxed))
+        {
+            break;
+        }
+    }
+
+    uint32_t used = start + count - readPosition.load(std::memory_order_relaxed);
+    uint32_t mark = highWater.load(std::memory_order_relaxed);
+    while (used > mark && !highWater.compare_exchange_weak(mark, used, std::memory_order_relaxed))
+    {
+    }
+    *position = start;
+    return true;
+}
+
+/**
+ * Print queued records (drain task only)
+ *
+ * @param output Where to print, e.g. Serial
+ * @param maxRecords Largest number of records to print before returning
+ * @return Number of records printed, 0 if the ring was empty
+ */
+size_t AsyncLog::drain(Print &output, size_t maxRecords)
+{
+    size_t printed = 0;
+    uint32_t position = readPosition.load(std::memory_order_relaxed);
+    while (printed < maxRecords)
+    {
+        // A record that is reserved but not written yet holds back the ones behind it
+        LogRecord &record = records[position & LOG_RING_MASK];
+        if (record.sequence.load(std::memory_order_acquire) != position + 1)
+        {
+            break;
+        }
+
+        char header[24];
+        if (record.flags & LOG_RECORD_FIRST)
+        {
+            // Drops are reported between messages, never in the middle of one
+            uint32_t drops = dropped.load(std::memory_order_relaxed);
+            if (drops != reportedDrops)
+            {
+                int length = snprintf(header, sizeof(header), "%lu W ", (unsigned long)record.time);
+                output.write(header, length);
+                output.print("Log dropped ");
+                output.print((unsigned long)(drops - reportedDrops));
+                output.println(" messages");
+                reportedDrops = drops;
+            }
+            int length = snprintf(header, sizeof(header), "%lu %c ", (unsigned long)record.time,
+                                  getLevelLetter(record.level));
+            output.write(header, length);
+        }
+        output.write(record.text, record.length);
+        if (record.flags & LOG_RECORD_LAST)
+        {
+            output.println();
+        }
+
+        // Free the record for the next lap of the ring
+        record.sequence.store(position + LOG_RING_CAPACITY, std::memory_order_release);
+        position++;
+        readPosition.store(position, std::memory_order_relaxed);
+        printed++;
+    }
+    return printed;
+}
+
+/**
+ * Get the letter printed in front of the messages of a level
+ *
+ * @param level LOG_LEVEL_* to name
+ * @return Letter of the level, e.g. 'I'
+ */
+char AsyncLog::getLevelLetter(uint8_t level)
+{
+    switch (level)
+    {
+    case LOG_LEVEL_ERROR:
+        return 'E';
+    case LOG_LEVEL_WARN:
+        return 'W';
+    case LOG_LEVEL_INFO:
+        return 'I';
+    case LOG_LEVEL_DEBUG:
+        return 'D';
+    default:
+        return '?';
+    }
+}
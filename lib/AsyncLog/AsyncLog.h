@@ -0,0 +1,182 @@
+#ifndef ASYNC_LOG_H
+#define ASYNC_LOG_H
+
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <atomic>
+#include <Arduino.h>
+
+// Log levels, messages above LOG_LEVEL are compiled out and their arguments never evaluated
+#define LOG_LEVEL_NONE 0
+#define LOG_LEVEL_ERROR 1
+#define LOG_LEVEL_WARN 2
+#define LOG_LEVEL_INFO 3
+#define LOG_LEVEL_DEBUG 4
+
+#ifndef LOG_LEVEL
+#define LOG_LEVEL LOG_LEVEL_INFO // Set for every file with -DLOG_LEVEL=... in build_flags
+#endif
+#ifndef LOG_RING_CAPACITY
+#define LOG_RING_CAPACITY 64 // Records in the ring, a power of two
+#endif
+#ifndef LOG_RECORD_TEXT_SIZE
+#define LOG_RECORD_TEXT_SIZE 53 // Bytes of text per record, so that a record is 64 bytes
+#endif
+#ifndef LOG_LINE_SIZE
+#define LOG_LINE_SIZE 256 // Longest formatted message in bytes, longer ones are truncated
+#endif
+
+#define LOG_RECORD_FIRST 0x01 // First record of a message
+#define LOG_RECORD_LAST 0x02  // Last record of a message
+
+/**
+ * Slot of the ring, holding a message or a part of one
+ */
+struct LogRecord
+{
+    std::atomic<uint32_t> sequence; // Position the slot is free for, or position + 1 once it is written
+    uint32_t time;                  // millis() when the message was logged
+    uint8_t level;                  // LOG_LEVEL_* of the message
+    uint8_t flags;                  // LOG_RECORD_FIRST and LOG_RECORD_LAST
+    uint8_t length;                 // Bytes of text in this record
+    char text[LOG_RECORD_TEXT_SIZE];
+};
+
+/**
+ * Logger that never blocks the task logging a message
+ * Messages are formatted into fixed-size records in a lock-free ring and printed later by a
+ * single drain task, so a slow serial port only delays the log and never the caller. Any task
+ * may log. A message longer than one record takes several consecutive ones, reserved at once
+ * so messages of different tasks never interleave. When the ring is full the message is dropped
+ * and counted, and the drain task reports the drops with the next message it prints.
+ *
+ *   LOG_INFO("Publishing %u fixes", (unsigned)count);
+ *
+ *   // In the drain task
+ *   if (asyncLog.drain(Serial, LOG_RING_CAPACITY) == 0)
+ *   {
+ *       vTaskDelay(pdMS_TO_TICKS(20));
+ *   }
+ */
+class AsyncLog
+{
+    static_assert(LOG_RING_CAPACITY > 0 && (LOG_RING_CAPACITY & (LOG_RING_CAPACITY - 1)) == 0,
+                  "LOG_RING_CAPACITY must be a power of two");
+
+public:
+    AsyncLog();
+
+    /**
+     * Format and log a message
+     *
+     * @param level LOG_LEVEL_* of the message
+     * @param format printf() format of the message, without a trailing newline
+     */
+    void printf(uint8_t level, const char *format, ...) __attribute__((format(printf, 3, 4)));
+
+    /**
+     * Format and log a message
+     *
+     * @param level LOG_LEVEL_* of the message
+     * @param format printf() format of the message, without a trailing newline
+     * @param args Arguments of the format
+     */
+    void vprintf(uint8_t level, const char *format, va_list args);
+
+    /**
+     * Log a message as it is, e.g. a payload, without the LOG_LINE_SIZE limit
+     *
+     * @param level LOG_LEVEL_* of the message
+     * @param text Text of the message, without a trailing newline
+     * @param length Length of the text in bytes
+     * @return true if the message was queued, false if it was dropped
+     */
+    bool write(uint8_t level, const char *text, size_t length);
+
+    /**
+     * Print queued records (drain task only)
+     *
+     * @param output Where to print, e.g. Serial
+     * @param maxRecords Largest number of records to print before returning
+     * @return Number of records printed, 0 if the ring was empty
+     */
+    size_t drain(Print &output, size_t maxRecords);
+
+    /**
+     * Get the number of messages queued
+     *
+     * @return Queued messages since boot
+     */
+    uint32_t getWrittenCount() const { return written.load(std::memory_order_relaxed); }
+
+    /**
+     * Get the number of messages dropped because the ring was full
+     *
+     * @return Dropped messages since boot
+     */
+    uint32_t getDroppedCount() const { return dropped.load(std::memory_order_relaxed); }
+
+    /**
+     * Get the number of messages cut at LOG_LINE_SIZE
+     *
+     * @return Truncated messages since boot
+     */
+    uint32_t getTruncatedCount() const { return truncated.load(std::memory_order_relaxed); }
+
+    /**
+     * Get the largest number of records that were queued at once
+     *
+     * @return Ring high-water mark in records
+     */
+    uint32_t getHighWaterMark() const { return highWater.load(std::memory_order_relaxed); }
+
+    /**
+     * Get the letter printed in front of the messages of a level
+     *
+     * @param level LOG_LEVEL_* to name
+     * @return Letter of the level, e.g. 'I'
+     */
+    static char getLevelLetter(uint8_t level);
+
+private:
+    bool reserve(size_t count, uint32_t *position);
+
+    LogRecord records[LOG_RING_CAPACITY];
+    std::atomic<uint32_t> writePosition; // Next position to reserve, advanced by every producer
+    std::atomic<uint32_t> readPosition;  // Next position to print, only advanced by the drain task
+    std::atomic<uint32_t> written;
+    std::atomic<uint32_t> dropped;
+    std::atomic<uint32_t> truncated;
+    std::atomic<uint32_t> highWater;
+    uint32_t reportedDrops; // Drops already reported (drain task only)
+};
+
+// Logger shared by every task
+extern AsyncLog asyncLog;
+
+#if LOG_LEVEL >= LOG_LEVEL_ERROR
+#define LOG_ERROR(...) asyncLog.printf(LOG_LEVEL_ERROR, __VA_ARGS__)
+#else
+#define LOG_ERROR(...) do { if (0) asyncLog.printf(LOG_LEVEL_ERROR, __VA_ARGS__); } while (0)
+#endif
+
+#if LOG_LEVEL >= LOG_LEVEL_WARN
+#define LOG_WARN(...) asyncLog.printf(LOG_LEVEL_WARN, __VA_ARGS__)
+#else
+#define LOG_WARN(...) do { if (0) asyncLog.printf(LOG_LEVEL_WARN, __VA_ARGS__); } while (0)
+#endif
+
+#if LOG_LEVEL >= LOG_LEVEL_INFO
+#define LOG_INFO(...) asyncLog.printf(LOG_LEVEL_INFO, __VA_ARGS__)
+#else
+#define LOG_INFO(...) do { if (0) asyncLog.printf(LOG_LEVEL_INFO, __VA_ARGS__); } while (0)
+#endif
+
+#if LOG_LEVEL >= LOG_LEVEL_DEBUG
+#define LOG_DEBUG(...) asyncLog.printf(LOG_LEVEL_DEBUG, __VA_ARGS__)
+#else
+#define LOG_DEBUG(...) do { if (0) asyncLog.printf(LOG_LEVEL_DEBUG, __VA_ARGS__); } while (0)
+#endif
+
+#endif // ASYNC_LOG_H
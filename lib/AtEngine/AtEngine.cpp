@@ -0,0 +1,232 @@
+#include "AtEngine.h"
+
+/**
+ * Check whether a string starts with a prefix
+ *
+ * @param str Null-terminated string
+ * @param prefix Null-terminated prefix
+ * @return true if str starts with prefix, false otherwise
+ */
+static bool startsWith(const char *str, const char *prefix)
+{
+    return strncmp(str, prefix, strlen(prefix)) == 0;
+}
+
+/**
+ * Create an AT engine
+ *
+ * @param stream Serial stream connected to the modem
+ */
+AtEngine::AtEngine(Stream &stream)
+    : stream(stream), lineLength(0), lineOverflowed(false),
+      busy(false), result(AT_IDLE), sentAt(0), timeout(0), onResponse(nullptr), finalPrefix(nullptr),
+      urcHandlerCount(0), overflows(0), unhandled(0)
+{
+    line[0] = '\0';
+}
+
+/**
+ * Send a command without waiting for its response
+ * Pending input is processed as URCs first.
+ *
+ * @param command Command without the line terminator, e.g. "AT+CCLK?"
+ * @param timeout Time to wait for the final response in milliseconds
+ * @param onResponse Called with every information line of the response, or nullptr
+ * @param finalPrefix Complete on a line starting with this prefix instead of OK, or nullptr
+ * @return true if the command was sent, false if another command is in flight
+ */
+bool AtEngine::send(const char *command, uint32_t timeout, AtLineHandler onResponse, const char *finalPrefix)
+{
+    if (busy)
+    {
+        return false;
+    }
+    poll(); // Leftovers are not part of this command's response
+
+    stream.print(command);
+    stream.print("\r\n");
+
+    busy = true;
+    result = AT_PENDING;
+    sentAt = millis();
+    this->timeout = timeout;
+    this->onResponse = onResponse;
+    this->finalPrefix = finalPrefix;
+    return true;
+}
+
+/**
+ * Process the bytes received so far without blocking
+ *
+ * @return AT_PENDING while the command is in flight, its result once (AT_OK, AT_ERROR or
+ *         AT_TIMEOUT), AT_IDLE when no command is in flight
+ */
+AtResult AtEngine::poll()
+{
+    while (stream.available() > 0)
+    {
+        int c = stream.read();
+        if (c < 0)
+        {
+            break;
+        }
+
+        if (c == '\n')
+        {
+            bool completed = handleLine();
+            lineLength = 0;
+            lineOverflowed = false;
+            if (completed)
+            {
+                break; // Leave the rest for the next command
+            }
+        }
+        else if (c == '\r')
+        {
+            continue;
+        }
+        else if (lineLength < AT_LINE_BUFFER_SIZE - 1)
+        {
+            line[lineLength++] = (char)c;
+        }
+        else
+        {
+            lineOverflowed = true;
+        }
+    }
+
+    if (busy && millis() - sentAt >= timeout)
+    {
+        complete(AT_TIMEOUT);
+    }
+
+    if (busy)
+    {
+        return AT_PENDING;
+    }
+
+    AtResult finished = result;
+    result = AT_IDLE;
+    return finished;
+}
+
+/**
+ * Register a handler for unsolicited result codes
+ *
+ * @param prefix Line prefix, e.g. "+CMTI:" (not copied)
+ * @param handler Called with every matching line
+ * @return true if the handler was registered, false if all AT_MAX_URC_HANDLERS are taken
+ */
+bool AtEngine::addUrcHandler(const char *prefix, AtLineHandler handler)
+{
+    if (urcHandlerCount >= AT_MAX_URC_HANDLERS)
+    {
+        return false;
+    }
+    urcHandlers[urcHandlerCount].prefix = prefix;
+    urcHandlers[urcHandlerCount].handler = handler;
+    urcHandlerCount++;
+    return true;
+}
+
+/**
+ * Handle the complete line in the line buffer
+ *
+ * @return true if the line completed the command in flight, false otherwise
+ */
+bool AtEngine::handleLine()
+{
+    if (lineOverflowed)
+    {
+        overflows++;
+        return false;
+    }
+    if (lineLength == 0)
+    {
+        return false;
+    }
+    line[lineLength] = '\0';
+
+    if (!busy)
+    {
+        dispatchUrc();
+        return false;
+    }
+
+    if (startsWith(line, "AT"))
+    {
+        return false; // Command echo
+    }
+
+    if (finalPrefix != nullptr && startsWith(line, finalPrefix))
+    {
+        if (onResponse != nullptr)
+        {
+            onResponse(line);
+        }
+        complete(AT_OK);
+        return true;
+    }
+
+    if (strcmp(line, "OK") == 0)
+    {
+        if (finalPrefix != nullptr)
+        {
+            return false; // The result follows later
+        }
+        complete(AT_OK);
+        return true;
+    }
+
+    if (strcmp(line, "ERROR") == 0 || startsWith(line, "+CME ERROR") || startsWith(line, "+CMS ERROR"))
+    {
+        complete(AT_ERROR);
+        return true;
+    }
+
+    if (dispatchUrc())
+    {
+        return false;
+    }
+
+    if (onResponse != nullptr)
+    {
+        onResponse(line);
+    }
+    return false;
+}
+
+/**
+ * Pass the line in the line buffer to the first URC handler whose prefix matches
+ *
+ * @return true if a handler matched, false otherwise
+ */
+bool AtEngine::dispatchUrc()
+{
+    for (size_t i = 0; i < urcHandlerCount; i++)
+    {
+        if (startsWith(line, urcHandlers[i].prefix))
+        {
+            urcHandlers[i].handler(line);
+            return true;
+        }
+    }
+    if (!busy)
+    {
+        unhandled++;
+    }
+    return false;
+}
+
+/**
+ * Finish the command in flight
+ *
+ * @param result Result reported by the next poll()
+ */
+void AtEngine::complete(AtResult result)
+{
+    busy = false;
+    this->result = result;
+    onResponse = nullptr;
+    finalPrefix = nullptr;
+}
@@ -0,0 +1,129 @@
+#ifndef AT_ENGINE_H
+#define AT_ENGINE_H
+
+#include <Arduino.h>
+
+// Longest line kept from the modem, including the null terminator; longer lines are dropped
+#define AT_LINE_BUFFER_SIZE 128
+
+// Largest number of unsolicited result code handlers
+#define AT_MAX_URC_HANDLERS 4
+
+/**
+ * State of the command in flight
+ */
+enum AtResult : uint8_t
+{
+    AT_IDLE = 0,    // No command in flight
+    AT_PENDING = 1, // Waiting for the final response
+    AT_OK = 2,      // Final response received
+    AT_ERROR = 3,   // ERROR, +CME ERROR or +CMS ERROR received
+    AT_TIMEOUT = 4  // No final response within the timeout
+};
+
+/**
+ * Called with a complete line from the modem, without the line terminator
+ */
+typedef void (*AtLineHandler)(const char *line);
+
+/**
+ * Asynchronous AT command engine
+ * Bytes are read from the modem as they arrive and assembled into lines in a fixed buffer,
+ * so every line is scanned once. A command completes the moment its final line arrives:
+ * OK or an error by default, or a line starting with a given prefix for commands such as
+ * AT+CNTP that report their result after OK. Lines that are neither echo nor part of the
+ * response are dispatched to the matching unsolicited result code (URC) handler.
+ * Only one command is in flight at a time; nothing else may read the stream meanwhile.
+ */
+class AtEngine
+{
+public:
+    /**
+     * Create an AT engine
+     *
+     * @param stream Serial stream connected to the modem
+     */
+    explicit AtEngine(Stream &stream);
+
+    /**
+     * Send a command without waiting for its response
+     * Pending input is processed as URCs first.
+     *
+     * @param command Command without the line terminator, e.g. "AT+CCLK?"
+     * @param timeout Time to wait for the final response in milliseconds
+     * @param onResponse Called with every information line of the response, or nullptr
+     * @param finalPrefix Complete on a line starting with this prefix instead of OK, or nullptr
+     * @return true if the command was sent, false if another command is in flight
+     */
+    bool send(const char *command, uint32_t timeout, AtLineHandler onResponse = nullptr, const char *finalPrefix = nullptr);
+
+    /**
+     * Process the bytes received so far without blocking
+     *
+     * @return AT_PENDING while the command is in flight, its result once (AT_OK, AT_ERROR or
+     *         AT_TIMEOUT), AT_IDLE when no command is in flight
+     */
+    AtResult poll();
+
+    /**
+     * Check whether a command is in flight
+     *
+     * @return true if a command is waiting for its final response
+     */
+    bool isBusy() const { return busy; }
+
+    /**
+     * Register a handler for unsolicited result codes
+     *
+     * @param prefix Line prefix, e.g. "+CMTI:" (not copied)
+     * @param handler Called with every matching line
+     * @return true if the handler was registered, false if all AT_MAX_URC_HANDLERS are taken
+     */
+    bool addUrcHandler(const char *prefix, AtLineHandler handler);
+
+    /**
+     * Get the number of lines dropped because they did not fit in the line buffer
+     *
+     * @return Number of dropped lines
+     */
+    uint32_t getOverflowCount() const { return overflows; }
+
+    /**
+     * Get the number of lines that matched neither a response nor a URC handler
+     *
+     * @return Number of ignored lines
+     */
+    uint32_t getUnhandledCount() const { return unhandled; }
+
+private:
+    struct UrcHandler
+    {
+        const char *prefix;
+        AtLineHandler handler;
+    };
+
+    bool handleLine();
+    bool dispatchUrc();
+    void complete(AtResult result);
+
+    Stream &stream;
+
+    char line[AT_LINE_BUFFER_SIZE];
+    size_t lineLength;
+    bool lineOverflowed;
+
+    bool busy;
+    AtResult result;
+    uint32_t sentAt;
+    uint32_t timeout;
+    AtLineHandler onResponse;
+    const char *finalPrefix;
+
+    UrcHandler urcHandlers[AT_MAX_URC_HANDLERS];
+    size_t urcHandlerCount;
+
+    uint32_t overflows;
+    uint32_t unhandled;
+};
+
+#endif // AT_ENGINE_H
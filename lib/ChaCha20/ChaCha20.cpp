@@ -1,8 +1,12 @@
 #include <Crypto.h>
 #include <ChaCha.h>
+#include <SHA256.h>
+#include <HKDF.h>
 #include <string.h>
 #include <Arduino.h>
 #include <ArduinoJson.h>
+#include "ChaCha20.h"
+#include "ChaChaSimd.h"
 
 // Default encryption settings
 #define DEFAULT_CHACHA_ROUNDS 20
@@ -28,6 +32,9 @@ static byte defaultIV[DEFAULT_IV_SIZE] = {
 static byte defaultCounter[DEFAULT_COUNTER_SIZE] = {
     0x6D, 0x6E, 0x6F, 0x70, 0x71, 0x72, 0x73, 0x74};
 
+// Salt for per-device key derivation, must match the backend
+static const char deviceKeySalt[] = "lokatrack-device-key";
+
 // Current IV and counter in use - updated for each encryption operation
 static byte currentIV[DEFAULT_IV_SIZE];
 static byte currentCounter[DEFAULT_COUNTER_SIZE];
@@ -35,6 +42,43 @@ static byte currentCounter[DEFAULT_COUNTER_SIZE];
 // Flag to indicate if we need to generate a new IV/counter for the next encryption
 static bool useNewIvCounter = true;
 
+// Size of a ChaCha keystream block in bytes
+#define KEYSTREAM_BLOCK_SIZE 64
+
+static_assert(KEYSTREAM_PREFETCH_SIZE % KEYSTREAM_BLOCK_SIZE == 0, "KEYSTREAM_PREFETCH_SIZE must be a multiple of 64");
+
+// Keystream generated ahead of time for the next message, with its own cipher so that
+// decryption on the global cipher does not disturb it
+static ChaCha prefetchCipher;
+static byte prefetchKeystream[KEYSTREAM_PREFETCH_SIZE];
+static size_t prefetchFilled = 0;
+static bool prefetchNewSession = true;
+static byte prefetchIV[DEFAULT_IV_SIZE];
+static byte prefetchCounter[DEFAULT_COUNTER_SIZE];
+static KeystreamPrefetchStats prefetchStats = {};
+
+// Lookup tables for hexadecimal and base64 encoding
+static constexpr char hexDigits[] = "0123456789ABCDEF";
+static constexpr char base64Digits[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+/**
+ * Expand binary data to uppercase hexadecimal in place
+ * The buffer must hold at least 2 * len bytes. Bytes are expanded from the end
+ * so that no input byte is overwritten before it has been read.
+ *
+ * @param buffer Buffer holding len bytes of binary data at its start
+ * @param len Number of binary bytes to expand
+ */
+static void hexExpandInPlace(byte *buffer, size_t len)
+{
+    for (size_t i = len; i-- > 0;)
+    {
+        byte value = buffer[i];
+        buffer[i * 2] = hexDigits[value >> 4];
+        buffer[i * 2 + 1] = hexDigits[value & 0x0F];
+    }
+}
+
 /**
  * Initialize the ChaCha cipher with default parameters
  */
@@ -43,6 +87,11 @@ void initChaCha()
     chaCha.setNumRounds(DEFAULT_CHACHA_ROUNDS);
     chaCha.setKey(defaultKey, DEFAULT_KEY_SIZE);
 
+    // Keystream prefetched under the previous key is no longer valid
+    prefetchCipher.setNumRounds(DEFAULT_CHACHA_ROUNDS);
+    prefetchCipher.setKey(defaultKey, DEFAULT_KEY_SIZE);
+    prefetchFilled = 0;
+
     // Initialize the current IV and counter with the default values
     memcpy(currentIV, defaultIV, DEFAULT_IV_SIZE);
     memcpy(currentCounter, defaultCounter, DEFAULT_COUNTER_SIZE);
@@ -80,6 +129,11 @@ bool initChaChaCustom(const byte *key, size_t keySize, const byte *iv, const byt
         return false;
     }
 
+    // Keystream prefetched under the previous key is no longer valid
+    prefetchCipher.setNumRounds(rounds);
+    prefetchCipher.setKey(key, keySize);
+    prefetchFilled = 0;
+
     // Update the current IV and counter
     if (iv != nullptr)
     {
@@ -105,6 +159,42 @@ bool initChaChaCustom(const byte *key, size_t keySize, const byte *iv, const byt
     return true;
 }
 
+/**
+ * Derive a per-device key from a master secret and the device ID
+ * Uses HKDF-SHA256 with a fixed salt and the device ID as info, so the backend can derive
+ * the same key for any device from the master secret alone.
+ *
+ * @param masterKey Pointer to the master secret bytes
+ * @param masterKeySize Size of the master secret in bytes
+ * @param deviceId Null-terminated device ID (e.g. MQTT_CLIENT_ID)
+ * @param key Buffer to store the derived key (must be at least DEVICE_KEY_SIZE bytes)
+ * @return true if derivation was successful, false otherwise
+ */
+bool deriveDeviceKey(const byte *masterKey, size_t masterKeySize, const char *deviceId, byte *key)
+{
+    if (masterKey == nullptr || masterKeySize == 0 || deviceId == nullptr)
+    {
+        return false;
+    }
+
+    hkdf<SHA256>(key, DEVICE_KEY_SIZE, masterKey, masterKeySize,
+                 deviceKeySalt, sizeof(deviceKeySalt) - 1, deviceId, strlen(deviceId));
+    return true;
+}
+
+/**
+ * Initialize the ChaCha cipher with a provisioned key and the default IV, counter and rounds
+ * Devices are flashed with their derived key (see scripts/device_key.py), never the master secret.
+ *
+ * @param key Pointer to the key bytes
+ * @param keySize Size of the key in bytes (16 or 32)
+ * @return true if initialization was successful, false otherwise
+ */
+bool initChaChaWithKey(const byte *key, size_t keySize)
+{
+    return initChaChaCustom(key, keySize, defaultIV, defaultCounter, DEFAULT_CHACHA_ROUNDS);
+}
+
 /**
  * Generate a random initialization vector
  *
@@ -169,8 +259,104 @@ void prepareNextMessage()
     chaCha.setCounter(currentCounter, DEFAULT_COUNTER_SIZE);
 }
 
+/**
+ * Check whether the prefetched keystream belongs to the next message
+ * A new session may use any IV, continuing the session needs the current IV and the next counter.
+ *
+ * @param useNewSession Whether the next message starts a new session
+ * @return true if the prefetched keystream can be used for the next message, false otherwise
+ */
+static bool isPrefetchCurrent(bool useNewSession)
+{
+    if (prefetchNewSession != useNewSession)
+    {
+        return false;
+    }
+    if (useNewSession)
+    {
+        return true;
+    }
+
+    byte nextCounter[DEFAULT_COUNTER_SIZE];
+    memcpy(nextCounter, currentCounter, DEFAULT_COUNTER_SIZE);
+    incrementCounter(nextCounter);
+    return memcmp(prefetchIV, currentIV, DEFAULT_IV_SIZE) == 0 &&
+           memcmp(prefetchCounter, nextCounter, DEFAULT_COUNTER_SIZE) == 0;
+}
+
+/**
+ * Generate keystream for the next message ahead of time
+ * Call this from idle time (e.g. loop() while waiting for GPS data); the next encryption
+ * then only has to XOR with the prefetched keystream. The IV and counter of the next message
+ * are chosen on the first call, later calls extend the keystream until the buffer is full.
+ *
+ * @param maxBytes Maximum number of keystream bytes to generate in this call (rounded up to 64)
+ * @param useNewSession Whether the next message will start a new session, as passed to the encrypt function
+ * @return true if the prefetch buffer is full, false if more keystream can be generated
+ */
+bool prefetchKeystreamStep(size_t maxBytes, bool useNewSession)
+{
+    if (prefetchFilled > 0 && !isPrefetchCurrent(useNewSession))
+    {
+        prefetchFilled = 0;
+    }
+
+    if (prefetchFilled == 0)
+    {
+        prefetchNewSession = useNewSession;
+        if (useNewSession)
+        {
+            generateRandomIV(prefetchIV);
+            memcpy(prefetchCounter, defaultCounter, DEFAULT_COUNTER_SIZE);
+        }
+        else
+        {
+            memcpy(prefetchIV, currentIV, DEFAULT_IV_SIZE);
+            memcpy(prefetchCounter, currentCounter, DEFAULT_COUNTER_SIZE);
+            incrementCounter(prefetchCounter);
+        }
+        prefetchCipher.setIV(prefetchIV, DEFAULT_IV_SIZE);
+        prefetchCipher.setCounter(prefetchCounter, DEFAULT_COUNTER_SIZE);
+    }
+
+    // Encrypting zeros yields the raw keystream
+    size_t generated = 0;
+    while (prefetchFilled < KEYSTREAM_PREFETCH_SIZE && generated < maxBytes)
+    {
+        byte *block = prefetchKeystream + prefetchFilled;
+        memset(block, 0, KEYSTREAM_BLOCK_SIZE);
+        prefetchCipher.encrypt(block, block, KEYSTREAM_BLOCK_SIZE);
+        prefetchFilled += KEYSTREAM_BLOCK_SIZE;
+        generated += KEYSTREAM_BLOCK_SIZE;
+    }
+
+    return prefetchFilled == KEYSTREAM_PREFETCH_SIZE;
+}
+
+/**
+ * Get the number of keystream bytes prefetched for the next message
+ *
+ * @return Number of prefetched bytes
+ */
+size_t getPrefetchedKeystreamSize()
+{
+    return prefetchFilled;
+}
+
+/**
+ * Get the keystream prefetch statistics since boot
+ *
+ * @return Prefetch hit and miss counters
+ */
+KeystreamPrefetchStats getKeystreamPrefetchStats()
+{
+    return prefetchStats;
+}
+
 /**
  * Encrypt data using ChaCha
+ * Uses the prefetched keystream when it belongs to this message, so that encryption is a plain
+ * XOR; whatever the prefetch does not cover is generated inline.
  *
  * @param output Buffer to store the encrypted data
  * @param input Data to encrypt
@@ -179,7 +365,18 @@ void prepareNextMessage()
  */
 bool encryptData(byte *output, const byte *input, size_t len)
 {
-    if (useNewIvCounter)
+    size_t prefetched = 0;
+    if (prefetchFilled > 0 && isPrefetchCurrent(useNewIvCounter))
+    {
+        // Adopt the IV and counter the keystream was generated for
+        memcpy(currentIV, prefetchIV, DEFAULT_IV_SIZE);
+        memcpy(currentCounter, prefetchCounter, DEFAULT_COUNTER_SIZE);
+        chaCha.setIV(currentIV, DEFAULT_IV_SIZE);
+        chaCha.setCounter(currentCounter, DEFAULT_COUNTER_SIZE);
+        useNewIvCounter = false;
+        prefetched = prefetchFilled;
+    }
+    else if (useNewIvCounter)
     {
         newEncryptionSession();
     }
@@ -188,7 +385,42 @@ bool encryptData(byte *output, const byte *input, size_t len)
         prepareNextMessage();
     }
 
-    chaCha.encrypt(output, input, len);
+    // The prefetched keystream is used at most once, whether or not it matched
+    prefetchFilled = 0;
+
+    if (prefetched == 0)
+    {
+        prefetchStats.misses++;
+        chaCha.encrypt(output, input, len);
+        return true;
+    }
+
+    size_t xorLen = len < prefetched ? len : prefetched;
+    for (size_t i = 0; i < xorLen; i++)
+    {
+        output[i] = input[i] ^ prefetchKeystream[i];
+    }
+
+    if (len > prefetched)
+    {
+        // Continue inline from the first block that was not prefetched
+        byte counter[DEFAULT_COUNTER_SIZE];
+        memcpy(counter, currentCounter, DEFAULT_COUNTER_SIZE);
+        for (size_t i = 0; i < prefetched / KEYSTREAM_BLOCK_SIZE; i++)
+        {
+            incrementCounter(counter);
+        }
+        chaCha.setCounter(counter, DEFAULT_COUNTER_SIZE);
+        chaCha.encrypt(output + prefetched, input + prefetched, len - prefetched);
+        chaCha.setCounter(currentCounter, DEFAULT_COUNTER_SIZE);
+        prefetchStats.partialHits++;
+    }
+    else
+    {
+        prefetchStats.hits++;
+    }
+    prefetchStats.prefetchedBytes += xorLen;
+
     return true;
 }
 
@@ -306,21 +538,20 @@ String encryptString(const String &input, bool useNewSession)
 
     // Convert header and encrypted bytes to hexadecimal string
     String encryptedHex = "";
+    encryptedHex.reserve((headerSize + inputLen) * 2);
 
     // First add the header (IV + counter)
     for (size_t i = 0; i < headerSize; i++)
     {
-        char hex[3];
-        sprintf(hex, "%02X", headerBytes[i]);
-        encryptedHex += hex;
+        encryptedHex += hexDigits[headerBytes[i] >> 4];
+        encryptedHex += hexDigits[headerBytes[i] & 0x0F];
     }
 
     // Then add the encrypted data
     for (size_t i = 0; i < inputLen; i++)
     {
-        char hex[3];
-        sprintf(hex, "%02X", outputBytes[i]);
-        encryptedHex += hex;
+        encryptedHex += hexDigits[outputBytes[i] >> 4];
+        encryptedHex += hexDigits[outputBytes[i] & 0x0F];
     }
 
     // Clean up
@@ -347,91 +578,637 @@ String encryptString(const String &input)
  * Decrypt a hexadecimal string that was encrypted using ChaCha
  * The input string should include the IV and counter in the format:
  * [IV(8 bytes)][Counter(8 bytes)][Encrypted Data(variable)]
+ * Prefixed hex and base64 frames are detected and decoded as well.
  *
  * @param hexInput Encrypted data in hexadecimal format, including IV and counter
  * @return Decrypted string
  */
 String decryptString(const String &hexInput)
 {
-    size_t hexLen = hexInput.length();
-    size_t headerSize = getIvHeaderSize() * 2; // *2 because each byte is 2 hex chars
-    size_t dataHexLen = hexLen - headerSize;
-    size_t dataByteLen = dataHexLen / 2;
+    return decryptString((const uint8_t *)hexInput.c_str(), hexInput.length());
+}
+
+/**
+ * Encrypt a JSON document
+ *
+ * @param doc JsonDocument to encrypt
+ * @param useNewSession Whether to generate a new IV for this encryption (true) or increment the counter (false)
+ * @return String with the encrypted JSON in hexadecimal format
+ */
+String encryptJson(const JsonDocument &doc, bool useNewSession)
+{
+    String jsonStr;
+    serializeJson(doc, jsonStr);
+    return encryptString(jsonStr, useNewSession);
+}
+
+/**
+ * Encrypt a JSON document with default new session behavior
+ *
+ * @param doc JsonDocument to encrypt
+ * @return String with the encrypted JSON in hexadecimal format
+ */
+String encryptJson(const JsonDocument &doc)
+{
+    return encryptJson(doc, true);
+}
+
+/**
+ * Get the size of the frame prefix for a payload format
+ *
+ * @param format Wire format of the frame
+ * @return Size of the prefix in bytes (0 for PAYLOAD_FORMAT_HEX_LEGACY)
+ */
+static size_t getFramePrefixSize(PayloadFormat format)
+{
+    return format == PAYLOAD_FORMAT_HEX_LEGACY ? 0 : 1;
+}
+
+/**
+ * Get the encoded length of a binary frame body
+ *
+ * @param len Length of the binary body ([IV][Counter][Encrypted Data]) in bytes
+ * @param format Wire format of the frame
+ * @return Encoded length in bytes (excluding prefix and null terminator)
+ */
+static size_t getEncodedLength(size_t len, PayloadFormat format)
+{
+    switch (format)
+    {
+    case PAYLOAD_FORMAT_BINARY:
+        return len;
+    case PAYLOAD_FORMAT_BASE64:
+        return ((len + 2) / 3) * 4;
+    default:
+        return len * 2;
+    }
+}
 
-    // Check if the input has enough data for a header
-    if (hexLen < headerSize)
+/**
+ * Expand binary data to base64 in place
+ * The buffer must hold at least getEncodedLength(len, PAYLOAD_FORMAT_BASE64) bytes. Groups are
+ * expanded from the end so that no input byte is overwritten before it has been read.
+ *
+ * @param buffer Buffer holding len bytes of binary data at its start
+ * @param len Number of binary bytes to expand
+ */
+static void base64ExpandInPlace(byte *buffer, size_t len)
+{
+    size_t groups = (len + 2) / 3;
+    for (size_t g = groups; g-- > 0;)
     {
-        Serial.println("Error: Input too short to contain IV header");
-        return "";
+        size_t remaining = len - g * 3;
+        uint32_t b0 = buffer[g * 3];
+        uint32_t b1 = remaining > 1 ? buffer[g * 3 + 1] : 0;
+        uint32_t b2 = remaining > 2 ? buffer[g * 3 + 2] : 0;
+        uint32_t triple = (b0 << 16) | (b1 << 8) | b2;
+
+        byte *out = buffer + g * 4;
+        out[0] = base64Digits[(triple >> 18) & 0x3F];
+        out[1] = base64Digits[(triple >> 12) & 0x3F];
+        out[2] = remaining > 1 ? base64Digits[(triple >> 6) & 0x3F] : '=';
+        out[3] = remaining > 2 ? base64Digits[triple & 0x3F] : '=';
     }
+}
+
+/**
+ * Get the offset at which the plaintext must be placed in the buffer passed to encryptInPlace()
+ * The bytes before it are reserved for the frame prefix and the IV header.
+ *
+ * @param format Wire format of the frame
+ * @return Offset of the plaintext in bytes
+ */
+size_t getPlaintextOffset(PayloadFormat format)
+{
+    return getFramePrefixSize(format) + getIvHeaderSize();
+}
 
-    // Allocate memory for IV, counter, and data
-    byte *iv = new byte[DEFAULT_IV_SIZE];
-    byte *counter = new byte[DEFAULT_COUNTER_SIZE];
-    byte *encryptedBytes = new byte[dataByteLen];
-    byte *decryptedBytes = new byte[dataByteLen + 1]; // +1 for null terminator
+/**
+ * Get the largest plaintext that encryptInPlace() can handle for a buffer of the given capacity
+ *
+ * @param capacity Capacity of the buffer in bytes
+ * @param format Wire format of the frame
+ * @return Maximum plaintext length in bytes, or 0 if the buffer is too small for the header
+ */
+size_t getMaxPlaintextSize(size_t capacity, PayloadFormat format)
+{
+    size_t headerSize = getIvHeaderSize();
+    size_t overhead = getFramePrefixSize(format);
 
-    // Extract the IV and counter from the hex string
-    for (size_t i = 0; i < DEFAULT_IV_SIZE; i++)
+    // Text formats are null-terminated
+    if (format != PAYLOAD_FORMAT_BINARY)
+    {
+        overhead++;
+    }
+
+    if (capacity <= overhead)
     {
-        String byteHex = hexInput.substring(i * 2, i * 2 + 2);
-        iv[i] = (byte)strtol(byteHex.c_str(), NULL, 16);
+        return 0;
     }
 
-    for (size_t i = 0; i < DEFAULT_COUNTER_SIZE; i++)
+    size_t available = capacity - overhead;
+    size_t maxBodyLen;
+    switch (format)
     {
-        String byteHex = hexInput.substring((DEFAULT_IV_SIZE + i) * 2, (DEFAULT_IV_SIZE + i) * 2 + 2);
-        counter[i] = (byte)strtol(byteHex.c_str(), NULL, 16);
+    case PAYLOAD_FORMAT_BINARY:
+        maxBodyLen = available;
+        break;
+    case PAYLOAD_FORMAT_BASE64:
+        maxBodyLen = (available / 4) * 3;
+        break;
+    default:
+        maxBodyLen = available / 2;
+        break;
     }
 
-    // Convert hex data to bytes
-    for (size_t i = 0; i < dataByteLen; i++)
+    return maxBodyLen > headerSize ? maxBodyLen - headerSize : 0;
+}
+
+/**
+ * Encrypt a plaintext in place and encode the result without any heap allocation
+ * On entry the plaintext must be stored at buffer + getPlaintextOffset(format).
+ * On return the buffer holds the frame [Prefix(1 byte)][IV(8 bytes)][Counter(8 bytes)][Encrypted Data(variable)],
+ * where everything after the prefix is encoded according to the format. Text formats are null-terminated.
+ *
+ * @param buffer Buffer holding the plaintext, also receives the encoded frame
+ * @param capacity Capacity of the buffer in bytes
+ * @param plainLen Length of the plaintext in bytes
+ * @param format Wire format of the frame
+ * @param useNewSession Whether to generate a new IV for this encryption (true) or increment the counter (false)
+ * @return Length of the frame (excluding null terminator), or 0 if the buffer is too small
+ */
+size_t encryptInPlace(uint8_t *buffer, size_t capacity, size_t plainLen, PayloadFormat format, bool useNewSession)
+{
+    if (plainLen > getMaxPlaintextSize(capacity, format))
     {
-        String byteHex = hexInput.substring(headerSize + i * 2, headerSize + i * 2 + 2);
-        encryptedBytes[i] = (byte)strtol(byteHex.c_str(), NULL, 16);
+        return 0;
     }
 
-    // Decrypt the data using the extracted IV and counter
-    decryptDataWithIV(decryptedBytes, encryptedBytes, dataByteLen, iv, counter);
+    useNewIvCounter = useNewSession;
 
-    // Add null terminator
-    decryptedBytes[dataByteLen] = 0;
+    size_t prefixSize = getFramePrefixSize(format);
+    byte *body = buffer + prefixSize;
 
-    // Convert decrypted bytes to string
-    String decryptedStr = String((char *)decryptedBytes);
+    // Encrypt the data in place, then write the header that was used in front of it
+    byte *data = body + getIvHeaderSize();
+    encryptData(data, data, plainLen);
+    size_t bodyLen = createIvHeader(body) + plainLen;
 
-    // Clean up
-    delete[] iv;
-    delete[] counter;
-    delete[] encryptedBytes;
-    delete[] decryptedBytes;
+    if (prefixSize > 0)
+    {
+        buffer[0] = (PAYLOAD_FRAME_VERSION << 4) | format;
+    }
 
-    return decryptedStr;
+    switch (format)
+    {
+    case PAYLOAD_FORMAT_BINARY:
+        return prefixSize + bodyLen;
+    case PAYLOAD_FORMAT_BASE64:
+        base64ExpandInPlace(body, bodyLen);
+        break;
+    default:
+        hexExpandInPlace(body, bodyLen);
+        break;
+    }
+
+    size_t frameLen = prefixSize + getEncodedLength(bodyLen, format);
+    buffer[frameLen] = '\0';
+    return frameLen;
 }
 
 /**
- * Encrypt a JSON document
+ * Serialize and encrypt a JSON document into a caller-owned buffer without any heap allocation
+ * The document is serialized once, directly into the buffer, encrypted in place and encoded.
  *
  * @param doc JsonDocument to encrypt
+ * @param output Buffer to store the encoded frame
+ * @param capacity Capacity of the output buffer in bytes
+ * @param format Wire format of the frame
  * @param useNewSession Whether to generate a new IV for this encryption (true) or increment the counter (false)
- * @return String with the encrypted JSON in hexadecimal format
+ * @return Length of the frame (excluding null terminator), or 0 if the buffer is too small
  */
-String encryptJson(const JsonDocument &doc, bool useNewSession)
+size_t encryptJsonInto(const JsonDocument &doc, uint8_t *output, size_t capacity, PayloadFormat format, bool useNewSession)
 {
-    String jsonStr;
-    serializeJson(doc, jsonStr);
-    return encryptString(jsonStr, useNewSession);
+    size_t offset = getPlaintextOffset(format);
+    if (capacity <= offset)
+    {
+        return 0;
+    }
+
+    // Serialize into the rest of the buffer, encryptInPlace() rejects plaintexts that do not fit the format
+    size_t window = capacity - offset;
+    size_t plainLen = serializeJson(doc, (char *)(output + offset), window);
+
+    // A completely filled window is ambiguous, so check whether the document was truncated
+    if (plainLen >= window && measureJson(doc) > window)
+    {
+        return 0;
+    }
+
+    return encryptInPlace(output, capacity, plainLen, format, useNewSession);
 }
 
 /**
- * Encrypt a JSON document with default new session behavior
+ * Serialize and encrypt a JSON document into a caller-owned buffer with default new session behavior
  *
  * @param doc JsonDocument to encrypt
- * @return String with the encrypted JSON in hexadecimal format
+ * @param output Buffer to store the encoded frame
+ * @param capacity Capacity of the output buffer in bytes
+ * @param format Wire format of the frame
+ * @return Length of the frame (excluding null terminator), or 0 if the buffer is too small
  */
-String encryptJson(const JsonDocument &doc)
+size_t encryptJsonInto(const JsonDocument &doc, uint8_t *output, size_t capacity, PayloadFormat format)
 {
-    return encryptJson(doc, true);
+    return encryptJsonInto(doc, output, capacity, format, true);
+}
+
+/**
+ * Serialize and encrypt a JSON document into a caller-owned buffer as unprefixed hexadecimal
+ * with default new session behavior
+ *
+ * @param doc JsonDocument to encrypt
+ * @param output Buffer to store the null-terminated hexadecimal output
+ * @param capacity Capacity of the output buffer in bytes
+ * @return Length of the hexadecimal output (excluding null terminator), or 0 if the buffer is too small
+ */
+size_t encryptJsonInto(const JsonDocument &doc, uint8_t *output, size_t capacity)
+{
+    return encryptJsonInto(doc, output, capacity, PAYLOAD_FORMAT_HEX_LEGACY, true);
+}
+
+/**
+ * Reverse lookup table from a character to its digit value, -1 for characters that are not digits
+ */
+struct DigitTable
+{
+    int8_t values[256];
+};
+
+/**
+ * Build a reverse lookup table at compile time
+ *
+ * @param digits Null-terminated digit alphabet, in value order
+ * @param caseInsensitive Whether lower case letters map to the same values as upper case ones
+ * @return Lookup table for the alphabet
+ */
+static constexpr DigitTable makeDigitTable(const char *digits, bool caseInsensitive)
+{
+    DigitTable table{};
+    for (int i = 0; i < 256; i++)
+    {
+        table.values[i] = -1;
+    }
+    for (int i = 0; digits[i] != '\0'; i++)
+    {
+        uint8_t c = (uint8_t)digits[i];
+        table.values[c] = (int8_t)i;
+        if (caseInsensitive && c >= 'A' && c <= 'Z')
+        {
+            table.values[c - 'A' + 'a'] = (int8_t)i;
+        }
+    }
+    return table;
+}
+
+// Reverse lookup tables for decoding, hexadecimal accepts lower case digits as well
+static constexpr DigitTable hexValues = makeDigitTable(hexDigits, true);
+static constexpr DigitTable base64Values = makeDigitTable(base64Digits, false);
+
+/**
+ * Get the largest binary body an encoded frame can decode to
+ *
+ * @param input Encoded frame
+ * @param len Length of the encoded frame in bytes
+ * @return Upper bound of the decoded length in bytes
+ */
+static size_t getMaxDecodedLength(const uint8_t *input, size_t len)
+{
+    if (len == 0 || (input[0] >> 4) != PAYLOAD_FRAME_VERSION)
+    {
+        return len / 2;
+    }
+
+    switch ((PayloadFormat)(input[0] & 0x0F))
+    {
+    case PAYLOAD_FORMAT_BINARY:
+        return len - 1;
+    case PAYLOAD_FORMAT_BASE64:
+        return (len - 1) / 4 * 3;
+    default:
+        return (len - 1) / 2;
+    }
+}
+
+/**
+ * Decode the body of a frame into its binary [IV][Counter][Encrypted Data] form
+ * Frames starting with a version/format prefix are decoded according to that format,
+ * anything else is treated as unprefixed hexadecimal.
+ *
+ * The output may be the same buffer as the input, as no byte is written before it is read.
+ *
+ * @param input Encoded frame
+ * @param len Length of the encoded frame in bytes
+ * @param output Buffer to store the binary body (at least getMaxDecodedLength() bytes)
+ * @return Length of the binary body, or 0 if the frame is malformed
+ */
+static size_t decodeFrame(const uint8_t *input, size_t len, byte *output)
+{
+    PayloadFormat format = PAYLOAD_FORMAT_HEX_LEGACY;
+    if (len > 0 && (input[0] >> 4) == PAYLOAD_FRAME_VERSION)
+    {
+        format = (PayloadFormat)(input[0] & 0x0F);
+        input++;
+        len--;
+    }
+
+    switch (format)
+    {
+    case PAYLOAD_FORMAT_BINARY:
+        memmove(output, input, len);
+        return len;
+
+    case PAYLOAD_FORMAT_BASE64:
+    {
+        if (len % 4 != 0)
+        {
+            return 0;
+        }
+
+        size_t outLen = 0;
+        for (size_t i = 0; i < len; i += 4)
+        {
+            // Padding is only valid at the end, as "x===" is never produced: "xx==" or "xxx="
+            bool pad2 = input[i + 2] == '=';
+            bool pad3 = input[i + 3] == '=';
+            if ((pad2 && !pad3) || (pad3 && i + 4 != len))
+            {
+                return 0;
+            }
+            int v0 = base64Values.values[input[i]];
+            int v1 = base64Values.values[input[i + 1]];
+            int v2 = pad2 ? 0 : base64Values.values[input[i + 2]];
+            int v3 = pad3 ? 0 : base64Values.values[input[i + 3]];
+            if ((v0 | v1 | v2 | v3) < 0)
+            {
+                return 0;
+            }
+
+            uint32_t triple = ((uint32_t)v0 << 18) | ((uint32_t)v1 << 12) | ((uint32_t)v2 << 6) | (uint32_t)v3;
+            output[outLen++] = triple >> 16;
+            if (!pad2)
+            {
+                output[outLen++] = triple >> 8;
+            }
+            if (!pad3)
+            {
+                output[outLen++] = triple;
+            }
+        }
+        return outLen;
+    }
+
+    case PAYLOAD_FORMAT_HEX:
+    case PAYLOAD_FORMAT_HEX_LEGACY:
+    {
+        if (len % 2 != 0)
+        {
+            return 0;
+        }
+
+        for (size_t i = 0; i < len / 2; i++)
+        {
+            int high = hexValues.values[input[i * 2]];
+            int low = hexValues.values[input[i * 2 + 1]];
+            if ((high | low) < 0)
+            {
+                return 0;
+            }
+            output[i] = (high << 4) | low;
+        }
+        return len / 2;
+    }
+
+    default:
+        return 0;
+    }
+}
+
+/**
+ * Decode and decrypt an encoded frame into a buffer with the given cipher
+ * The buffer may be the same as the input, which makes the whole operation in place.
+ *
+ * @param cipher Cipher holding the key to use (ChaCha or ChaChaSimd), or nullptr for the global
+ *               cipher (its IV and counter are preserved)
+ * @param input Encoded frame as received from MQTT
+ * @param len Length of the encoded frame in bytes
+ * @param output Buffer to store the null-terminated plaintext (at least getMaxDecodedLength() bytes)
+ * @return Length of the plaintext (excluding null terminator), or 0 if the frame is malformed
+ */
+template <typename Cipher>
+static size_t decryptFrame(Cipher *cipher, const uint8_t *input, size_t len, byte *output)
+{
+    size_t headerSize = getIvHeaderSize();
+    size_t frameLen = decodeFrame(input, len, output);
+    if (frameLen < headerSize)
+    {
+        Serial.println("Error: Input too short or malformed to contain IV header");
+        return 0;
+    }
+
+    byte iv[DEFAULT_IV_SIZE];
+    byte counter[DEFAULT_COUNTER_SIZE];
+    extractIvHeader(output, iv, counter);
+
+    byte *data = output + headerSize;
+    size_t dataLen = frameLen - headerSize;
+    if (cipher == nullptr)
+    {
+        decryptDataWithIV(data, data, dataLen, iv, counter);
+    }
+    else
+    {
+        cipher->setIV(iv, DEFAULT_IV_SIZE);
+        cipher->setCounter(counter, DEFAULT_COUNTER_SIZE);
+        cipher->decrypt(data, data, dataLen);
+    }
+
+    // Move the plaintext over the header, the terminator fits as the header is 16 bytes
+    memmove(output, data, dataLen);
+    output[dataLen] = 0;
+    return dataLen;
+}
+
+/**
+ * Decode and decrypt an encoded frame into a String with the given cipher
+ *
+ * @param cipher Cipher holding the key to use, or nullptr for the global cipher
+ * @param input Encoded frame as received from MQTT
+ * @param len Length of the encoded frame in bytes
+ * @return Decrypted string, or an empty string if the frame is malformed
+ */
+template <typename Cipher>
+static String decryptFrame(Cipher *cipher, const uint8_t *input, size_t len)
+{
+    byte *buffer = new byte[getMaxDecodedLength(input, len) + 1];
+    if (decryptFrame(cipher, input, len, buffer) == 0)
+    {
+        buffer[0] = 0;
+    }
+
+    String decryptedStr = String((char *)buffer);
+    delete[] buffer;
+
+    return decryptedStr;
+}
+
+/**
+ * Get the buffer size decryptInto() needs for an encoded frame
+ *
+ * @param input Encoded frame as received from MQTT
+ * @param len Length of the encoded frame in bytes
+ * @return Required output capacity in bytes
+ */
+size_t getDecryptedBufferSize(const uint8_t *input, size_t len)
+{
+    size_t size = getMaxDecodedLength(input, len);
+    return size > 0 ? size : 1;
+}
+
+/**
+ * Decrypt an encoded frame into a caller-owned buffer, without heap allocation
+ *
+ * @param input Encoded frame as received from MQTT
+ * @param len Length of the encoded frame in bytes
+ * @param output Buffer to store the null-terminated plaintext (may be the same as input)
+ * @param capacity Capacity of the output buffer (at least getDecryptedBufferSize() bytes)
+ * @return Length of the plaintext (excluding null terminator), or 0 if the frame is malformed
+ *         or the buffer is too small
+ */
+size_t decryptInto(const uint8_t *input, size_t len, uint8_t *output, size_t capacity)
+{
+    if (capacity < getDecryptedBufferSize(input, len))
+    {
+        Serial.println("Error: Output buffer too small for decrypted data");
+        return 0;
+    }
+
+    return decryptFrame<ChaCha>(nullptr, input, len, output);
+}
+
+/**
+ * Decrypt an encoded frame in place
+ * The frame is overwritten with the null-terminated plaintext, which always fits as every
+ * encoding is at least 16 bytes longer than the plaintext it carries.
+ *
+ * @param buffer Encoded frame as received from MQTT
+ * @param len Length of the encoded frame in bytes
+ * @return Length of the plaintext (excluding null terminator), or 0 if the frame is malformed
+ */
+size_t decryptInPlace(uint8_t *buffer, size_t len)
+{
+    return decryptFrame<ChaCha>(nullptr, buffer, len, buffer);
+}
+
+/**
+ * Decrypt an encoded frame in place with a multi-block cipher
+ * Only the IV and counter of the cipher are changed, its key and rounds are used as they are.
+ *
+ * @param cipher Cipher holding the key to use
+ * @param buffer Encoded frame as received from MQTT
+ * @param len Length of the encoded frame in bytes
+ * @return Length of the plaintext (excluding null terminator), or 0 if the frame is malformed
+ */
+size_t decryptInPlace(ChaChaSimd &cipher, uint8_t *buffer, size_t len)
+{
+    return decryptFrame(&cipher, buffer, len, buffer);
+}
+
+/**
+ * Decrypt a JSON document from an encoded frame in place
+ * ArduinoJson parses the plaintext straight from the frame buffer, without an intermediate String.
+ *
+ * @param buffer Encoded frame as received from MQTT, overwritten with the plaintext
+ * @param len Length of the encoded frame in bytes
+ * @param doc JsonDocument to store the decrypted JSON
+ * @return true if decryption and deserialization was successful, false otherwise
+ */
+bool decryptJsonInPlace(uint8_t *buffer, size_t len, JsonDocument &doc)
+{
+    size_t plainLen = decryptInPlace(buffer, len);
+    if (plainLen == 0)
+    {
+        return false;
+    }
+
+    DeserializationError error = deserializeJson(doc, (const char *)buffer, plainLen);
+    return (error == DeserializationError::Ok);
+}
+
+/**
+ * Decrypt an encoded frame in any supported payload format
+ * The format is detected from the frame prefix. Frames without a prefix are treated as
+ * unprefixed hexadecimal.
+ *
+ * @param input Encoded frame as received from MQTT
+ * @param len Length of the encoded frame in bytes
+ * @return Decrypted string, or an empty string if the frame is malformed
+ */
+String decryptString(const uint8_t *input, size_t len)
+{
+    return decryptFrame<ChaCha>(nullptr, input, len);
+}
+
+/**
+ * Decrypt an encoded frame in any supported payload format with a caller-owned cipher
+ * Only the IV and counter of the cipher are changed, its key and rounds are used as they are.
+ *
+ * @param cipher Cipher holding the key to use
+ * @param input Encoded frame as received from MQTT
+ * @param len Length of the encoded frame in bytes
+ * @return Decrypted string, or an empty string if the frame is malformed
+ */
+String decryptString(ChaCha &cipher, const uint8_t *input, size_t len)
+{
+    return decryptFrame(&cipher, input, len);
+}
+
+/**
+ * Decrypt an encoded frame in any supported payload format with a multi-block cipher
+ * Only the IV and counter of the cipher are changed, its key and rounds are used as they are.
+ *
+ * @param cipher Cipher holding the key to use
+ * @param input Encoded frame as received from MQTT
+ * @param len Length of the encoded frame in bytes
+ * @return Decrypted string, or an empty string if the frame is malformed
+ */
+String decryptString(ChaChaSimd &cipher, const uint8_t *input, size_t len)
+{
+    return decryptFrame(&cipher, input, len);
+}
+
+/**
+ * Decrypt a JSON document from an encoded frame in any supported payload format
+ *
+ * @param input Encoded frame as received from MQTT
+ * @param len Length of the encoded frame in bytes
+ * @param doc JsonDocument to store the decrypted JSON
+ * @return true if decryption and deserialization was successful, false otherwise
+ */
+bool decryptJson(const uint8_t *input, size_t len, JsonDocument &doc)
+{
+    size_t capacity = getDecryptedBufferSize(input, len);
+    byte *buffer = new byte[capacity];
+    size_t plainLen = decryptInto(input, len, buffer, capacity);
+
+    bool success = false;
+    if (plainLen > 0)
+    {
+        DeserializationError error = deserializeJson(doc, (const char *)buffer, plainLen);
+        success = (error == DeserializationError::Ok);
+    }
+
+    delete[] buffer;
+    return success;
 }
 
 /**
@@ -443,9 +1220,7 @@ String encryptJson(const JsonDocument &doc)
  */
 bool decryptJson(const String &hexInput, JsonDocument &doc)
 {
-    String jsonStr = decryptString(hexInput);
-    DeserializationError error = deserializeJson(doc, jsonStr);
-    return (error == DeserializationError::Ok);
+    return decryptJson((const uint8_t *)hexInput.c_str(), hexInput.length(), doc);
 }
 
 /**
@@ -4,6 +4,29 @@
 #include <Arduino.h>
 #include <ArduinoJson.h>
 
+class ChaCha; // From the Crypto library
+class ChaChaSimd;
+
+// Size of a key derived with deriveDeviceKey() in bytes
+#define DEVICE_KEY_SIZE 32
+
+// Keystream bytes that can be prefetched for the next message, a multiple of 64
+// (override with -DKEYSTREAM_PREFETCH_SIZE=...)
+#if !defined(KEYSTREAM_PREFETCH_SIZE)
+#define KEYSTREAM_PREFETCH_SIZE 1024
+#endif
+
+/**
+ * Keystream prefetch counters
+ */
+struct KeystreamPrefetchStats
+{
+    uint32_t hits;            // Messages encrypted entirely with prefetched keystream
+    uint32_t partialHits;     // Messages longer than the prefetched keystream
+    uint32_t misses;          // Messages encrypted without prefetched keystream
+    uint32_t prefetchedBytes; // Bytes encrypted with prefetched keystream
+};
+
 /**
  * Initialize the ChaCha cipher with default parameters
  */
@@ -21,6 +44,29 @@ void initChaCha();
  */
 bool initChaChaCustom(const byte *key, size_t keySize, const byte *iv, const byte *counter, uint8_t rounds);
 
+/**
+ * Derive a per-device key from a master secret and the device ID
+ * Uses HKDF-SHA256 with a fixed salt and the device ID as info, so the backend can derive
+ * the same key for any device from the master secret alone.
+ *
+ * @param masterKey Pointer to the master secret bytes
+ * @param masterKeySize Size of the master secret in bytes
+ * @param deviceId Null-terminated device ID (e.g. MQTT_CLIENT_ID)
+ * @param key Buffer to store the derived key (must be at least DEVICE_KEY_SIZE bytes)
+ * @return true if derivation was successful, false otherwise
+ */
+bool deriveDeviceKey(const byte *masterKey, size_t masterKeySize, const char *deviceId, byte *key);
+
+/**
+ * Initialize the ChaCha cipher with a provisioned key and the default IV, counter and rounds
+ * Devices are flashed with their derived key (see scripts/device_key.py), never the master secret.
+ *
+ * @param key Pointer to the key bytes
+ * @param keySize Size of the key in bytes (16 or 32)
+ * @return true if initialization was successful, false otherwise
+ */
+bool initChaChaWithKey(const byte *key, size_t keySize);
+
 /**
  * Generate a random initialization vector
  *
@@ -52,8 +98,36 @@ void newEncryptionSession();
  */
 void prepareNextMessage();
 
+/**
+ * Generate keystream for the next message ahead of time
+ * Call this from idle time (e.g. loop() while waiting for GPS data); the next encryption
+ * then only has to XOR with the prefetched keystream. The IV and counter of the next message
+ * are chosen on the first call, later calls extend the keystream until the buffer is full.
+ *
+ * @param maxBytes Maximum number of keystream bytes to generate in this call (rounded up to 64)
+ * @param useNewSession Whether the next message will start a new session, as passed to the encrypt function
+ * @return true if the prefetch buffer is full, false if more keystream can be generated
+ */
+bool prefetchKeystreamStep(size_t maxBytes, bool useNewSession);
+
+/**
+ * Get the number of keystream bytes prefetched for the next message
+ *
+ * @return Number of prefetched bytes
+ */
+size_t getPrefetchedKeystreamSize();
+
+/**
+ * Get the keystream prefetch statistics since boot
+ *
+ * @return Prefetch hit and miss counters
+ */
+KeystreamPrefetchStats getKeystreamPrefetchStats();
+
 /**
  * Encrypt data using ChaCha
+ * Uses the prefetched keystream when it belongs to this message, so that encryption is a plain
+ * XOR; whatever the prefetch does not cover is generated inline.
  *
  * @param output Buffer to store the encrypted data
  * @param input Data to encrypt
@@ -133,6 +207,7 @@ String encryptString(const String &input);
  * Decrypt a hexadecimal string that was encrypted using ChaCha
  * The input string should include the IV and counter in the format:
  * [IV(8 bytes)][Counter(8 bytes)][Encrypted Data(variable)]
+ * Prefixed hex and base64 frames are detected and decoded as well.
  *
  * @param hexInput Encrypted data in hexadecimal format, including IV and counter
  * @return Decrypted string
@@ -156,6 +231,187 @@ String encryptJson(const JsonDocument &doc, bool useNewSession);
  */
 String encryptJson(const JsonDocument &doc);
 
+/**
+ * Wire format of an encrypted frame
+ * Prefixed frames start with one byte holding PAYLOAD_FRAME_VERSION in the high nibble
+ * and the format in the low nibble, so a receiver can detect the encoding from the first byte.
+ */
+enum PayloadFormat : uint8_t
+{
+    PAYLOAD_FORMAT_HEX_LEGACY = 0x0, // Unprefixed uppercase hexadecimal, as produced by encryptString()
+    PAYLOAD_FORMAT_BINARY = 0x1,     // Raw bytes, to be published with the length-taking publish()
+    PAYLOAD_FORMAT_BASE64 = 0x2,     // Standard base64 with padding
+    PAYLOAD_FORMAT_HEX = 0x3         // Uppercase hexadecimal
+};
+
+// Version of the frame layout, stored in the high nibble of the frame prefix
+#define PAYLOAD_FRAME_VERSION 0x1
+
+/**
+ * Get the offset at which the plaintext must be placed in the buffer passed to encryptInPlace()
+ * The bytes before it are reserved for the frame prefix and the IV header.
+ *
+ * @param format Wire format of the frame
+ * @return Offset of the plaintext in bytes
+ */
+size_t getPlaintextOffset(PayloadFormat format);
+
+/**
+ * Get the largest plaintext that encryptInPlace() can handle for a buffer of the given capacity
+ *
+ * @param capacity Capacity of the buffer in bytes
+ * @param format Wire format of the frame
+ * @return Maximum plaintext length in bytes, or 0 if the buffer is too small for the header
+ */
+size_t getMaxPlaintextSize(size_t capacity, PayloadFormat format);
+
+/**
+ * Encrypt a plaintext in place and encode the result without any heap allocation
+ * On entry the plaintext must be stored at buffer + getPlaintextOffset(format).
+ * On return the buffer holds the frame [Prefix(1 byte)][IV(8 bytes)][Counter(8 bytes)][Encrypted Data(variable)],
+ * where everything after the prefix is encoded according to the format. Text formats are null-terminated.
+ *
+ * @param buffer Buffer holding the plaintext, also receives the encoded frame
+ * @param capacity Capacity of the buffer in bytes
+ * @param plainLen Length of the plaintext in bytes
+ * @param format Wire format of the frame
+ * @param useNewSession Whether to generate a new IV for this encryption (true) or increment the counter (false)
+ * @return Length of the frame (excluding null terminator), or 0 if the buffer is too small
+ */
+size_t encryptInPlace(uint8_t *buffer, size_t capacity, size_t plainLen, PayloadFormat format, bool useNewSession);
+
+/**
+ * Serialize and encrypt a JSON document into a caller-owned buffer without any heap allocation
+ * The document is serialized once, directly into the buffer, encrypted in place and encoded.
+ *
+ * @param doc JsonDocument to encrypt
+ * @param output Buffer to store the encoded frame
+ * @param capacity Capacity of the output buffer in bytes
+ * @param format Wire format of the frame
+ * @param useNewSession Whether to generate a new IV for this encryption (true) or increment the counter (false)
+ * @return Length of the frame (excluding null terminator), or 0 if the buffer is too small
+ */
+size_t encryptJsonInto(const JsonDocument &doc, uint8_t *output, size_t capacity, PayloadFormat format, bool useNewSession);
+
+/**
+ * Serialize and encrypt a JSON document into a caller-owned buffer with default new session behavior
+ *
+ * @param doc JsonDocument to encrypt
+ * @param output Buffer to store the encoded frame
+ * @param capacity Capacity of the output buffer in bytes
+ * @param format Wire format of the frame
+ * @return Length of the frame (excluding null terminator), or 0 if the buffer is too small
+ */
+size_t encryptJsonInto(const JsonDocument &doc, uint8_t *output, size_t capacity, PayloadFormat format);
+
+/**
+ * Serialize and encrypt a JSON document into a caller-owned buffer as unprefixed hexadecimal
+ * with default new session behavior
+ *
+ * @param doc JsonDocument to encrypt
+ * @param output Buffer to store the null-terminated hexadecimal output
+ * @param capacity Capacity of the output buffer in bytes
+ * @return Length of the hexadecimal output (excluding null terminator), or 0 if the buffer is too small
+ */
+size_t encryptJsonInto(const JsonDocument &doc, uint8_t *output, size_t capacity);
+
+/**
+ * Decrypt an encoded frame in any supported payload format
+ * The format is detected from the frame prefix. Frames without a prefix are treated as
+ * unprefixed hexadecimal.
+ *
+ * @param input Encoded frame as received from MQTT
+ * @param len Length of the encoded frame in bytes
+ * @return Decrypted string, or an empty string if the frame is malformed
+ */
+String decryptString(const uint8_t *input, size_t len);
+
+/**
+ * Decrypt an encoded frame in any supported payload format with a caller-owned cipher
+ * Only the IV and counter of the cipher are changed, its key and rounds are used as they are.
+ *
+ * @param cipher Cipher holding the key to use
+ * @param input Encoded frame as received from MQTT
+ * @param len Length of the encoded frame in bytes
+ * @return Decrypted string, or an empty string if the frame is malformed
+ */
+String decryptString(ChaCha &cipher, const uint8_t *input, size_t len);
+
+/**
+ * Decrypt an encoded frame in any supported payload format with a multi-block cipher
+ * Only the IV and counter of the cipher are changed, its key and rounds are used as they are.
+ *
+ * @param cipher Cipher holding the key to use
+ * @param input Encoded frame as received from MQTT
+ * @param len Length of the encoded frame in bytes
+ * @return Decrypted string, or an empty string if the frame is malformed
+ */
+String decryptString(ChaChaSimd &cipher, const uint8_t *input, size_t len);
+
+/**
+ * Get the buffer size decryptInto() needs for an encoded frame
+ *
+ * @param input Encoded frame as received from MQTT
+ * @param len Length of the encoded frame in bytes
+ * @return Required output capacity in bytes
+ */
+size_t getDecryptedBufferSize(const uint8_t *input, size_t len);
+
+/**
+ * Decrypt an encoded frame into a caller-owned buffer, without heap allocation
+ *
+ * @param input Encoded frame as received from MQTT
+ * @param len Length of the encoded frame in bytes
+ * @param output Buffer to store the null-terminated plaintext (may be the same as input)
+ * @param capacity Capacity of the output buffer (at least getDecryptedBufferSize() bytes)
+ * @return Length of the plaintext (excluding null terminator), or 0 if the frame is malformed
+ *         or the buffer is too small
+ */
+size_t decryptInto(const uint8_t *input, size_t len, uint8_t *output, size_t capacity);
+
+/**
+ * Decrypt an encoded frame in place
+ * The frame is overwritten with the null-terminated plaintext, which always fits as every
+ * encoding is at least 16 bytes longer than the plaintext it carries.
+ *
+ * @param buffer Encoded frame as received from MQTT
+ * @param len Length of the encoded frame in bytes
+ * @return Length of the plaintext (excluding null terminator), or 0 if the frame is malformed
+ */
+size_t decryptInPlace(uint8_t *buffer, size_t len);
+
+/**
+ * Decrypt an encoded frame in place with a multi-block cipher
+ * Only the IV and counter of the cipher are changed, its key and rounds are used as they are.
+ *
+ * @param cipher Cipher holding the key to use
+ * @param buffer Encoded frame as received from MQTT
+ * @param len Length of the encoded frame in bytes
+ * @return Length of the plaintext (excluding null terminator), or 0 if the frame is malformed
+ */
+size_t decryptInPlace(ChaChaSimd &cipher, uint8_t *buffer, size_t len);
+
+/**
+ * Decrypt a JSON document from an encoded frame in place
+ * ArduinoJson parses the plaintext straight from the frame buffer, without an intermediate String.
+ *
+ * @param buffer Encoded frame as received from MQTT, overwritten with the plaintext
+ * @param len Length of the encoded frame in bytes
+ * @param doc JsonDocument to store the decrypted JSON
+ * @return true if decryption and deserialization was successful, false otherwise
+ */
+bool decryptJsonInPlace(uint8_t *buffer, size_t len, JsonDocument &doc);
+
+/**
+ * Decrypt a JSON document from an encoded frame in any supported payload format
+ *
+ * @param input Encoded frame as received from MQTT
+ * @param len Length of the encoded frame in bytes
+ * @param doc JsonDocument to store the decrypted JSON
+ * @return true if decryption and deserialization was successful, false otherwise
+ */
+bool decryptJson(const uint8_t *input, size_t len, JsonDocument &doc);
+
 /**
  * Decrypt a JSON document that was encrypted using ChaCha
  *
@@ -0,0 +1,237 @@
+#include <Crypto.h>
+#include <string.h>
+#include <new>
+#include <Arduino.h>
+#include <ArduinoJson.h>
+
+#include "ChaChaKeyring.h"
+
+/**
+ * Hash a device ID with 32-bit FNV-1a
+ *
+ * @param deviceId Null-terminated device ID
+ * @param len Set to the length of the device ID
+ * @return Hash of the device ID
+ */
+static uint32_t hashDeviceId(const char *deviceId, size_t *len)
+{
+    uint32_t hash = 2166136261u;
+    size_t i = 0;
+    for (; deviceId[i] != '\0'; i++)
+    {
+        hash ^= (uint8_t)deviceId[i];
+        hash *= 16777619u;
+    }
+    *len = i;
+    return hash;
+}
+
+/**
+ * Create a keyring for up to maxDevices devices
+ *
+ * @param masterKey Pointer to the master secret bytes (copied)
+ * @param masterKeySize Size of the master secret in bytes, any size HKDF accepts
+ * @param maxDevices Number of devices to cache
+ * @param rounds Number of ChaCha rounds used by the devices
+ */
+ChaChaKeyring::ChaChaKeyring(const byte *masterKey, size_t masterKeySize, size_t maxDevices, uint8_t rounds)
+    : master(nullptr), masterSize(0), rounds(rounds), entries(nullptr), capacity(0), maxEntries(maxDevices), count(0),
+      derivations(0), hits(0)
+{
+    if (masterKey != nullptr && masterKeySize > 0)
+    {
+        master = new (std::nothrow) byte[masterKeySize];
+    }
+    if (master != nullptr)
+    {
+        memcpy(master, masterKey, masterKeySize);
+        masterSize = masterKeySize;
+    }
+
+    // Keep the load factor at or below one half so probe chains stay short
+    capacity = 1;
+    while (capacity < maxDevices * 2)
+    {
+        capacity <<= 1;
+    }
+
+    if (maxDevices > 0)
+    {
+        entries = new (std::nothrow) Entry[capacity];
+    }
+    if (entries == nullptr)
+    {
+        capacity = 0;
+        maxEntries = 0;
+        return;
+    }
+
+    for (size_t i = 0; i < capacity; i++)
+    {
+        entries[i].used = false;
+    }
+}
+
+ChaChaKeyring::~ChaChaKeyring()
+{
+    for (size_t i = 0; i < capacity; i++)
+    {
+        entries[i].cipher.clear();
+    }
+    delete[] entries;
+    overflow.clear();
+    if (master != nullptr)
+    {
+        clean(master, masterSize);
+        delete[] master;
+    }
+}
+
+/**
+ * Derive the key for a device and load it into a cipher
+ *
+ * @param cipher Cipher to key
+ * @param deviceId Null-terminated device ID
+ * @return true if the key was derived and set, false otherwise
+ */
+bool ChaChaKeyring::setKey(ChaChaSimd &cipher, const char *deviceId)
+{
+    byte key[DEVICE_KEY_SIZE];
+    if (!deriveDeviceKey(master, masterSize, deviceId, key))
+    {
+        return false;
+    }
+    derivations++;
+
+    cipher.setNumRounds(rounds);
+    bool success = cipher.setKey(key, sizeof(key));
+    clean(key, sizeof(key));
+    return success;
+}
+
+/**
+ * Get the cipher for a device, deriving and caching its key on first use
+ *
+ * @param deviceId Null-terminated device ID
+ * @return Cipher keyed for the device, or nullptr if no key could be derived
+ */
+ChaChaSimd *ChaChaKeyring::find(const char *deviceId)
+{
+    if (deviceId == nullptr || masterSize == 0)
+    {
+        return nullptr;
+    }
+
+    size_t len;
+    uint32_t hash = hashDeviceId(deviceId, &len);
+
+    if (capacity > 0 && len < KEYRING_MAX_DEVICE_ID_SIZE)
+    {
+        size_t mask = capacity - 1;
+        for (size_t i = hash & mask;; i = (i + 1) & mask)
+        {
+            Entry &entry = entries[i];
+            if (!entry.used)
+            {
+                if (count >= maxEntries)
+                {
+                    break;
+                }
+                if (!setKey(entry.cipher, deviceId))
+                {
+                    return nullptr;
+                }
+                entry.hash = hash;
+                memcpy(entry.deviceId, deviceId, len + 1);
+                entry.used = true;
+                count++;
+                return &entry.cipher;
+            }
+            if (entry.hash == hash && strcmp(entry.deviceId, deviceId) == 0)
+            {
+                hits++;
+                return &entry.cipher;
+            }
+        }
+    }
+
+    // Table full or device ID too long: derive again without caching
+    return setKey(overflow, deviceId) ? &overflow : nullptr;
+}
+
+/**
+ * Decrypt an encoded frame from a device
+ *
+ * @param deviceId Null-terminated device ID
+ * @param input Encoded frame as received from MQTT
+ * @param len Length of the encoded frame in bytes
+ * @return Decrypted string, or an empty string if the frame is malformed
+ */
+String ChaChaKeyring::decryptString(const char *deviceId, const uint8_t *input, size_t len)
+{
+    ChaChaSimd *cipher = find(deviceId);
+    if (cipher == nullptr)
+    {
+        Serial.println("Error: No key for device");
+        return "";
+    }
+
+    return ::decryptString(*cipher, input, len);
+}
+
+/**
+ * Decrypt an encoded frame from a device in place
+ *
+ * @param deviceId Null-terminated device ID
+ * @param buffer Encoded frame as received from MQTT, overwritten with the null-terminated plaintext
+ * @param len Length of the encoded frame in bytes
+ * @return Length of the plaintext (excluding null terminator), or 0 if the frame is malformed
+ */
+size_t ChaChaKeyring::decryptInPlace(const char *deviceId, uint8_t *buffer, size_t len)
+{
+    ChaChaSimd *cipher = find(deviceId);
+    if (cipher == nullptr)
+    {
+        Serial.println("Error: No key for device");
+        return 0;
+    }
+
+    return ::decryptInPlace(*cipher, buffer, len);
+}
+
+/**
+ * Decrypt a JSON document from an encoded frame from a device in place
+ *
+ * @param deviceId Null-terminated device ID
+ * @param buffer Encoded frame as received from MQTT, overwritten with the plaintext
+ * @param len Length of the encoded frame in bytes
+ * @param doc JsonDocument to store the decrypted JSON
+ * @return true if decryption and parsing were successful, false otherwise
+ */
+bool ChaChaKeyring::decryptJsonInPlace(const char *deviceId, uint8_t *buffer, size_t len, JsonDocument &doc)
+{
+    size_t plainLen = decryptInPlace(deviceId, buffer, len);
+    if (plainLen == 0)
+    {
+        return false;
+    }
+
+    DeserializationError error = deserializeJson(doc, (const char *)buffer, plainLen);
+    return (error == DeserializationError::Ok);
+}
+
+/**
+ * Decrypt a JSON document from an encoded frame from a device
+ *
+ * @param deviceId Null-terminated device ID
+ * @param input Encoded frame as received from MQTT
+ * @param len Length of the encoded frame in bytes
+ * @param doc JsonDocument to store the decrypted JSON
+ * @return true if decryption and parsing were successful, false otherwise
+ */
+bool ChaChaKeyring::decryptJson(const char *deviceId, const uint8_t *input, size_t len, JsonDocument &doc)
+{
+    String jsonStr = decryptString(deviceId, input, len);
+    DeserializationError error = deserializeJson(doc, jsonStr);
+    return (error == DeserializationError::Ok);
+}
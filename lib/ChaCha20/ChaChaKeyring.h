@@ -0,0 +1,143 @@
+#if !defined(CHACHA_KEYRING_H)
+#define CHACHA_KEYRING_H
+
+#include <Arduino.h>
+#include <ArduinoJson.h>
+
+#include "ChaCha20.h"
+#include "ChaChaSimd.h"
+
+// Longest device ID that can be cached, including the null terminator
+#define KEYRING_MAX_DEVICE_ID_SIZE 48
+
+/**
+ * Cache of per-device ciphers for decrypting frames from many devices
+ * Keys are derived from the master secret with deriveDeviceKey() on first use and kept with
+ * their key schedule, so later frames from the same device only pay for the lookup and the
+ * keystream, which ChaChaSimd produces several blocks at a time. The table is allocated once
+ * and never grows; when it is full, or the device ID is too long to cache, the key is derived
+ * again for every frame.
+ */
+class ChaChaKeyring
+{
+public:
+    /**
+     * Create a keyring for up to maxDevices devices
+     *
+     * @param masterKey Pointer to the master secret bytes (copied)
+     * @param masterKeySize Size of the master secret in bytes, any size HKDF accepts
+     * @param maxDevices Number of devices to cache
+     * @param rounds Number of ChaCha rounds used by the devices
+     */
+    ChaChaKeyring(const byte *masterKey, size_t masterKeySize, size_t maxDevices, uint8_t rounds = 20);
+    ~ChaChaKeyring();
+
+    ChaChaKeyring(const ChaChaKeyring &) = delete;
+    ChaChaKeyring &operator=(const ChaChaKeyring &) = delete;
+
+    /**
+     * Get the cipher for a device, deriving and caching its key on first use
+     *
+     * @param deviceId Null-terminated device ID
+     * @return Cipher keyed for the device, or nullptr if the keyring could not be allocated
+     */
+    ChaChaSimd *find(const char *deviceId);
+
+    /**
+     * Check whether the keyring holds a master secret
+     *
+     * @return true if keys can be derived, false if the secret was empty or could not be allocated
+     */
+    bool isValid() const { return masterSize > 0; }
+
+    /**
+     * Decrypt an encoded frame from a device
+     *
+     * @param deviceId Null-terminated device ID
+     * @param input Encoded frame as received from MQTT
+     * @param len Length of the encoded frame in bytes
+     * @return Decrypted string, or an empty string if the frame is malformed
+     */
+    String decryptString(const char *deviceId, const uint8_t *input, size_t len);
+
+    /**
+     * Decrypt an encoded frame from a device in place
+     *
+     * @param deviceId Null-terminated device ID
+     * @param buffer Encoded frame as received from MQTT, overwritten with the null-terminated plaintext
+     * @param len Length of the encoded frame in bytes
+     * @return Length of the plaintext (excluding null terminator), or 0 if the frame is malformed
+     */
+    size_t decryptInPlace(const char *deviceId, uint8_t *buffer, size_t len);
+
+    /**
+     * Decrypt a JSON document from an encoded frame from a device in place
+     *
+     * @param deviceId Null-terminated device ID
+     * @param buffer Encoded frame as received from MQTT, overwritten with the plaintext
+     * @param len Length of the encoded frame in bytes
+     * @param doc JsonDocument to store the decrypted JSON
+     * @return true if decryption and parsing were successful, false otherwise
+     */
+    bool decryptJsonInPlace(const char *deviceId, uint8_t *buffer, size_t len, JsonDocument &doc);
+
+    /**
+     * Decrypt a JSON document from an encoded frame from a device
+     *
+     * @param deviceId Null-terminated device ID
+     * @param input Encoded frame as received from MQTT
+     * @param len Length of the encoded frame in bytes
+     * @param doc JsonDocument to store the decrypted JSON
+     * @return true if decryption and parsing were successful, false otherwise
+     */
+    bool decryptJson(const char *deviceId, const uint8_t *input, size_t len, JsonDocument &doc);
+
+    /**
+     * Get the number of cached devices
+     *
+     * @return Number of devices with a cached cipher
+     */
+    size_t size() const { return count; }
+
+    /**
+     * Get the number of key derivations performed so far
+     *
+     * @return Number of HKDF derivations, including uncached ones
+     */
+    uint32_t getDerivationCount() const { return derivations; }
+
+    /**
+     * Get the number of lookups served from the cache
+     *
+     * @return Number of cache hits
+     */
+    uint32_t getHitCount() const { return hits; }
+
+private:
+    struct Entry
+    {
+        uint32_t hash;
+        bool used;
+        char deviceId[KEYRING_MAX_DEVICE_ID_SIZE];
+        ChaChaSimd cipher;
+    };
+
+    bool setKey(ChaChaSimd &cipher, const char *deviceId);
+
+    byte *master;
+    size_t masterSize;
+    uint8_t rounds;
+
+    Entry *entries;
+    size_t capacity;
+    size_t maxEntries;
+    size_t count;
+
+    // Used for devices that do not fit in the table
+    ChaChaSimd overflow;
+
+    uint32_t derivations;
+    uint32_t hits;
+};
+
+#endif
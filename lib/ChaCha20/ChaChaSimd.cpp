@@ -0,0 +1,546 @@
+#include <Crypto.h>
+#include <string.h>
+#include <Arduino.h>
+
+#include "ChaChaSimd.h"
+
+#if (defined(__x86_64__) || defined(__i386__)) && (defined(__GNUC__) || defined(__clang__))
+#define CHACHA_SIMD_X86
+#include <immintrin.h>
+#endif
+
+// Size of a ChaCha block in bytes
+#define CHACHA_BLOCK_SIZE 64
+
+// Processes a run of whole blocks: XORs the keystream into the input and advances the counter
+typedef void (*ChaChaBlocksFn)(uint32_t *state, uint8_t rounds, uint8_t *output, const uint8_t *input, size_t blocks);
+
+#define ROTL32(v, n) (((v) << (n)) | ((v) >> (32 - (n))))
+
+#define QUARTER_ROUND(a, b, c, d)   \
+    a += b, d = ROTL32(d ^ a, 16); \
+    c += d, b = ROTL32(b ^ c, 12); \
+    a += b, d = ROTL32(d ^ a, 8);  \
+    c += d, b = ROTL32(b ^ c, 7)
+
+/**
+ * Read a little-endian 32-bit word
+ *
+ * @param p Pointer to 4 bytes
+ * @return Word value
+ */
+static inline uint32_t loadLE32(const uint8_t *p)
+{
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+/**
+ * Write a little-endian 32-bit word
+ *
+ * @param p Pointer to 4 bytes
+ * @param v Word value
+ */
+static inline void storeLE32(uint8_t *p, uint32_t v)
+{
+    p[0] = (uint8_t)v;
+    p[1] = (uint8_t)(v >> 8);
+    p[2] = (uint8_t)(v >> 16);
+    p[3] = (uint8_t)(v >> 24);
+}
+
+/**
+ * Advance the 64-bit block counter in state words 12-13
+ *
+ * @param state Cipher state
+ * @param blocks Number of blocks to advance by
+ */
+static inline void advanceCounter(uint32_t *state, uint64_t blocks)
+{
+    uint64_t counter = ((uint64_t)state[13] << 32 | state[12]) + blocks;
+    state[12] = (uint32_t)counter;
+    state[13] = (uint32_t)(counter >> 32);
+}
+
+/**
+ * Generate one keystream block and advance the counter
+ *
+ * @param state Cipher state
+ * @param rounds Number of rounds
+ * @param stream Buffer to store the keystream block (CHACHA_BLOCK_SIZE bytes)
+ */
+static void portableKeystream(uint32_t *state, uint8_t rounds, uint8_t *stream)
+{
+    uint32_t x[16];
+    memcpy(x, state, sizeof(x));
+
+    for (uint8_t i = 0; i < rounds; i += 2)
+    {
+        QUARTER_ROUND(x[0], x[4], x[8], x[12]);
+        QUARTER_ROUND(x[1], x[5], x[9], x[13]);
+        QUARTER_ROUND(x[2], x[6], x[10], x[14]);
+        QUARTER_ROUND(x[3], x[7], x[11], x[15]);
+        QUARTER_ROUND(x[0], x[5], x[10], x[15]);
+        QUARTER_ROUND(x[1], x[6], x[11], x[12]);
+        QUARTER_ROUND(x[2], x[7], x[8], x[13]);
+        QUARTER_ROUND(x[3], x[4], x[9], x[14]);
+    }
+
+    for (int i = 0; i < 16; i++)
+    {
+        storeLE32(stream + i * 4, x[i] + state[i]);
+    }
+    advanceCounter(state, 1);
+}
+
+/**
+ * Portable kernel: one block at a time
+ */
+static void portableBlocks(uint32_t *state, uint8_t rounds, uint8_t *output, const uint8_t *input, size_t blocks)
+{
+    uint8_t stream[CHACHA_BLOCK_SIZE];
+    for (; blocks > 0; blocks--)
+    {
+        portableKeystream(state, rounds, stream);
+        for (int i = 0; i < CHACHA_BLOCK_SIZE; i++)
+        {
+            output[i] = input[i] ^ stream[i];
+        }
+        output += CHACHA_BLOCK_SIZE;
+        input += CHACHA_BLOCK_SIZE;
+    }
+}
+
+#if defined(CHACHA_SIMD_X86)
+
+#define SSE2_ROTL(v, n) _mm_or_si128(_mm_slli_epi32(v, n), _mm_srli_epi32(v, 32 - (n)))
+
+#define SSE2_QUARTER_ROUND(a, b, c, d)                               \
+    a = _mm_add_epi32(a, b), d = SSE2_ROTL(_mm_xor_si128(d, a), 16); \
+    c = _mm_add_epi32(c, d), b = SSE2_ROTL(_mm_xor_si128(b, c), 12); \
+    a = _mm_add_epi32(a, b), d = SSE2_ROTL(_mm_xor_si128(d, a), 8);  \
+    c = _mm_add_epi32(c, d), b = SSE2_ROTL(_mm_xor_si128(b, c), 7)
+
+/**
+ * SSE2 kernel: four blocks at a time, one block per 32-bit lane
+ */
+__attribute__((target("sse2"))) static void sse2Blocks(uint32_t *state, uint8_t rounds, uint8_t *output,
+                                                       const uint8_t *input, size_t blocks)
+{
+    for (; blocks >= 4; blocks -= 4)
+    {
+        __m128i start[16];
+        for (int i = 0; i < 16; i++)
+        {
+            start[i] = _mm_set1_epi32((int)state[i]);
+        }
+
+        // Each lane gets its own block number, carrying into the high counter word
+        uint64_t counter = (uint64_t)state[13] << 32 | state[12];
+        start[12] = _mm_setr_epi32((int)(uint32_t)counter, (int)(uint32_t)(counter + 1),
+                                   (int)(uint32_t)(counter + 2), (int)(uint32_t)(counter + 3));
+        start[13] = _mm_setr_epi32((int)(uint32_t)(counter >> 32), (int)(uint32_t)((counter + 1) >> 32),
+                                   (int)(uint32_t)((counter + 2) >> 32), (int)(uint32_t)((counter + 3) >> 32));
+
+        __m128i x[16];
+        memcpy(x, start, sizeof(x));
+        for (uint8_t i = 0; i < rounds; i += 2)
+        {
+            SSE2_QUARTER_ROUND(x[0], x[4], x[8], x[12]);
+            SSE2_QUARTER_ROUND(x[1], x[5], x[9], x[13]);
+            SSE2_QUARTER_ROUND(x[2], x[6], x[10], x[14]);
+            SSE2_QUARTER_ROUND(x[3], x[7], x[11], x[15]);
+            SSE2_QUARTER_ROUND(x[0], x[5], x[10], x[15]);
+            SSE2_QUARTER_ROUND(x[1], x[6], x[11], x[12]);
+            SSE2_QUARTER_ROUND(x[2], x[7], x[8], x[13]);
+            SSE2_QUARTER_ROUND(x[3], x[4], x[9], x[14]);
+        }
+
+        // Transpose each group of four words from word-per-vector to block-per-vector
+        for (int g = 0; g < 4; g++)
+        {
+            __m128i a = _mm_add_epi32(x[g * 4 + 0], start[g * 4 + 0]);
+            __m128i b = _mm_add_epi32(x[g * 4 + 1], start[g * 4 + 1]);
+            __m128i c = _mm_add_epi32(x[g * 4 + 2], start[g * 4 + 2]);
+            __m128i d = _mm_add_epi32(x[g * 4 + 3], start[g * 4 + 3]);
+
+            __m128i ab01 = _mm_unpacklo_epi32(a, b);
+            __m128i cd01 = _mm_unpacklo_epi32(c, d);
+            __m128i ab23 = _mm_unpackhi_epi32(a, b);
+            __m128i cd23 = _mm_unpackhi_epi32(c, d);
+
+            __m128i words[4] = {
+                _mm_unpacklo_epi64(ab01, cd01),
+                _mm_unpackhi_epi64(ab01, cd01),
+                _mm_unpacklo_epi64(ab23, cd23),
+                _mm_unpackhi_epi64(ab23, cd23)};
+
+            for (size_t j = 0; j < 4; j++)
+            {
+                size_t offset = j * CHACHA_BLOCK_SIZE + g * 16;
+                __m128i data = _mm_loadu_si128((const __m128i *)(input + offset));
+                _mm_storeu_si128((__m128i *)(output + offset), _mm_xor_si128(data, words[j]));
+            }
+        }
+
+        advanceCounter(state, 4);
+        output += 4 * CHACHA_BLOCK_SIZE;
+        input += 4 * CHACHA_BLOCK_SIZE;
+    }
+
+    portableBlocks(state, rounds, output, input, blocks);
+}
+
+#define AVX2_ROTL(v, n) _mm256_or_si256(_mm256_slli_epi32(v, n), _mm256_srli_epi32(v, 32 - (n)))
+#define AVX2_ROTL_BYTES(v, shuffle) _mm256_shuffle_epi8(v, shuffle)
+
+#define AVX2_QUARTER_ROUND(a, b, c, d)                                                  \
+    a = _mm256_add_epi32(a, b), d = AVX2_ROTL_BYTES(_mm256_xor_si256(d, a), rot16); \
+    c = _mm256_add_epi32(c, d), b = AVX2_ROTL(_mm256_xor_si256(b, c), 12);          \
+    a = _mm256_add_epi32(a, b), d = AVX2_ROTL_BYTES(_mm256_xor_si256(d, a), rot8);  \
+    c = _mm256_add_epi32(c, d), b = AVX2_ROTL(_mm256_xor_si256(b, c), 7)
+
+/**
+ * AVX2 kernel: eight blocks at a time, one block per 32-bit lane
+ */
+__attribute__((target("avx2"))) static void avx2Blocks(uint32_t *state, uint8_t rounds, uint8_t *output,
+                                                       const uint8_t *input, size_t blocks)
+{
+    // Rotations by whole bytes are a single byte shuffle
+    const __m256i rot16 = _mm256_setr_epi8(2, 3, 0, 1, 6, 7, 4, 5, 10, 11, 8, 9, 14, 15, 12, 13,
+                                           2, 3, 0, 1, 6, 7, 4, 5, 10, 11, 8, 9, 14, 15, 12, 13);
+    const __m256i rot8 = _mm256_setr_epi8(3, 0, 1, 2, 7, 4, 5, 6, 11, 8, 9, 10, 15, 12, 13, 14,
+                                          3, 0, 1, 2, 7, 4, 5, 6, 11, 8, 9, 10, 15, 12, 13, 14);
+
+    for (; blocks >= 8; blocks -= 8)
+    {
+        __m256i start[16];
+        for (int i = 0; i < 16; i++)
+        {
+            start[i] = _mm256_set1_epi32((int)state[i]);
+        }
+
+        uint64_t counter = (uint64_t)state[13] << 32 | state[12];
+        uint32_t counterLow[8];
+        uint32_t counterHigh[8];
+        for (int j = 0; j < 8; j++)
+        {
+            counterLow[j] = (uint32_t)(counter + j);
+            counterHigh[j] = (uint32_t)((counter + j) >> 32);
+        }
+        start[12] = _mm256_loadu_si256((const __m256i *)counterLow);
+        start[13] = _mm256_loadu_si256((const __m256i *)counterHigh);
+
+        __m256i x[16];
+        memcpy(x, start, sizeof(x));
+        for (uint8_t i = 0; i < rounds; i += 2)
+        {
+            AVX2_QUARTER_ROUND(x[0], x[4], x[8], x[12]);
+            AVX2_QUARTER_ROUND(x[1], x[5], x[9], x[13]);
+            AVX2_QUARTER_ROUND(x[2], x[6], x[10], x[14]);
+            AVX2_QUARTER_ROUND(x[3], x[7], x[11], x[15]);
+            AVX2_QUARTER_ROUND(x[0], x[5], x[10], x[15]);
+            AVX2_QUARTER_ROUND(x[1], x[6], x[11], x[12]);
+            AVX2_QUARTER_ROUND(x[2], x[7], x[8], x[13]);
+            AVX2_QUARTER_ROUND(x[3], x[4], x[9], x[14]);
+        }
+
+        // Transpose within each 128-bit half: words[g][j] holds words 4g..4g+3 of block j in
+        // the low half and of block j + 4 in the high half
+        __m256i words[4][4];
+        for (int g = 0; g < 4; g++)
+        {
+            __m256i a = _mm256_add_epi32(x[g * 4 + 0], start[g * 4 + 0]);
+            __m256i b = _mm256_add_epi32(x[g * 4 + 1], start[g * 4 + 1]);
+            __m256i c = _mm256_add_epi32(x[g * 4 + 2], start[g * 4 + 2]);
+            __m256i d = _mm256_add_epi32(x[g * 4 + 3], start[g * 4 + 3]);
+
+            __m256i ab01 = _mm256_unpacklo_epi32(a, b);
+            __m256i cd01 = _mm256_unpacklo_epi32(c, d);
+            __m256i ab23 = _mm256_unpackhi_epi32(a, b);
+            __m256i cd23 = _mm256_unpackhi_epi32(c, d);
+
+            words[g][0] = _mm256_unpacklo_epi64(ab01, cd01);
+            words[g][1] = _mm256_unpackhi_epi64(ab01, cd01);
+            words[g][2] = _mm256_unpacklo_epi64(ab23, cd23);
+            words[g][3] = _mm256_unpackhi_epi64(ab23, cd23);
+        }
+
+        // Join the halves into whole blocks
+        for (size_t j = 0; j < 4; j++)
+        {
+            __m256i stream[4] = {
+                _mm256_permute2x128_si256(words[0][j], words[1][j], 0x20),
+                _mm256_permute2x128_si256(words[2][j], words[3][j], 0x20),
+                _mm256_permute2x128_si256(words[0][j], words[1][j], 0x31),
+                _mm256_permute2x128_si256(words[2][j], words[3][j], 0x31)};
+            size_t offsets[4] = {
+                j * CHACHA_BLOCK_SIZE,
+                j * CHACHA_BLOCK_SIZE + 32,
+                (j + 4) * CHACHA_BLOCK_SIZE,
+                (j + 4) * CHACHA_BLOCK_SIZE + 32};
+
+            for (int k = 0; k < 4; k++)
+            {
+                __m256i data = _mm256_loadu_si256((const __m256i *)(input + offsets[k]));
+                _mm256_storeu_si256((__m256i *)(output + offsets[k]), _mm256_xor_si256(data, stream[k]));
+            }
+        }
+
+        advanceCounter(state, 8);
+        output += 8 * CHACHA_BLOCK_SIZE;
+        input += 8 * CHACHA_BLOCK_SIZE;
+    }
+
+    sse2Blocks(state, rounds, output, input, blocks);
+}
+
+#endif
+
+// Kernel selected on first use, or forced with setChaChaKernel()
+static ChaChaKernel activeKernel = CHACHA_KERNEL_PORTABLE;
+static ChaChaBlocksFn activeBlocks = nullptr;
+
+/**
+ * Check whether a kernel can run in this build and on this CPU
+ *
+ * @param kernel Kernel to check
+ * @return true if the kernel is supported, false otherwise
+ */
+static bool isKernelSupported(ChaChaKernel kernel)
+{
+    switch (kernel)
+    {
+    case CHACHA_KERNEL_PORTABLE:
+        return true;
+#if defined(CHACHA_SIMD_X86)
+    case CHACHA_KERNEL_SSE2:
+        return __builtin_cpu_supports("sse2");
+    case CHACHA_KERNEL_AVX2:
+        return __builtin_cpu_supports("avx2");
+#endif
+    default:
+        return false;
+    }
+}
+
+/**
+ * Force the kernel used by ChaChaSimd, e.g. to compare kernels in benchmarks
+ *
+ * @param kernel Kernel to use
+ * @return true if the kernel is supported by this build and CPU, false otherwise
+ */
+bool setChaChaKernel(ChaChaKernel kernel)
+{
+    if (!isKernelSupported(kernel))
+    {
+        return false;
+    }
+
+    switch (kernel)
+    {
+#if defined(CHACHA_SIMD_X86)
+    case CHACHA_KERNEL_AVX2:
+        activeBlocks = avx2Blocks;
+        break;
+    case CHACHA_KERNEL_SSE2:
+        activeBlocks = sse2Blocks;
+        break;
+#endif
+    default:
+        activeBlocks = portableBlocks;
+        break;
+    }
+    activeKernel = kernel;
+    return true;
+}
+
+/**
+ * Get the kernel used by ChaChaSimd
+ * The fastest kernel supported by the CPU is selected on first use.
+ *
+ * @return Active kernel
+ */
+ChaChaKernel getChaChaKernel()
+{
+    if (activeBlocks == nullptr)
+    {
+        if (!setChaChaKernel(CHACHA_KERNEL_AVX2) && !setChaChaKernel(CHACHA_KERNEL_SSE2))
+        {
+            setChaChaKernel(CHACHA_KERNEL_PORTABLE);
+        }
+    }
+    return activeKernel;
+}
+
+/**
+ * Get the name of a kernel
+ *
+ * @param kernel Kernel to name
+ * @return Kernel name ("portable", "sse2" or "avx2")
+ */
+const char *getChaChaKernelName(ChaChaKernel kernel)
+{
+    switch (kernel)
+    {
+    case CHACHA_KERNEL_SSE2:
+        return "sse2";
+    case CHACHA_KERNEL_AVX2:
+        return "avx2";
+    default:
+        return "portable";
+    }
+}
+
+/**
+ * Create a cipher
+ *
+ * @param rounds Number of ChaCha rounds (8, 12, or 20)
+ */
+ChaChaSimd::ChaChaSimd(uint8_t rounds)
+    : rounds(rounds), posn(CHACHA_BLOCK_SIZE)
+{
+    memset(state, 0, sizeof(state));
+}
+
+ChaChaSimd::~ChaChaSimd()
+{
+    clear();
+}
+
+/**
+ * Set the number of rounds
+ *
+ * @param rounds Number of ChaCha rounds (8, 12, or 20)
+ */
+void ChaChaSimd::setNumRounds(uint8_t rounds)
+{
+    this->rounds = rounds;
+}
+
+/**
+ * Set the key
+ *
+ * @param key Pointer to the key bytes
+ * @param len Size of the key in bytes (16 or 32)
+ * @return true if the key size is supported, false otherwise
+ */
+bool ChaChaSimd::setKey(const uint8_t *key, size_t len)
+{
+    static const char tag256[] = "expand 32-byte k";
+    static const char tag128[] = "expand 16-byte k";
+
+    const char *tag;
+    if (len == 32)
+    {
+        tag = tag256;
+    }
+    else if (len == 16)
+    {
+        tag = tag128;
+    }
+    else
+    {
+        return false;
+    }
+
+    // A 16-byte key is repeated to fill the eight key words, as in the Crypto library
+    for (int i = 0; i < 4; i++)
+    {
+        state[i] = loadLE32((const uint8_t *)tag + i * 4);
+    }
+    for (int i = 0; i < 8; i++)
+    {
+        state[4 + i] = loadLE32(key + (i * 4) % len);
+    }
+    memset(state + 12, 0, 4 * sizeof(uint32_t));
+    posn = CHACHA_BLOCK_SIZE;
+    return true;
+}
+
+/**
+ * Set the initialization vector and reset the block counter to zero
+ *
+ * @param iv Pointer to the IV bytes
+ * @param len Size of the IV in bytes (must be 8)
+ * @return true if the IV size is supported, false otherwise
+ */
+bool ChaChaSimd::setIV(const uint8_t *iv, size_t len)
+{
+    if (len != 8)
+    {
+        return false;
+    }
+
+    state[12] = 0;
+    state[13] = 0;
+    state[14] = loadLE32(iv);
+    state[15] = loadLE32(iv + 4);
+    posn = CHACHA_BLOCK_SIZE;
+    return true;
+}
+
+/**
+ * Set the block counter
+ *
+ * @param counter Pointer to the little-endian counter bytes
+ * @param len Size of the counter in bytes (must be 8)
+ * @return true if the counter size is supported, false otherwise
+ */
+bool ChaChaSimd::setCounter(const uint8_t *counter, size_t len)
+{
+    if (len != 8)
+    {
+        return false;
+    }
+
+    state[12] = loadLE32(counter);
+    state[13] = loadLE32(counter + 4);
+    posn = CHACHA_BLOCK_SIZE;
+    return true;
+}
+
+/**
+ * Encrypt data, continuing the keystream of earlier calls
+ *
+ * @param output Output buffer (may be the same as input)
+ * @param input Input buffer
+ * @param len Number of bytes to encrypt
+ */
+void ChaChaSimd::encrypt(uint8_t *output, const uint8_t *input, size_t len)
+{
+    // Use up the keystream left over from the previous call
+    while (len > 0 && posn < CHACHA_BLOCK_SIZE)
+    {
+        *output++ = *input++ ^ stream[posn++];
+        len--;
+    }
+
+    size_t blocks = len / CHACHA_BLOCK_SIZE;
+    if (blocks > 0)
+    {
+        getChaChaKernel();
+        activeBlocks(state, rounds, output, input, blocks);
+        output += blocks * CHACHA_BLOCK_SIZE;
+        input += blocks * CHACHA_BLOCK_SIZE;
+        len -= blocks * CHACHA_BLOCK_SIZE;
+    }
+
+    if (len > 0)
+    {
+        portableKeystream(state, rounds, stream);
+        for (posn = 0; posn < len; posn++)
+        {
+            output[posn] = input[posn] ^ stream[posn];
+        }
+    }
+}
+
+/**
+ * Wipe the key and keystream
+ */
+void ChaChaSimd::clear()
+{
+    clean(state, sizeof(state));
+    clean(stream, sizeof(stream));
+    posn = CHACHA_BLOCK_SIZE;
+}
@@ -0,0 +1,122 @@
+#if !defined(CHACHA_SIMD_H)
+#define CHACHA_SIMD_H
+
+#include <Arduino.h>
+
+/**
+ * Keystream kernels, from slowest to fastest
+ */
+enum ChaChaKernel : uint8_t
+{
+    CHACHA_KERNEL_PORTABLE = 0, // One block at a time in plain C++
+    CHACHA_KERNEL_SSE2 = 1,     // Four blocks at a time with SSE2 (x86)
+    CHACHA_KERNEL_AVX2 = 2      // Eight blocks at a time with AVX2 (x86)
+};
+
+/**
+ * Get the kernel used by ChaChaSimd
+ * The fastest kernel supported by the CPU is selected on first use.
+ *
+ * @return Active kernel
+ */
+ChaChaKernel getChaChaKernel();
+
+/**
+ * Force the kernel used by ChaChaSimd, e.g. to compare kernels in benchmarks
+ *
+ * @param kernel Kernel to use
+ * @return true if the kernel is supported by this build and CPU, false otherwise
+ */
+bool setChaChaKernel(ChaChaKernel kernel);
+
+/**
+ * Get the name of a kernel
+ *
+ * @param kernel Kernel to name
+ * @return Kernel name ("portable", "sse2" or "avx2")
+ */
+const char *getChaChaKernelName(ChaChaKernel kernel);
+
+/**
+ * Multi-block ChaCha cipher for bulk decryption on the backend
+ * Drop-in for the Crypto library's ChaCha when decrypting frames: same key setup, same
+ * 64-bit little-endian block counter in state words 12-13 and 8-byte IV in words 14-15, so
+ * it decrypts the device's [IV(8)][Counter(8)][data] frames bit for bit. Runs of whole blocks
+ * are produced several at a time by the active kernel.
+ */
+class ChaChaSimd
+{
+public:
+    /**
+     * Create a cipher
+     *
+     * @param rounds Number of ChaCha rounds (8, 12, or 20)
+     */
+    explicit ChaChaSimd(uint8_t rounds = 20);
+    ~ChaChaSimd();
+
+    /**
+     * Set the number of rounds
+     *
+     * @param rounds Number of ChaCha rounds (8, 12, or 20)
+     */
+    void setNumRounds(uint8_t rounds);
+
+    /**
+     * Set the key
+     *
+     * @param key Pointer to the key bytes
+     * @param len Size of the key in bytes (16 or 32)
+     * @return true if the key size is supported, false otherwise
+     */
+    bool setKey(const uint8_t *key, size_t len);
+
+    /**
+     * Set the initialization vector and reset the block counter to zero
+     *
+     * @param iv Pointer to the IV bytes
+     * @param len Size of the IV in bytes (must be 8)
+     * @return true if the IV size is supported, false otherwise
+     */
+    bool setIV(const uint8_t *iv, size_t len);
+
+    /**
+     * Set the block counter
+     *
+     * @param counter Pointer to the little-endian counter bytes
+     * @param len Size of the counter in bytes (must be 8)
+     * @return true if the counter size is supported, false otherwise
+     */
+    bool setCounter(const uint8_t *counter, size_t len);
+
+    /**
+     * Encrypt data, continuing the keystream of earlier calls
+     *
+     * @param output Output buffer (may be the same as input)
+     * @param input Input buffer
+     * @param len Number of bytes to encrypt
+     */
+    void encrypt(uint8_t *output, const uint8_t *input, size_t len);
+
+    /**
+     * Decrypt data, continuing the keystream of earlier calls
+     *
+     * @param output Output buffer (may be the same as input)
+     * @param input Input buffer
+     * @param len Number of bytes to decrypt
+     */
+    void decrypt(uint8_t *output, const uint8_t *input, size_t len) { encrypt(output, input, len); }
+
+    /**
+     * Wipe the key and keystream
+     */
+    void clear();
+
+private:
+    uint32_t state[16];
+    uint8_t stream[64];
+    uint8_t rounds;
+    uint8_t posn;
+};
+
+#endif
@@ -0,0 +1,203 @@
+#include <Arduino.h>
+#include <AsyncLog.h>
+
+#include "ConnectionManager.h"
+
+/**
+ * Create a connection manager
+ *
+ * @param steps Steps in the order they are brought up (at most CONNECTION_MAX_STEPS, not copied)
+ * @param stepCount Number of steps
+ * @param backoff Backoff between failed attempts
+ */
+ConnectionManager::ConnectionManager(const ConnectionStep *steps, size_t stepCount, const BackoffPolicy &backoff)
+    : steps(steps), stepCount(stepCount < CONNECTION_MAX_STEPS ? stepCount : CONNECTION_MAX_STEPS), backoff(backoff),
+      started(false), connected(false), outageStartedAt(0),
+      connectCount(0), lastConnectTime(0), attempts(0), failures(0), timeouts(0)
+{
+    resetFrom(0, 0);
+}
+
+/**
+ * Mark a step and every step after it as down, ready for an immediate attempt
+ *
+ * @param index Index of the first step to reset
+ * @param now Current time in milliseconds
+ */
+void ConnectionManager::resetFrom(size_t index, uint32_t now)
+{
+    for (size_t i = index; i < stepCount; i++)
+    {
+        status[i].state = STEP_WAITING;
+        status[i].failedAttempts = 0;
+        status[i].nextAttemptAt = now;
+        status[i].attemptStartedAt = now;
+        status[i].lastCheckAt = now;
+    }
+}
+
+/**
+ * Schedule the next attempt of a step after a failure
+ * The delay doubles with every consecutive failure up to the maximum, and is spread by the
+ * jitter so that a fleet does not reconnect in lockstep after a network-wide outage.
+ *
+ * @param index Index of the failed step
+ * @param now Current time in milliseconds
+ */
+void ConnectionManager::scheduleRetry(size_t index, uint32_t now)
+{
+    StepStatus &stepStatus = status[index];
+    if (stepStatus.failedAttempts < UINT8_MAX)
+    {
+        stepStatus.failedAttempts++;
+    }
+
+    uint32_t delay = backoff.initialDelay;
+    for (uint8_t i = 1; i < stepStatus.failedAttempts && delay < backoff.maxDelay; i++)
+    {
+        delay *= 2;
+    }
+    if (delay > backoff.maxDelay)
+    {
+        delay = backoff.maxDelay;
+    }
+
+    uint32_t spread = (uint32_t)((uint64_t)delay * backoff.jitterPercent / 100);
+    if (spread > 0)
+    {
+        delay = delay - spread + (uint32_t)random((long)spread * 2 + 1);
+    }
+
+    stepStatus.state = STEP_WAITING;
+    stepStatus.nextAttemptAt = now + delay;
+
+    LOG_WARN("%s failed, retrying in %u ms", steps[index].name, (unsigned)delay);
+}
+
+/**
+ * Advance the state machine without blocking
+ *
+ * @param now Current time in milliseconds (millis())
+ * @return true if every step is up, false otherwise
+ */
+bool ConnectionManager::poll(uint32_t now)
+{
+    if (!started)
+    {
+        started = true;
+        outageStartedAt = now;
+        resetFrom(0, now);
+    }
+
+    for (size_t i = 0; i < stepCount; i++)
+    {
+        const ConnectionStep &step = steps[i];
+        StepStatus &stepStatus = status[i];
+
+        if (stepStatus.state == STEP_UP)
+        {
+            if (now - stepStatus.lastCheckAt < step.checkInterval)
+            {
+                continue;
+            }
+            stepStatus.lastCheckAt = now;
+            if (step.isUp())
+            {
+                continue;
+            }
+
+            LOG_WARN("%s lost", step.name);
+            if (connected)
+            {
+                connected = false;
+                outageStartedAt = now;
+            }
+            resetFrom(i, now);
+        }
+
+        ConnectionResult result;
+        if (stepStatus.state == STEP_WAITING)
+        {
+            if ((int32_t)(now - stepStatus.nextAttemptAt) < 0)
+            {
+                return false;
+            }
+
+            LOG_INFO("Connecting %s...", step.name);
+            attempts++;
+            stepStatus.state = STEP_CONNECTING;
+            stepStatus.attemptStartedAt = now;
+            stepStatus.lastCheckAt = now;
+            result = step.start();
+        }
+        else
+        {
+            result = CONNECTION_PENDING;
+            if (now - stepStatus.lastCheckAt >= step.checkInterval)
+            {
+                stepStatus.lastCheckAt = now;
+                if (step.poll != nullptr)
+                {
+                    result = step.poll();
+                }
+                else if (step.isUp())
+                {
+                    result = CONNECTION_UP;
+                }
+            }
+
+            if (result == CONNECTION_PENDING && now - stepStatus.attemptStartedAt >= step.timeout)
+            {
+                LOG_WARN("%s timed out", step.name);
+                timeouts++;
+                result = CONNECTION_FAILED;
+            }
+        }
+
+        if (result == CONNECTION_UP)
+        {
+            LOG_INFO("%s up", step.name);
+            stepStatus.state = STEP_UP;
+            stepStatus.failedAttempts = 0;
+            stepStatus.lastCheckAt = now;
+            continue; // Start on the next step right away
+        }
+
+        if (result == CONNECTION_FAILED)
+        {
+            failures++;
+            scheduleRetry(i, now);
+        }
+        return false;
+    }
+
+    if (!connected)
+    {
+        connected = true;
+        connectCount++;
+        lastConnectTime = now - outageStartedAt;
+        LOG_INFO("Connected in %u ms", (unsigned)lastConnectTime);
+    }
+    return true;
+}
+
+/**
+ * Check whether every step was up at the last poll
+ *
+ * @return true if connected, false otherwise
+ */
+bool ConnectionManager::isUp() const
+{
+    return connected;
+}
+
+/**
+ * Check whether a step was up at the last poll
+ *
+ * @param index Index of the step
+ * @return true if the step is up, false otherwise
+ */
+bool ConnectionManager::isStepUp(size_t index) const
+{
+    return index < stepCount && status[index].state == STEP_UP;
+}
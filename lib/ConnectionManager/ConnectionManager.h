@@ -0,0 +1,155 @@
+#ifndef CONNECTION_MANAGER_H
+#define CONNECTION_MANAGER_H
+
+#include <Arduino.h>
+
+// Largest number of steps a connection manager can drive
+#define CONNECTION_MAX_STEPS 4
+
+/**
+ * Outcome of starting or polling a connection step
+ */
+enum ConnectionResult : uint8_t
+{
+    CONNECTION_PENDING = 0, // Still connecting, poll again later
+    CONNECTION_UP = 1,      // Connected
+    CONNECTION_FAILED = 2   // Attempt failed, retry after a backoff
+};
+
+/**
+ * One layer of the connection, e.g. network registration, GPRS/WiFi or MQTT
+ * Steps are brought up in order; when a step goes down, every step after it is restarted.
+ */
+struct ConnectionStep
+{
+    const char *name;
+    bool (*isUp)();                // Check whether the step is still up
+    ConnectionResult (*start)();   // Begin an attempt, should return quickly
+    ConnectionResult (*poll)();    // Check on an attempt in progress, or nullptr to poll isUp()
+    uint32_t timeout;              // Give up on an attempt after this many milliseconds
+    uint32_t checkInterval;        // Minimum time between isUp()/poll() calls in milliseconds
+};
+
+/**
+ * Exponential backoff between failed attempts of a step
+ */
+struct BackoffPolicy
+{
+    uint32_t initialDelay;  // Delay after the first failure in milliseconds
+    uint32_t maxDelay;      // Upper bound of the delay in milliseconds
+    uint8_t jitterPercent;  // Random spread of each delay, in percent of the delay
+};
+
+/**
+ * Non-blocking connection state machine
+ * Call poll() from loop(); each call does at most one short step of work: checking a link,
+ * starting an attempt or polling one in progress. Failed and timed out attempts are retried
+ * with exponential backoff and jitter, so the rest of the pipeline keeps running during outages.
+ */
+class ConnectionManager
+{
+public:
+    /**
+     * Create a connection manager
+     *
+     * @param steps Steps in the order they are brought up (at most CONNECTION_MAX_STEPS, not copied)
+     * @param stepCount Number of steps
+     * @param backoff Backoff between failed attempts
+     */
+    ConnectionManager(const ConnectionStep *steps, size_t stepCount, const BackoffPolicy &backoff);
+
+    /**
+     * Advance the state machine without blocking
+     *
+     * @param now Current time in milliseconds (millis())
+     * @return true if every step is up, false otherwise
+     */
+    bool poll(uint32_t now);
+
+    /**
+     * Check whether every step was up at the last poll
+     *
+     * @return true if connected, false otherwise
+     */
+    bool isUp() const;
+
+    /**
+     * Check whether a step was up at the last poll
+     *
+     * @param index Index of the step
+     * @return true if the step is up, false otherwise
+     */
+    bool isStepUp(size_t index) const;
+
+    /**
+     * Get the number of times the connection came up, including the first time
+     *
+     * @return Number of successful (re)connections
+     */
+    uint32_t getConnectCount() const { return connectCount; }
+
+    /**
+     * Get how long the last (re)connection took, from detecting the outage until every step was up
+     *
+     * @return Duration of the last (re)connection in milliseconds
+     */
+    uint32_t getLastConnectTime() const { return lastConnectTime; }
+
+    /**
+     * Get the number of attempts started across all steps
+     *
+     * @return Number of attempts
+     */
+    uint32_t getAttemptCount() const { return attempts; }
+
+    /**
+     * Get the number of attempts that failed or timed out
+     *
+     * @return Number of failed attempts
+     */
+    uint32_t getFailureCount() const { return failures; }
+
+    /**
+     * Get the number of attempts that timed out
+     *
+     * @return Number of timed out attempts
+     */
+    uint32_t getTimeoutCount() const { return timeouts; }
+
+private:
+    enum StepState : uint8_t
+    {
+        STEP_WAITING,    // Down, waiting for the next attempt
+        STEP_CONNECTING, // Attempt in progress
+        STEP_UP          // Connected
+    };
+
+    struct StepStatus
+    {
+        StepState state;
+        uint8_t failedAttempts; // Consecutive failures, drives the backoff
+        uint32_t nextAttemptAt;
+        uint32_t attemptStartedAt;
+        uint32_t lastCheckAt;
+    };
+
+    void resetFrom(size_t index, uint32_t now);
+    void scheduleRetry(size_t index, uint32_t now);
+
+    const ConnectionStep *steps;
+    size_t stepCount;
+    BackoffPolicy backoff;
+    StepStatus status[CONNECTION_MAX_STEPS];
+
+    bool started;
+    bool connected;
+    uint32_t outageStartedAt;
+
+    uint32_t connectCount;
+    uint32_t lastConnectTime;
+    uint32_t attempts;
+    uint32_t failures;
+    uint32_t timeouts;
+};
+
+#endif // CONNECTION_MANAGER_H
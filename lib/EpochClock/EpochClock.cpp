@@ -0,0 +1,222 @@
+#include <stdio.h>
+
+#include "EpochClock.h"
+
+#define MILLIS_PER_DAY 86400000ULL
+
+/**
+ * Get the number of days from 1970-01-01 to a civil date in the proleptic Gregorian calendar
+ *
+ * @param year Year
+ * @param month Month, 1 to 12
+ * @param day Day of the month, 1 to 31
+ * @return Days since 1970-01-01
+ */
+static int64_t daysFromCivil(int32_t year, uint32_t month, uint32_t day)
+{
+    year -= month <= 2;
+    int32_t era = (year >= 0 ? year : year - 399) / 400;
+    uint32_t yearOfEra = (uint32_t)(year - era * 400);
+    uint32_t dayOfYear = (153 * (month > 2 ? month - 3 : month + 9) + 2) / 5 + day - 1;
+    uint32_t dayOfEra = yearOfEra * 365 + yearOfEra / 4 - yearOfEra / 100 + dayOfYear;
+    return (int64_t)era * 146097 + dayOfEra - 719468;
+}
+
+/**
+ * Convert a UTC date and time to milliseconds since the Unix epoch
+ *
+ * @param year Year, e.g. 2025
+ * @param month Month, 1 to 12
+ * @param day Day of the month, 1 to 31
+ * @param hour Hour, 0 to 23
+ * @param minute Minute, 0 to 59
+ * @param second Second, 0 to 60
+ * @param millisecond Millisecond, 0 to 999
+ * @return Milliseconds since 1970-01-01T00:00:00Z
+ */
+uint64_t makeEpochMillis(uint16_t year, uint8_t month, uint8_t day, uint8_t hour, uint8_t minute, uint8_t second, uint16_t millisecond)
+{
+    uint64_t days = (uint64_t)daysFromCivil(year, month, day);
+    return days * MILLIS_PER_DAY + ((hour * 60UL + minute) * 60UL + second) * 1000UL + millisecond;
+}
+
+/**
+ * Format milliseconds since the Unix epoch as an ISO 8601 UTC timestamp
+ *
+ * @param epochMillis Milliseconds since 1970-01-01T00:00:00Z
+ * @param output Buffer to store the null-terminated timestamp
+ * @param capacity Capacity of the output buffer, at least EPOCH_ISO_TIME_SIZE
+ * @return Length of the timestamp, or 0 if the buffer is too small
+ */
+size_t formatIsoTime(uint64_t epochMillis, char *output, size_t capacity)
+{
+    if (capacity < EPOCH_ISO_TIME_SIZE)
+    {
+        if (capacity > 0)
+        {
+            output[0] = '\0';
+        }
+        return 0;
+    }
+
+    uint32_t days = epochMillis / MILLIS_PER_DAY;
+    uint32_t millisOfDay = epochMillis % MILLIS_PER_DAY;
+
+    // Civil date from days since 1970-01-01
+    uint32_t z = days + 719468;
+    uint32_t era = z / 146097;
+    uint32_t dayOfEra = z - era * 146097;
+    uint32_t yearOfEra = (dayOfEra - dayOfEra / 1460 + dayOfEra / 36524 - dayOfEra / 146096) / 365;
+    uint32_t dayOfYear = dayOfEra - (365 * yearOfEra + yearOfEra / 4 - yearOfEra / 100);
+    uint32_t monthIndex = (5 * dayOfYear + 2) / 153;
+    uint32_t day = dayOfYear - (153 * monthIndex + 2) / 5 + 1;
+    uint32_t month = monthIndex < 10 ? monthIndex + 3 : monthIndex - 9;
+    uint32_t year = yearOfEra + era * 400 + (month <= 2);
+
+    int len = snprintf(output, capacity, "%04lu-%02lu-%02luT%02lu:%02lu:%02lu.%03luZ",
+                       (unsigned long)year % 10000, (unsigned long)month, (unsigned long)day,
+                       (unsigned long)(millisOfDay / 3600000), (unsigned long)(millisOfDay / 60000 % 60),
+                       (unsigned long)(millisOfDay / 1000 % 60), (unsigned long)(millisOfDay % 1000));
+    return len > 0 && (size_t)len < capacity ? len : 0;
+}
+
+/**
+ * Create an unset clock
+ *
+ * @param stepThreshold Step instead of slewing when the error exceeds this many milliseconds
+ * @param maxSlew Largest correction applied per discipline() call, in milliseconds
+ */
+EpochClock::EpochClock(uint32_t stepThreshold, uint32_t maxSlew)
+    : stepThreshold(stepThreshold), maxSlew(maxSlew), sequence(0), writing(false),
+      referenceEpoch(0), referenceMillis(0), lastIssued(0), lastError(0), steps(0), disciplines(0)
+{
+}
+
+/**
+ * Get the epoch time of a millis() value, never earlier than the previous call
+ * Only call from one task, e.g. the one timestamping fixes.
+ *
+ * @param ms millis() value, e.g. when a fix was taken
+ * @return Milliseconds since the Unix epoch, or 0 if the clock is not set
+ */
+uint64_t EpochClock::now(uint32_t ms)
+{
+    uint64_t epochMillis = toEpoch(ms);
+    if (epochMillis < lastIssued && lastIssued - epochMillis <= stepThreshold)
+    {
+        // Hold still while a backward correction is slewed in, but follow backward steps
+        return lastIssued;
+    }
+    lastIssued = epochMillis;
+    return epochMillis;
+}
+
+/**
+ * Get the epoch time of a millis() value
+ * Safe to call from any task, but not monotonic across corrections.
+ *
+ * @param ms millis() value
+ * @return Milliseconds since the Unix epoch, or 0 if the clock is not set
+ */
+uint64_t EpochClock::toEpoch(uint32_t ms) const
+{
+    uint32_t before;
+    uint32_t after;
+    uint64_t epoch;
+    uint32_t reference;
+    do
+    {
+        before = sequence.load(std::memory_order_acquire);
+        epoch = referenceEpoch;
+        reference = referenceMillis;
+        std::atomic_thread_fence(std::memory_order_acquire);
+        after = sequence.load(std::memory_order_relaxed);
+    } while ((before & 1) != 0 || before != after);
+
+    if (before < 2)
+    {
+        return 0;
+    }
+    return epoch + (int64_t)(int32_t)(ms - reference);
+}
+
+/**
+ * Set the clock
+ *
+ * @param epochMillis Milliseconds since the Unix epoch
+ * @param ms millis() value at which epochMillis was current
+ */
+void EpochClock::set(uint64_t epochMillis, uint32_t ms)
+{
+    while (writing.exchange(true, std::memory_order_acquire))
+    {
+    }
+    steps++;
+    store(epochMillis, ms);
+    writing.store(false, std::memory_order_release);
+}
+
+/**
+ * Correct the clock against a reference time, setting it if it is not set
+ *
+ * @param epochMillis Milliseconds since the Unix epoch, e.g. from GPS
+ * @param ms millis() value at which epochMillis was current
+ */
+void EpochClock::discipline(uint64_t epochMillis, uint32_t ms)
+{
+    while (writing.exchange(true, std::memory_order_acquire))
+    {
+    }
+    disciplines++;
+
+    if (sequence.load(std::memory_order_relaxed) < 2)
+    {
+        lastError = 0;
+        steps++;
+        store(epochMillis, ms);
+    }
+    else
+    {
+        uint64_t estimate = referenceEpoch + (int64_t)(int32_t)(ms - referenceMillis);
+        int64_t error = (int64_t)(epochMillis - estimate);
+        lastError = error > INT32_MAX ? INT32_MAX : (error < INT32_MIN ? INT32_MIN : (int32_t)error);
+
+        if (error > (int64_t)stepThreshold || error < -(int64_t)stepThreshold)
+        {
+            steps++;
+            store(epochMillis, ms);
+        }
+        else
+        {
+            // Slew: move towards the reference by at most maxSlew, and rebase on ms so that
+            // millis() wrapping around never matters
+            if (error > (int64_t)maxSlew)
+            {
+                error = maxSlew;
+            }
+            else if (error < -(int64_t)maxSlew)
+            {
+                error = -(int64_t)maxSlew;
+            }
+            store(estimate + error, ms);
+        }
+    }
+
+    writing.store(false, std::memory_order_release);
+}
+
+/**
+ * Publish a new reference pair to readers
+ *
+ * @param epochMillis Milliseconds since the Unix epoch
+ * @param ms millis() value at which epochMillis is current
+ */
+void EpochClock::store(uint64_t epochMillis, uint32_t ms)
+{
+    uint32_t current = sequence.load(std::memory_order_relaxed);
+    sequence.store(current + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    referenceEpoch = epochMillis;
+    referenceMillis = ms;
+    sequence.store(current + 2, std::memory_order_release);
+}
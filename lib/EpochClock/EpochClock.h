@@ -0,0 +1,135 @@
+#ifndef EPOCH_CLOCK_H
+#define EPOCH_CLOCK_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <atomic>
+
+// Size of an ISO 8601 timestamp "YYYY-MM-DDTHH:MM:SS.mmmZ", including the null terminator
+#define EPOCH_ISO_TIME_SIZE 25
+
+/**
+ * Convert a UTC date and time to milliseconds since the Unix epoch
+ *
+ * @param year Year, e.g. 2025
+ * @param month Month, 1 to 12
+ * @param day Day of the month, 1 to 31
+ * @param hour Hour, 0 to 23
+ * @param minute Minute, 0 to 59
+ * @param second Second, 0 to 60
+ * @param millisecond Millisecond, 0 to 999
+ * @return Milliseconds since 1970-01-01T00:00:00Z
+ */
+uint64_t makeEpochMillis(uint16_t year, uint8_t month, uint8_t day, uint8_t hour, uint8_t minute, uint8_t second, uint16_t millisecond);
+
+/**
+ * Format milliseconds since the Unix epoch as an ISO 8601 UTC timestamp
+ *
+ * @param epochMillis Milliseconds since 1970-01-01T00:00:00Z
+ * @param output Buffer to store the null-terminated timestamp
+ * @param capacity Capacity of the output buffer, at least EPOCH_ISO_TIME_SIZE
+ * @return Length of the timestamp, or 0 if the buffer is too small
+ */
+size_t formatIsoTime(uint64_t epochMillis, char *output, size_t capacity);
+
+/**
+ * 64-bit UTC clock in milliseconds since the Unix epoch, on top of millis()
+ * The clock keeps a reference pair (epoch time, millis()) that is stepped once when the time is
+ * first known and then disciplined against each new GPS time: small errors are slewed by at
+ * most maxSlew per correction, large ones are stepped. now() never goes backwards, so fixes
+ * taken in order carry increasing timestamps even while a correction is slewed in.
+ * One task may correct the clock while others read it; reads never block.
+ */
+class EpochClock
+{
+public:
+    /**
+     * Create an unset clock
+     *
+     * @param stepThreshold Step instead of slewing when the error exceeds this many milliseconds
+     * @param maxSlew Largest correction applied per discipline() call, in milliseconds
+     */
+    EpochClock(uint32_t stepThreshold, uint32_t maxSlew);
+
+    /**
+     * Check whether the clock has been set
+     *
+     * @return true if the clock has been set, false otherwise
+     */
+    bool isSet() const { return sequence.load(std::memory_order_acquire) >= 2; }
+
+    /**
+     * Get the epoch time of a millis() value, never earlier than the previous call
+     * Only call from one task, e.g. the one timestamping fixes.
+     *
+     * @param ms millis() value, e.g. when a fix was taken
+     * @return Milliseconds since the Unix epoch, or 0 if the clock is not set
+     */
+    uint64_t now(uint32_t ms);
+
+    /**
+     * Get the epoch time of a millis() value
+     * Safe to call from any task, but not monotonic across corrections.
+     *
+     * @param ms millis() value
+     * @return Milliseconds since the Unix epoch, or 0 if the clock is not set
+     */
+    uint64_t toEpoch(uint32_t ms) const;
+
+    /**
+     * Set the clock
+     *
+     * @param epochMillis Milliseconds since the Unix epoch
+     * @param ms millis() value at which epochMillis was current
+     */
+    void set(uint64_t epochMillis, uint32_t ms);
+
+    /**
+     * Correct the clock against a reference time, setting it if it is not set
+     *
+     * @param epochMillis Milliseconds since the Unix epoch, e.g. from GPS
+     * @param ms millis() value at which epochMillis was current
+     */
+    void discipline(uint64_t epochMillis, uint32_t ms);
+
+    /**
+     * Get the error measured by the last discipline() call
+     *
+     * @return Reference time minus clock time in milliseconds
+     */
+    int32_t getLastError() const { return lastError; }
+
+    /**
+     * Get the number of times the clock was stepped, including the first set
+     *
+     * @return Number of steps
+     */
+    uint32_t getStepCount() const { return steps; }
+
+    /**
+     * Get the number of discipline() calls
+     *
+     * @return Number of corrections
+     */
+    uint32_t getDisciplineCount() const { return disciplines; }
+
+private:
+    void store(uint64_t epochMillis, uint32_t ms);
+
+    uint32_t stepThreshold;
+    uint32_t maxSlew;
+
+    // Reference pair, guarded by a sequence lock: odd while being written
+    std::atomic<uint32_t> sequence;
+    std::atomic<bool> writing;
+    uint64_t referenceEpoch;
+    uint32_t referenceMillis;
+
+    uint64_t lastIssued; // Only used by now()
+
+    volatile int32_t lastError;
+    volatile uint32_t steps;
+    volatile uint32_t disciplines;
+};
+
+#endif // EPOCH_CLOCK_H
@@ -0,0 +1,553 @@
+#include <Arduino.h>
+#include <stdio.h>
+#include <errno.h>
+#include <sys/stat.h>
+
+#include "FixLog.h"
+
+#define FIX_LOG_RECORD_MAGIC 0x4C46 // "FL"
+#define FIX_LOG_META_MAGIC 0x464C4D31 // "1MLF"
+
+/**
+ * Header stored in front of every record, little-endian
+ */
+struct FixLogRecordHeader
+{
+    uint16_t magic;
+    uint16_t length; // Length of the record after the header
+    uint32_t crc;    // CRC-32 of the record
+};
+
+/**
+ * Contents of the metadata file
+ */
+struct FixLogMeta
+{
+    uint32_t magic;
+    uint32_t readSeq;
+    uint32_t readOffset;
+    uint32_t writeSeq;
+    uint32_t crc; // CRC-32 of the fields above
+};
+
+/**
+ * Update a CRC-32 (IEEE 802.3) with more data
+ * Uses a 16-entry table, one lookup per nibble, to keep flash use small.
+ *
+ * @param crc CRC of the previous data, 0 to start
+ * @param data Pointer to the data
+ * @param len Length of the data in bytes
+ * @return Updated CRC
+ */
+static uint32_t updateCrc32(uint32_t crc, const uint8_t *data, size_t len)
+{
+    static const uint32_t table[16] = {
+        0x00000000, 0x1DB71064, 0x3B6E20C8, 0x26D930AC, 0x76DC4190, 0x6B6B51F4, 0x4DB26158, 0x5005713C,
+        0xEDB88320, 0xF00F9344, 0xD6D6A3E8, 0xCB61B38C, 0x9B64C2B0, 0x86D3D2D4, 0xA00AE278, 0xBDBDF21C};
+
+    crc = ~crc;
+    for (size_t i = 0; i < len; i++)
+    {
+        crc = table[(crc ^ data[i]) & 0x0F] ^ (crc >> 4);
+        crc = table[(crc ^ (data[i] >> 4)) & 0x0F] ^ (crc >> 4);
+    }
+    return ~crc;
+}
+
+/**
+ * Read and check the record at the current position of a segment file
+ *
+ * @param file Segment file positioned at a record header
+ * @param record Buffer of at least FIX_LOG_MAX_RECORD_SIZE bytes to store the record
+ * @param len Receives the length of the record
+ * @return 1 if a valid record was read, 0 at the clean end of the file, -1 if the record is corrupt
+ */
+static int readRecord(FILE *file, uint8_t *record, size_t *len)
+{
+    FixLogRecordHeader header;
+    size_t headerRead = fread(&header, 1, sizeof(header), file);
+    if (headerRead == 0)
+    {
+        return 0;
+    }
+    if (headerRead != sizeof(header) || header.magic != FIX_LOG_RECORD_MAGIC ||
+        header.length == 0 || header.length > FIX_LOG_MAX_RECORD_SIZE)
+    {
+        return -1;
+    }
+    if (fread(record, 1, header.length, file) != header.length || updateCrc32(0, record, header.length) != header.crc)
+    {
+        return -1;
+    }
+    *len = header.length;
+    return 1;
+}
+
+/**
+ * Create a fix log
+ *
+ * @param directory Directory holding the log files, e.g. "/littlefs/fixlog" (copied)
+ * @param segmentSize Maximum size of a segment file in bytes
+ * @param maxSegments Maximum number of segment files, at least 2
+ */
+FixLog::FixLog(const char *directory, uint32_t segmentSize, uint16_t maxSegments)
+    : segmentSize(segmentSize), maxSegments(maxSegments < 2 ? 2 : maxSegments), ready(false),
+      readSeq(0), readOffset(0), writeSeq(0), writeOffset(0), writeBuffered(0),
+      hasPending(false), pendingSeq(0), pendingOffset(0), pendingRecords(0), stats()
+{
+    snprintf(this->directory, sizeof(this->directory), "%s", directory);
+}
+
+/**
+ * Open the log, creating the directory if needed and resuming from the saved read position
+ *
+ * @return true if the log is ready, false otherwise
+ */
+bool FixLog::begin()
+{
+    if (mkdir(directory, 0755) != 0 && errno != EEXIST)
+    {
+        Serial.print("Error: Cannot create fix log directory ");
+        Serial.println(directory);
+        return false;
+    }
+
+    char path[FIX_LOG_PATH_SIZE + 16];
+    if (!loadMeta())
+    {
+        // Fresh log, or the metadata was lost: start over
+        readSeq = 0;
+        readOffset = 0;
+        writeSeq = 0;
+        segmentPath(0, path, sizeof(path));
+        remove(path);
+    }
+
+    // Keep appending to the last segment only if it ends on a complete record,
+    // so a write torn by a power loss never ends up in the middle of the log
+    uint32_t fileSize = 0;
+    writeOffset = scanSegment(writeSeq, &fileSize);
+    ready = true;
+    if (writeOffset != fileSize || fileSize >= segmentSize)
+    {
+        return rotate();
+    }
+    return saveMeta();
+}
+
+/**
+ * Append a serialized fix
+ * The record is buffered in RAM until flush() or until the buffer is full.
+ *
+ * @param record Serialized fix
+ * @param len Length of the serialized fix in bytes (at most FIX_LOG_MAX_RECORD_SIZE)
+ * @return true if the record was appended, false otherwise
+ */
+bool FixLog::append(const uint8_t *record, size_t len)
+{
+    if (!ready || len == 0 || len > FIX_LOG_MAX_RECORD_SIZE)
+    {
+        return false;
+    }
+
+    size_t recordSize = sizeof(FixLogRecordHeader) + len;
+    if (writeOffset + writeBuffered + recordSize > segmentSize && writeOffset + writeBuffered > 0)
+    {
+        if (!flush() || !rotate())
+        {
+            return false;
+        }
+    }
+    if (writeBuffered + recordSize > sizeof(writeBuffer) && !flush())
+    {
+        return false;
+    }
+
+    FixLogRecordHeader header = {FIX_LOG_RECORD_MAGIC, (uint16_t)len, updateCrc32(0, record, len)};
+    memcpy(writeBuffer + writeBuffered, &header, sizeof(header));
+    memcpy(writeBuffer + writeBuffered + sizeof(header), record, len);
+    writeBuffered += recordSize;
+    stats.appended++;
+    return true;
+}
+
+/**
+ * Write the buffered records to flash
+ *
+ * @return true if the records were written (or none were buffered), false otherwise
+ */
+bool FixLog::flush()
+{
+    if (writeBuffered == 0)
+    {
+        return true;
+    }
+
+    char path[FIX_LOG_PATH_SIZE + 16];
+    segmentPath(writeSeq, path, sizeof(path));
+    FILE *file = fopen(path, "ab");
+    bool written = file != nullptr && fwrite(writeBuffer, 1, writeBuffered, file) == writeBuffered;
+    if (file != nullptr && fclose(file) != 0)
+    {
+        written = false;
+    }
+
+    if (!written)
+    {
+        // Start a fresh segment so a partial write is never followed by more records
+        Serial.println("Error: Failed to write the fix log!");
+        writeBuffered = 0;
+        rotate();
+        return false;
+    }
+
+    writeOffset += writeBuffered;
+    writeBuffered = 0;
+    stats.flushes++;
+    return true;
+}
+
+/**
+ * Read the oldest records as one batch, without removing them
+ * JSON batches are an array of the records, binary batches a one-byte count followed by
+ * the records. Call commitBatch() once the batch has been delivered.
+ *
+ * @param encoding Encoding the records were serialized with, JSON or binary (columnar records cannot be joined)
+ * @param maxRecords Maximum number of records in the batch
+ * @param output Buffer to store the batch
+ * @param capacity Capacity of the output buffer in bytes
+ * @param recordCount Receives the number of records in the batch
+ * @return Length of the batch, or 0 if the log is empty
+ */
+size_t FixLog::peekBatch(FixEncoding encoding, size_t maxRecords, uint8_t *output, size_t capacity, size_t *recordCount)
+{
+    *recordCount = 0;
+    hasPending = false;
+    if (!ready || !flush())
+    {
+        return 0;
+    }
+    if (encoding == FIX_ENCODING_BINARY && maxRecords > 255)
+    {
+        maxRecords = 255;
+    }
+
+    // Reserve the opening and closing bytes of the batch
+    if (capacity < 2)
+    {
+        return 0;
+    }
+    size_t len = 1;
+    capacity--;
+
+    uint8_t record[FIX_LOG_MAX_RECORD_SIZE];
+    char path[FIX_LOG_PATH_SIZE + 16];
+    uint32_t seq = readSeq;
+    uint32_t offset = readOffset;
+    size_t count = 0;
+    FILE *file = nullptr;
+
+    while (count < maxRecords && (seq < writeSeq || offset < writeOffset))
+    {
+        if (file == nullptr)
+        {
+            segmentPath(seq, path, sizeof(path));
+            file = fopen(path, "rb");
+            if (file == nullptr || fseek(file, offset, SEEK_SET) != 0)
+            {
+                if (seq == writeSeq)
+                {
+                    break;
+                }
+                seq++; // Missing segment, e.g. after a failed write
+                offset = 0;
+                if (file != nullptr)
+                {
+                    fclose(file);
+                    file = nullptr;
+                }
+                continue;
+            }
+        }
+
+        size_t recordLen = 0;
+        int status = readRecord(file, record, &recordLen);
+        if (status <= 0)
+        {
+            // End of a segment, or the rest of it is unreadable: move on to the next one
+            if (status < 0)
+            {
+                stats.corruptRecords++;
+            }
+            fclose(file);
+            file = nullptr;
+            if (seq == writeSeq)
+            {
+                offset = writeOffset;
+                break;
+            }
+            seq++;
+            offset = 0;
+            continue;
+        }
+
+        size_t separator = (encoding == FIX_ENCODING_JSON && count > 0) ? 1 : 0;
+        if (len + separator + recordLen > capacity)
+        {
+            if (count == 0)
+            {
+                // Can never be sent, skip it
+                stats.corruptRecords++;
+                offset += sizeof(FixLogRecordHeader) + recordLen;
+                continue;
+            }
+            break;
+        }
+
+        if (separator > 0)
+        {
+            output[len] = ',';
+        }
+        memcpy(output + len + separator, record, recordLen);
+        len += separator + recordLen;
+        offset += sizeof(FixLogRecordHeader) + recordLen;
+        count++;
+    }
+    if (file != nullptr)
+    {
+        fclose(file);
+    }
+
+    hasPending = true;
+    pendingSeq = seq;
+    pendingOffset = offset;
+    pendingRecords = count;
+
+    if (count == 0)
+    {
+        // Only skipped data, nothing to deliver
+        commitBatch();
+        return 0;
+    }
+
+    *recordCount = count;
+    if (encoding == FIX_ENCODING_BINARY)
+    {
+        output[0] = count;
+        return len;
+    }
+
+    output[0] = '[';
+    output[len++] = ']';
+    return len;
+}
+
+/**
+ * Remove the records of the last peekBatch() and persist the read position
+ *
+ * @return true if the read position was saved, false otherwise
+ */
+bool FixLog::commitBatch()
+{
+    if (!hasPending)
+    {
+        return false;
+    }
+    hasPending = false;
+
+    if (pendingSeq == readSeq && pendingOffset == readOffset)
+    {
+        return true;
+    }
+
+    // Delete the segments that have been replayed completely
+    char path[FIX_LOG_PATH_SIZE + 16];
+    while (readSeq < pendingSeq)
+    {
+        segmentPath(readSeq, path, sizeof(path));
+        remove(path);
+        readSeq++;
+    }
+    readOffset = pendingOffset;
+    stats.replayed += pendingRecords;
+
+    // Once everything is replayed, free the write segment too by starting a new one
+    if (readSeq == writeSeq && readOffset >= writeOffset && writeBuffered == 0 && writeOffset > 0)
+    {
+        return rotate();
+    }
+    return saveMeta();
+}
+
+/**
+ * Check whether there is nothing left to replay
+ *
+ * @return true if the log is empty, false otherwise
+ */
+bool FixLog::empty() const
+{
+    return !ready || (readSeq == writeSeq && readOffset >= writeOffset && writeBuffered == 0);
+}
+
+/**
+ * Build the path of a segment file
+ *
+ * @param seq Sequence number of the segment
+ * @param path Buffer to store the path
+ * @param size Size of the buffer in bytes
+ */
+void FixLog::segmentPath(uint32_t seq, char *path, size_t size) const
+{
+    snprintf(path, size, "%s/%08lx.log", directory, (unsigned long)seq);
+}
+
+/**
+ * Build the path of a metadata file
+ *
+ * @param name File name
+ * @param path Buffer to store the path
+ * @param size Size of the buffer in bytes
+ */
+void FixLog::metaPath(const char *name, char *path, size_t size) const
+{
+    snprintf(path, size, "%s/%s", directory, name);
+}
+
+/**
+ * Load the read and write positions from the metadata file
+ *
+ * @return true if valid metadata was loaded, false otherwise
+ */
+bool FixLog::loadMeta()
+{
+    char path[FIX_LOG_PATH_SIZE + 16];
+    metaPath("meta", path, sizeof(path));
+    FILE *file = fopen(path, "rb");
+    if (file == nullptr)
+    {
+        return false;
+    }
+
+    FixLogMeta meta;
+    bool valid = fread(&meta, 1, sizeof(meta), file) == sizeof(meta) && meta.magic == FIX_LOG_META_MAGIC &&
+                 meta.crc == updateCrc32(0, (const uint8_t *)&meta, offsetof(FixLogMeta, crc)) &&
+                 meta.readSeq <= meta.writeSeq;
+    fclose(file);
+    if (!valid)
+    {
+        Serial.println("Error: Fix log metadata is corrupt, starting over");
+        return false;
+    }
+
+    readSeq = meta.readSeq;
+    readOffset = meta.readOffset;
+    writeSeq = meta.writeSeq;
+    return true;
+}
+
+/**
+ * Save the read and write positions, replacing the metadata file atomically
+ *
+ * @return true if the metadata was saved, false otherwise
+ */
+bool FixLog::saveMeta()
+{
+    FixLogMeta meta = {FIX_LOG_META_MAGIC, readSeq, readOffset, writeSeq, 0};
+    meta.crc = updateCrc32(0, (const uint8_t *)&meta, offsetof(FixLogMeta, crc));
+
+    char tempPath[FIX_LOG_PATH_SIZE + 16];
+    char path[FIX_LOG_PATH_SIZE + 16];
+    metaPath("meta.tmp", tempPath, sizeof(tempPath));
+    metaPath("meta", path, sizeof(path));
+
+    FILE *file = fopen(tempPath, "wb");
+    bool written = file != nullptr && fwrite(&meta, 1, sizeof(meta), file) == sizeof(meta);
+    if (file != nullptr && fclose(file) != 0)
+    {
+        written = false;
+    }
+    if (!written || rename(tempPath, path) != 0)
+    {
+        Serial.println("Error: Failed to save the fix log metadata!");
+        return false;
+    }
+    return true;
+}
+
+/**
+ * Start a new write segment, dropping the oldest segments beyond maxSegments
+ *
+ * @return true if the metadata was saved, false otherwise
+ */
+bool FixLog::rotate()
+{
+    bool replayed = readSeq == writeSeq && readOffset >= writeOffset && writeBuffered == 0;
+    writeSeq++;
+    writeOffset = 0;
+
+    char path[FIX_LOG_PATH_SIZE + 16];
+    segmentPath(writeSeq, path, sizeof(path));
+    remove(path); // Leftover from before the metadata was lost
+
+    // The old segment can go right away if the reader has already finished it
+    if (replayed)
+    {
+        segmentPath(readSeq, path, sizeof(path));
+        remove(path);
+        readSeq = writeSeq;
+        readOffset = 0;
+    }
+
+    while (writeSeq - readSeq + 1 > maxSegments)
+    {
+        dropOldestSegment();
+    }
+    return saveMeta();
+}
+
+/**
+ * Delete the oldest segment without replaying it
+ */
+void FixLog::dropOldestSegment()
+{
+    char path[FIX_LOG_PATH_SIZE + 16];
+    segmentPath(readSeq, path, sizeof(path));
+    remove(path);
+    readSeq++;
+    readOffset = 0;
+    hasPending = false;
+    stats.droppedSegments++;
+}
+
+/**
+ * Find the length of the valid records at the start of a segment
+ *
+ * @param seq Sequence number of the segment
+ * @param fileSize Receives the size of the segment file, 0 if it does not exist
+ * @return Length of the valid records in bytes
+ */
+uint32_t FixLog::scanSegment(uint32_t seq, uint32_t *fileSize)
+{
+    *fileSize = 0;
+    char path[FIX_LOG_PATH_SIZE + 16];
+    segmentPath(seq, path, sizeof(path));
+    FILE *file = fopen(path, "rb");
+    if (file == nullptr)
+    {
+        return 0;
+    }
+
+    uint8_t record[FIX_LOG_MAX_RECORD_SIZE];
+    uint32_t validLength = 0;
+    size_t recordLen = 0;
+    while (readRecord(file, record, &recordLen) > 0)
+    {
+        validLength += sizeof(FixLogRecordHeader) + recordLen;
+    }
+
+    fseek(file, 0, SEEK_END);
+    long size = ftell(file);
+    fclose(file);
+    *fileSize = size > 0 ? (uint32_t)size : 0;
+    return validLength;
+}
@@ -0,0 +1,154 @@
+#ifndef FIX_LOG_H
+#define FIX_LOG_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <GpsFix.h>
+
+// Longest log directory path, including the null terminator
+#define FIX_LOG_PATH_SIZE 48
+
+// Largest serialized fix that can be logged, in bytes
+#define FIX_LOG_MAX_RECORD_SIZE 384
+
+// Size of the RAM buffer collecting records before they are written to flash, in bytes
+#ifndef FIX_LOG_WRITE_BUFFER_SIZE
+#define FIX_LOG_WRITE_BUFFER_SIZE 1024
+#endif
+
+/**
+ * Counters of a fix log since boot
+ */
+struct FixLogStats
+{
+    uint32_t appended;        // Records appended
+    uint32_t replayed;        // Records handed out by peekBatch() and committed
+    uint32_t droppedSegments; // Unreplayed segments deleted to make room for new ones
+    uint32_t corruptRecords;  // Records skipped because of a bad header or CRC
+    uint32_t flushes;         // Writes of the RAM buffer to flash
+};
+
+/**
+ * Persistent store-and-forward queue of serialized fixes
+ * Records are appended to fixed-size segment files, each with a CRC-32, and read back in
+ * order as ready-to-encrypt batches in the same layout as serializeGpsFixBatch(). Segments
+ * are only ever appended to and deleted whole once replayed, and appends are collected in
+ * RAM and written in one go on flush(), which keeps flash wear low. When maxSegments is
+ * reached, the oldest unreplayed segment is dropped. The read position is kept in a small
+ * metadata file that is replaced atomically on every commit.
+ * Files are accessed through stdio, so the same code runs on LittleFS (through the ESP-IDF
+ * VFS) and on a directory of the host file system.
+ */
+class FixLog
+{
+public:
+    /**
+     * Create a fix log
+     *
+     * @param directory Directory holding the log files, e.g. "/littlefs/fixlog" (copied)
+     * @param segmentSize Maximum size of a segment file in bytes
+     * @param maxSegments Maximum number of segment files, at least 2
+     */
+    FixLog(const char *directory, uint32_t segmentSize, uint16_t maxSegments);
+
+    FixLog(const FixLog &) = delete;
+    FixLog &operator=(const FixLog &) = delete;
+
+    /**
+     * Open the log, creating the directory if needed and resuming from the saved read position
+     *
+     * @return true if the log is ready, false otherwise
+     */
+    bool begin();
+
+    /**
+     * Append a serialized fix
+     * The record is buffered in RAM until flush() or until the buffer is full.
+     *
+     * @param record Serialized fix
+     * @param len Length of the serialized fix in bytes (at most FIX_LOG_MAX_RECORD_SIZE)
+     * @return true if the record was appended, false otherwise
+     */
+    bool append(const uint8_t *record, size_t len);
+
+    /**
+     * Write the buffered records to flash
+     *
+     * @return true if the records were written (or none were buffered), false otherwise
+     */
+    bool flush();
+
+    /**
+     * Read the oldest records as one batch, without removing them
+     * JSON batches are an array of the records, binary batches a one-byte count followed by
+     * the records. Call commitBatch() once the batch has been delivered.
+     *
+     * @param encoding Encoding the records were serialized with, JSON or binary (columnar records cannot be joined)
+     * @param maxRecords Maximum number of records in the batch
+     * @param output Buffer to store the batch
+     * @param capacity Capacity of the output buffer in bytes
+     * @param recordCount Receives the number of records in the batch
+     * @return Length of the batch, or 0 if the log is empty
+     */
+    size_t peekBatch(FixEncoding encoding, size_t maxRecords, uint8_t *output, size_t capacity, size_t *recordCount);
+
+    /**
+     * Remove the records of the last peekBatch() and persist the read position
+     *
+     * @return true if the read position was saved, false otherwise
+     */
+    bool commitBatch();
+
+    /**
+     * Check whether there is nothing left to replay
+     *
+     * @return true if the log is empty, false otherwise
+     */
+    bool empty() const;
+
+    /**
+     * Get the number of segment files in use
+     *
+     * @return Number of segments from the read position to the write position
+     */
+    uint32_t getSegmentCount() const { return ready ? writeSeq - readSeq + 1 : 0; }
+
+    /**
+     * Get the counters of the log since boot
+     *
+     * @return Log counters
+     */
+    const FixLogStats &getStats() const { return stats; }
+
+private:
+    void segmentPath(uint32_t seq, char *path, size_t size) const;
+    void metaPath(const char *name, char *path, size_t size) const;
+    bool loadMeta();
+    bool saveMeta();
+    bool rotate();
+    void dropOldestSegment();
+    uint32_t scanSegment(uint32_t seq, uint32_t *fileSize);
+
+    char directory[FIX_LOG_PATH_SIZE];
+    uint32_t segmentSize;
+    uint16_t maxSegments;
+    bool ready;
+
+    uint32_t readSeq;
+    uint32_t readOffset;
+    uint32_t writeSeq;
+    uint32_t writeOffset; // Bytes of the write segment already on flash
+
+    uint8_t writeBuffer[FIX_LOG_WRITE_BUFFER_SIZE];
+    size_t writeBuffered;
+
+    // Position after the last peeked batch
+    bool hasPending;
+    uint32_t pendingSeq;
+    uint32_t pendingOffset;
+    size_t pendingRecords;
+
+    FixLogStats stats;
+};
+
+#endif // FIX_LOG_H
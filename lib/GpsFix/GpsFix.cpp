@@ -0,0 +1,40 @@
+#include "GpsFix.h"
+
+/**
+ * Serialize a fix record
+ *
+ * @param fix Fix to serialize
+ * @param encoding Encoding of the output
+ * @param output Buffer to store the serialized fix
+ * @param capacity Capacity of the output buffer in bytes
+ * @return Length of the serialized fix, or 0 if it does not fit in the buffer
+ */
+size_t serializeGpsFix(const GpsFix &fix, FixEncoding encoding, uint8_t *output, size_t capacity)
+{
+    if (encoding == FIX_ENCODING_BINARY)
+    {
+        return serializeRecordBinary(fix, gpsFixSchema, output, capacity);
+    }
+    if (encoding == FIX_ENCODING_COLUMNAR)
+    {
+        // A batch of one
+        return serializeRecordColumns(&fix, 1, gpsFixSchema, output, capacity);
+    }
+    return serializeRecordJson(fix, gpsFixSchema, (char *)output, capacity);
+}
+
+/**
+ * Deserialize a columnar batch of fixes
+ *
+ * @param input Columnar batch
+ * @param length Length of the batch in bytes
+ * @param fixes Buffer to store the fixes
+ * @param maxFixes Capacity of the fixes buffer
+ * @param strings Buffer to store the device IDs, must outlive the fixes
+ * @param stringsCapacity Capacity of the strings buffer in bytes
+ * @return Number of fixes, or 0 if the batch is malformed or does not fit
+ */
+size_t deserializeGpsFixColumns(const uint8_t *input, size_t length, GpsFix *fixes, size_t maxFixes, char *strings, size_t stringsCapacity)
+{
+    return deserializeRecordColumns(input, length, gpsFixSchema, fixes, maxFixes, strings, stringsCapacity);
+}
@@ -0,0 +1,197 @@
+#ifndef GPS_FIX_H
+#define GPS_FIX_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "RecordSchema.h"
+#include "RecordColumns.h"
+#include "RingBuffer.h"
+
+// Presence flags for GpsFix::valid
+#define GPS_FIX_HAS_LOCATION 0x01
+#define GPS_FIX_HAS_HDOP 0x02
+#define GPS_FIX_HAS_ALTITUDE 0x04
+#define GPS_FIX_HAS_SPEED 0x08
+#define GPS_FIX_HAS_TIME 0x10
+
+/**
+ * Encoding of a serialized fix record
+ */
+enum FixEncoding : uint8_t
+{
+    FIX_ENCODING_JSON = 0,    // JSON object, same keys as the original dynamic document
+    FIX_ENCODING_BINARY = 1,  // Packed little-endian struct with a presence bitmap
+    FIX_ENCODING_COLUMNAR = 2 // Batch stored column by column as zigzag varint deltas, see RecordColumns.h
+};
+
+/**
+ * One GPS fix as published by the device
+ * Values are fixed-point integers, published with the decimals given in the schema, so no
+ * floating-point arithmetic or formatting is needed between the receiver and the payload.
+ */
+struct GpsFix
+{
+    const char *id;                           // Device ID
+    uint64_t timestamp;                       // UTC time in milliseconds since the Unix epoch
+    int32_t lat;                              // Latitude in 1e-7 degrees
+    int32_t lng;                              // Longitude in 1e-7 degrees
+    uint32_t satellites;                      // Number of satellites in use
+    uint16_t hdop;                            // Horizontal dilution of precision in 0.01
+    int32_t alt;                              // Altitude in centimeters
+    uint32_t speed;                           // Speed in 0.01 km/h
+    bool dummy;                               // Whether the fix is dummy data for testing
+    uint32_t valid;                           // Bitmask of GPS_FIX_HAS_* flags
+    uint32_t capturedAt;                      // millis() when the fix was taken, not serialized
+};
+
+// Field table of the fix record, in wire order
+constexpr auto gpsFixSchema = std::make_tuple(
+    schemaField("id", &GpsFix::id),
+    schemaField("timestamp", &GpsFix::timestamp, GPS_FIX_HAS_TIME),
+    schemaField("lat", &GpsFix::lat, GPS_FIX_HAS_LOCATION, 7),
+    schemaField("long", &GpsFix::lng, GPS_FIX_HAS_LOCATION, 7),
+    schemaField("satellites", &GpsFix::satellites),
+    schemaField("hdop", &GpsFix::hdop, GPS_FIX_HAS_HDOP, 2),
+    schemaField("alt", &GpsFix::alt, GPS_FIX_HAS_ALTITUDE, 2),
+    schemaField("speed", &GpsFix::speed, GPS_FIX_HAS_SPEED, 2),
+    schemaField("dummy", &GpsFix::dummy));
+
+/**
+ * Convert a coordinate in whole degrees and billionths to 1e-7 degrees
+ * Matches TinyGPSPlus' RawDegrees, without going through a double.
+ *
+ * @param degrees Whole degrees
+ * @param billionths Billionths of a degree
+ * @param negative Whether the coordinate is south or west
+ * @return Coordinate in 1e-7 degrees
+ */
+inline int32_t makeFixCoordinate(uint16_t degrees, uint32_t billionths, bool negative)
+{
+    int32_t value = (int32_t)degrees * 10000000 + (int32_t)((billionths + 50) / 100);
+    return negative ? -value : value;
+}
+
+/**
+ * Convert a speed in 0.01 knots to 0.01 km/h
+ *
+ * @param centiKnots Speed in 0.01 knots
+ * @return Speed in 0.01 km/h
+ */
+inline uint32_t makeFixSpeed(uint32_t centiKnots)
+{
+    return (uint32_t)(((uint64_t)centiKnots * 1852 + 500) / 1000);
+}
+
+/**
+ * Serialize a fix record
+ *
+ * @param fix Fix to serialize
+ * @param encoding Encoding of the output
+ * @param output Buffer to store the serialized fix
+ * @param capacity Capacity of the output buffer in bytes
+ * @return Length of the serialized fix, or 0 if it does not fit in the buffer
+ */
+size_t serializeGpsFix(const GpsFix &fix, FixEncoding encoding, uint8_t *output, size_t capacity);
+
+/**
+ * Deserialize a columnar batch of fixes
+ *
+ * @param input Columnar batch
+ * @param length Length of the batch in bytes
+ * @param fixes Buffer to store the fixes
+ * @param maxFixes Capacity of the fixes buffer
+ * @param strings Buffer to store the device IDs, must outlive the fixes
+ * @param stringsCapacity Capacity of the strings buffer in bytes
+ * @return Number of fixes, or 0 if the batch is malformed or does not fit
+ */
+size_t deserializeGpsFixColumns(const uint8_t *input, size_t length, GpsFix *fixes, size_t maxFixes, char *strings, size_t stringsCapacity);
+
+/**
+ * Serialize the oldest fixes of a ring buffer as one batch
+ * JSON batches are an array of fix objects. Binary batches are a one-byte fix count followed
+ * by the packed fix records. Columnar batches are described in RecordColumns.h. As many fixes
+ * as fit in the buffer are serialized, up to maxFixes.
+ *
+ * @param fixes Ring buffer holding the fixes, oldest first
+ * @param maxFixes Maximum number of fixes to serialize
+ * @param encoding Encoding of the output
+ * @param output Buffer to store the serialized batch
+ * @param capacity Capacity of the output buffer in bytes
+ * @param fixCount Receives the number of fixes in the batch
+ * @return Length of the serialized batch, or 0 if not even one fix fits in the buffer
+ */
+template <size_t N>
+size_t serializeGpsFixBatch(const RingBuffer<GpsFix, N> &fixes, size_t maxFixes, FixEncoding encoding, uint8_t *output, size_t capacity, size_t *fixCount)
+{
+    *fixCount = 0;
+    if (maxFixes > fixes.size())
+    {
+        maxFixes = fixes.size();
+    }
+    if (encoding == FIX_ENCODING_BINARY && maxFixes > 255)
+    {
+        maxFixes = 255;
+    }
+
+    if (encoding == FIX_ENCODING_COLUMNAR)
+    {
+        // A columnar batch is only complete once every column is written, so shrink it until it fits
+        for (size_t count = maxFixes; count > 0; count--)
+        {
+            size_t len = serializeRecordColumns(fixes, count, gpsFixSchema, output, capacity);
+            if (len > 0)
+            {
+                *fixCount = count;
+                return len;
+            }
+        }
+        return 0;
+    }
+
+    // Reserve the opening and closing bytes of the batch
+    if (maxFixes == 0 || capacity < 2)
+    {
+        return 0;
+    }
+    size_t len = 1;
+    capacity--;
+
+    for (size_t i = 0; i < maxFixes; i++)
+    {
+        size_t separator = (encoding == FIX_ENCODING_JSON && i > 0) ? 1 : 0;
+        if (len + separator >= capacity)
+        {
+            break;
+        }
+
+        size_t fixLen = serializeGpsFix(fixes[i], encoding, output + len + separator, capacity - len - separator);
+        if (fixLen == 0)
+        {
+            break;
+        }
+
+        if (separator > 0)
+        {
+            output[len] = ',';
+        }
+        len += separator + fixLen;
+        (*fixCount)++;
+    }
+
+    if (*fixCount == 0)
+    {
+        return 0;
+    }
+
+    if (encoding == FIX_ENCODING_BINARY)
+    {
+        output[0] = *fixCount;
+        return len;
+    }
+
+    output[0] = '[';
+    output[len++] = ']';
+    return len;
+}
+
+#endif // GPS_FIX_H
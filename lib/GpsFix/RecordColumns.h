@@ -0,0 +1,446 @@
+#ifndef RECORD_COLUMNS_H
+#define RECORD_COLUMNS_H
+
+#include <math.h>
+#include "RecordSchema.h"
+
+/**
+ * Column-wise batch encoding of records described by a schema
+ * Consecutive records of one device differ only slightly, so a batch is stored column by
+ * column, each value as the difference to the previous one in its column:
+ *
+ *   0x00                     Tag, a binary batch never starts with a zero count
+ *   varint count             Number of records
+ *   presence runs            (varint run length, varint bitmap) pairs covering all records,
+ *                            one bit per field in schema order, LSB first
+ *   one column per field     Values of the records where the field is present:
+ *     integers, floats       Zigzag varint of the difference to the previous value, starting
+ *                            from 0. Fixed-point integers are stored as they are. Floats are
+ *                            first scaled by 10^decimals and rounded, like the JSON encoding,
+ *                            so the batch holds exactly what JSON would.
+ *     booleans               Bit-packed, LSB first
+ *     strings                (varint run length, varint length + 1 or 0 for null, characters)
+ *
+ * Absent fields take no space beyond their presence bit, instead of a null per record.
+ */
+
+/**
+ * Get the factor a floating-point field is scaled by
+ *
+ * @param decimals Number of decimals of the field
+ * @return 10^decimals
+ */
+inline double getColumnScale(uint8_t decimals)
+{
+    double scale = 1;
+    while (decimals-- > 0)
+    {
+        scale *= 10;
+    }
+    return scale;
+}
+
+/**
+ * Check whether a field is stored in a column batch
+ * Floating-point values that JSON would write as null are left out like absent fields.
+ *
+ * @param record Record to check
+ * @param field Field descriptor
+ * @return true if the field is present and representable
+ */
+template <typename Record, typename T>
+inline bool isColumnPresent(const Record &record, const SchemaField<Record, T> &field)
+{
+    if constexpr (std::is_floating_point<T>::value)
+    {
+        return isFieldPresent(record, field) && fabs(record.*(field.member)) * getColumnScale(field.decimals) < 9.2e18;
+    }
+    else
+    {
+        return isFieldPresent(record, field);
+    }
+}
+
+/**
+ * Get the presence bitmap of a record
+ *
+ * @param record Record to check
+ * @param schema Tuple of field descriptors
+ * @return One bit per field in schema order, set if the field is stored
+ */
+template <typename Record, typename... Ts>
+inline uint32_t getColumnPresence(const Record &record, const std::tuple<SchemaField<Record, Ts>...> &schema)
+{
+    uint32_t presence = 0;
+    uint32_t bit = 1;
+    std::apply([&](const auto &...fields)
+               { ((presence |= isColumnPresent(record, fields) ? bit : 0, bit <<= 1), ...); },
+               schema);
+    return presence;
+}
+
+/**
+ * Check whether two strings of a string column are equal
+ *
+ * @param a First string, may be null
+ * @param b Second string, may be null
+ * @param maxLen Maximum number of characters to compare
+ * @return true if both are null or both hold the same characters
+ */
+inline bool isSameColumnString(const char *a, const char *b, size_t maxLen)
+{
+    if (a == nullptr || b == nullptr)
+    {
+        return a == b;
+    }
+    return strncmp(a, b, maxLen) == 0;
+}
+
+/**
+ * Write one run of a string column
+ *
+ * @param writer Binary writer
+ * @param value String of the run, may be null
+ * @param run Number of records in the run
+ * @param maxLen Maximum number of characters to write (at most 255)
+ */
+inline void writeColumnString(BinaryWriter &writer, const char *value, size_t run, size_t maxLen)
+{
+    writer.writeVarint(run);
+    if (value == nullptr)
+    {
+        writer.writeVarint(0);
+        return;
+    }
+    size_t n = strnlen(value, maxLen);
+    writer.writeVarint(n + 1);
+    writer.write((const uint8_t *)value, n);
+}
+
+/**
+ * Write the column of one field
+ *
+ * @param writer Binary writer
+ * @param records Records of the batch, indexable from 0
+ * @param count Number of records
+ * @param field Field descriptor
+ */
+template <typename Records, typename Record, typename T>
+void writeColumn(BinaryWriter &writer, const Records &records, size_t count, const SchemaField<Record, T> &field)
+{
+    if constexpr (std::is_same<T, bool>::value)
+    {
+        uint8_t bits = 0;
+        size_t n = 0;
+        for (size_t i = 0; i < count; i++)
+        {
+            if (!isColumnPresent(records[i], field))
+            {
+                continue;
+            }
+            if (records[i].*(field.member))
+            {
+                bits |= 1 << (n % 8);
+            }
+            if (++n % 8 == 0)
+            {
+                writer.writeLE(bits, 1);
+                bits = 0;
+            }
+        }
+        if (n % 8 != 0)
+        {
+            writer.writeLE(bits, 1);
+        }
+    }
+    else if constexpr (std::is_same<T, const char *>::value || std::is_array<T>::value)
+    {
+        const size_t maxLen = std::is_array<T>::value && sizeof(T) < 255 ? sizeof(T) : 255;
+        const char *runValue = nullptr;
+        size_t run = 0;
+        for (size_t i = 0; i < count; i++)
+        {
+            if (!isColumnPresent(records[i], field))
+            {
+                continue;
+            }
+            const char *value = records[i].*(field.member);
+            if (run > 0 && isSameColumnString(value, runValue, maxLen))
+            {
+                run++;
+                continue;
+            }
+            if (run > 0)
+            {
+                writeColumnString(writer, runValue, run, maxLen);
+            }
+            runValue = value;
+            run = 1;
+        }
+        if (run > 0)
+        {
+            writeColumnString(writer, runValue, run, maxLen);
+        }
+    }
+    else
+    {
+        static_assert(std::is_arithmetic<T>::value, "unsupported field type");
+        int64_t previous = 0;
+        for (size_t i = 0; i < count; i++)
+        {
+            if (!isColumnPresent(records[i], field))
+            {
+                continue;
+            }
+            int64_t value;
+            if constexpr (std::is_floating_point<T>::value)
+            {
+                value = llround(records[i].*(field.member) * getColumnScale(field.decimals));
+            }
+            else
+            {
+                value = (int64_t)(records[i].*(field.member));
+            }
+            // Wrapping difference, undone exactly by the wrapping sum when decoding
+            writer.writeVarint(zigzagEncode((int64_t)((uint64_t)value - (uint64_t)previous)));
+            previous = value;
+        }
+    }
+}
+
+/**
+ * Read the column of one field
+ * Expects the presence bitmap of each record in its `valid` member.
+ *
+ * @param reader Binary reader
+ * @param records Records of the batch
+ * @param count Number of records
+ * @param field Field descriptor
+ * @param bit Presence bit of the field
+ * @param strings Buffer to store the characters of string fields
+ * @param stringsCapacity Capacity of the strings buffer in bytes
+ * @param stringsLength Bytes of the strings buffer in use, updated
+ * @return true if the column was read, false if it is malformed
+ */
+template <typename Record, typename T>
+bool readColumn(BinaryReader &reader, Record *records, size_t count, const SchemaField<Record, T> &field, uint32_t bit,
+                char *strings, size_t stringsCapacity, size_t *stringsLength)
+{
+    if constexpr (std::is_same<T, bool>::value)
+    {
+        uint8_t bits = 0;
+        size_t n = 0;
+        for (size_t i = 0; i < count; i++)
+        {
+            if ((records[i].valid & bit) == 0)
+            {
+                continue;
+            }
+            if (n % 8 == 0)
+            {
+                bits = reader.readLE(1);
+            }
+            records[i].*(field.member) = (bits >> (n % 8)) & 1;
+            n++;
+        }
+    }
+    else if constexpr (std::is_same<T, const char *>::value || std::is_array<T>::value)
+    {
+        size_t i = 0;
+        for (;;)
+        {
+            while (i < count && (records[i].valid & bit) == 0)
+            {
+                i++;
+            }
+            if (i == count)
+            {
+                break;
+            }
+
+            uint64_t run = reader.readVarint();
+            uint64_t lengthPlusOne = reader.readVarint();
+            const char *data = lengthPlusOne > 0 ? (const char *)reader.read(lengthPlusOne - 1) : nullptr;
+            if (run == 0 || reader.failed())
+            {
+                return false;
+            }
+
+            const char *value = nullptr;
+            if constexpr (std::is_same<T, const char *>::value)
+            {
+                if (data != nullptr)
+                {
+                    if (lengthPlusOne > stringsCapacity - *stringsLength)
+                    {
+                        return false;
+                    }
+                    char *copy = strings + *stringsLength;
+                    memcpy(copy, data, lengthPlusOne - 1);
+                    copy[lengthPlusOne - 1] = '\0';
+                    *stringsLength += lengthPlusOne;
+                    value = copy;
+                }
+            }
+
+            for (; i < count && run > 0; i++)
+            {
+                if ((records[i].valid & bit) == 0)
+                {
+                    continue;
+                }
+                if constexpr (std::is_same<T, const char *>::value)
+                {
+                    records[i].*(field.member) = value;
+                }
+                else
+                {
+                    size_t n = data == nullptr ? 0 : lengthPlusOne - 1;
+                    n = n < sizeof(T) ? n : sizeof(T);
+                    memset(records[i].*(field.member), 0, sizeof(T));
+                    memcpy(records[i].*(field.member), data, n);
+                }
+                run--;
+            }
+            if (run > 0)
+            {
+                return false;
+            }
+        }
+    }
+    else
+    {
+        int64_t previous = 0;
+        for (size_t i = 0; i < count; i++)
+        {
+            if ((records[i].valid & bit) == 0)
+            {
+                continue;
+            }
+            previous = (int64_t)((uint64_t)previous + (uint64_t)zigzagDecode(reader.readVarint()));
+            if constexpr (std::is_floating_point<T>::value)
+            {
+                records[i].*(field.member) = previous / getColumnScale(field.decimals);
+            }
+            else
+            {
+                records[i].*(field.member) = (T)previous;
+            }
+        }
+    }
+    return !reader.failed();
+}
+
+/**
+ * Serialize records as one column batch using their schema
+ *
+ * @param records Records of the batch, indexable from 0 (array or ring buffer)
+ * @param count Number of records
+ * @param schema Tuple of field descriptors, at most 32
+ * @param output Buffer to store the batch
+ * @param capacity Capacity of the output buffer in bytes
+ * @return Length of the batch, or 0 if it does not fit in the buffer
+ */
+template <typename Records, typename Record, typename... Ts>
+size_t serializeRecordColumns(const Records &records, size_t count, const std::tuple<SchemaField<Record, Ts>...> &schema, uint8_t *output, size_t capacity)
+{
+    static_assert(sizeof...(Ts) <= 32, "presence bitmaps hold at most 32 fields");
+    if (count == 0)
+    {
+        return 0;
+    }
+
+    BinaryWriter writer(output, capacity);
+    writer.writeLE(0, 1);
+    writer.writeVarint(count);
+
+    for (size_t i = 0; i < count;)
+    {
+        uint32_t presence = getColumnPresence(records[i], schema);
+        size_t run = 1;
+        while (i + run < count && getColumnPresence(records[i + run], schema) == presence)
+        {
+            run++;
+        }
+        writer.writeVarint(run);
+        writer.writeVarint(presence);
+        i += run;
+    }
+
+    std::apply([&](const auto &...fields)
+               { (writeColumn(writer, records, count, fields), ...); },
+               schema);
+
+    return writer.overflowed() ? 0 : writer.length();
+}
+
+/**
+ * Deserialize a column batch using its schema
+ * Present fields set their presence mask in `valid`, absent ones are left zero. Strings are
+ * copied into the strings buffer, which must outlive the records.
+ *
+ * @param input Column batch
+ * @param length Length of the batch in bytes
+ * @param schema Tuple of field descriptors the batch was serialized with
+ * @param records Buffer to store the records
+ * @param maxRecords Capacity of the records buffer
+ * @param strings Buffer to store the characters of string fields
+ * @param stringsCapacity Capacity of the strings buffer in bytes
+ * @return Number of records, or 0 if the batch is malformed or does not fit
+ */
+template <typename Record, typename... Ts>
+size_t deserializeRecordColumns(const uint8_t *input, size_t length, const std::tuple<SchemaField<Record, Ts>...> &schema,
+                                Record *records, size_t maxRecords, char *strings, size_t stringsCapacity)
+{
+    BinaryReader reader(input, length);
+    if (reader.readLE(1) != 0)
+    {
+        return 0;
+    }
+    uint64_t count = reader.readVarint();
+    if (count == 0 || count > maxRecords || reader.failed())
+    {
+        return 0;
+    }
+
+    // The presence bitmaps are kept in `valid` until every column is read
+    for (size_t i = 0; i < count;)
+    {
+        uint64_t run = reader.readVarint();
+        uint64_t presence = reader.readVarint();
+        if (run == 0 || run > count - i || reader.failed())
+        {
+            return 0;
+        }
+        for (; run > 0; run--, i++)
+        {
+            records[i] = Record{};
+            records[i].valid = presence;
+        }
+    }
+
+    bool ok = true;
+    uint32_t bit = 1;
+    size_t stringsLength = 0;
+    std::apply([&](const auto &...fields)
+               { ((ok = ok && readColumn(reader, records, count, fields, bit, strings, stringsCapacity, &stringsLength), bit <<= 1), ...); },
+               schema);
+    if (!ok || reader.remaining() != 0)
+    {
+        return 0;
+    }
+
+    for (size_t i = 0; i < count; i++)
+    {
+        uint32_t presence = records[i].valid;
+        uint32_t valid = 0;
+        bit = 1;
+        std::apply([&](const auto &...fields)
+                   { ((valid |= (presence & bit) ? fields.presenceMask : 0, bit <<= 1), ...); },
+                   schema);
+        records[i].valid = valid;
+    }
+    return count;
+}
+
+#endif // RECORD_COLUMNS_H
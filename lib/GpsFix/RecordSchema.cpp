@@ -0,0 +1,384 @@
+#include "RecordSchema.h"
+#include <math.h>
+
+// Powers of ten for fixed-point formatting
+static const uint64_t powersOfTen[] = {
+    1ULL, 10ULL, 100ULL, 1000ULL, 10000ULL, 100000ULL, 1000000ULL, 10000000ULL, 100000000ULL, 1000000000ULL};
+
+#define MAX_FIXED_DECIMALS 9
+
+// Two-digit pairs 00 to 99, so integers are formatted with one division per two digits
+static const char digitPairs[] =
+    "00010203040506070809101112131415161718192021222324252627282930313233343536373839"
+    "40414243444546474849505152535455565758596061626364656667686970717273747576777879"
+    "8081828384858687888990919293949596979899";
+
+/**
+ * Format an unsigned integer in decimal, backwards from the end of a buffer
+ * Values that fit in 32 bits never take a 64-bit division, which is a library call on the ESP32.
+ *
+ * @param value Value to format
+ * @param end End of the buffer, at least 20 characters are written before it
+ * @return Start of the digits
+ */
+static char *formatDigits(uint64_t value, char *end)
+{
+    char *p = end;
+    while (value > UINT32_MAX)
+    {
+        uint64_t high = value / 100000000;
+        uint32_t low = (uint32_t)(value - high * 100000000);
+        for (uint8_t i = 0; i < 4; i++)
+        {
+            p -= 2;
+            memcpy(p, digitPairs + (low % 100) * 2, 2);
+            low /= 100;
+        }
+        value = high;
+    }
+
+    uint32_t v = (uint32_t)value;
+    while (v >= 100)
+    {
+        p -= 2;
+        memcpy(p, digitPairs + (v % 100) * 2, 2);
+        v /= 100;
+    }
+    if (v >= 10)
+    {
+        p -= 2;
+        memcpy(p, digitPairs + v * 2, 2);
+    }
+    else
+    {
+        *--p = '0' + v;
+    }
+    return p;
+}
+
+/**
+ * Append a character
+ *
+ * @param c Character to append
+ */
+void TextWriter::write(char c)
+{
+    if (len >= capacity)
+    {
+        overflow = true;
+        return;
+    }
+    buffer[len++] = c;
+}
+
+/**
+ * Append a sequence of characters
+ *
+ * @param s Characters to append
+ * @param n Number of characters
+ */
+void TextWriter::write(const char *s, size_t n)
+{
+    if (n > capacity - len)
+    {
+        overflow = true;
+        return;
+    }
+    memcpy(buffer + len, s, n);
+    len += n;
+}
+
+/**
+ * Append a quoted JSON string, escaping quotes, backslashes and control characters
+ * A null pointer is written as null.
+ *
+ * @param s Null-terminated string
+ * @param maxLen Maximum number of characters to read from s
+ */
+void TextWriter::writeString(const char *s, size_t maxLen)
+{
+    if (s == nullptr)
+    {
+        write("null", 4);
+        return;
+    }
+
+    write('"');
+    for (size_t i = 0; i < maxLen && s[i] != '\0'; i++)
+    {
+        char c = s[i];
+        if (c == '"' || c == '\\')
+        {
+            write('\\');
+            write(c);
+        }
+        else if ((uint8_t)c < 0x20)
+        {
+            static const char hexDigits[] = "0123456789abcdef";
+            write("\\u00", 4);
+            write(hexDigits[(uint8_t)c >> 4]);
+            write(hexDigits[c & 0x0F]);
+        }
+        else
+        {
+            write(c);
+        }
+    }
+    write('"');
+}
+
+/**
+ * Append an unsigned integer in decimal
+ *
+ * @param value Value to append
+ */
+void TextWriter::writeUnsigned(uint64_t value)
+{
+    char digits[20];
+    char *start = formatDigits(value, digits + sizeof(digits));
+    write(start, digits + sizeof(digits) - start);
+}
+
+/**
+ * Append a signed integer in decimal
+ *
+ * @param value Value to append
+ */
+void TextWriter::writeSigned(int64_t value)
+{
+    if (value < 0)
+    {
+        write('-');
+        writeUnsigned(0 - (uint64_t)value);
+    }
+    else
+    {
+        writeUnsigned(value);
+    }
+}
+
+/**
+ * Append a fixed-point integer as a decimal number
+ * Trailing zeros are trimmed, so 1250 with 2 decimals is written as 12.5.
+ *
+ * @param value Value in units of 10^-decimals
+ * @param decimals Number of decimals (at most 9)
+ */
+void TextWriter::writeScaled(int64_t value, uint8_t decimals)
+{
+    if (value < 0)
+    {
+        write('-');
+        writeDecimal(0 - (uint64_t)value, decimals);
+    }
+    else
+    {
+        writeDecimal(value, decimals);
+    }
+}
+
+/**
+ * Append an unsigned fixed-point integer as a decimal number, trimming trailing zeros
+ *
+ * @param magnitude Value in units of 10^-decimals
+ * @param decimals Number of decimals
+ */
+void TextWriter::writeDecimal(uint64_t magnitude, uint8_t decimals)
+{
+    if (decimals > MAX_FIXED_DECIMALS)
+    {
+        decimals = MAX_FIXED_DECIMALS;
+    }
+
+    char digits[20];
+    char *end = digits + sizeof(digits);
+    char *start = formatDigits(magnitude, end);
+
+    // At least one digit before the decimal point
+    while (end - start <= decimals)
+    {
+        *--start = '0';
+    }
+
+    // Drop trailing zeros of the fraction
+    while (decimals > 0 && end[-1] == '0')
+    {
+        end--;
+        decimals--;
+    }
+
+    char *point = end - decimals;
+    write(start, point - start);
+    if (decimals > 0)
+    {
+        write('.');
+        write(point, decimals);
+    }
+}
+
+/**
+ * Append a floating-point value rounded to a fixed number of decimals
+ * Trailing zeros are trimmed. Non-finite values are written as null.
+ *
+ * @param value Value to append
+ * @param decimals Number of decimals (at most 9)
+ */
+void TextWriter::writeFixed(double value, uint8_t decimals)
+{
+    if (!isfinite(value))
+    {
+        write("null", 4);
+        return;
+    }
+
+    if (decimals > MAX_FIXED_DECIMALS)
+    {
+        decimals = MAX_FIXED_DECIMALS;
+    }
+
+    uint64_t scale = powersOfTen[decimals];
+    double scaled = fabs(value) * scale + 0.5;
+    if (scaled >= 18446744073709551615.0)
+    {
+        write("null", 4);
+        return;
+    }
+
+    uint64_t magnitude = (uint64_t)scaled;
+    if (value < 0 && magnitude != 0)
+    {
+        write('-');
+    }
+    writeDecimal(magnitude, decimals);
+}
+
+/**
+ * Append raw bytes
+ *
+ * @param data Bytes to append
+ * @param n Number of bytes
+ */
+void BinaryWriter::write(const uint8_t *data, size_t n)
+{
+    if (n > capacity - len)
+    {
+        overflow = true;
+        return;
+    }
+    memcpy(buffer + len, data, n);
+    len += n;
+}
+
+/**
+ * Append an integer in little-endian byte order
+ *
+ * @param value Value to append
+ * @param bytes Number of bytes to write (at most 8)
+ */
+void BinaryWriter::writeLE(uint64_t value, size_t bytes)
+{
+    if (bytes > capacity - len)
+    {
+        overflow = true;
+        return;
+    }
+    for (size_t i = 0; i < bytes; i++)
+    {
+        buffer[len++] = value >> (i * 8);
+    }
+}
+
+/**
+ * Append an unsigned integer as a LEB128 varint, 7 bits per byte, least significant first
+ *
+ * @param value Value to append
+ */
+void BinaryWriter::writeVarint(uint64_t value)
+{
+    while (value >= 0x80)
+    {
+        writeLE((value & 0x7F) | 0x80, 1);
+        value >>= 7;
+    }
+    writeLE(value, 1);
+}
+
+/**
+ * Reserve zeroed bytes to be filled in later
+ *
+ * @param n Number of bytes to reserve
+ * @return Pointer to the reserved bytes, or nullptr if they do not fit in the buffer
+ */
+uint8_t *BinaryWriter::reserve(size_t n)
+{
+    if (n > capacity - len)
+    {
+        overflow = true;
+        return nullptr;
+    }
+    uint8_t *reserved = buffer + len;
+    memset(reserved, 0, n);
+    len += n;
+    return reserved;
+}
+
+/**
+ * Consume raw bytes
+ *
+ * @param n Number of bytes
+ * @return Pointer to the bytes, or nullptr if fewer are left
+ */
+const uint8_t *BinaryReader::read(size_t n)
+{
+    if (n > length - position)
+    {
+        failure = true;
+        position = length;
+        return nullptr;
+    }
+    const uint8_t *data = buffer + position;
+    position += n;
+    return data;
+}
+
+/**
+ * Consume an integer in little-endian byte order
+ *
+ * @param bytes Number of bytes to read (at most 8)
+ * @return Value read, or 0 if fewer bytes are left
+ */
+uint64_t BinaryReader::readLE(size_t bytes)
+{
+    const uint8_t *data = read(bytes);
+    uint64_t value = 0;
+    for (size_t i = 0; data != nullptr && i < bytes; i++)
+    {
+        value |= (uint64_t)data[i] << (i * 8);
+    }
+    return value;
+}
+
+/**
+ * Consume a LEB128 varint
+ *
+ * @return Value read, or 0 if the varint is truncated or longer than 64 bits
+ */
+uint64_t BinaryReader::readVarint()
+{
+    uint64_t value = 0;
+    for (uint8_t shift = 0; shift < 64; shift += 7)
+    {
+        if (position >= length)
+        {
+            break;
+        }
+        uint8_t byte = buffer[position++];
+        value |= (uint64_t)(byte & 0x7F) << shift;
+        if ((byte & 0x80) == 0)
+        {
+            return value;
+        }
+    }
+    failure = true;
+    return 0;
+}
@@ -0,0 +1,321 @@
+#ifndef RECORD_SCHEMA_H
+#define RECORD_SCHEMA_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <tuple>
+#include <type_traits>
+
+/**
+ * Compile-time description of one field of a record
+ * A schema is a std::tuple of fields built with schemaField(). The serializers below walk the
+ * tuple at compile time, so there is no dynamic document, no key lookup and no heap allocation.
+ *
+ * The record type must have a `valid` bitmask member. A field is present when all bits of its
+ * presence mask are set in `valid`; a mask of 0 marks a field that is always present.
+ */
+template <typename Record, typename T>
+struct SchemaField
+{
+    const char *key;       // JSON key
+    size_t keyLen;         // Length of the key, computed at compile time
+    T Record::*member;     // Member holding the value
+    uint32_t presenceMask; // Bits of Record::valid that must be set for the field to be present
+    uint8_t decimals;      // Number of decimals of the JSON output, fixed-point for integer members
+};
+
+/**
+ * Describe a field of a record
+ *
+ * @param key JSON key of the field
+ * @param member Pointer to the member holding the value
+ * @param presenceMask Bits of Record::valid that must be set for the field to be present (0 = always present)
+ * @param decimals Number of decimals of the JSON output: floats are rounded to them, integers are fixed-point values with that many decimals
+ * @return Field descriptor
+ */
+template <typename Record, typename T, size_t N>
+constexpr SchemaField<Record, T> schemaField(const char (&key)[N], T Record::*member, uint32_t presenceMask = 0, uint8_t decimals = 0)
+{
+    return {key, N - 1, member, presenceMask, decimals};
+}
+
+/**
+ * Bounded writer for JSON text
+ * Writes are dropped once the buffer is full and the overflow is remembered.
+ */
+class TextWriter
+{
+public:
+    TextWriter(char *buffer, size_t capacity) : buffer(buffer), capacity(capacity), len(0), overflow(false) {}
+
+    void write(char c);
+    void write(const char *s, size_t n);
+    void writeString(const char *s, size_t maxLen);
+    void writeUnsigned(uint64_t value);
+    void writeSigned(int64_t value);
+    void writeScaled(int64_t value, uint8_t decimals);
+    void writeFixed(double value, uint8_t decimals);
+
+    size_t length() const { return len; }
+    bool overflowed() const { return overflow; }
+
+private:
+    void writeDecimal(uint64_t magnitude, uint8_t decimals);
+
+    char *buffer;
+    size_t capacity;
+    size_t len;
+    bool overflow;
+};
+
+/**
+ * Bounded writer for packed little-endian binary records
+ * Writes are dropped once the buffer is full and the overflow is remembered.
+ */
+class BinaryWriter
+{
+public:
+    BinaryWriter(uint8_t *buffer, size_t capacity) : buffer(buffer), capacity(capacity), len(0), overflow(false) {}
+
+    void write(const uint8_t *data, size_t n);
+    void writeLE(uint64_t value, size_t bytes);
+    void writeVarint(uint64_t value);
+    uint8_t *reserve(size_t n);
+
+    size_t length() const { return len; }
+    bool overflowed() const { return overflow; }
+
+private:
+    uint8_t *buffer;
+    size_t capacity;
+    size_t len;
+    bool overflow;
+};
+
+/**
+ * Bounded reader for packed little-endian binary records
+ * Reads past the end return zeros and the failure is remembered.
+ */
+class BinaryReader
+{
+public:
+    BinaryReader(const uint8_t *buffer, size_t length) : buffer(buffer), length(length), position(0), failure(false) {}
+
+    const uint8_t *read(size_t n);
+    uint64_t readLE(size_t bytes);
+    uint64_t readVarint();
+
+    size_t remaining() const { return length - position; }
+    bool failed() const { return failure; }
+
+private:
+    const uint8_t *buffer;
+    size_t length;
+    size_t position;
+    bool failure;
+};
+
+/**
+ * Map a signed integer to an unsigned one, so that small magnitudes of either sign give short varints
+ *
+ * @param value Signed value
+ * @return Zigzag-encoded value
+ */
+inline uint64_t zigzagEncode(int64_t value)
+{
+    return ((uint64_t)value << 1) ^ (uint64_t)(value >> 63);
+}
+
+/**
+ * Map a zigzag-encoded integer back to the signed one
+ *
+ * @param value Zigzag-encoded value
+ * @return Signed value
+ */
+inline int64_t zigzagDecode(uint64_t value)
+{
+    return (int64_t)(value >> 1) ^ -(int64_t)(value & 1);
+}
+
+/**
+ * Check whether a field is present in a record
+ *
+ * @param record Record to check
+ * @param field Field descriptor
+ * @return true if all bits of the field's presence mask are set in the record
+ */
+template <typename Record, typename T>
+inline bool isFieldPresent(const Record &record, const SchemaField<Record, T> &field)
+{
+    return (record.valid & field.presenceMask) == field.presenceMask;
+}
+
+/**
+ * Write one value as JSON
+ *
+ * @param writer Text writer
+ * @param value Value to write
+ * @param decimals Number of decimals for floating-point values, or of a fixed-point integer
+ */
+template <typename T>
+inline void writeJsonValue(TextWriter &writer, const T &value, uint8_t decimals)
+{
+    if constexpr (std::is_same<T, bool>::value)
+    {
+        writer.write(value ? "true" : "false", value ? 4 : 5);
+    }
+    else if constexpr (std::is_floating_point<T>::value)
+    {
+        writer.writeFixed(value, decimals);
+    }
+    else if constexpr (std::is_integral<T>::value)
+    {
+        if (decimals > 0)
+        {
+            writer.writeScaled(value, decimals);
+        }
+        else if constexpr (std::is_signed<T>::value)
+        {
+            writer.writeSigned(value);
+        }
+        else
+        {
+            writer.writeUnsigned(value);
+        }
+    }
+    else if constexpr (std::is_array<T>::value)
+    {
+        writer.writeString(value, sizeof(T));
+    }
+    else
+    {
+        static_assert(std::is_same<T, const char *>::value, "unsupported field type");
+        writer.writeString(value, SIZE_MAX);
+    }
+}
+
+/**
+ * Write one value as packed little-endian binary
+ * Strings are written as a one-byte length followed by the characters.
+ *
+ * @param writer Binary writer
+ * @param value Value to write
+ */
+template <typename T>
+inline void writeBinaryValue(BinaryWriter &writer, const T &value)
+{
+    if constexpr (std::is_same<T, bool>::value)
+    {
+        writer.writeLE(value ? 1 : 0, 1);
+    }
+    else if constexpr (std::is_same<T, double>::value)
+    {
+        uint64_t bits;
+        memcpy(&bits, &value, sizeof(bits));
+        writer.writeLE(bits, sizeof(bits));
+    }
+    else if constexpr (std::is_same<T, float>::value)
+    {
+        uint32_t bits;
+        memcpy(&bits, &value, sizeof(bits));
+        writer.writeLE(bits, sizeof(bits));
+    }
+    else if constexpr (std::is_integral<T>::value)
+    {
+        writer.writeLE((uint64_t)value, sizeof(T));
+    }
+    else
+    {
+        const char *s = value;
+        size_t n = s != nullptr ? strnlen(s, std::is_array<T>::value ? sizeof(T) : 255) : 0;
+        n = n > 255 ? 255 : n;
+        writer.writeLE(n, 1);
+        writer.write((const uint8_t *)s, n);
+    }
+}
+
+/**
+ * Serialize a record to JSON text using its schema
+ * Absent fields are written as null. The output is not null-terminated.
+ *
+ * @param record Record to serialize
+ * @param schema Tuple of field descriptors
+ * @param output Buffer to store the JSON text
+ * @param capacity Capacity of the output buffer in bytes
+ * @return Length of the JSON text, or 0 if it does not fit in the buffer
+ */
+template <typename Record, typename... Fields>
+size_t serializeRecordJson(const Record &record, const std::tuple<Fields...> &schema, char *output, size_t capacity)
+{
+    TextWriter writer(output, capacity);
+    writer.write('{');
+
+    bool first = true;
+    std::apply([&](const auto &...fields)
+               { ([&](const auto &field)
+                  {
+                      if (!first)
+                      {
+                          writer.write(',');
+                      }
+                      first = false;
+
+                      writer.write('"');
+                      writer.write(field.key, field.keyLen);
+                      writer.write("\":", 2);
+
+                      if (isFieldPresent(record, field))
+                      {
+                          writeJsonValue(writer, record.*(field.member), field.decimals);
+                      }
+                      else
+                      {
+                          writer.write("null", 4);
+                      }
+                  }(fields),
+                  ...); },
+               schema);
+
+    writer.write('}');
+    return writer.overflowed() ? 0 : writer.length();
+}
+
+/**
+ * Serialize a record to a packed little-endian binary struct using its schema
+ * The output starts with a presence bitmap (one bit per field in schema order, LSB first),
+ * followed by the values of the present fields in schema order.
+ *
+ * @param record Record to serialize
+ * @param schema Tuple of field descriptors
+ * @param output Buffer to store the binary record
+ * @param capacity Capacity of the output buffer in bytes
+ * @return Length of the binary record, or 0 if it does not fit in the buffer
+ */
+template <typename Record, typename... Fields>
+size_t serializeRecordBinary(const Record &record, const std::tuple<Fields...> &schema, uint8_t *output, size_t capacity)
+{
+    BinaryWriter writer(output, capacity);
+    uint8_t *bitmap = writer.reserve((sizeof...(Fields) + 7) / 8);
+
+    size_t index = 0;
+    std::apply([&](const auto &...fields)
+               { ([&](const auto &field)
+                  {
+                      if (isFieldPresent(record, field))
+                      {
+                          if (bitmap != nullptr)
+                          {
+                              bitmap[index / 8] |= 1 << (index % 8);
+                          }
+                          writeBinaryValue(writer, record.*(field.member));
+                      }
+                      index++;
+                  }(fields),
+                  ...); },
+               schema);
+
+    return writer.overflowed() ? 0 : writer.length();
+}
+
+#endif // RECORD_SCHEMA_H
@@ -0,0 +1,80 @@
+#ifndef RING_BUFFER_H
+#define RING_BUFFER_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * Fixed-capacity FIFO ring buffer in static storage
+ * When the buffer is full, pushing a new element overwrites the oldest one and
+ * counts it as dropped.
+ */
+template <typename T, size_t N>
+class RingBuffer
+{
+public:
+    RingBuffer() : head(0), count(0), dropped(0) {}
+
+    /**
+     * Append an element, overwriting the oldest one if the buffer is full
+     *
+     * @param item Element to append
+     */
+    void push(const T &item)
+    {
+        if (count == N)
+        {
+            head = (head + 1) % N;
+            count--;
+            dropped++;
+        }
+        items[(head + count) % N] = item;
+        count++;
+    }
+
+    /**
+     * Remove the oldest elements
+     *
+     * @param n Number of elements to remove
+     */
+    void pop(size_t n)
+    {
+        if (n > count)
+        {
+            n = count;
+        }
+        head = (head + n) % N;
+        count -= n;
+    }
+
+    /**
+     * Get an element by age
+     *
+     * @param index Index of the element, 0 being the oldest
+     * @return Reference to the element
+     */
+    const T &operator[](size_t index) const
+    {
+        return items[(head + index) % N];
+    }
+
+    const T &front() const { return items[head]; }
+    size_t size() const { return count; }
+    bool empty() const { return count == 0; }
+    static constexpr size_t capacity() { return N; }
+
+    /**
+     * Get the number of elements overwritten because the buffer was full
+     *
+     * @return Number of dropped elements
+     */
+    uint32_t droppedCount() const { return dropped; }
+
+private:
+    T items[N];
+    size_t head;
+    size_t count;
+    uint32_t dropped;
+};
+
+#endif // RING_BUFFER_H
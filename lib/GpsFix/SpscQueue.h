@@ -0,0 +1,103 @@
+#ifndef SPSC_QUEUE_H
+#define SPSC_QUEUE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <atomic>
+
+/**
+ * Fixed-capacity lock-free queue for exactly one producer and one consumer
+ * The producer and the consumer may run on different cores: push() is only called from
+ * the producer and pop() only from the consumer. When the queue is full, push() rejects the
+ * new element and counts it as dropped, so the consumer never sees a torn element.
+ */
+template <typename T, size_t N>
+class SpscQueue
+{
+    static_assert(N > 0 && (N & (N - 1)) == 0, "SpscQueue capacity must be a power of two");
+
+public:
+    SpscQueue() : head(0), tail(0), highWater(0), dropped(0) {}
+
+    /**
+     * Append an element (producer only)
+     *
+     * @param item Element to append
+     * @return true if the element was queued, false if the queue was full
+     */
+    bool push(const T &item)
+    {
+        size_t currentTail = tail.load(std::memory_order_relaxed);
+        size_t used = currentTail - head.load(std::memory_order_acquire);
+        if (used == N)
+        {
+            dropped.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        }
+
+        items[currentTail & (N - 1)] = item;
+        tail.store(currentTail + 1, std::memory_order_release);
+
+        if (used + 1 > highWater.load(std::memory_order_relaxed))
+        {
+            highWater.store(used + 1, std::memory_order_relaxed);
+        }
+        return true;
+    }
+
+    /**
+     * Remove the oldest element (consumer only)
+     *
+     * @param item Set to the removed element
+     * @return true if an element was removed, false if the queue was empty
+     */
+    bool pop(T &item)
+    {
+        size_t currentHead = head.load(std::memory_order_relaxed);
+        if (currentHead == tail.load(std::memory_order_acquire))
+        {
+            return false;
+        }
+
+        item = items[currentHead & (N - 1)];
+        head.store(currentHead + 1, std::memory_order_release);
+        return true;
+    }
+
+    /**
+     * Get the number of queued elements
+     * Only a snapshot when called while the other side is running.
+     *
+     * @return Number of queued elements
+     */
+    size_t size() const
+    {
+        return tail.load(std::memory_order_acquire) - head.load(std::memory_order_acquire);
+    }
+
+    bool empty() const { return size() == 0; }
+    static constexpr size_t capacity() { return N; }
+
+    /**
+     * Get the largest number of elements that were queued at once
+     *
+     * @return Queue high-water mark
+     */
+    size_t highWaterMark() const { return highWater.load(std::memory_order_relaxed); }
+
+    /**
+     * Get the number of elements rejected because the queue was full
+     *
+     * @return Number of dropped elements
+     */
+    uint32_t droppedCount() const { return dropped.load(std::memory_order_relaxed); }
+
+private:
+    T items[N];
+    std::atomic<size_t> head; // Written by the consumer only
+    std::atomic<size_t> tail; // Written by the producer only
+    std::atomic<size_t> highWater;
+    std::atomic<uint32_t> dropped;
+};
+
+#endif // SPSC_QUEUE_H
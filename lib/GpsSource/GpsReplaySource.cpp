@@ -0,0 +1,266 @@
+#include <string.h>
+
+#include "GpsReplaySource.h"
+
+#define UBX_SYNC_CHAR_1 0xB5
+#define UBX_SYNC_CHAR_2 0x62
+#define UBX_CLASS_NAV 0x01
+
+/**
+ * Parse the time field of an NMEA sentence
+ *
+ * @param field Field, "hhmmss" with an optional fraction
+ * @param length Bytes available from the start of the field
+ * @param time Receives the time of day in milliseconds
+ * @return true if the field holds a time, false otherwise
+ */
+static bool parseNmeaTime(const uint8_t *field, size_t length, uint32_t *time)
+{
+    if (length < 6)
+    {
+        return false;
+    }
+
+    uint32_t digits[6];
+    for (size_t i = 0; i < 6; i++)
+    {
+        if (field[i] < '0' || field[i] > '9')
+        {
+            return false;
+        }
+        digits[i] = field[i] - '0';
+    }
+    uint32_t hour = digits[0] * 10 + digits[1];
+    uint32_t minute = digits[2] * 10 + digits[3];
+    uint32_t second = digits[4] * 10 + digits[5];
+
+    uint32_t millis = 0;
+    if (length > 6 && field[6] == '.')
+    {
+        uint32_t scale = 100;
+        for (size_t i = 7; i < length && i < 10 && field[i] >= '0' && field[i] <= '9'; i++)
+        {
+            millis += (field[i] - '0') * scale;
+            scale /= 10;
+        }
+    }
+
+    *time = ((hour * 60 + minute) * 60 + second) * 1000 + millis;
+    return true;
+}
+
+/**
+ * Create a replay source
+ *
+ * @param path Path of the capture, e.g. "/littlefs/replay.nmea" (copied)
+ * @param speed Replay speed, 1 for real time, N for N times faster, 0 for as fast as possible
+ */
+GpsReplaySource::GpsReplaySource(const char *path, float speed)
+    : speed(speed), file(nullptr), endOfFile(false), windowStart(0), windowEnd(0), released(0), paced(false),
+      lastUbxTime(false), lastTime(0), baseTime(0), baseNow(0), lastDue(0), passes(0), bytes(0)
+{
+    snprintf(this->path, sizeof(this->path), "%s", path);
+}
+
+GpsReplaySource::~GpsReplaySource()
+{
+    if (file != nullptr)
+    {
+        fclose(file);
+    }
+}
+
+/**
+ * Open the capture
+ *
+ * @return true if the capture could be opened and is not empty, false otherwise
+ */
+bool GpsReplaySource::begin()
+{
+    file = fopen(path, "rb");
+    if (file == nullptr)
+    {
+        return false;
+    }
+    fill();
+    return windowEnd > 0;
+}
+
+/**
+ * Get the bytes of the capture that are due
+ *
+ * @param buffer Buffer to store the bytes
+ * @param capacity Capacity of the buffer in bytes
+ * @param now Current time in milliseconds (millis())
+ * @return Number of bytes stored
+ */
+size_t GpsReplaySource::read(uint8_t *buffer, size_t capacity, uint32_t now)
+{
+    size_t length = 0;
+    while (length < capacity && file != nullptr)
+    {
+        if (released == 0)
+        {
+            bool timed;
+            uint32_t time;
+            bool ubxTime;
+            size_t unitLength = findUnit(&timed, &time, &ubxTime);
+            if (unitLength == 0)
+            {
+                // End of the capture, start over
+                rewind(file);
+                endOfFile = false;
+                windowStart = 0;
+                windowEnd = 0;
+                passes++;
+                if (!fill())
+                {
+                    break;
+                }
+                continue;
+            }
+
+            if (timed && !isDue(time, ubxTime, now))
+            {
+                break;
+            }
+            released = unitLength;
+        }
+
+        size_t chunk = released < capacity - length ? released : capacity - length;
+        memcpy(buffer + length, window + windowStart, chunk);
+        windowStart += chunk;
+        released -= chunk;
+        length += chunk;
+    }
+
+    bytes += length;
+    return length;
+}
+
+/**
+ * Move the unread bytes to the start of the window and read more of the capture behind them
+ *
+ * @return true if bytes were read, false otherwise
+ */
+bool GpsReplaySource::fill()
+{
+    memmove(window, window + windowStart, windowEnd - windowStart);
+    windowEnd -= windowStart;
+    windowStart = 0;
+
+    if (endOfFile || windowEnd == sizeof(window))
+    {
+        return false;
+    }
+    size_t wanted = sizeof(window) - windowEnd;
+    size_t got = fread(window + windowEnd, 1, wanted, file);
+    windowEnd += got;
+    endOfFile = got < wanted;
+    return got > 0;
+}
+
+/**
+ * Find the next sentence, frame or run of other bytes at the start of the window
+ *
+ * @param timed Receives whether the unit carries a time
+ * @param time Receives the time of day of an NMEA sentence or the time of week of a UBX frame, in milliseconds
+ * @param ubxTime Receives whether the time is a UBX time of week
+ * @return Length of the unit, 0 at the end of the capture
+ */
+size_t GpsReplaySource::findUnit(bool *timed, uint32_t *time, bool *ubxTime)
+{
+    *timed = false;
+    *ubxTime = false;
+
+    if (windowEnd - windowStart < sizeof(window) / 2)
+    {
+        fill();
+    }
+    size_t available = windowEnd - windowStart;
+    const uint8_t *unit = window + windowStart;
+    if (available == 0)
+    {
+        return 0;
+    }
+
+    if (unit[0] == '$')
+    {
+        size_t searched = available < GPS_REPLAY_MAX_SENTENCE ? available : GPS_REPLAY_MAX_SENTENCE;
+        const uint8_t *end = (const uint8_t *)memchr(unit, '\n', searched);
+        if (end == nullptr)
+        {
+            return searched;
+        }
+
+        size_t length = end - unit + 1;
+        bool hasTime = length > 7 && unit[6] == ',' &&
+                       (memcmp(unit + 3, "GGA", 3) == 0 || memcmp(unit + 3, "RMC", 3) == 0);
+        *timed = hasTime && parseNmeaTime(unit + 7, length - 7, time);
+        return length;
+    }
+
+    if (unit[0] == UBX_SYNC_CHAR_1 && available >= 6 && unit[1] == UBX_SYNC_CHAR_2)
+    {
+        size_t frameLength = (unit[4] | (unit[5] << 8)) + 8;
+        if (frameLength > available && frameLength <= sizeof(window))
+        {
+            fill();
+            unit = window;
+            available = windowEnd;
+        }
+        if (frameLength <= available)
+        {
+            if (unit[2] == UBX_CLASS_NAV && frameLength >= 12)
+            {
+                *timed = true;
+                *ubxTime = true;
+                *time = (uint32_t)unit[6] | ((uint32_t)unit[7] << 8) | ((uint32_t)unit[8] << 16) | ((uint32_t)unit[9] << 24);
+            }
+            return frameLength;
+        }
+    }
+
+    // Anything else goes out up to the next possible sentence or frame
+    size_t length = 1;
+    while (length < available && unit[length] != '$' && unit[length] != UBX_SYNC_CHAR_1)
+    {
+        length++;
+    }
+    return length;
+}
+
+/**
+ * Check whether a timed unit of the capture is due, and advance the pacing if so
+ *
+ * @param time Time carried by the unit in milliseconds
+ * @param ubxTime Whether the time is a UBX time of week
+ * @param now Current time in milliseconds (millis())
+ * @return true if the unit is due, false otherwise
+ */
+bool GpsReplaySource::isDue(uint32_t time, bool ubxTime, uint32_t now)
+{
+    if (speed <= 0)
+    {
+        return true;
+    }
+
+    if (!paced || ubxTime != lastUbxTime || time < lastTime || time - lastTime > GPS_REPLAY_MAX_GAP)
+    {
+        // First unit, or a discontinuity in the capture: carry on right after the last due unit
+        baseTime = time;
+        baseNow = paced ? lastDue : now;
+        paced = true;
+    }
+
+    uint32_t due = baseNow + (uint32_t)((time - baseTime) / speed);
+    if ((int32_t)(now - due) < 0)
+    {
+        return false;
+    }
+
+    lastUbxTime = ubxTime;
+    lastTime = time;
+    lastDue = due;
+    return true;
+}
@@ -0,0 +1,103 @@
+#ifndef GPS_REPLAY_SOURCE_H
+#define GPS_REPLAY_SOURCE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+// Longest replay file path, including the null terminator
+#define GPS_REPLAY_PATH_SIZE 48
+
+// Bytes of the capture kept in RAM, at least one UBX frame
+#define GPS_REPLAY_WINDOW_SIZE 512
+
+// Longest NMEA sentence looked for, longer lines are replayed as plain bytes
+#define GPS_REPLAY_MAX_SENTENCE 128
+
+// Gaps in the capture longer than this many milliseconds are skipped
+#define GPS_REPLAY_MAX_GAP 10000
+
+/**
+ * GPS byte source replaying a recorded NMEA or UBX capture
+ * The capture is released one sentence or frame at a time, paced by the time it carries: the
+ * UTC time of GGA and RMC sentences, and the time of week of UBX NAV messages. Bytes between
+ * timed sentences go out with the sentence before them. Gaps, midnight and the switch from
+ * NMEA to UBX in a capture taken across the receiver's configuration replay without a pause.
+ * At the end of the file the capture starts over.
+ * The file is read through stdio, so the same code replays from LittleFS and on the host.
+ */
+class GpsReplaySource
+{
+public:
+    /**
+     * Create a replay source
+     *
+     * @param path Path of the capture, e.g. "/littlefs/replay.nmea" (copied)
+     * @param speed Replay speed, 1 for real time, N for N times faster, 0 for as fast as possible
+     */
+    GpsReplaySource(const char *path, float speed);
+
+    ~GpsReplaySource();
+
+    GpsReplaySource(const GpsReplaySource &) = delete;
+    GpsReplaySource &operator=(const GpsReplaySource &) = delete;
+
+    /**
+     * Open the capture
+     *
+     * @return true if the capture could be opened and is not empty, false otherwise
+     */
+    bool begin();
+
+    /**
+     * Get the bytes of the capture that are due
+     *
+     * @param buffer Buffer to store the bytes
+     * @param capacity Capacity of the buffer in bytes
+     * @param now Current time in milliseconds (millis())
+     * @return Number of bytes stored
+     */
+    size_t read(uint8_t *buffer, size_t capacity, uint32_t now);
+
+    /**
+     * Get the number of times the capture was replayed to the end
+     *
+     * @return Number of completed passes
+     */
+    uint32_t getPassCount() const { return passes; }
+
+    /**
+     * Get the number of bytes replayed
+     *
+     * @return Number of bytes
+     */
+    uint32_t getByteCount() const { return bytes; }
+
+private:
+    bool fill();
+    size_t findUnit(bool *timed, uint32_t *time, bool *ubxTime);
+    bool isDue(uint32_t time, bool ubxTime, uint32_t now);
+
+    char path[GPS_REPLAY_PATH_SIZE];
+    float speed;
+    FILE *file;
+    bool endOfFile;
+
+    uint8_t window[GPS_REPLAY_WINDOW_SIZE];
+    size_t windowStart;
+    size_t windowEnd;
+    size_t released; // Bytes at windowStart that are due
+
+    // Pacing: a capture time of baseTime is due at baseNow
+    bool paced;
+    bool lastUbxTime;
+    uint32_t lastTime;
+    uint32_t baseTime;
+    uint32_t baseNow;
+    uint32_t lastDue;
+
+    uint32_t passes;
+    uint32_t bytes;
+};
+
+#endif // GPS_REPLAY_SOURCE_H
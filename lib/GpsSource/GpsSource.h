@@ -0,0 +1,18 @@
+#ifndef GPS_SOURCE_H
+#define GPS_SOURCE_H
+
+// Sources of the bytes fed to the GPS decoder, for GPS_SOURCE in app_config.h
+#define GPS_SOURCE_UART 0      // The receiver on gpsSerial
+#define GPS_SOURCE_REPLAY 1    // A recorded NMEA or UBX capture, see GpsReplaySource
+#define GPS_SOURCE_SYNTHETIC 2 // A generated route, see GpsSyntheticSource
+
+// Every source offers the same call as a UART read, so the decoder cannot tell them apart:
+//
+//   size_t read(uint8_t *buffer, size_t capacity, uint32_t now);
+//
+// It returns the bytes the receiver would have sent by now (millis()), at most capacity.
+
+#include "GpsReplaySource.h"
+#include "GpsSyntheticSource.h"
+
+#endif // GPS_SOURCE_H
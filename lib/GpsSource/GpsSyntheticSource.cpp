@@ -0,0 +1,278 @@
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <EpochClock.h>
+#include <UbxGps.h>
+
+#include "GpsSyntheticSource.h"
+
+#define EARTH_RADIUS_METERS 6371008.8
+#define DEGREES_TO_RADIANS (M_PI / 180.0)
+#define KMPH_TO_KNOTS 0.539957f
+#define GPS_EPOCH_MILLIS 315964800000ULL // 1980-01-06T00:00:00Z
+#define GPS_LEAP_MILLIS 18000ULL         // GPS time ahead of UTC
+#define MILLIS_PER_WEEK 604800000ULL
+
+static const float legSpeeds[] = {0.0f, 15.0f, 30.0f, 50.0f, 80.0f};
+
+static void putU16(uint8_t *p, uint16_t value)
+{
+    p[0] = value;
+    p[1] = value >> 8;
+}
+
+static void putU32(uint8_t *p, uint32_t value)
+{
+    putU16(p, value);
+    putU16(p + 2, value >> 16);
+}
+
+/**
+ * Format a coordinate as NMEA degrees and minutes with its hemisphere, e.g. "0612.52580,S"
+ *
+ * @param output Buffer to store the text
+ * @param capacity Capacity of the output buffer
+ * @param degrees Coordinate in degrees
+ * @param degreeDigits Digits of the whole degrees, 2 for latitude and 3 for longitude
+ * @param positive Hemisphere of positive coordinates
+ * @param negative Hemisphere of negative coordinates
+ * @return Length of the text
+ */
+static int formatCoordinate(char *output, size_t capacity, double degrees, int degreeDigits, char positive, char negative)
+{
+    unsigned long minutes = lround(fabs(degrees) * 60.0 * 100000.0); // 1e-5 minutes
+    return snprintf(output, capacity, "%0*lu%02lu.%05lu,%c", degreeDigits, minutes / 6000000,
+                    minutes / 100000 % 60, minutes % 100000, degrees < 0 ? negative : positive);
+}
+
+/**
+ * Wrap a sentence body in "$" and its checksum
+ *
+ * @param output Buffer to store the sentence
+ * @param capacity Capacity of the output buffer
+ * @param body Sentence between "$" and "*"
+ * @return Length of the sentence, or 0 if it does not fit in the buffer
+ */
+static size_t writeSentence(uint8_t *output, size_t capacity, const char *body)
+{
+    uint8_t checksum = 0;
+    for (const char *c = body; *c != '\0'; c++)
+    {
+        checksum ^= *c;
+    }
+    int length = snprintf((char *)output, capacity, "$%s*%02X\r\n", body, checksum);
+    return length > 0 && (size_t)length < capacity ? length : 0;
+}
+
+/**
+ * Create a synthetic source
+ *
+ * @param format Output format
+ * @param rate Epochs per second, 1 to 10
+ * @param speed Pacing, 1 for real time, N for N times faster, 0 for as fast as possible
+ * @param seed Seed of the route
+ */
+GpsSyntheticSource::GpsSyntheticSource(GpsSyntheticFormat format, uint8_t rate, float speed, uint32_t seed)
+    : format(format), rate(rate < 1 ? 1 : (rate > 10 ? 10 : rate)), speed(speed), state(seed),
+      time(GPS_SYNTHETIC_START_TIME), lat(GPS_SYNTHETIC_START_LAT), lng(GPS_SYNTHETIC_START_LNG), course(0),
+      groundSpeed(0), targetSpeed(0), turnRate(0), legEpochs(0), satellites(8), hdop(100), altitude(12000),
+      started(false), startedAt(0), epochs(0), outputStart(0), outputEnd(0)
+{
+}
+
+/**
+ * Get the bytes of the route that are due
+ *
+ * @param buffer Buffer to store the bytes
+ * @param capacity Capacity of the buffer in bytes
+ * @param now Current time in milliseconds (millis())
+ * @return Number of bytes stored
+ */
+size_t GpsSyntheticSource::read(uint8_t *buffer, size_t capacity, uint32_t now)
+{
+    if (!started)
+    {
+        started = true;
+        startedAt = now;
+    }
+
+    size_t length = 0;
+    while (length < capacity)
+    {
+        if (outputStart == outputEnd)
+        {
+            uint32_t routeMillis = (uint64_t)epochs * 1000 / rate;
+            if (speed > 0 && (int32_t)(now - startedAt - (uint32_t)(routeMillis / speed)) < 0)
+            {
+                break;
+            }
+
+            outputStart = 0;
+            outputEnd = format == GPS_SYNTHETIC_UBX ? writeUbx(output, sizeof(output)) : writeNmea(output, sizeof(output));
+            advance();
+            epochs++;
+        }
+
+        size_t chunk = outputEnd - outputStart < capacity - length ? outputEnd - outputStart : capacity - length;
+        memcpy(buffer + length, output + outputStart, chunk);
+        outputStart += chunk;
+        length += chunk;
+    }
+    return length;
+}
+
+/**
+ * Draw the next number of the route's generator
+ *
+ * @return Pseudo-random number of 24 bits
+ */
+uint32_t GpsSyntheticSource::nextRandom()
+{
+    state = state * 1664525UL + 1013904223UL;
+    return state >> 8;
+}
+
+/**
+ * Move the vehicle to the next epoch
+ */
+void GpsSyntheticSource::advance()
+{
+    float dt = 1.0f / rate;
+
+    if (legEpochs == 0)
+    {
+        targetSpeed = legSpeeds[nextRandom() % (sizeof(legSpeeds) / sizeof(legSpeeds[0]))];
+        uint32_t turn = nextRandom();
+        turnRate = turn % 2 == 0 ? 0.0f : (float)((int32_t)(turn % 31) - 15);
+        legEpochs = rate * (5 + nextRandom() % 26);
+        satellites = 5 + nextRandom() % 8;
+    }
+    legEpochs--;
+
+    // Accelerate or brake towards the target at 2 m/s²
+    float step = 7.2f * dt;
+    if (groundSpeed < targetSpeed)
+    {
+        groundSpeed = groundSpeed + step < targetSpeed ? groundSpeed + step : targetSpeed;
+    }
+    else
+    {
+        groundSpeed = groundSpeed - step > targetSpeed ? groundSpeed - step : targetSpeed;
+    }
+    if (groundSpeed > 1.0f)
+    {
+        course = fmodf(course + turnRate * dt + 360.0f, 360.0f);
+    }
+
+    double distance = groundSpeed / 3.6 * dt;
+    lat += distance * cos(course * DEGREES_TO_RADIANS) / EARTH_RADIUS_METERS / DEGREES_TO_RADIANS;
+    lng += distance * sin(course * DEGREES_TO_RADIANS) / (EARTH_RADIUS_METERS * cos(lat * DEGREES_TO_RADIANS)) / DEGREES_TO_RADIANS;
+    if (lng > 180.0)
+    {
+        lng -= 360.0;
+    }
+    else if (lng < -180.0)
+    {
+        lng += 360.0;
+    }
+
+    hdop = 80 + nextRandom() % 60;
+    altitude += (int32_t)(nextRandom() % 201) - 100;
+    if (altitude < 0)
+    {
+        altitude = -altitude;
+    }
+    time = GPS_SYNTHETIC_START_TIME + (uint64_t)(epochs + 1) * 1000 / rate;
+}
+
+/**
+ * Write the GGA and RMC sentences of the current epoch
+ *
+ * @param output Buffer to store the sentences
+ * @param capacity Capacity of the output buffer in bytes
+ * @return Length of the sentences
+ */
+size_t GpsSyntheticSource::writeNmea(uint8_t *output, size_t capacity)
+{
+    // "YYYY-MM-DDTHH:MM:SS.mmmZ"
+    char iso[EPOCH_ISO_TIME_SIZE];
+    formatIsoTime(time, iso, sizeof(iso));
+    char utc[16];
+    snprintf(utc, sizeof(utc), "%.2s%.2s%.2s.%.2s", iso + 11, iso + 14, iso + 17, iso + 20);
+    char date[8];
+    snprintf(date, sizeof(date), "%.2s%.2s%.2s", iso + 8, iso + 5, iso + 2);
+
+    char latText[24];
+    char lngText[24];
+    formatCoordinate(latText, sizeof(latText), lat, 2, 'N', 'S');
+    formatCoordinate(lngText, sizeof(lngText), lng, 3, 'E', 'W');
+
+    bool hasFix = satellites >= 4;
+    char body[GPS_SYNTHETIC_EPOCH_SIZE / 2];
+    snprintf(body, sizeof(body), "GPGGA,%s,%s,%s,%d,%02u,%u.%02u,%ld.%01ld,M,0.0,M,,", utc, latText, lngText,
+             hasFix ? 1 : 0, satellites, hdop / 100, hdop % 100, (long)(altitude / 1000), (long)(altitude / 100 % 10));
+    size_t length = writeSentence(output, capacity, body);
+
+    unsigned long knots = lroundf(groundSpeed * KMPH_TO_KNOTS * 1000.0f);
+    unsigned long heading = lroundf(course * 100.0f) % 36000;
+    snprintf(body, sizeof(body), "GPRMC,%s,%c,%s,%s,%lu.%03lu,%lu.%02lu,%s,,,A", utc, hasFix ? 'A' : 'V', latText,
+             lngText, knots / 1000, knots % 1000, heading / 100, heading % 100, date);
+    return length + writeSentence(output + length, capacity - length, body);
+}
+
+/**
+ * Write the UBX NAV frames of the current epoch
+ *
+ * @param output Buffer to store the frames
+ * @param capacity Capacity of the output buffer in bytes
+ * @return Length of the frames
+ */
+size_t GpsSyntheticSource::writeUbx(uint8_t *output, size_t capacity)
+{
+    uint32_t iTOW = (time + GPS_LEAP_MILLIS - GPS_EPOCH_MILLIS) % MILLIS_PER_WEEK;
+    bool hasFix = satellites >= 4;
+    uint8_t payload[52];
+    size_t length = 0;
+
+    memset(payload, 0, sizeof(payload));
+    putU32(payload, iTOW);
+    putU32(payload + 4, (uint32_t)(int32_t)lround(lng * 1e7));
+    putU32(payload + 8, (uint32_t)(int32_t)lround(lat * 1e7));
+    putU32(payload + 12, altitude + 28000); // Geoid separation of about 28 m
+    putU32(payload + 16, altitude);
+    length += buildUbxFrame(UBX_CLASS_NAV, UBX_NAV_POSLLH, payload, 28, output + length, capacity - length);
+
+    memset(payload, 0, sizeof(payload));
+    putU32(payload, iTOW);
+    payload[10] = hasFix ? 3 : 0;
+    payload[11] = hasFix ? 0x0D : 0x0C;
+    payload[47] = satellites;
+    length += buildUbxFrame(UBX_CLASS_NAV, UBX_NAV_SOL, payload, 52, output + length, capacity - length);
+
+    memset(payload, 0, sizeof(payload));
+    putU32(payload, iTOW);
+    putU16(payload + 12, hdop);
+    length += buildUbxFrame(UBX_CLASS_NAV, UBX_NAV_DOP, payload, 18, output + length, capacity - length);
+
+    memset(payload, 0, sizeof(payload));
+    putU32(payload, iTOW);
+    putU32(payload + 20, lroundf(groundSpeed / 3.6f * 100.0f));
+    putU32(payload + 24, lroundf(course * 100000.0f));
+    length += buildUbxFrame(UBX_CLASS_NAV, UBX_NAV_VELNED, payload, 36, output + length, capacity - length);
+
+    char iso[EPOCH_ISO_TIME_SIZE];
+    formatIsoTime(time, iso, sizeof(iso));
+    memset(payload, 0, sizeof(payload));
+    putU32(payload, iTOW);
+    putU32(payload + 8, (time % 1000) * 1000000);
+    putU16(payload + 12, atoi(iso));
+    payload[14] = atoi(iso + 5);
+    payload[15] = atoi(iso + 8);
+    payload[16] = atoi(iso + 11);
+    payload[17] = atoi(iso + 14);
+    payload[18] = atoi(iso + 17);
+    payload[19] = 0x07; // validTOW, validWKN, validUTC
+    length += buildUbxFrame(UBX_CLASS_NAV, UBX_NAV_TIMEUTC, payload, 20, output + length, capacity - length);
+    return length;
+}
@@ -0,0 +1,94 @@
+#ifndef GPS_SYNTHETIC_SOURCE_H
+#define GPS_SYNTHETIC_SOURCE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Largest output of one epoch, in bytes
+#define GPS_SYNTHETIC_EPOCH_SIZE 256
+
+// Start of every synthetic route
+#define GPS_SYNTHETIC_START_TIME 1735689600000ULL // 2025-01-01T00:00:00Z
+#define GPS_SYNTHETIC_START_LAT -6.2087634
+#define GPS_SYNTHETIC_START_LNG 106.845599
+
+/**
+ * Output format of a synthetic source
+ */
+enum GpsSyntheticFormat : uint8_t
+{
+    GPS_SYNTHETIC_NMEA = 0, // GGA and RMC sentences, for TinyGPSPlus
+    GPS_SYNTHETIC_UBX = 1   // NAV-POSLLH, NAV-SOL, NAV-DOP, NAV-VELNED and NAV-TIMEUTC frames, for UbxGps
+};
+
+/**
+ * GPS byte source generating a deterministic route
+ * The vehicle drives legs of 5 to 30 seconds, each with its own target speed between
+ * standing still and 80 km/h and its own turn rate, all drawn from a seeded generator: the
+ * same seed and rate always give the same fixes. Epochs are emitted at the given rate, paced
+ * by millis() or as fast as they are read.
+ */
+class GpsSyntheticSource
+{
+public:
+    /**
+     * Create a synthetic source
+     *
+     * @param format Output format
+     * @param rate Epochs per second, 1 to 10
+     * @param speed Pacing, 1 for real time, N for N times faster, 0 for as fast as possible
+     * @param seed Seed of the route
+     */
+    GpsSyntheticSource(GpsSyntheticFormat format, uint8_t rate, float speed, uint32_t seed);
+
+    /**
+     * Get the bytes of the route that are due
+     *
+     * @param buffer Buffer to store the bytes
+     * @param capacity Capacity of the buffer in bytes
+     * @param now Current time in milliseconds (millis())
+     * @return Number of bytes stored
+     */
+    size_t read(uint8_t *buffer, size_t capacity, uint32_t now);
+
+    /**
+     * Get the number of epochs generated
+     *
+     * @return Number of epochs
+     */
+    uint32_t getEpochCount() const { return epochs; }
+
+private:
+    uint32_t nextRandom();
+    void advance();
+    size_t writeNmea(uint8_t *output, size_t capacity);
+    size_t writeUbx(uint8_t *output, size_t capacity);
+
+    GpsSyntheticFormat format;
+    uint8_t rate;
+    float speed;
+    uint32_t state;
+
+    // Route
+    uint64_t time;       // UTC time of the epoch in milliseconds since the Unix epoch
+    double lat;          // Degrees
+    double lng;          // Degrees
+    float course;        // Degrees
+    float groundSpeed;   // km/h
+    float targetSpeed;   // km/h
+    float turnRate;      // Degrees per second
+    uint32_t legEpochs;  // Epochs left in the current leg
+    uint8_t satellites;
+    uint16_t hdop;       // 0.01
+    int32_t altitude;    // Millimeters
+
+    // Pacing and output
+    bool started;
+    uint32_t startedAt;
+    uint32_t epochs;
+    uint8_t output[GPS_SYNTHETIC_EPOCH_SIZE];
+    size_t outputStart;
+    size_t outputEnd;
+};
+
+#endif // GPS_SYNTHETIC_SOURCE_H
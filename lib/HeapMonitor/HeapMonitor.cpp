@@ -0,0 +1,138 @@
+#if defined(ARDUINO_ARCH_ESP32)
+#include <Arduino.h>
+#endif
+
+#include <stdlib.h>
+#include <atomic>
+
+#include "HeapMonitor.h"
+
+// Calls to malloc, calloc and realloc since boot, counted by the hooks below
+static std::atomic<uint32_t> allocationCount(0);
+
+#if defined(HEAP_MONITOR_COUNT_ALLOCATIONS) && defined(ARDUINO_ARCH_ESP32)
+extern "C"
+{
+    void *__real_malloc(size_t size);
+    void *__real_calloc(size_t n, size_t size);
+    void *__real_realloc(void *ptr, size_t size);
+
+    void *__wrap_malloc(size_t size)
+    {
+        allocationCount.fetch_add(1, std::memory_order_relaxed);
+        return __real_malloc(size);
+    }
+
+    void *__wrap_calloc(size_t n, size_t size)
+    {
+        allocationCount.fetch_add(1, std::memory_order_relaxed);
+        return __real_calloc(n, size);
+    }
+
+    void *__wrap_realloc(void *ptr, size_t size)
+    {
+        allocationCount.fetch_add(1, std::memory_order_relaxed);
+        return __real_realloc(ptr, size);
+    }
+}
+#elif defined(HEAP_MONITOR_COUNT_ALLOCATIONS) && defined(__GLIBC__)
+extern "C"
+{
+    void *__libc_malloc(size_t size);
+    void *__libc_calloc(size_t n, size_t size);
+    void *__libc_realloc(void *ptr, size_t size);
+
+    void *malloc(size_t size)
+    {
+        allocationCount.fetch_add(1, std::memory_order_relaxed);
+        return __libc_malloc(size);
+    }
+
+    void *calloc(size_t n, size_t size)
+    {
+        allocationCount.fetch_add(1, std::memory_order_relaxed);
+        return __libc_calloc(n, size);
+    }
+
+    void *realloc(void *ptr, size_t size)
+    {
+        allocationCount.fetch_add(1, std::memory_order_relaxed);
+        return __libc_realloc(ptr, size);
+    }
+}
+#endif
+
+/**
+ * Create a heap monitor
+ *
+ * @param interval Time between samples in milliseconds
+ */
+HeapMonitor::HeapMonitor(uint32_t interval)
+    : interval(interval), lastPollTime(0), sampleCount(0), first(), last(), lowestLargestFreeBlock(0)
+{
+}
+
+/**
+ * Take a sample if the interval has passed since the last one
+ *
+ * @param now Current time in milliseconds
+ * @return true if a sample was taken, false otherwise
+ */
+bool HeapMonitor::poll(uint32_t now)
+{
+    if (!history.empty() && now - lastPollTime < interval)
+    {
+        return false;
+    }
+    lastPollTime = now;
+    history.push(sample(now));
+    return true;
+}
+
+/**
+ * Take a sample now, whatever the interval
+ *
+ * @param now Current time in milliseconds
+ * @return The sample
+ */
+const HeapSample &HeapMonitor::sample(uint32_t now)
+{
+    last = read(now);
+    if (sampleCount == 0)
+    {
+        first = last;
+    }
+    if (sampleCount == 0 || last.largestFreeBlock < lowestLargestFreeBlock)
+    {
+        lowestLargestFreeBlock = last.largestFreeBlock;
+    }
+    sampleCount++;
+    return last;
+}
+
+/**
+ * Read the state of the heap
+ *
+ * @param now Current time in milliseconds
+ * @return The state, all sizes zero on platforms without heap statistics
+ */
+HeapSample HeapMonitor::read(uint32_t now)
+{
+    HeapSample sample = {now, 0, 0, 0};
+#if defined(ARDUINO_ARCH_ESP32)
+    sample.freeHeap = ESP.getFreeHeap();
+    sample.largestFreeBlock = ESP.getMaxAllocHeap();
+    sample.minFreeHeap = ESP.getMinFreeHeap();
+#endif
+    return sample;
+}
+
+/**
+ * Get the number of heap allocations of the whole program
+ *
+ * @return Calls to malloc, calloc and realloc since boot, 0 without HEAP_MONITOR_COUNT_ALLOCATIONS
+ */
+uint32_t HeapMonitor::getAllocationCount()
+{
+    return allocationCount.load(std::memory_order_relaxed);
+}
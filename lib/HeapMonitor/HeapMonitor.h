@@ -0,0 +1,113 @@
+#ifndef HEAP_MONITOR_H
+#define HEAP_MONITOR_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <RingBuffer.h>
+
+#ifndef HEAP_MONITOR_HISTORY
+#define HEAP_MONITOR_HISTORY 24 // Samples kept for the trend
+#endif
+
+/**
+ * State of the heap at one point in time
+ */
+struct HeapSample
+{
+    uint32_t time;             // millis() when the sample was taken
+    uint32_t freeHeap;         // Free heap in bytes
+    uint32_t largestFreeBlock; // Largest block that can be allocated in bytes
+    uint32_t minFreeHeap;      // Lowest free heap since boot in bytes
+};
+
+/**
+ * Periodic record of the heap, to see fragmentation build up on units that run for weeks
+ * A TLS handshake needs large contiguous blocks, so the largest free block is what runs out
+ * first, long before the free heap does. Samples are kept in a short history and the lowest
+ * largest free block is remembered over the whole run.
+ *
+ * Built with HEAP_MONITOR_COUNT_ALLOCATIONS, every malloc, calloc and realloc call of the
+ * program is counted, including the ones behind new, String and ArduinoJson. On the ESP32 this
+ * needs -Wl,--wrap=malloc -Wl,--wrap=calloc -Wl,--wrap=realloc, on glibc hosts the allocator
+ * is interposed.
+ */
+class HeapMonitor
+{
+public:
+    /**
+     * Create a heap monitor
+     *
+     * @param interval Time between samples in milliseconds
+     */
+    explicit HeapMonitor(uint32_t interval);
+
+    /**
+     * Take a sample if the interval has passed since the last one
+     *
+     * @param now Current time in milliseconds
+     * @return true if a sample was taken, false otherwise
+     */
+    bool poll(uint32_t now);
+
+    /**
+     * Take a sample now, whatever the interval
+     *
+     * @param now Current time in milliseconds
+     * @return The sample
+     */
+    const HeapSample &sample(uint32_t now);
+
+    /**
+     * Get the most recent sample
+     *
+     * @return Most recent sample, all zero before the first one
+     */
+    const HeapSample &getLast() const { return last; }
+
+    /**
+     * Get the first sample since boot, to compare the current state with
+     *
+     * @return First sample, all zero before the first one
+     */
+    const HeapSample &getFirst() const { return first; }
+
+    /**
+     * Get the lowest largest free block seen in any sample
+     *
+     * @return Size in bytes, 0 before the first sample
+     */
+    uint32_t getLowestLargestFreeBlock() const { return lowestLargestFreeBlock; }
+
+    /**
+     * Get the periodic samples, oldest first
+     *
+     * @return Last HEAP_MONITOR_HISTORY samples taken by poll()
+     */
+    const RingBuffer<HeapSample, HEAP_MONITOR_HISTORY> &getHistory() const { return history; }
+
+    /**
+     * Read the state of the heap
+     *
+     * @param now Current time in milliseconds
+     * @return The state, all sizes zero on platforms without heap statistics
+     */
+    static HeapSample read(uint32_t now);
+
+    /**
+     * Get the number of heap allocations of the whole program
+     *
+     * @return Calls to malloc, calloc and realloc since boot, 0 without HEAP_MONITOR_COUNT_ALLOCATIONS
+     */
+    static uint32_t getAllocationCount();
+
+private:
+    uint32_t interval;
+    uint32_t lastPollTime;
+    uint32_t sampleCount;
+    HeapSample first;
+    HeapSample last;
+    uint32_t lowestLargestFreeBlock;
+    RingBuffer<HeapSample, HEAP_MONITOR_HISTORY> history;
+};
+
+#endif // HEAP_MONITOR_H
@@ -0,0 +1,151 @@
+#include <string.h>
+
+#include "JsonArena.h"
+
+// Alignment of every block, enough for the pointers, 64-bit integers and doubles of a document
+#define JSON_ARENA_ALIGNMENT 8
+
+/**
+ * Header in front of every block
+ */
+struct JsonArenaBlock
+{
+    size_t size;     // Requested size of the block in bytes
+    size_t previous; // Offset of the header of the block allocated before this one, or SIZE_MAX
+};
+
+// Size of the header, rounded so the block after it stays aligned
+#define JSON_ARENA_HEADER_SIZE \
+    ((sizeof(JsonArenaBlock) + JSON_ARENA_ALIGNMENT - 1) / JSON_ARENA_ALIGNMENT * JSON_ARENA_ALIGNMENT)
+
+/**
+ * Round a size up to the block alignment
+ *
+ * @param size Size in bytes
+ * @return Aligned size in bytes, or SIZE_MAX if it overflows
+ */
+static size_t alignSize(size_t size)
+{
+    if (size > SIZE_MAX - JSON_ARENA_ALIGNMENT)
+    {
+        return SIZE_MAX;
+    }
+    return (size + JSON_ARENA_ALIGNMENT - 1) / JSON_ARENA_ALIGNMENT * JSON_ARENA_ALIGNMENT;
+}
+
+/**
+ * Create an arena
+ *
+ * @param buffer Memory the blocks are carved from, must outlive the arena
+ * @param capacity Size of the buffer in bytes
+ */
+JsonArena::JsonArena(uint8_t *buffer, size_t capacity)
+    : buffer(buffer), capacity(capacity), used(0), last(SIZE_MAX), highWaterMark(0), failures(0)
+{
+    // Skip the bytes in front of the first aligned address
+    size_t padding = (JSON_ARENA_ALIGNMENT - (uintptr_t)buffer % JSON_ARENA_ALIGNMENT) % JSON_ARENA_ALIGNMENT;
+    padding = padding < capacity ? padding : capacity;
+    this->buffer += padding;
+    this->capacity -= padding;
+}
+
+/**
+ * Allocate a block
+ *
+ * @param size Size of the block in bytes
+ * @return Pointer to the block, or nullptr if the arena is full
+ */
+void *JsonArena::allocate(size_t size)
+{
+    size_t aligned = alignSize(size);
+    if (aligned > capacity - used || JSON_ARENA_HEADER_SIZE > capacity - used - aligned)
+    {
+        failures++;
+        return nullptr;
+    }
+
+    JsonArenaBlock *block = (JsonArenaBlock *)(buffer + used);
+    block->size = size;
+    block->previous = last;
+    last = used;
+    used += JSON_ARENA_HEADER_SIZE + aligned;
+    if (used > highWaterMark)
+    {
+        highWaterMark = used;
+    }
+    return buffer + last + JSON_ARENA_HEADER_SIZE;
+}
+
+/**
+ * Free a block, only reclaimed right away if it is the most recent one
+ *
+ * @param ptr Block to free, may be nullptr
+ */
+void JsonArena::deallocate(void *ptr)
+{
+    if (ptr == nullptr)
+    {
+        return;
+    }
+
+    size_t offset = (uint8_t *)ptr - buffer - JSON_ARENA_HEADER_SIZE;
+    if (offset == last)
+    {
+        used = last;
+        last = ((JsonArenaBlock *)(buffer + offset))->previous;
+    }
+}
+
+/**
+ * Resize a block, in place if it is the most recent one
+ *
+ * @param ptr Block to resize, or nullptr to allocate a new one
+ * @param newSize New size of the block in bytes
+ * @return Pointer to the resized block, or nullptr if the arena is full (the block is left as it was)
+ */
+void *JsonArena::reallocate(void *ptr, size_t newSize)
+{
+    if (ptr == nullptr)
+    {
+        return allocate(newSize);
+    }
+
+    size_t offset = (uint8_t *)ptr - buffer - JSON_ARENA_HEADER_SIZE;
+    JsonArenaBlock *block = (JsonArenaBlock *)(buffer + offset);
+    if (offset == last)
+    {
+        // The most recent block grows or shrinks where it is
+        size_t aligned = alignSize(newSize);
+        if (aligned > capacity - offset - JSON_ARENA_HEADER_SIZE)
+        {
+            failures++;
+            return nullptr;
+        }
+        block->size = newSize;
+        used = offset + JSON_ARENA_HEADER_SIZE + aligned;
+        if (used > highWaterMark)
+        {
+            highWaterMark = used;
+        }
+        return ptr;
+    }
+
+    // Any other block is copied, its old space is only reclaimed by reset()
+    size_t oldSize = block->size;
+    void *moved = allocate(newSize);
+    if (moved != nullptr)
+    {
+        memcpy(moved, ptr, oldSize < newSize ? oldSize : newSize);
+    }
+    return moved;
+}
+
+/**
+ * Free every block at once
+ * Only call this when no document uses the arena any more.
+ */
+void JsonArena::reset()
+{
+    used = 0;
+    last = SIZE_MAX;
+}
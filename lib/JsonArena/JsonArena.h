@@ -0,0 +1,103 @@
+#ifndef JSON_ARENA_H
+#define JSON_ARENA_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <ArduinoJson.h>
+
+/**
+ * Bump allocator for ArduinoJson documents, in a caller-provided buffer
+ * Allocations are carved off the buffer one after the other and never touch the heap, so
+ * parsing or building a document every message cannot fragment it. Freeing or resizing the
+ * most recent block is done in place, any other free is deferred until reset(). When the
+ * buffer is full, allocations fail and the document reports overflowed().
+ *
+ *   static uint8_t arenaBuffer[2048];
+ *   JsonArena arena(arenaBuffer, sizeof(arenaBuffer));
+ *   {
+ *       JsonDocument doc(&arena);
+ *       deserializeJson(doc, input, length);
+ *   }
+ *   arena.reset(); // Once no document uses the arena any more
+ *
+ * A document that is kept and reused is emptied with doc.clear() before the arena is reset.
+ */
+class JsonArena : public ArduinoJson::Allocator
+{
+public:
+    /**
+     * Create an arena
+     *
+     * @param buffer Memory the blocks are carved from, must outlive the arena
+     * @param capacity Size of the buffer in bytes
+     */
+    JsonArena(uint8_t *buffer, size_t capacity);
+
+    /**
+     * Allocate a block
+     *
+     * @param size Size of the block in bytes
+     * @return Pointer to the block, or nullptr if the arena is full
+     */
+    void *allocate(size_t size) override;
+
+    /**
+     * Free a block, only reclaimed right away if it is the most recent one
+     *
+     * @param ptr Block to free, may be nullptr
+     */
+    void deallocate(void *ptr) override;
+
+    /**
+     * Resize a block, in place if it is the most recent one
+     *
+     * @param ptr Block to resize, or nullptr to allocate a new one
+     * @param newSize New size of the block in bytes
+     * @return Pointer to the resized block, or nullptr if the arena is full (the block is left as it was)
+     */
+    void *reallocate(void *ptr, size_t newSize) override;
+
+    /**
+     * Free every block at once
+     * Only call this when no document uses the arena any more.
+     */
+    void reset();
+
+    /**
+     * Get the number of bytes in use
+     *
+     * @return Bytes in use, including block headers and padding
+     */
+    size_t getUsed() const { return used; }
+
+    /**
+     * Get the size of the arena
+     *
+     * @return Capacity in bytes
+     */
+    size_t getCapacity() const { return capacity; }
+
+    /**
+     * Get the largest number of bytes in use since the arena was created
+     *
+     * @return High-water mark in bytes
+     */
+    size_t getHighWaterMark() const { return highWaterMark; }
+
+    /**
+     * Get the number of allocations that did not fit
+     *
+     * @return Number of failed allocations
+     */
+    uint32_t getFailureCount() const { return failures; }
+
+private:
+    uint8_t *buffer;
+    size_t capacity;
+    size_t used;
+    size_t last; // Offset of the header of the most recent block, or SIZE_MAX if there is none
+    size_t highWaterMark;
+    uint32_t failures;
+};
+
+#endif // JSON_ARENA_H
@@ -0,0 +1,214 @@
+#include <math.h>
+
+#include "MotionScheduler.h"
+
+#define EARTH_RADIUS_METERS 6371008.8f
+#define COORDINATE_TO_RADIANS ((float)M_PI / 180.0f * 1e-7f)
+
+/**
+ * Get the distance between two points, for the short distances between consecutive fixes
+ * Uses the equirectangular approximation, which is well within GPS accuracy below a few km.
+ * The differences are taken in integers, so single precision is enough for the rest.
+ *
+ * @param lat1 Latitude of the first point in 1e-7 degrees
+ * @param lng1 Longitude of the first point in 1e-7 degrees
+ * @param lat2 Latitude of the second point in 1e-7 degrees
+ * @param lng2 Longitude of the second point in 1e-7 degrees
+ * @return Distance in meters
+ */
+float getShortDistance(int32_t lat1, int32_t lng1, int32_t lat2, int32_t lng2)
+{
+    int64_t dLng = (int64_t)lng2 - lng1;
+    if (dLng > 1800000000)
+    {
+        dLng -= 3600000000LL;
+    }
+    else if (dLng < -1800000000)
+    {
+        dLng += 3600000000LL;
+    }
+
+    float x = dLng * COORDINATE_TO_RADIANS * cosf(((int64_t)lat1 + lat2) * 0.5f * COORDINATE_TO_RADIANS);
+    float y = (lat2 - lat1) * COORDINATE_TO_RADIANS;
+    return EARTH_RADIUS_METERS * sqrtf(x * x + y * y);
+}
+
+/**
+ * Get the absolute difference between two headings
+ *
+ * @param from First heading in degrees
+ * @param to Second heading in degrees
+ * @return Difference in degrees, between 0 and 180
+ */
+static float getHeadingChange(float from, float to)
+{
+    float change = fmodf(fabsf(to - from), 360.0f);
+    return change > 180.0f ? 360.0f - change : change;
+}
+
+/**
+ * Create a motion scheduler
+ *
+ * @param thresholds Thresholds of the scheduler
+ */
+MotionScheduler::MotionScheduler(const MotionThresholds &thresholds)
+    : thresholds(thresholds), hasReference(false), referenceHasLocation(false), referenceHasCourse(false),
+      referenceLat(0), referenceLng(0), referenceCourse(0), referenceBand(SPEED_BAND_STOPPED), referenceTime(0),
+      candidateReason(MOTION_SUPPRESSED), candidateHasLocation(false), candidateHasCourse(false), candidateLat(0),
+      candidateLng(0), candidateCourse(0), candidateBand(SPEED_BAND_STOPPED), candidateTime(0), sent()
+{
+}
+
+/**
+ * Decide whether to emit a fix
+ * The fix is held as a candidate, it only becomes the reference with accept().
+ *
+ * @param fix Candidate fix, with GPS_FIX_HAS_LOCATION/GPS_FIX_HAS_SPEED set if valid
+ * @param course Course over ground in degrees
+ * @param hasCourse Whether the course is valid
+ * @param now Current time in milliseconds
+ * @return Why the fix was emitted, or MOTION_SUPPRESSED
+ */
+MotionReason MotionScheduler::evaluate(const GpsFix &fix, float course, bool hasCourse, uint32_t now)
+{
+    bool hasLocation = (fix.valid & GPS_FIX_HAS_LOCATION) != 0;
+    SpeedBand band = getSpeedBand(fix);
+    hasCourse = hasCourse && (fix.valid & GPS_FIX_HAS_SPEED) && fix.speed * 0.01f >= thresholds.headingMinSpeed;
+    uint32_t elapsed = now - referenceTime;
+
+    MotionReason reason = MOTION_SUPPRESSED;
+    if (!hasReference || (hasLocation && !referenceHasLocation))
+    {
+        reason = MOTION_FIRST;
+    }
+    else if (elapsed >= thresholds.heartbeatInterval)
+    {
+        reason = MOTION_HEARTBEAT;
+    }
+    else if (band != SPEED_BAND_STOPPED || referenceBand != SPEED_BAND_STOPPED)
+    {
+        // Only the heartbeat applies while stopped, so a parked vehicle's drift is not published
+        uint32_t minInterval = band == SPEED_BAND_FAST ? thresholds.fastMinInterval : thresholds.slowMinInterval;
+        if (elapsed < minInterval)
+        {
+            // Too soon after the last fix
+        }
+        else if (band != referenceBand)
+        {
+            reason = MOTION_SPEED_BAND;
+        }
+        else if (hasLocation && getShortDistance(referenceLat, referenceLng, fix.lat, fix.lng) >= thresholds.minDistance)
+        {
+            reason = MOTION_DISTANCE;
+        }
+        else if (hasCourse && referenceHasCourse && getHeadingChange(referenceCourse, course) >= thresholds.minHeadingChange)
+        {
+            reason = MOTION_HEADING;
+        }
+    }
+
+    candidateReason = reason;
+    if (reason == MOTION_SUPPRESSED)
+    {
+        sent[MOTION_SUPPRESSED]++;
+        return reason;
+    }
+
+    candidateHasLocation = hasLocation;
+    candidateLat = fix.lat;
+    candidateLng = fix.lng;
+    candidateHasCourse = hasCourse;
+    candidateCourse = course;
+    candidateBand = band;
+    candidateTime = now;
+    return reason;
+}
+
+/**
+ * Remember the fix last passed to evaluate() as the reference, once it is published
+ * Does nothing if that fix was suppressed or already accepted.
+ */
+void MotionScheduler::accept()
+{
+    if (candidateReason == MOTION_SUPPRESSED)
+    {
+        return;
+    }
+
+    sent[candidateReason]++;
+    candidateReason = MOTION_SUPPRESSED;
+
+    hasReference = true;
+    referenceHasLocation = candidateHasLocation;
+    if (candidateHasLocation)
+    {
+        referenceLat = candidateLat;
+        referenceLng = candidateLng;
+    }
+    referenceHasCourse = candidateHasCourse;
+    referenceCourse = candidateCourse;
+    referenceBand = candidateBand;
+    referenceTime = candidateTime;
+}
+
+/**
+ * Get the number of fixes accepted for any reason
+ *
+ * @return Number of accepted fixes
+ */
+uint32_t MotionScheduler::getSentCount() const
+{
+    uint32_t total = 0;
+    for (size_t i = MOTION_FIRST; i < MOTION_REASON_COUNT; i++)
+    {
+        total += sent[i];
+    }
+    return total;
+}
+
+/**
+ * Get the name of a reason, for logging
+ *
+ * @param reason Reason of the emission
+ * @return Name of the reason
+ */
+const char *MotionScheduler::getReasonName(MotionReason reason)
+{
+    switch (reason)
+    {
+    case MOTION_SUPPRESSED:
+        return "suppressed";
+    case MOTION_FIRST:
+        return "first";
+    case MOTION_HEARTBEAT:
+        return "heartbeat";
+    case MOTION_SPEED_BAND:
+        return "speed band";
+    case MOTION_DISTANCE:
+        return "distance";
+    case MOTION_HEADING:
+        return "heading";
+    default:
+        return "unknown";
+    }
+}
+
+/**
+ * Get the speed band of a fix
+ *
+ * @param fix Fix to classify
+ * @return Speed band, SPEED_BAND_SLOW if the speed is unknown
+ */
+SpeedBand MotionScheduler::getSpeedBand(const GpsFix &fix) const
+{
+    if (!(fix.valid & GPS_FIX_HAS_SPEED))
+    {
+        return SPEED_BAND_SLOW;
+    }
+    float speed = fix.speed * 0.01f; // km/h
+    if (speed < thresholds.stoppedSpeed)
+    {
+        return SPEED_BAND_STOPPED;
+    }
+    return speed >= thresholds.fastSpeed ? SPEED_BAND_FAST : SPEED_BAND_SLOW;
+}
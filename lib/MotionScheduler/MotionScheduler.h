@@ -0,0 +1,159 @@
+#ifndef MOTION_SCHEDULER_H
+#define MOTION_SCHEDULER_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <GpsFix.h>
+
+/**
+ * Why a fix was emitted, or MOTION_SUPPRESSED if it was not
+ */
+enum MotionReason : uint8_t
+{
+    MOTION_SUPPRESSED = 0,  // Nothing changed enough
+    MOTION_FIRST = 1,       // First fix since boot
+    MOTION_HEARTBEAT = 2,   // Silent for the heartbeat interval
+    MOTION_SPEED_BAND = 3,  // Started, stopped or changed speed band
+    MOTION_DISTANCE = 4,    // Moved far enough
+    MOTION_HEADING = 5,     // Turned far enough while moving
+    MOTION_REASON_COUNT = 6
+};
+
+/**
+ * Speed band of the vehicle
+ */
+enum SpeedBand : uint8_t
+{
+    SPEED_BAND_STOPPED = 0,
+    SPEED_BAND_SLOW = 1,
+    SPEED_BAND_FAST = 2
+};
+
+/**
+ * Thresholds of the motion scheduler
+ */
+struct MotionThresholds
+{
+    float minDistance;          // Emit after moving this many meters
+    float minHeadingChange;     // Emit after turning this many degrees
+    float headingMinSpeed;      // Ignore the course below this speed in km/h, it is noise
+    float stoppedSpeed;         // Below this speed in km/h the vehicle is stopped
+    float fastSpeed;            // From this speed in km/h the vehicle is fast
+    uint32_t slowMinInterval;   // Minimum time between fixes in the slow band, in milliseconds
+    uint32_t fastMinInterval;   // Minimum time between fixes in the fast band, in milliseconds
+    uint32_t heartbeatInterval; // Emit at least this often, in milliseconds
+};
+
+/**
+ * Decides which fixes are worth publishing
+ * A fix is emitted when the vehicle has moved far enough, turned far enough or changed speed
+ * band since the last emitted fix, and at least once per heartbeat interval otherwise. While
+ * stopped only the heartbeat applies, so position drift of a parked vehicle is not published.
+ * Each band has its own minimum interval, so a fast vehicle is tracked more densely.
+ * A fix only becomes the reference once accept() is called, so a later filter may still drop
+ * it without resetting the heartbeat:
+ *
+ *   MotionReason reason = scheduler.evaluate(fix, course, hasCourse, now);
+ *   if (reason != MOTION_SUPPRESSED && publishable(fix))
+ *   {
+ *       scheduler.accept();
+ *   }
+ */
+class MotionScheduler
+{
+public:
+    /**
+     * Create a motion scheduler
+     *
+     * @param thresholds Thresholds of the scheduler
+     */
+    explicit MotionScheduler(const MotionThresholds &thresholds);
+
+    /**
+     * Decide whether to emit a fix
+     * The fix is held as a candidate, it only becomes the reference with accept().
+     *
+     * @param fix Candidate fix, with GPS_FIX_HAS_LOCATION/GPS_FIX_HAS_SPEED set if valid
+     * @param course Course over ground in degrees
+     * @param hasCourse Whether the course is valid
+     * @param now Current time in milliseconds
+     * @return Why the fix was emitted, or MOTION_SUPPRESSED
+     */
+    MotionReason evaluate(const GpsFix &fix, float course, bool hasCourse, uint32_t now);
+
+    /**
+     * Remember the fix last passed to evaluate() as the reference, once it is published
+     * Does nothing if that fix was suppressed or already accepted.
+     */
+    void accept();
+
+    /**
+     * Get the number of fixes accepted for a reason
+     *
+     * @param reason Reason of the emission
+     * @return Number of accepted fixes
+     */
+    uint32_t getSentCount(MotionReason reason) const { return reason < MOTION_REASON_COUNT ? sent[reason] : 0; }
+
+    /**
+     * Get the number of fixes accepted for any reason
+     *
+     * @return Number of accepted fixes
+     */
+    uint32_t getSentCount() const;
+
+    /**
+     * Get the number of fixes suppressed
+     *
+     * @return Number of suppressed fixes
+     */
+    uint32_t getSuppressedCount() const { return sent[MOTION_SUPPRESSED]; }
+
+    /**
+     * Get the name of a reason, for logging
+     *
+     * @param reason Reason of the emission
+     * @return Name of the reason
+     */
+    static const char *getReasonName(MotionReason reason);
+
+private:
+    SpeedBand getSpeedBand(const GpsFix &fix) const;
+
+    MotionThresholds thresholds;
+
+    bool hasReference;
+    bool referenceHasLocation;
+    bool referenceHasCourse;
+    int32_t referenceLat; // 1e-7 degrees
+    int32_t referenceLng; // 1e-7 degrees
+    float referenceCourse;
+    SpeedBand referenceBand;
+    uint32_t referenceTime;
+
+    MotionReason candidateReason; // MOTION_SUPPRESSED when there is no candidate to accept
+    bool candidateHasLocation;
+    bool candidateHasCourse;
+    int32_t candidateLat; // 1e-7 degrees
+    int32_t candidateLng; // 1e-7 degrees
+    float candidateCourse;
+    SpeedBand candidateBand;
+    uint32_t candidateTime;
+
+    uint32_t sent[MOTION_REASON_COUNT]; // Indexed by reason, MOTION_SUPPRESSED counts suppressed fixes
+};
+
+/**
+ * Get the distance between two points, for the short distances between consecutive fixes
+ * Uses the equirectangular approximation, which is well within GPS accuracy below a few km.
+ * The differences are taken in integers, so single precision is enough for the rest.
+ *
+ * @param lat1 Latitude of the first point in 1e-7 degrees
+ * @param lng1 Longitude of the first point in 1e-7 degrees
+ * @param lat2 Latitude of the second point in 1e-7 degrees
+ * @param lng2 Longitude of the second point in 1e-7 degrees
+ * @return Distance in meters
+ */
+float getShortDistance(int32_t lat1, int32_t lng1, int32_t lat2, int32_t lng2);
+
+#endif // MOTION_SCHEDULER_H
@@ -0,0 +1,175 @@
+#include <string.h>
+
+#include "PipelineStats.h"
+
+PipelineStats::PipelineStats()
+{
+    reset();
+}
+
+/**
+ * Add a pass through a stage
+ *
+ * @param stage Stage passed through
+ * @param time Time spent in microseconds
+ */
+void PipelineStats::add(PipelineStage stage, uint32_t time)
+{
+    PipelineStageStats &stats = stages[stage];
+    stats.count++;
+    stats.totalTime += time;
+    if (time > stats.maxTime)
+    {
+        stats.maxTime = time;
+    }
+    stats.buckets[getBucket(time)]++;
+}
+
+/**
+ * Get the average time of a pass through a stage
+ *
+ * @param stage Stage to get
+ * @return Average time in microseconds, 0 if the stage was never passed through
+ */
+uint32_t PipelineStats::getAverageTime(PipelineStage stage) const
+{
+    const PipelineStageStats &stats = stages[stage];
+    return stats.count == 0 ? 0 : (uint32_t)(stats.totalTime / stats.count);
+}
+
+/**
+ * Get the time under which a share of the passes through a stage finished
+ *
+ * @param stage Stage to get
+ * @param percent Share of the passes, e.g. 99
+ * @return Upper bound of the bucket the percentile falls in, in microseconds, capped at the slowest pass, 0 if the stage was never passed through
+ */
+uint32_t PipelineStats::getPercentile(PipelineStage stage, uint8_t percent) const
+{
+    const PipelineStageStats &stats = stages[stage];
+    if (stats.count == 0)
+    {
+        return 0;
+    }
+
+    // Rank of the pass the percentile falls on, rounded up so p100 is the slowest pass
+    uint64_t rank = ((uint64_t)stats.count * percent + 99) / 100;
+    uint64_t seen = 0;
+    for (uint8_t bucket = 0; bucket < PIPELINE_BUCKET_COUNT; bucket++)
+    {
+        seen += stats.buckets[bucket];
+        if (seen >= rank && seen > 0)
+        {
+            if (bucket == PIPELINE_BUCKET_COUNT - 1)
+            {
+                return stats.maxTime;
+            }
+            uint32_t bound = (uint32_t)1 << bucket;
+            return bound < stats.maxTime ? bound : stats.maxTime;
+        }
+    }
+    return stats.maxTime;
+}
+
+/**
+ * Write every stage as a compact JSON object
+ * Each stage is written as "name":[count,max,first,...] where first is the index of the first
+ * non-empty bucket and the counts from it to the last non-empty bucket follow.
+ *
+ * @param writer Writer to append to
+ */
+void PipelineStats::writeJson(TextWriter &writer) const
+{
+    writer.write('{');
+    for (uint8_t stage = 0; stage < PIPELINE_STAGE_COUNT; stage++)
+    {
+        const PipelineStageStats &stats = stages[stage];
+        const char *name = getStageName((PipelineStage)stage);
+        if (stage > 0)
+        {
+            writer.write(',');
+        }
+        writer.write('"');
+        writer.write(name, strlen(name));
+        writer.write("\":[", 3);
+        writer.writeUnsigned(stats.count);
+        writer.write(',');
+        writer.writeUnsigned(stats.maxTime);
+
+        // Only the non-empty range of buckets is sent, most stages span a handful of them
+        uint8_t first = 0;
+        while (first < PIPELINE_BUCKET_COUNT && stats.buckets[first] == 0)
+        {
+            first++;
+        }
+        uint8_t end = PIPELINE_BUCKET_COUNT;
+        while (end > first && stats.buckets[end - 1] == 0)
+        {
+            end--;
+        }
+        if (first < end)
+        {
+            writer.write(',');
+            writer.writeUnsigned(first);
+            for (uint8_t bucket = first; bucket < end; bucket++)
+            {
+                writer.write(',');
+                writer.writeUnsigned(stats.buckets[bucket]);
+            }
+        }
+        writer.write(']');
+    }
+    writer.write('}');
+}
+
+/**
+ * Forget all passes
+ */
+void PipelineStats::reset()
+{
+    memset(stages, 0, sizeof(stages));
+}
+
+/**
+ * Get the bucket a time falls in
+ *
+ * @param time Time in microseconds
+ * @return Index of the bucket
+ */
+uint8_t PipelineStats::getBucket(uint32_t time)
+{
+    if (time == 0)
+    {
+        return 0;
+    }
+    // Bit length of the time, so 1 us lands in bucket 1 and 2-3 us in bucket 2
+    uint8_t bucket = 32 - __builtin_clz(time);
+    return bucket < PIPELINE_BUCKET_COUNT ? bucket : PIPELINE_BUCKET_COUNT - 1;
+}
+
+/**
+ * Get the name of a stage for logging
+ *
+ * @param stage Stage to name
+ * @return Name of the stage, e.g. "decode"
+ */
+const char *PipelineStats::getStageName(PipelineStage stage)
+{
+    switch (stage)
+    {
+    case PIPELINE_DECODE:
+        return "decode";
+    case PIPELINE_SERIALIZE:
+        return "serialize";
+    case PIPELINE_ENCRYPT:
+        return "encrypt";
+    case PIPELINE_PUBLISH:
+        return "publish";
+    case PIPELINE_RECONNECT:
+        return "reconnect";
+    case PIPELINE_LATENCY:
+        return "latency";
+    default:
+        return "unknown";
+    }
+}
@@ -0,0 +1,151 @@
+#ifndef PIPELINE_STATS_H
+#define PIPELINE_STATS_H
+
+#include <stdint.h>
+#include <Arduino.h>
+#include <RecordSchema.h>
+
+#if defined(ARDUINO_ARCH_ESP32)
+#define PIPELINE_TICKS_PER_US (F_CPU / 1000000) // Timestamps are CPU cycles
+#else
+#define PIPELINE_TICKS_PER_US 1 // Timestamps are micros()
+#endif
+
+#define PIPELINE_BUCKET_COUNT 32 // log2 buckets per stage, the last one is open-ended
+
+/**
+ * Stages a fix goes through from the receiver's bytes to the broker
+ */
+enum PipelineStage : uint8_t
+{
+    PIPELINE_DECODE = 0,    // NMEA or UBX bytes to decoder state
+    PIPELINE_SERIALIZE = 1, // Fix batch to plaintext payload
+    PIPELINE_ENCRYPT = 2,   // Plaintext to encrypted payload
+    PIPELINE_PUBLISH = 3,   // Encrypted payload to the MQTT client
+    PIPELINE_RECONNECT = 4, // Outage detected to every connection step back up
+    PIPELINE_LATENCY = 5,   // Fix captured to its batch handed to the MQTT client
+    PIPELINE_STAGE_COUNT = 6
+};
+
+/**
+ * Time spent in one stage
+ * Bucket 0 counts passes under 1 us, bucket i counts passes from 2^(i-1) up to 2^i us.
+ */
+struct PipelineStageStats
+{
+    uint32_t count;                          // Passes through the stage
+    uint64_t totalTime;                      // Microseconds over all passes
+    uint32_t maxTime;                        // Microseconds of the slowest pass
+    uint32_t buckets[PIPELINE_BUCKET_COUNT]; // Passes per power of two microseconds
+};
+
+/**
+ * Per-stage timing of the fix pipeline
+ * Each stage is expected to be timed by a single task. Reading the stages of another task is
+ * only meant for logging and may see a pass half-way through being added.
+ *
+ *   uint32_t start = PipelineStats::now();
+ *   encryptPayload(...);
+ *   pipelineStats.addSince(PIPELINE_ENCRYPT, start);
+ *
+ * On the ESP32 timestamps are read from the cycle counter, which wraps after about 17 s at
+ * 240 MHz, so longer stages are added in microseconds with add().
+ */
+class PipelineStats
+{
+public:
+    PipelineStats();
+
+    /**
+     * Get a timestamp to time a stage from
+     *
+     * @return Cycle counter on the ESP32, micros() elsewhere
+     */
+    static inline uint32_t now()
+    {
+#if defined(ARDUINO_ARCH_ESP32)
+        return ESP.getCycleCount();
+#else
+        return micros();
+#endif
+    }
+
+    /**
+     * Add a pass through a stage that started at a timestamp
+     *
+     * @param stage Stage passed through
+     * @param start Timestamp from now() when the pass started
+     */
+    inline void addSince(PipelineStage stage, uint32_t start)
+    {
+        add(stage, (now() - start) / PIPELINE_TICKS_PER_US);
+    }
+
+    /**
+     * Add a pass through a stage
+     *
+     * @param stage Stage passed through
+     * @param time Time spent in microseconds
+     */
+    void add(PipelineStage stage, uint32_t time);
+
+    /**
+     * Get the time spent in a stage
+     *
+     * @param stage Stage to get
+     * @return Counters of the stage
+     */
+    const PipelineStageStats &get(PipelineStage stage) const { return stages[stage]; }
+
+    /**
+     * Get the average time of a pass through a stage
+     *
+     * @param stage Stage to get
+     * @return Average time in microseconds, 0 if the stage was never passed through
+     */
+    uint32_t getAverageTime(PipelineStage stage) const;
+
+    /**
+     * Get the time under which a share of the passes through a stage finished
+     *
+     * @param stage Stage to get
+     * @param percent Share of the passes, e.g. 99
+     * @return Upper bound of the bucket the percentile falls in, in microseconds, capped at the slowest pass, 0 if the stage was never passed through
+     */
+    uint32_t getPercentile(PipelineStage stage, uint8_t percent) const;
+
+    /**
+     * Write every stage as a compact JSON object
+     * Each stage is written as "name":[count,max,first,...] where first is the index of the first
+     * non-empty bucket and the counts from it to the last non-empty bucket follow.
+     *
+     * @param writer Writer to append to
+     */
+    void writeJson(TextWriter &writer) const;
+
+    /**
+     * Forget all passes
+     */
+    void reset();
+
+    /**
+     * Get the bucket a time falls in
+     *
+     * @param time Time in microseconds
+     * @return Index of the bucket
+     */
+    static uint8_t getBucket(uint32_t time);
+
+    /**
+     * Get the name of a stage for logging
+     *
+     * @param stage Stage to name
+     * @return Name of the stage, e.g. "decode"
+     */
+    static const char *getStageName(PipelineStage stage);
+
+private:
+    PipelineStageStats stages[PIPELINE_STAGE_COUNT];
+};
+
+#endif // PIPELINE_STATS_H
@@ -0,0 +1,77 @@
+#include "TimeArbiter.h"
+
+/**
+ * Create an arbiter without a time source
+ *
+ * @param fallbackDelay Request NTP if GPS time has not arrived this many milliseconds after begin()
+ */
+TimeArbiter::TimeArbiter(uint32_t fallbackDelay)
+    : fallbackDelay(fallbackDelay), startedAt(0), firstSourceDelay(0), source(TIME_SOURCE_NONE)
+{
+}
+
+/**
+ * Start waiting for a time source
+ *
+ * @param now Current time in milliseconds (millis())
+ */
+void TimeArbiter::begin(uint32_t now)
+{
+    startedAt = now;
+    firstSourceDelay = 0;
+    source = TIME_SOURCE_NONE;
+}
+
+/**
+ * Offer a time from a source
+ *
+ * @param source Source of the time
+ * @param now Current time in milliseconds (millis())
+ * @return true if the time should be applied, i.e. the source is better than the current one
+ */
+bool TimeArbiter::offer(TimeSource source, uint32_t now)
+{
+    if (source <= this->source)
+    {
+        return false;
+    }
+
+    if (this->source == TIME_SOURCE_NONE)
+    {
+        firstSourceDelay = now - startedAt;
+    }
+    this->source = source;
+    return true;
+}
+
+/**
+ * Check whether NTP should be requested because no source has delivered the time yet
+ *
+ * @param now Current time in milliseconds (millis())
+ * @return true if the fallback delay has passed without a time source, false otherwise
+ */
+bool TimeArbiter::isFallbackDue(uint32_t now) const
+{
+    return source == TIME_SOURCE_NONE && now - startedAt >= fallbackDelay;
+}
+
+/**
+ * Get the name of a source, for logging
+ *
+ * @param source Time source
+ * @return Name of the source
+ */
+const char *TimeArbiter::getSourceName(TimeSource source)
+{
+    switch (source)
+    {
+    case TIME_SOURCE_NONE:
+        return "none";
+    case TIME_SOURCE_NTP:
+        return "NTP";
+    case TIME_SOURCE_GPS:
+        return "GPS";
+    default:
+        return "unknown";
+    }
+}
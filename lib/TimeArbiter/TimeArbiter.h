@@ -0,0 +1,87 @@
+#ifndef TIME_ARBITER_H
+#define TIME_ARBITER_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * Source of the wall-clock time, in increasing order of preference
+ */
+enum TimeSource : uint8_t
+{
+    TIME_SOURCE_NONE = 0, // Time not known yet
+    TIME_SOURCE_NTP = 1,  // NTP over WiFi, or the SIM800 network clock (AT+CNTP/AT+CCLK)
+    TIME_SOURCE_GPS = 2   // UTC date and time decoded from the GPS receiver
+};
+
+/**
+ * Decides which source sets the wall-clock time
+ * GPS time is preferred: the receiver delivers it with the first sentences, without any network
+ * round trip. NTP is only a fallback, requested when GPS time has not arrived within the
+ * fallback delay. A source is accepted only if it is better than the current one, so a late NTP
+ * answer never overrides GPS time.
+ */
+class TimeArbiter
+{
+public:
+    /**
+     * Create an arbiter without a time source
+     *
+     * @param fallbackDelay Request NTP if GPS time has not arrived this many milliseconds after begin()
+     */
+    explicit TimeArbiter(uint32_t fallbackDelay);
+
+    /**
+     * Start waiting for a time source
+     *
+     * @param now Current time in milliseconds (millis())
+     */
+    void begin(uint32_t now);
+
+    /**
+     * Offer a time from a source
+     *
+     * @param source Source of the time
+     * @param now Current time in milliseconds (millis())
+     * @return true if the time should be applied, i.e. the source is better than the current one
+     */
+    bool offer(TimeSource source, uint32_t now);
+
+    /**
+     * Check whether NTP should be requested because no source has delivered the time yet
+     *
+     * @param now Current time in milliseconds (millis())
+     * @return true if the fallback delay has passed without a time source, false otherwise
+     */
+    bool isFallbackDue(uint32_t now) const;
+
+    /**
+     * Get the source of the current time
+     *
+     * @return Current time source, TIME_SOURCE_NONE if the time is not known
+     */
+    TimeSource getSource() const { return source; }
+
+    /**
+     * Get how long it took to learn the time
+     *
+     * @return Milliseconds from begin() to the first accepted source, 0 if the time is not known
+     */
+    uint32_t getTimeToFirstSource() const { return firstSourceDelay; }
+
+    /**
+     * Get the name of a source, for logging
+     *
+     * @param source Time source
+     * @return Name of the source
+     */
+    static const char *getSourceName(TimeSource source);
+
+private:
+    uint32_t fallbackDelay;
+    uint32_t startedAt;
+    uint32_t firstSourceDelay;
+    TimeSource source;
+};
+
+#endif // TIME_ARBITER_H
@@ -0,0 +1,99 @@
+#include <math.h>
+#include <MotionScheduler.h>
+
+#include "TrackSimplifier.h"
+
+#define EARTH_RADIUS_METERS 6371008.8f
+#define DEGREES_TO_RADIANS ((float)M_PI / 180.0f)
+#define COORDINATE_TO_RADIANS (DEGREES_TO_RADIANS * 1e-7f)
+#define METERS_TO_COORDINATE (1.0f / (EARTH_RADIUS_METERS * COORDINATE_TO_RADIANS)) // 1e-7 degrees of latitude per meter
+#define CENTI_KMPH_TO_MPS (0.01f / 3.6f)
+
+/**
+ * Create a track simplifier
+ *
+ * @param tolerance Largest distance in meters between a dropped fix and the predicted track, 0 keeps every fix
+ */
+TrackSimplifier::TrackSimplifier(float tolerance)
+    : tolerance(tolerance), hasReference(false), referenceLat(0), referenceLng(0), referenceVelocityNorth(0),
+      referenceVelocityEast(0), referenceTime(0), hasCandidate(false), candidateHasLocation(false), candidateLat(0),
+      candidateLng(0), candidateVelocityNorth(0), candidateVelocityEast(0), candidateTime(0), lastDeviation(0), kept(0),
+      dropped(0)
+{
+}
+
+/**
+ * Decide whether to keep a fix
+ * A kept fix is held as a candidate, it only becomes the reference with accept().
+ *
+ * @param fix Candidate fix, with GPS_FIX_HAS_LOCATION/GPS_FIX_HAS_SPEED set if valid
+ * @param course Course over ground in degrees
+ * @param hasCourse Whether the course is valid
+ * @param force Keep the fix whatever the prediction, e.g. for a heartbeat
+ * @return true if the fix is kept, false if it is dropped
+ */
+bool TrackSimplifier::evaluate(const GpsFix &fix, float course, bool hasCourse, bool force)
+{
+    bool hasLocation = (fix.valid & GPS_FIX_HAS_LOCATION) != 0;
+    lastDeviation = 0;
+    hasCandidate = false;
+
+    if (hasReference && hasLocation)
+    {
+        // Dead reckoning from the last kept fix, a fix without course is predicted to stand still
+        float elapsed = (fix.capturedAt - referenceTime) / 1000.0f;
+        int32_t predictedLat = referenceLat + (int32_t)lroundf(referenceVelocityNorth * elapsed * METERS_TO_COORDINATE);
+        int32_t predictedLng = referenceLng + (int32_t)lroundf(referenceVelocityEast * elapsed * METERS_TO_COORDINATE /
+                                                               cosf(referenceLat * COORDINATE_TO_RADIANS));
+        lastDeviation = getShortDistance(predictedLat, predictedLng, fix.lat, fix.lng);
+
+        if (!force && tolerance > 0 && lastDeviation <= tolerance)
+        {
+            dropped++;
+            return false;
+        }
+    }
+
+    hasCandidate = true;
+    candidateHasLocation = hasLocation;
+    candidateLat = fix.lat;
+    candidateLng = fix.lng;
+    candidateTime = fix.capturedAt;
+    float speed = hasCourse && (fix.valid & GPS_FIX_HAS_SPEED) ? fix.speed * CENTI_KMPH_TO_MPS : 0.0f;
+    candidateVelocityNorth = speed * cosf(course * DEGREES_TO_RADIANS);
+    candidateVelocityEast = speed * sinf(course * DEGREES_TO_RADIANS);
+    return true;
+}
+
+/**
+ * Predict the track from the fix last kept by evaluate(), once it is published
+ * Does nothing if that fix was dropped or already accepted.
+ */
+void TrackSimplifier::accept()
+{
+    if (!hasCandidate)
+    {
+        return;
+    }
+
+    kept++;
+    hasCandidate = false;
+
+    // Without a location there is nothing to predict from, the next fix with one is kept
+    hasReference = candidateHasLocation;
+    referenceLat = candidateLat;
+    referenceLng = candidateLng;
+    referenceTime = candidateTime;
+    referenceVelocityNorth = candidateVelocityNorth;
+    referenceVelocityEast = candidateVelocityEast;
+}
+
+/**
+ * Get the compression ratio of the evaluated fixes
+ *
+ * @return Accepted and dropped fixes per accepted fix, 1 if none were accepted
+ */
+float TrackSimplifier::getCompressionRatio() const
+{
+    return kept == 0 ? 1.0f : (float)(kept + dropped) / kept;
+}
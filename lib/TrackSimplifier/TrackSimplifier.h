@@ -0,0 +1,100 @@
+#ifndef TRACK_SIMPLIFIER_H
+#define TRACK_SIMPLIFIER_H
+
+#include <stdint.h>
+#include <GpsFix.h>
+
+/**
+ * Streaming simplification of the published track by dead reckoning
+ * The last kept fix is extrapolated along its course at its speed. A new fix is dropped while
+ * it lies within the tolerance of that prediction, so long straight stretches at a steady
+ * speed shrink to their end points while turns, stops and speed changes are kept. Decisions
+ * are made fix by fix, nothing is held back waiting for later fixes.
+ * A kept fix only becomes the prediction's reference once accept() is called, so a fix that
+ * is never published is not extrapolated from:
+ *
+ *   if (simplifier.evaluate(fix, course, hasCourse, false) && publishable(fix))
+ *   {
+ *       simplifier.accept();
+ *   }
+ */
+class TrackSimplifier
+{
+public:
+    /**
+     * Create a track simplifier
+     *
+     * @param tolerance Largest distance in meters between a dropped fix and the predicted track, 0 keeps every fix
+     */
+    explicit TrackSimplifier(float tolerance);
+
+    /**
+     * Decide whether to keep a fix
+     * A kept fix is held as a candidate, it only becomes the reference with accept().
+     *
+     * @param fix Candidate fix, with GPS_FIX_HAS_LOCATION/GPS_FIX_HAS_SPEED set if valid
+     * @param course Course over ground in degrees
+     * @param hasCourse Whether the course is valid
+     * @param force Keep the fix whatever the prediction, e.g. for a heartbeat
+     * @return true if the fix is kept, false if it is dropped
+     */
+    bool evaluate(const GpsFix &fix, float course, bool hasCourse, bool force);
+
+    /**
+     * Predict the track from the fix last kept by evaluate(), once it is published
+     * Does nothing if that fix was dropped or already accepted.
+     */
+    void accept();
+
+    /**
+     * Get the distance between the last evaluated fix and the predicted track
+     *
+     * @return Distance in meters, 0 if there was no prediction
+     */
+    float getLastDeviation() const { return lastDeviation; }
+
+    /**
+     * Get the number of fixes kept and accepted
+     *
+     * @return Number of accepted fixes
+     */
+    uint32_t getKeptCount() const { return kept; }
+
+    /**
+     * Get the number of fixes dropped
+     *
+     * @return Number of dropped fixes
+     */
+    uint32_t getDroppedCount() const { return dropped; }
+
+    /**
+     * Get the compression ratio of the evaluated fixes
+     *
+     * @return Accepted and dropped fixes per accepted fix, 1 if none were accepted
+     */
+    float getCompressionRatio() const;
+
+private:
+    float tolerance;
+
+    bool hasReference;
+    int32_t referenceLat;         // 1e-7 degrees
+    int32_t referenceLng;         // 1e-7 degrees
+    float referenceVelocityNorth; // m/s
+    float referenceVelocityEast;  // m/s
+    uint32_t referenceTime;
+
+    bool hasCandidate;            // Set by evaluate() when a kept fix waits for accept()
+    bool candidateHasLocation;
+    int32_t candidateLat;         // 1e-7 degrees
+    int32_t candidateLng;         // 1e-7 degrees
+    float candidateVelocityNorth; // m/s
+    float candidateVelocityEast;  // m/s
+    uint32_t candidateTime;
+
+    float lastDeviation;
+    uint32_t kept;
+    uint32_t dropped;
+};
+
+#endif // TRACK_SIMPLIFIER_H
@@ -0,0 +1,496 @@
+#include <string.h>
+#include <EpochClock.h>
+
+#include "UbxGps.h"
+
+#define UBX_PORT_UART1 1
+#define UBX_PORT_MODE_8N1 0x000008D0
+#define UBX_PROTO_UBX 0x0001
+#define UBX_PROTO_NMEA 0x0002
+#define UBX_TIME_REF_GPS 1
+
+static uint16_t readU16(const uint8_t *p)
+{
+    return (uint16_t)(p[0] | (p[1] << 8));
+}
+
+static uint32_t readU32(const uint8_t *p)
+{
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static int32_t readI32(const uint8_t *p)
+{
+    return (int32_t)readU32(p);
+}
+
+static void writeU16(uint8_t *p, uint16_t value)
+{
+    p[0] = value;
+    p[1] = value >> 8;
+}
+
+static void writeU32(uint8_t *p, uint32_t value)
+{
+    writeU16(p, value);
+    writeU16(p + 2, value >> 16);
+}
+
+/**
+ * Check the Fletcher checksum of a frame
+ *
+ * @param frame Frame starting with the sync chars, with a valid length field
+ * @return true if the checksum matches, false otherwise
+ */
+static bool isChecksumValid(const uint8_t *frame)
+{
+    size_t end = UBX_HEADER_SIZE + readU16(frame + 4);
+    uint8_t a = 0;
+    uint8_t b = 0;
+    for (size_t i = 2; i < end; i++)
+    {
+        a += frame[i];
+        b += a;
+    }
+    return frame[end] == a && frame[end + 1] == b;
+}
+
+/**
+ * Convert the UTC date and time of a NAV message to milliseconds since the Unix epoch
+ *
+ * @param date Year (2 bytes), month, day, hour, minute and second fields of the message
+ * @param nano Fraction of the second in nanoseconds, may be negative
+ * @return Milliseconds since 1970-01-01T00:00:00Z
+ */
+static uint64_t toEpochMillis(const uint8_t *date, int32_t nano)
+{
+    int64_t millis = makeEpochMillis(readU16(date), date[2], date[3], date[4], date[5], date[6], 0);
+    millis += nano >= 0 ? (nano + 500000) / 1000000 : -((500000 - (int64_t)nano) / 1000000);
+    return (uint64_t)millis;
+}
+
+/**
+ * Create a decoder
+ *
+ * @param requiredParts UBX_HAS_* flags that complete an epoch, e.g. UBX_EPOCH_NEO6
+ */
+UbxGps::UbxGps(uint8_t requiredParts)
+    : requiredParts(requiredParts), pending(), solution(), pendingReported(false), carryLength(0),
+      ackClass(0), ackId(0), ackResult(UBX_ACK_NONE), epochs(0), frames(0), errors(0), skipped(0), carried(0)
+{
+}
+
+/**
+ * Decode received bytes
+ *
+ * @param data Received bytes, any split of the stream
+ * @param length Number of bytes
+ * @return Number of epochs completed by these bytes
+ */
+size_t UbxGps::feed(const uint8_t *data, size_t length)
+{
+    uint32_t before = epochs;
+    size_t pos = carryLength > 0 ? feedCarry(data, length) : 0;
+
+    while (pos < length)
+    {
+        const uint8_t *frame = data + pos;
+        size_t available = length - pos;
+
+        if (frame[0] != UBX_SYNC_CHAR_1 || (available > 1 && frame[1] != UBX_SYNC_CHAR_2))
+        {
+            skipped++;
+            pos++;
+            continue;
+        }
+
+        if (available >= UBX_HEADER_SIZE && readU16(frame + 4) > UBX_MAX_PAYLOAD_SIZE)
+        {
+            errors++;
+            pos++;
+            continue;
+        }
+
+        if (available < UBX_HEADER_SIZE || available < readU16(frame + 4) + (size_t)UBX_FRAME_OVERHEAD)
+        {
+            // The rest of the frame comes with the next bytes
+            memcpy(carry, frame, available);
+            carryLength = available;
+            break;
+        }
+
+        if (!isChecksumValid(frame))
+        {
+            errors++;
+            pos++;
+            continue;
+        }
+
+        handleFrame(frame);
+        pos += readU16(frame + 4) + UBX_FRAME_OVERHEAD;
+    }
+
+    return epochs - before;
+}
+
+/**
+ * Complete the frame started in the carry buffer
+ *
+ * @param data Received bytes
+ * @param length Number of bytes
+ * @return Number of bytes consumed
+ */
+size_t UbxGps::feedCarry(const uint8_t *data, size_t length)
+{
+    size_t pos = 0;
+    while (pos < length)
+    {
+        carry[carryLength++] = data[pos++];
+
+        if (carryLength == 2 && carry[1] != UBX_SYNC_CHAR_2)
+        {
+            // Not a frame after all, the new byte is scanned again
+            skipped++;
+            carryLength = 0;
+            return pos - 1;
+        }
+
+        if (carryLength < UBX_HEADER_SIZE)
+        {
+            continue;
+        }
+
+        size_t payloadLength = readU16(carry + 4);
+        if (payloadLength > UBX_MAX_PAYLOAD_SIZE)
+        {
+            errors++;
+            carryLength = 0;
+            return pos;
+        }
+
+        if (carryLength == payloadLength + UBX_FRAME_OVERHEAD)
+        {
+            carried++;
+            if (isChecksumValid(carry))
+            {
+                handleFrame(carry);
+            }
+            else
+            {
+                errors++;
+            }
+            carryLength = 0;
+            return pos;
+        }
+    }
+    return pos;
+}
+
+/**
+ * Decode a valid frame in place
+ *
+ * @param frame Frame starting with the sync chars
+ */
+void UbxGps::handleFrame(const uint8_t *frame)
+{
+    frames++;
+
+    uint8_t messageClass = frame[2];
+    uint8_t messageId = frame[3];
+    uint16_t length = readU16(frame + 4);
+    const uint8_t *payload = frame + UBX_HEADER_SIZE;
+
+    if (messageClass == UBX_CLASS_ACK && length >= 2)
+    {
+        ackClass = payload[0];
+        ackId = payload[1];
+        ackResult = messageId == UBX_ACK_ACK ? UBX_ACK_ACCEPTED : UBX_ACK_REJECTED;
+        return;
+    }
+    if (messageClass != UBX_CLASS_NAV || length < 4)
+    {
+        return;
+    }
+
+    uint8_t part;
+    switch (messageId)
+    {
+    case UBX_NAV_POSLLH:
+        if (length < 28)
+        {
+            return;
+        }
+        beginEpoch(readU32(payload));
+        pending.lng = readI32(payload + 4);
+        pending.lat = readI32(payload + 8);
+        pending.altitude = readI32(payload + 16);
+        part = UBX_HAS_POSITION;
+        break;
+
+    case UBX_NAV_VELNED:
+        if (length < 36)
+        {
+            return;
+        }
+        beginEpoch(readU32(payload));
+        pending.groundSpeed = readU32(payload + 20) * 10; // cm/s to mm/s
+        pending.heading = readI32(payload + 24);
+        part = UBX_HAS_VELOCITY;
+        break;
+
+    case UBX_NAV_TIMEUTC:
+        if (length < 20)
+        {
+            return;
+        }
+        beginEpoch(readU32(payload));
+        pending.timeValid = (payload[19] & 0x04) != 0; // validUTC
+        pending.utcTime = pending.timeValid ? toEpochMillis(payload + 12, readI32(payload + 8)) : 0;
+        part = UBX_HAS_TIME;
+        break;
+
+    case UBX_NAV_SOL:
+        if (length < 52)
+        {
+            return;
+        }
+        beginEpoch(readU32(payload));
+        pending.fixType = payload[10];
+        pending.fixOk = (payload[11] & 0x01) != 0;
+        pending.satellites = payload[47];
+        part = UBX_HAS_STATUS;
+        break;
+
+    case UBX_NAV_DOP:
+        if (length < 18)
+        {
+            return;
+        }
+        beginEpoch(readU32(payload));
+        pending.hdop = readU16(payload + 12);
+        part = UBX_HAS_DOP;
+        break;
+
+    case UBX_NAV_PVT:
+        if (length < 84)
+        {
+            return;
+        }
+        beginEpoch(readU32(payload));
+        pending.timeValid = (payload[11] & 0x07) == 0x07; // validDate, validTime, fullyResolved
+        pending.utcTime = pending.timeValid ? toEpochMillis(payload + 4, readI32(payload + 16)) : 0;
+        pending.fixType = payload[20];
+        pending.fixOk = (payload[21] & 0x01) != 0;
+        pending.satellites = payload[23];
+        pending.lng = readI32(payload + 24);
+        pending.lat = readI32(payload + 28);
+        pending.altitude = readI32(payload + 36);
+        pending.groundSpeed = readI32(payload + 60);
+        pending.heading = readI32(payload + 64);
+        part = UBX_HAS_POSITION | UBX_HAS_VELOCITY | UBX_HAS_TIME | UBX_HAS_STATUS;
+        break;
+
+    default:
+        return;
+    }
+
+    pending.present |= part;
+    if (!pendingReported && (pending.present & requiredParts) == requiredParts)
+    {
+        solution = pending;
+        pendingReported = true;
+        epochs++;
+    }
+}
+
+/**
+ * Start assembling a new epoch, unless the time of week is the one being assembled
+ *
+ * @param iTOW GPS time of week of the message in milliseconds
+ */
+void UbxGps::beginEpoch(uint32_t iTOW)
+{
+    if (pending.present != 0 && pending.iTOW == iTOW)
+    {
+        return;
+    }
+    pending = {};
+    pending.iTOW = iTOW;
+    pendingReported = false;
+}
+
+/**
+ * Fill the GPS fields of a fix from the last completed epoch
+ * Sets the GPS_FIX_HAS_* flags of the fields that are valid and leaves the others untouched.
+ *
+ * @param fix Fix to fill
+ */
+void UbxGps::fillFix(GpsFix &fix) const
+{
+    bool located = solution.fixOk && solution.fixType >= 2 && solution.fixType <= 4;
+
+    fix.satellites = solution.satellites;
+
+    if (located && (solution.present & UBX_HAS_POSITION))
+    {
+        fix.lat = solution.lat;
+        fix.lng = solution.lng;
+        fix.valid |= GPS_FIX_HAS_LOCATION;
+
+        if (solution.fixType != 2)
+        {
+            fix.alt = solution.altitude >= 0 ? (solution.altitude + 5) / 10 : (solution.altitude - 5) / 10; // mm to cm
+            fix.valid |= GPS_FIX_HAS_ALTITUDE;
+        }
+    }
+
+    if (solution.present & UBX_HAS_DOP)
+    {
+        fix.hdop = solution.hdop;
+        fix.valid |= GPS_FIX_HAS_HDOP;
+    }
+
+    if (located && (solution.present & UBX_HAS_VELOCITY))
+    {
+        fix.speed = ((uint64_t)solution.groundSpeed * 36 + 50) / 100; // mm/s to 0.01 km/h
+        fix.valid |= GPS_FIX_HAS_SPEED;
+    }
+}
+
+/**
+ * Get the heading of motion of the last completed epoch
+ *
+ * @param course Receives the heading in degrees
+ * @return true if the heading is valid, false otherwise
+ */
+bool UbxGps::getCourse(float *course) const
+{
+    if (!solution.fixOk || !(solution.present & UBX_HAS_VELOCITY))
+    {
+        return false;
+    }
+    *course = solution.heading * 1e-5f;
+    return true;
+}
+
+/**
+ * Get the UTC time of the last completed epoch
+ *
+ * @param epochMillis Receives milliseconds since the Unix epoch
+ * @return true if the time is valid, false otherwise
+ */
+bool UbxGps::getUtcTime(uint64_t *epochMillis) const
+{
+    if (!solution.timeValid || !(solution.present & UBX_HAS_TIME))
+    {
+        return false;
+    }
+    *epochMillis = solution.utcTime;
+    return true;
+}
+
+/**
+ * Get the answer of the receiver to the last CFG message of a class and ID
+ *
+ * @param messageClass Class of the CFG message
+ * @param messageId ID of the CFG message
+ * @return Answer, UBX_ACK_NONE if there was none since clearAck()
+ */
+UbxAck UbxGps::getAck(uint8_t messageClass, uint8_t messageId) const
+{
+    return ackClass == messageClass && ackId == messageId ? ackResult : UBX_ACK_NONE;
+}
+
+/**
+ * Build a UBX frame
+ *
+ * @param messageClass Class of the message
+ * @param messageId ID of the message
+ * @param payload Payload of the message
+ * @param length Length of the payload
+ * @param output Buffer to store the frame
+ * @param capacity Capacity of the output buffer in bytes
+ * @return Length of the frame, or 0 if it does not fit in the buffer
+ */
+size_t buildUbxFrame(uint8_t messageClass, uint8_t messageId, const uint8_t *payload, uint16_t length, uint8_t *output, size_t capacity)
+{
+    size_t frameLength = length + UBX_FRAME_OVERHEAD;
+    if (capacity < frameLength)
+    {
+        return 0;
+    }
+
+    output[0] = UBX_SYNC_CHAR_1;
+    output[1] = UBX_SYNC_CHAR_2;
+    output[2] = messageClass;
+    output[3] = messageId;
+    writeU16(output + 4, length);
+    if (length > 0)
+    {
+        memcpy(output + UBX_HEADER_SIZE, payload, length);
+    }
+
+    uint8_t a = 0;
+    uint8_t b = 0;
+    for (size_t i = 2; i < (size_t)UBX_HEADER_SIZE + length; i++)
+    {
+        a += output[i];
+        b += a;
+    }
+    output[frameLength - 2] = a;
+    output[frameLength - 1] = b;
+    return frameLength;
+}
+
+/**
+ * Build a CFG-PRT frame setting the baud rate of UART1, with UBX-only output
+ * NMEA input stays enabled, every NMEA sentence is turned off.
+ *
+ * @param baud New baud rate
+ * @param output Buffer to store the frame
+ * @param capacity Capacity of the output buffer in bytes
+ * @return Length of the frame, or 0 if it does not fit in the buffer
+ */
+size_t buildUbxPortConfig(uint32_t baud, uint8_t *output, size_t capacity)
+{
+    uint8_t payload[20] = {};
+    payload[0] = UBX_PORT_UART1;
+    writeU32(payload + 4, UBX_PORT_MODE_8N1);
+    writeU32(payload + 8, baud);
+    writeU16(payload + 12, UBX_PROTO_UBX | UBX_PROTO_NMEA);
+    writeU16(payload + 14, UBX_PROTO_UBX);
+    return buildUbxFrame(UBX_CLASS_CFG, UBX_CFG_PRT, payload, sizeof(payload), output, capacity);
+}
+
+/**
+ * Build a CFG-RATE frame setting the navigation rate
+ *
+ * @param period Time between navigation epochs in milliseconds, 200 for 5 Hz
+ * @param output Buffer to store the frame
+ * @param capacity Capacity of the output buffer in bytes
+ * @return Length of the frame, or 0 if it does not fit in the buffer
+ */
+size_t buildUbxRateConfig(uint16_t period, uint8_t *output, size_t capacity)
+{
+    uint8_t payload[6];
+    writeU16(payload, period);
+    writeU16(payload + 2, 1); // One navigation solution per measurement
+    writeU16(payload + 4, UBX_TIME_REF_GPS);
+    return buildUbxFrame(UBX_CLASS_CFG, UBX_CFG_RATE, payload, sizeof(payload), output, capacity);
+}
+
+/**
+ * Build a CFG-MSG frame setting how often a message is output on the current port
+ *
+ * @param messageClass Class of the message
+ * @param messageId ID of the message
+ * @param rate Output the message every this many epochs, 0 to turn it off
+ * @param output Buffer to store the frame
+ * @param capacity Capacity of the output buffer in bytes
+ * @return Length of the frame, or 0 if it does not fit in the buffer
+ */
+size_t buildUbxMessageRate(uint8_t messageClass, uint8_t messageId, uint8_t rate, uint8_t *output, size_t capacity)
+{
+    uint8_t payload[3] = {messageClass, messageId, rate};
+    return buildUbxFrame(UBX_CLASS_CFG, UBX_CFG_MSG, payload, sizeof(payload), output, capacity);
+}
@@ -0,0 +1,248 @@
+#ifndef UBX_GPS_H
+#define UBX_GPS_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <GpsFix.h>
+
+// UBX frame layout: sync chars, class, ID, 16-bit length, payload, 2-byte Fletcher checksum
+#define UBX_SYNC_CHAR_1 0xB5
+#define UBX_SYNC_CHAR_2 0x62
+#define UBX_HEADER_SIZE 6
+#define UBX_FRAME_OVERHEAD 8
+#define UBX_MAX_PAYLOAD_SIZE 100 // Largest payload decoded, longer frames are skipped
+
+// Message classes and IDs
+#define UBX_CLASS_NAV 0x01
+#define UBX_CLASS_ACK 0x05
+#define UBX_CLASS_CFG 0x06
+#define UBX_NAV_POSLLH 0x02
+#define UBX_NAV_DOP 0x04
+#define UBX_NAV_SOL 0x06
+#define UBX_NAV_PVT 0x07
+#define UBX_NAV_VELNED 0x12
+#define UBX_NAV_TIMEUTC 0x21
+#define UBX_ACK_NAK 0x00
+#define UBX_ACK_ACK 0x01
+#define UBX_CFG_PRT 0x00
+#define UBX_CFG_MSG 0x01
+#define UBX_CFG_RATE 0x08
+
+// Parts of a navigation solution, each delivered by one or more NAV messages
+#define UBX_HAS_POSITION 0x01 // NAV-POSLLH or NAV-PVT
+#define UBX_HAS_VELOCITY 0x02 // NAV-VELNED or NAV-PVT
+#define UBX_HAS_TIME 0x04     // NAV-TIMEUTC or NAV-PVT
+#define UBX_HAS_STATUS 0x08   // NAV-SOL or NAV-PVT
+#define UBX_HAS_DOP 0x10      // NAV-DOP
+
+// Messages making up an epoch on a u-blox 6 receiver such as the NEO-6M, which has no NAV-PVT
+#define UBX_EPOCH_NEO6 (UBX_HAS_POSITION | UBX_HAS_VELOCITY | UBX_HAS_TIME | UBX_HAS_STATUS | UBX_HAS_DOP)
+
+/**
+ * Answer of the receiver to a CFG message
+ */
+enum UbxAck : uint8_t
+{
+    UBX_ACK_NONE = 0,     // No answer yet
+    UBX_ACK_ACCEPTED = 1, // ACK-ACK
+    UBX_ACK_REJECTED = 2  // ACK-NAK
+};
+
+/**
+ * One navigation epoch, in the receiver's integer units
+ */
+struct UbxSolution
+{
+    uint32_t iTOW;        // GPS time of week of the epoch in milliseconds
+    int32_t lat;          // Latitude in 1e-7 degrees
+    int32_t lng;          // Longitude in 1e-7 degrees
+    int32_t altitude;     // Height above mean sea level in millimeters
+    uint32_t groundSpeed; // Ground speed in millimeters per second
+    int32_t heading;      // Heading of motion in 1e-5 degrees
+    uint16_t hdop;        // Horizontal dilution of precision in 0.01
+    uint8_t satellites;   // Number of satellites used in the solution
+    uint8_t fixType;      // 0 no fix, 1 dead reckoning, 2 2D, 3 3D, 4 GPS and dead reckoning, 5 time only
+    bool fixOk;           // Whether the fix is within the receiver's accuracy limits
+    bool timeValid;       // Whether utcTime is valid
+    uint64_t utcTime;     // UTC time of the epoch in milliseconds since the Unix epoch
+    uint8_t present;      // Bitmask of UBX_HAS_* flags received for this epoch
+};
+
+/**
+ * Decoder of the u-blox UBX binary protocol
+ * Frames are validated and decoded in place in the buffer passed to feed(), straight into the
+ * solution fields. Only a frame split across two feed() calls is copied, into a small carry
+ * buffer. NAV messages with the same time of week are merged into one epoch, which completes
+ * once every message of the required set has arrived.
+ */
+class UbxGps
+{
+public:
+    /**
+     * Create a decoder
+     *
+     * @param requiredParts UBX_HAS_* flags that complete an epoch, e.g. UBX_EPOCH_NEO6
+     */
+    explicit UbxGps(uint8_t requiredParts);
+
+    /**
+     * Decode received bytes
+     *
+     * @param data Received bytes, any split of the stream
+     * @param length Number of bytes
+     * @return Number of epochs completed by these bytes
+     */
+    size_t feed(const uint8_t *data, size_t length);
+
+    /**
+     * Get the last completed epoch
+     *
+     * @return Last completed epoch, all zero before the first one
+     */
+    const UbxSolution &getSolution() const { return solution; }
+
+    /**
+     * Fill the GPS fields of a fix from the last completed epoch
+     * Sets the GPS_FIX_HAS_* flags of the fields that are valid and leaves the others untouched.
+     *
+     * @param fix Fix to fill
+     */
+    void fillFix(GpsFix &fix) const;
+
+    /**
+     * Get the heading of motion of the last completed epoch
+     *
+     * @param course Receives the heading in degrees
+     * @return true if the heading is valid, false otherwise
+     */
+    bool getCourse(float *course) const;
+
+    /**
+     * Get the UTC time of the last completed epoch
+     *
+     * @param epochMillis Receives milliseconds since the Unix epoch
+     * @return true if the time is valid, false otherwise
+     */
+    bool getUtcTime(uint64_t *epochMillis) const;
+
+    /**
+     * Get the answer of the receiver to the last CFG message of a class and ID
+     *
+     * @param messageClass Class of the CFG message
+     * @param messageId ID of the CFG message
+     * @return Answer, UBX_ACK_NONE if there was none since clearAck()
+     */
+    UbxAck getAck(uint8_t messageClass, uint8_t messageId) const;
+
+    /**
+     * Forget the last answer, before sending a CFG message
+     */
+    void clearAck() { ackResult = UBX_ACK_NONE; }
+
+    /**
+     * Get the number of completed epochs
+     *
+     * @return Number of epochs
+     */
+    uint32_t getEpochCount() const { return epochs; }
+
+    /**
+     * Get the number of valid frames, of any class
+     *
+     * @return Number of frames
+     */
+    uint32_t getFrameCount() const { return frames; }
+
+    /**
+     * Get the number of frames dropped for a bad checksum or length
+     *
+     * @return Number of bad frames
+     */
+    uint32_t getErrorCount() const { return errors; }
+
+    /**
+     * Get the number of bytes skipped outside of frames, e.g. NMEA before the receiver is configured
+     *
+     * @return Number of skipped bytes
+     */
+    uint32_t getSkippedCount() const { return skipped; }
+
+    /**
+     * Get the number of frames that had to be copied because they were split across feed() calls
+     *
+     * @return Number of copied frames
+     */
+    uint32_t getCarriedCount() const { return carried; }
+
+private:
+    size_t feedCarry(const uint8_t *data, size_t length);
+    void handleFrame(const uint8_t *frame);
+    void beginEpoch(uint32_t iTOW);
+
+    uint8_t requiredParts;
+
+    UbxSolution pending;  // Epoch being assembled
+    UbxSolution solution; // Last completed epoch
+    bool pendingReported;
+
+    uint8_t carry[UBX_MAX_PAYLOAD_SIZE + UBX_FRAME_OVERHEAD];
+    size_t carryLength;
+
+    uint8_t ackClass;
+    uint8_t ackId;
+    UbxAck ackResult;
+
+    uint32_t epochs;
+    uint32_t frames;
+    uint32_t errors;
+    uint32_t skipped;
+    uint32_t carried;
+};
+
+/**
+ * Build a UBX frame
+ *
+ * @param messageClass Class of the message
+ * @param messageId ID of the message
+ * @param payload Payload of the message
+ * @param length Length of the payload
+ * @param output Buffer to store the frame
+ * @param capacity Capacity of the output buffer in bytes
+ * @return Length of the frame, or 0 if it does not fit in the buffer
+ */
+size_t buildUbxFrame(uint8_t messageClass, uint8_t messageId, const uint8_t *payload, uint16_t length, uint8_t *output, size_t capacity);
+
+/**
+ * Build a CFG-PRT frame setting the baud rate of UART1, with UBX-only output
+ * NMEA input stays enabled, every NMEA sentence is turned off.
+ *
+ * @param baud New baud rate
+ * @param output Buffer to store the frame
+ * @param capacity Capacity of the output buffer in bytes
+ * @return Length of the frame, or 0 if it does not fit in the buffer
+ */
+size_t buildUbxPortConfig(uint32_t baud, uint8_t *output, size_t capacity);
+
+/**
+ * Build a CFG-RATE frame setting the navigation rate
+ *
+ * @param period Time between navigation epochs in milliseconds, 200 for 5 Hz
+ * @param output Buffer to store the frame
+ * @param capacity Capacity of the output buffer in bytes
+ * @return Length of the frame, or 0 if it does not fit in the buffer
+ */
+size_t buildUbxRateConfig(uint16_t period, uint8_t *output, size_t capacity);
+
+/**
+ * Build a CFG-MSG frame setting how often a message is output on the current port
+ *
+ * @param messageClass Class of the message
+ * @param messageId ID of the message
+ * @param rate Output the message every this many epochs, 0 to turn it off
+ * @param output Buffer to store the frame
+ * @param capacity Capacity of the output buffer in bytes
+ * @return Length of the frame, or 0 if it does not fit in the buffer
+ */
+size_t buildUbxMessageRate(uint8_t messageClass, uint8_t messageId, uint8_t rate, uint8_t *output, size_t capacity);
+
+#endif // UBX_GPS_H
@@ -0,0 +1,107 @@
+"""Derive the per-device key for USE_DEVICE_KEYS builds.
+
+The fleet master secret never goes into the firmware. This script derives the
+key of a single device from it and writes include/device_key.h, which is not
+checked in:
+
+    key = HKDF-SHA256(ikm=master, salt="lokatrack-device-key", info=device_id, length=32)
+
+The master secret is read as hex from LOKATRACK_MASTER_KEY, or from the file
+named by LOKATRACK_MASTER_KEY_FILE. The device ID defaults to MQTT_CLIENT_ID in
+include/mqtt_config.h and can be overridden with LOKATRACK_DEVICE_ID.
+
+Run by PlatformIO before every build (extra_scripts), where it does nothing
+unless a master secret is set, or by hand:
+
+    LOKATRACK_MASTER_KEY_FILE=~/secrets/master.hex python scripts/device_key.py [device_id]
+"""
+
+import hashlib
+import hmac
+import os
+import re
+import sys
+
+SALT = b"lokatrack-device-key"
+KEY_SIZE = 32
+
+
+def hkdf_sha256(master, salt, info, length):
+    prk = hmac.new(salt, master, hashlib.sha256).digest()
+    okm = b""
+    block = b""
+    counter = 1
+    while len(okm) < length:
+        block = hmac.new(prk, block + info + bytes([counter]), hashlib.sha256).digest()
+        okm += block
+        counter += 1
+    return okm[:length]
+
+
+def read_master_key():
+    text = os.environ.get("LOKATRACK_MASTER_KEY")
+    path = os.environ.get("LOKATRACK_MASTER_KEY_FILE")
+    if text is None and path:
+        with open(os.path.expanduser(path)) as f:
+            text = f.read()
+    if text is None:
+        return None
+    master = bytes.fromhex(re.sub(r"\s+", "", text))
+    if not master:
+        raise ValueError("the master secret is empty")
+    return master
+
+
+def read_device_id(project_dir):
+    device_id = os.environ.get("LOKATRACK_DEVICE_ID")
+    if device_id:
+        return device_id
+    with open(os.path.join(project_dir, "include", "mqtt_config.h")) as f:
+        match = re.search(r'#define\s+MQTT_CLIENT_ID\s+"([^"]*)"', f.read())
+    if match is None:
+        raise ValueError("MQTT_CLIENT_ID not found in include/mqtt_config.h")
+    return match.group(1)
+
+
+def write_header(path, device_id, key):
+    rows = ",\n".join(
+        "    " + ", ".join("0x%02x" % b for b in key[i:i + 8]) for i in range(0, len(key), 8)
+    )
+    with open(path, "w") as f:
+        f.write(
+            "#ifndef DEVICE_KEY_H\n"
+            "#define DEVICE_KEY_H\n"
+            "\n"
+            "// Generated by scripts/device_key.py, do not check in\n"
+            "// Key of %s, derived from the fleet master secret that stays with the backend\n"
+            "#define DEVICE_KEY_ID \"%s\"\n"
+            "const uint8_t DEVICE_KEY[%d] = {\n%s};\n"
+            "\n"
+            "#endif // DEVICE_KEY_H\n" % (device_id, device_id, len(key), rows)
+        )
+
+
+def generate(project_dir, device_id=None):
+    master = read_master_key()
+    if master is None:
+        return False
+    if device_id is None:
+        device_id = read_device_id(project_dir)
+    key = hkdf_sha256(master, SALT, device_id.encode(), KEY_SIZE)
+    write_header(os.path.join(project_dir, "include", "device_key.h"), device_id, key)
+    return True
+
+
+try:
+    Import("env")  # noqa: F821, defined when run by PlatformIO
+except NameError:
+    env = None
+
+if env is not None:
+    if generate(env["PROJECT_DIR"]):
+        print("Derived include/device_key.h")
+elif __name__ == "__main__":
+    project = os.path.dirname(os.path.dirname(os.path.abspath(__file__)))
+    if not generate(project, sys.argv[1] if len(sys.argv) > 1 else None):
+        sys.exit("Set LOKATRACK_MASTER_KEY or LOKATRACK_MASTER_KEY_FILE")
+    print("Wrote include/device_key.h")
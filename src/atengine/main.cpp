@@ -0,0 +1,423 @@
+// Host (native) test of the AT command engine against a scripted modem
+//
+// Feeds AtEngine the output a SIM800 produces: command echo, information lines, OK before a
+// late final line such as +CNTP:, ERROR and +CME ERROR, URCs in the middle of a response,
+// lines longer than the line buffer, and silence until the timeout. Every script is replayed
+// in one piece, byte by byte and in random chunks, with poll() called between the chunks, and
+// must end the same way. A load phase then runs many commands with URCs interleaved:
+//
+//   pio run -e atengine_native && .pio/build/atengine_native/program [commands] [maxChunk]
+
+#include <Arduino.h>
+#include <AtEngine.h>
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include <vector>
+
+#define TEST_COMMAND_TIMEOUT 1000
+#define TEST_SHORT_TIMEOUT 30 // For the timeout script, in milliseconds
+
+/**
+ * Modem side of the serial port: bytes queued by the test are read by the engine, bytes
+ * written by the engine are kept for the test to check
+ */
+class ScriptedModem : public Stream
+{
+public:
+    ScriptedModem() : readPosition(0), readLimit(0) {}
+
+    /**
+     * Queue modem output, readable once release() lets it through
+     *
+     * @param text Bytes the modem sends
+     */
+    void queue(const char *text)
+    {
+        input += text;
+    }
+
+    /**
+     * Let more of the queued output through to the engine
+     *
+     * @param count Number of bytes to release
+     */
+    void release(size_t count)
+    {
+        readLimit = readLimit + count < input.size() ? readLimit + count : input.size();
+    }
+
+    /**
+     * Get the number of queued bytes not released yet
+     *
+     * @return Bytes still held back
+     */
+    size_t held() const { return input.size() - readLimit; }
+
+    /**
+     * Forget the queued output and the written commands
+     */
+    void reset()
+    {
+        input.clear();
+        output.clear();
+        readPosition = 0;
+        readLimit = 0;
+    }
+
+    int available() override { return (int)(readLimit - readPosition); }
+    int read() override { return readPosition < readLimit ? (uint8_t)input[readPosition++] : -1; }
+    int peek() override { return readPosition < readLimit ? (uint8_t)input[readPosition] : -1; }
+    size_t write(uint8_t c) override
+    {
+        output += (char)c;
+        return 1;
+    }
+    using Print::write;
+
+    std::string output; // Everything the engine sent
+
+private:
+    std::string input;
+    size_t readPosition;
+    size_t readLimit;
+};
+
+static ScriptedModem modem;
+
+// Lines seen by the handlers of the current script
+static std::vector<std::string> responseLines;
+static std::vector<std::string> messageLines;
+static std::vector<std::string> ringLines;
+
+static void onResponse(const char *line)
+{
+    responseLines.push_back(line);
+}
+
+static void onMessage(const char *line)
+{
+    messageLines.push_back(line);
+}
+
+static void onRing(const char *line)
+{
+    ringLines.push_back(line);
+}
+
+static unsigned long failures = 0;
+
+/**
+ * Count a failed expectation and print it
+ *
+ * @param condition Expectation that must hold
+ * @param script Name of the script
+ * @param what Description of the expectation
+ * @return The condition
+ */
+static bool expect(bool condition, const char *script, const char *what)
+{
+    if (!condition)
+    {
+        failures++;
+        Serial.printf("%s: %s\n", script, what);
+    }
+    return condition;
+}
+
+/**
+ * Compare the lines a handler saw with the expected ones
+ *
+ * @param lines Lines the handler saw
+ * @param expected Expected lines, nullptr terminated
+ * @return true if they are the same, false otherwise
+ */
+static bool sameLines(const std::vector<std::string> &lines, const char *const *expected)
+{
+    size_t i = 0;
+    for (; expected[i] != nullptr; i++)
+    {
+        if (i >= lines.size() || lines[i] != expected[i])
+        {
+            return false;
+        }
+    }
+    return i == lines.size();
+}
+
+/**
+ * Release the queued modem output in chunks, polling the engine after each one
+ *
+ * @param engine Engine under test
+ * @param maxChunk Largest chunk in bytes, 0 releases everything at once
+ * @return Result of the command, AT_PENDING if it was still in flight after the last byte
+ */
+static AtResult feed(AtEngine &engine, size_t maxChunk)
+{
+    AtResult result = engine.isBusy() ? AT_PENDING : AT_IDLE;
+    do
+    {
+        modem.release(maxChunk == 0 ? modem.held() : 1 + random(maxChunk));
+        AtResult polled = engine.poll();
+        if (polled != AT_PENDING && polled != AT_IDLE)
+        {
+            result = polled;
+        }
+    } while (modem.held() > 0 || modem.available() > 0);
+    return result;
+}
+
+/**
+ * One scripted exchange with the modem
+ */
+struct AtScript
+{
+    const char *name;
+    const char *command;           // Command to send, or nullptr to only feed modem output
+    const char *finalPrefix;       // Final line prefix passed to send()
+    const char *modemOutput;       // What the modem answers
+    AtResult result;               // Expected result, AT_PENDING if the command must still be in flight
+    const char *responses[4];      // Expected response lines, nullptr terminated
+    const char *messages[3];       // Expected +CMTI: URC lines, nullptr terminated
+    uint32_t overflows;            // Expected overflow count
+    uint32_t unhandled;            // Expected unhandled count
+};
+
+static const AtScript scripts[] = {
+    {"plain command with echo", "AT+CSQ", nullptr, "AT+CSQ\r\r\n+CSQ: 20,0\r\n\r\nOK\r\n", AT_OK,
+     {"+CSQ: 20,0", nullptr}, {nullptr}, 0, 0},
+    {"OK before the final line", "AT+CNTP", "+CNTP:", "AT+CNTP\r\r\nOK\r\n\r\n+CNTP: 1\r\n", AT_OK,
+     {"+CNTP: 1", nullptr}, {nullptr}, 0, 0},
+    {"OK without the final line", "AT+CNTP", "+CNTP:", "AT+CNTP\r\r\nOK\r\n", AT_PENDING,
+     {nullptr}, {nullptr}, 0, 0},
+    {"ERROR", "AT+CCLK?", nullptr, "AT+CCLK?\r\r\nERROR\r\n", AT_ERROR, {nullptr}, {nullptr}, 0, 0},
+    {"+CME ERROR", "AT+CPIN?", nullptr, "AT+CPIN?\r\r\n+CME ERROR: 10\r\n", AT_ERROR, {nullptr}, {nullptr}, 0, 0},
+    {"+CMS ERROR before the final line", "AT+CNTP", "+CNTP:", "OK\r\n+CMS ERROR: 500\r\n", AT_ERROR,
+     {nullptr}, {nullptr}, 0, 0},
+    {"URC during a command", "AT+CCLK?", nullptr,
+     "AT+CCLK?\r\r\n+CMTI: \"SM\",1\r\n+CCLK: \"25/01/01,00:00:00+00\"\r\n+CMTI: \"SM\",2\r\n\r\nOK\r\n", AT_OK,
+     {"+CCLK: \"25/01/01,00:00:00+00\"", nullptr}, {"+CMTI: \"SM\",1", "+CMTI: \"SM\",2", nullptr}, 0, 0},
+    {"URC while idle", nullptr, nullptr, "\r\n+CMTI: \"SM\",3\r\n+CPIN: READY\r\n", AT_IDLE,
+     {nullptr}, {"+CMTI: \"SM\",3", nullptr}, 0, 1},
+    {"line longer than the buffer", "AT+CGDCONT?", nullptr,
+     "AT+CGDCONT?\r\r\n+CGDCONT: 1,\"IP\",\""
+     "0123456789012345678901234567890123456789012345678901234567890123456789"
+     "0123456789012345678901234567890123456789012345678901234567890123456789\"\r\n"
+     "+CGDCONT: 2,\"IP\",\"internet\"\r\nOK\r\n", AT_OK,
+     {"+CGDCONT: 2,\"IP\",\"internet\"", nullptr}, {nullptr}, 1, 0},
+    {"bare line feeds and missing carriage returns", "AT+GSN", nullptr, "\n\nAT+GSN\n861234567890123\nOK\n", AT_OK,
+     {"861234567890123", nullptr}, {nullptr}, 0, 0},
+};
+
+/**
+ * Run a script once
+ *
+ * @param script Script to run
+ * @param maxChunk Largest chunk in bytes, 0 releases everything at once
+ */
+static void runScript(const AtScript &script, size_t maxChunk)
+{
+    AtEngine engine(modem);
+    engine.addUrcHandler("+CMTI:", onMessage);
+    modem.reset();
+    responseLines.clear();
+    messageLines.clear();
+
+    if (script.command != nullptr)
+    {
+        expect(engine.send(script.command, TEST_COMMAND_TIMEOUT, onResponse, script.finalPrefix), script.name,
+               "send() failed");
+        expect(modem.output == std::string(script.command) + "\r\n", script.name, "command not written with CRLF");
+    }
+    modem.queue(script.modemOutput);
+
+    AtResult result = feed(engine, maxChunk);
+    char what[96];
+    snprintf(what, sizeof(what), "result %d, expected %d (max chunk %zu)", (int)result, (int)script.result, maxChunk);
+    expect(result == script.result, script.name, what);
+    expect(engine.isBusy() == (script.result == AT_PENDING), script.name, "isBusy() wrong");
+    expect(sameLines(responseLines, script.responses), script.name, "response lines differ");
+    expect(sameLines(messageLines, script.messages), script.name, "URC lines differ");
+    expect(engine.getOverflowCount() == script.overflows, script.name, "overflow count differs");
+    expect(engine.getUnhandledCount() == script.unhandled, script.name, "unhandled count differs");
+
+    // A result is reported once
+    if (script.result != AT_PENDING)
+    {
+        expect(engine.poll() == AT_IDLE, script.name, "result reported twice");
+    }
+}
+
+/**
+ * Check lines at and just past the line buffer size
+ */
+static void runLineLengths()
+{
+    const char *name = "line buffer boundary";
+    for (size_t length = AT_LINE_BUFFER_SIZE - 2; length <= AT_LINE_BUFFER_SIZE + 1; length++)
+    {
+        AtEngine engine(modem);
+        modem.reset();
+        responseLines.clear();
+        engine.send("AT+TEST", TEST_COMMAND_TIMEOUT, onResponse);
+
+        std::string line(length, 'x');
+        modem.queue((line + "\r\nOK\r\n").c_str());
+        bool fits = length <= AT_LINE_BUFFER_SIZE - 1;
+        expect(feed(engine, 7) == AT_OK, name, "command did not complete after a long line");
+        expect(fits ? responseLines.size() == 1 && responseLines[0] == line : responseLines.empty(), name,
+               fits ? "line that fits was not delivered whole" : "line that does not fit was delivered");
+        expect(engine.getOverflowCount() == (fits ? 0u : 1u), name, "overflow count differs");
+    }
+}
+
+/**
+ * Check that a command without an answer times out, and the engine is usable afterwards
+ */
+static void runTimeout()
+{
+    const char *name = "timeout";
+    AtEngine engine(modem);
+    modem.reset();
+    expect(engine.send("AT+CGATT=1", TEST_SHORT_TIMEOUT), name, "send() failed");
+    expect(engine.poll() == AT_PENDING, name, "completed without an answer");
+    expect(!engine.send("AT", TEST_COMMAND_TIMEOUT), name, "second command accepted while busy");
+    delay(TEST_SHORT_TIMEOUT + 10);
+    expect(engine.poll() == AT_TIMEOUT, name, "did not time out");
+    expect(engine.poll() == AT_IDLE, name, "timeout reported twice");
+
+    // A late OK of the timed out command is taken as an unsolicited line, not as the next answer
+    modem.queue("OK\r\n");
+    modem.release(modem.held());
+    expect(engine.send("AT+CSQ", TEST_COMMAND_TIMEOUT), name, "send() after a timeout failed");
+    expect(engine.poll() == AT_PENDING, name, "late OK completed the next command");
+    modem.queue("+CSQ: 15,0\r\nOK\r\n");
+    expect(feed(engine, 0) == AT_OK, name, "next command did not complete");
+}
+
+/**
+ * Check that the bytes after a final line are left for the next command
+ */
+static void runPipelined()
+{
+    const char *name = "bytes after the final line";
+    AtEngine engine(modem);
+    engine.addUrcHandler("+CMTI:", onMessage);
+    modem.reset();
+    messageLines.clear();
+    responseLines.clear();
+
+    engine.send("AT", TEST_COMMAND_TIMEOUT);
+    modem.queue("OK\r\n+CMTI: \"SM\",4\r\n");
+    modem.release(modem.held());
+    expect(engine.poll() == AT_OK, name, "command did not complete");
+    expect(messageLines.empty(), name, "bytes after OK were read with the command");
+    expect(modem.available() > 0, name, "bytes after OK were consumed");
+    expect(engine.poll() == AT_IDLE, name, "result reported twice");
+    expect(messageLines.size() == 1, name, "URC after OK was not dispatched");
+}
+
+/**
+ * Run many commands with URCs interleaved, in random chunks
+ *
+ * @param commands Number of commands
+ * @param maxChunk Largest chunk in bytes
+ * @return Elapsed time in microseconds
+ */
+static unsigned long runLoad(unsigned long commands, size_t maxChunk)
+{
+    const char *name = "load";
+    AtEngine engine(modem);
+    engine.addUrcHandler("+CMTI:", onMessage);
+    engine.addUrcHandler("RING", onRing);
+    messageLines.clear();
+    ringLines.clear();
+
+    unsigned long ok = 0;
+    unsigned long errors = 0;
+    unsigned long urcs = 0;
+    unsigned long start = micros();
+    for (unsigned long i = 0; i < commands; i++)
+    {
+        modem.reset();
+        responseLines.clear();
+        bool cntp = i % 3 == 1;
+        engine.send(cntp ? "AT+CNTP" : "AT+CSQ", TEST_COMMAND_TIMEOUT, onResponse, cntp ? "+CNTP:" : nullptr);
+
+        char text[96];
+        modem.queue(cntp ? "AT+CNTP\r\r\n" : "AT+CSQ\r\r\n");
+        if (i % 4 == 0)
+        {
+            snprintf(text, sizeof(text), "+CMTI: \"SM\",%lu\r\n", i);
+            modem.queue(text);
+            urcs++;
+        }
+        if (i % 5 == 0)
+        {
+            modem.queue("RING\r\n");
+        }
+        if (cntp)
+        {
+            modem.queue("OK\r\n\r\n+CNTP: 1\r\n");
+        }
+        else if (i % 7 == 0)
+        {
+            modem.queue("+CME ERROR: 100\r\n");
+        }
+        else
+        {
+            snprintf(text, sizeof(text), "+CSQ: %lu,0\r\n\r\nOK\r\n", i % 32);
+            modem.queue(text);
+        }
+
+        AtResult result = feed(engine, maxChunk);
+        bool expectedError = !cntp && i % 7 == 0;
+        if (!expect(result == (expectedError ? AT_ERROR : AT_OK), name, "wrong result") ||
+            !expect(responseLines.size() == (expectedError ? 0u : 1u), name, "wrong response lines"))
+        {
+            break;
+        }
+        ok += result == AT_OK;
+        errors += result == AT_ERROR;
+    }
+    unsigned long elapsed = micros() - start;
+
+    expect(messageLines.size() == urcs, name, "URCs lost");
+    expect(ringLines.size() == (commands + 4) / 5, name, "RING URCs lost");
+    expect(engine.getOverflowCount() == 0 && engine.getUnhandledCount() == 0, name, "lines dropped or unhandled");
+    Serial.printf("load: %lu commands (%lu OK, %lu errors), %u URCs, %lu us (%.2f us per command)\n", commands, ok,
+                  errors, (unsigned)(messageLines.size() + ringLines.size()), elapsed,
+                  commands > 0 ? (double)elapsed / commands : 0.0);
+    return elapsed;
+}
+
+int main(int argc, char **argv)
+{
+    unsigned long commands = argc > 1 ? strtoul(argv[1], nullptr, 10) : 100000;
+    size_t maxChunk = argc > 2 ? strtoul(argv[2], nullptr, 10) : 16;
+    if (maxChunk == 0)
+    {
+        maxChunk = 1;
+    }
+    randomSeed(1);
+
+    // In one piece, byte by byte and in random chunks
+    const size_t chunkSizes[] = {0, 1, 2, 3, 5, maxChunk};
+    for (const AtScript &script : scripts)
+    {
+        for (size_t chunk : chunkSizes)
+        {
+            runScript(script, chunk);
+        }
+    }
+    Serial.printf("scripts: %zu, each in %zu ways\n", sizeof(scripts) / sizeof(scripts[0]),
+                  sizeof(chunkSizes) / sizeof(chunkSizes[0]));
+
+    runLineLengths();
+    runTimeout();
+    runPipelined();
+    runLoad(commands, maxChunk);
+
+    Serial.printf("failures: %lu\n", failures);
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,485 @@
+// Microbenchmarks for the ChaCha20 library API
+//
+// Runs every encrypt/decrypt entry point of ChaCha20.h across payload sizes and round counts and
+// reports ns/byte, cycles per message, heap allocations per message and peak heap as JSON.
+//
+//   Host:  pio run -e bench_native && .pio/build/bench_native/program [iterations] > bench.json
+//   ESP32: pio run -e bench_esp32 -t upload -t monitor
+//
+// Heap usage is measured by hooking malloc/calloc/realloc/free: by symbol interposition on
+// glibc hosts, and with the linker's --wrap option on the ESP32 (see platformio.ini).
+
+#include <Arduino.h>
+#include <ArduinoJson.h>
+#include <ChaCha20.h>
+#include <ChaChaKeyring.h>
+#include <ChaChaSimd.h>
+
+#if defined(ARDUINO_ARCH_ESP32)
+#include <esp_heap_caps.h>
+#define BENCH_PLATFORM "esp32"
+#define BENCH_DEFAULT_ITERATIONS 50
+#else
+#include <chrono>
+#include <malloc.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+#define BENCH_PLATFORM "native"
+#define BENCH_DEFAULT_ITERATIONS 2000
+#endif
+
+// Largest plaintext benchmarked, hex output of the largest payload must fit in the arena
+#define BENCH_MAX_PAYLOAD 960
+#define BENCH_ARENA_SIZE (BENCH_MAX_PAYLOAD * 2 + 64)
+
+// Plaintext sizes, from a single fix up to a full MQTT buffer of binary payload
+static const size_t payloadSizes[] = {32, 160, 320, 480, 960};
+static const uint8_t roundCounts[] = {8, 12, 20};
+
+static const byte benchKey[32] = {
+    0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08,
+    0x09, 0x0A, 0x0B, 0x0C, 0x0D, 0x0E, 0x0F, 0x10,
+    0xC9, 0xCA, 0xCB, 0xCC, 0xCD, 0xCE, 0xCF, 0xD0,
+    0xD1, 0xD2, 0xD3, 0xD4, 0xD5, 0xD6, 0xD7, 0xD8};
+
+// Device whose derived key encrypts the benchmark frames, so the keyring can decrypt them
+#define BENCH_DEVICE_ID "lokatrack-bench"
+
+static uint8_t arena[BENCH_ARENA_SIZE];
+
+// Keyring with benchKey as master secret, recreated for each round count
+static ChaChaKeyring *keyring = nullptr;
+
+// Multi-block cipher holding the same key as the global cipher
+static ChaChaSimd simdCipher;
+
+// Heap accounting, updated by the allocator hooks below
+static volatile bool heapTracking = false;
+static uint32_t heapAllocations = 0;
+static size_t heapInUse = 0;
+static size_t heapPeak = 0;
+
+/**
+ * Account for an allocation
+ *
+ * @param size Usable size of the allocated block
+ */
+static void trackAllocation(size_t size)
+{
+    if (!heapTracking)
+    {
+        return;
+    }
+    heapAllocations++;
+    heapInUse += size;
+    if (heapInUse > heapPeak)
+    {
+        heapPeak = heapInUse;
+    }
+}
+
+/**
+ * Account for a release
+ *
+ * @param size Usable size of the released block
+ */
+static void trackRelease(size_t size)
+{
+    if (!heapTracking)
+    {
+        return;
+    }
+    heapInUse = size > heapInUse ? 0 : heapInUse - size;
+}
+
+#if defined(ARDUINO_ARCH_ESP32)
+extern "C"
+{
+    void *__real_malloc(size_t size);
+    void *__real_calloc(size_t n, size_t size);
+    void *__real_realloc(void *ptr, size_t size);
+    void __real_free(void *ptr);
+
+    void *__wrap_malloc(size_t size)
+    {
+        void *ptr = __real_malloc(size);
+        if (ptr != nullptr)
+        {
+            trackAllocation(heap_caps_get_allocated_size(ptr));
+        }
+        return ptr;
+    }
+
+    void *__wrap_calloc(size_t n, size_t size)
+    {
+        void *ptr = __real_calloc(n, size);
+        if (ptr != nullptr)
+        {
+            trackAllocation(heap_caps_get_allocated_size(ptr));
+        }
+        return ptr;
+    }
+
+    void *__wrap_realloc(void *ptr, size_t size)
+    {
+        size_t oldSize = ptr != nullptr ? heap_caps_get_allocated_size(ptr) : 0;
+        void *grown = __real_realloc(ptr, size);
+        if (grown != nullptr)
+        {
+            trackRelease(oldSize);
+            trackAllocation(heap_caps_get_allocated_size(grown));
+        }
+        return grown;
+    }
+
+    void __wrap_free(void *ptr)
+    {
+        if (ptr != nullptr)
+        {
+            trackRelease(heap_caps_get_allocated_size(ptr));
+        }
+        __real_free(ptr);
+    }
+}
+#elif defined(__GLIBC__)
+extern "C"
+{
+    void *__libc_malloc(size_t size);
+    void *__libc_calloc(size_t n, size_t size);
+    void *__libc_realloc(void *ptr, size_t size);
+    void __libc_free(void *ptr);
+
+    void *malloc(size_t size)
+    {
+        void *ptr = __libc_malloc(size);
+        if (ptr != nullptr)
+        {
+            trackAllocation(malloc_usable_size(ptr));
+        }
+        return ptr;
+    }
+
+    void *calloc(size_t n, size_t size)
+    {
+        void *ptr = __libc_calloc(n, size);
+        if (ptr != nullptr)
+        {
+            trackAllocation(malloc_usable_size(ptr));
+        }
+        return ptr;
+    }
+
+    void *realloc(void *ptr, size_t size)
+    {
+        size_t oldSize = ptr != nullptr ? malloc_usable_size(ptr) : 0;
+        void *grown = __libc_realloc(ptr, size);
+        if (grown != nullptr)
+        {
+            trackRelease(oldSize);
+            trackAllocation(malloc_usable_size(grown));
+        }
+        return grown;
+    }
+
+    void free(void *ptr)
+    {
+        if (ptr != nullptr)
+        {
+            trackRelease(malloc_usable_size(ptr));
+        }
+        __libc_free(ptr);
+    }
+}
+#endif
+
+/**
+ * Read the CPU cycle counter
+ *
+ * @return Current cycle count, or 0 if the platform has no cycle counter
+ */
+static uint64_t readCycles()
+{
+#if defined(ARDUINO_ARCH_ESP32)
+    return ESP.getCycleCount();
+#elif defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    return 0;
+#endif
+}
+
+/**
+ * Read a monotonic clock in nanoseconds
+ *
+ * @return Current time in nanoseconds
+ */
+static uint64_t readNanos()
+{
+#if defined(ARDUINO_ARCH_ESP32)
+    return (uint64_t)esp_timer_get_time() * 1000;
+#else
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+}
+
+/**
+ * State shared by the benchmarked operations
+ */
+struct BenchInput
+{
+    size_t payloadSize;
+    String plain;           // Plaintext of payloadSize bytes
+    JsonDocument doc;       // Document serializing to payloadSize bytes
+    String hexCiphertext;   // encryptString() output for plain
+    size_t binaryFrameSize; // Size of the binary frame for plain
+    uint8_t binaryFrame[BENCH_MAX_PAYLOAD + 32];
+};
+
+static BenchInput input;
+
+typedef void (*BenchOperation)();
+
+static void benchEncryptString()
+{
+    String encrypted = encryptString(input.plain);
+}
+
+static void benchDecryptString()
+{
+    String decrypted = decryptString(input.hexCiphertext);
+}
+
+static void benchEncryptJson()
+{
+    String encrypted = encryptJson(input.doc);
+}
+
+static void benchDecryptJson()
+{
+    JsonDocument doc;
+    decryptJson(input.hexCiphertext, doc);
+}
+
+static void benchDecryptBinaryFrame()
+{
+    String decrypted = decryptString(input.binaryFrame, input.binaryFrameSize);
+}
+
+static void benchKeyringDecryptBinaryFrame()
+{
+    String decrypted = keyring->decryptString(BENCH_DEVICE_ID, input.binaryFrame, input.binaryFrameSize);
+}
+
+static void benchSimdDecryptBinaryFrame()
+{
+    String decrypted = decryptString(simdCipher, input.binaryFrame, input.binaryFrameSize);
+}
+
+static void benchDecryptIntoHex()
+{
+    decryptInto((const uint8_t *)input.hexCiphertext.c_str(), input.hexCiphertext.length(), arena, sizeof(arena));
+}
+
+static void benchDecryptJsonInPlaceBinary()
+{
+    // Includes copying the frame, as decrypting in place consumes it
+    JsonDocument doc;
+    memcpy(arena, input.binaryFrame, input.binaryFrameSize);
+    decryptJsonInPlace(arena, input.binaryFrameSize, doc);
+}
+
+static void benchEncryptJsonIntoBinary()
+{
+    encryptJsonInto(input.doc, arena, sizeof(arena), PAYLOAD_FORMAT_BINARY);
+}
+
+static void benchEncryptJsonIntoBase64()
+{
+    encryptJsonInto(input.doc, arena, sizeof(arena), PAYLOAD_FORMAT_BASE64);
+}
+
+static void benchEncryptJsonIntoHex()
+{
+    encryptJsonInto(input.doc, arena, sizeof(arena), PAYLOAD_FORMAT_HEX);
+}
+
+static void prefetchFullKeystream()
+{
+    while (!prefetchKeystreamStep(BENCH_MAX_PAYLOAD, true))
+    {
+    }
+}
+
+static void benchEncryptInPlace()
+{
+    memcpy(arena + getPlaintextOffset(PAYLOAD_FORMAT_BINARY), input.plain.c_str(), input.payloadSize);
+    encryptInPlace(arena, sizeof(arena), input.payloadSize, PAYLOAD_FORMAT_BINARY, true);
+}
+
+struct BenchCase
+{
+    const char *api;
+    BenchOperation run;
+    BenchOperation prepare; // Untimed setup before each iteration, or nullptr
+};
+
+static const BenchCase benchCases[] = {
+    {"encryptString", benchEncryptString},
+    {"decryptString", benchDecryptString},
+    {"encryptJson", benchEncryptJson},
+    {"decryptJson", benchDecryptJson},
+    {"decryptString(binary)", benchDecryptBinaryFrame},
+    {"keyring.decryptString(binary)", benchKeyringDecryptBinaryFrame},
+    {"ChaChaSimd.decryptString(binary)", benchSimdDecryptBinaryFrame},
+    {"decryptInto(hex)", benchDecryptIntoHex},
+    {"decryptJsonInPlace(binary)", benchDecryptJsonInPlaceBinary},
+    {"encryptJsonInto(binary)", benchEncryptJsonIntoBinary},
+    {"encryptJsonInto(base64)", benchEncryptJsonIntoBase64},
+    {"encryptJsonInto(hex)", benchEncryptJsonIntoHex},
+    {"encryptInPlace(binary)", benchEncryptInPlace},
+    {"encryptInPlace(binary,prefetched)", benchEncryptInPlace, prefetchFullKeystream},
+};
+
+/**
+ * Prepare the inputs for one payload size
+ *
+ * @param payloadSize Plaintext size in bytes
+ */
+static void prepareInput(size_t payloadSize)
+{
+    input.payloadSize = payloadSize;
+
+    // {"data":"xxxx"} serializes to 11 bytes plus the string
+    String data;
+    data.reserve(payloadSize);
+    for (size_t i = 0; i + 11 < payloadSize; i++)
+    {
+        data += (char)('a' + i % 26);
+    }
+    input.doc.clear();
+    input.doc["data"] = data;
+
+    input.plain = "";
+    serializeJson(input.doc, input.plain);
+    input.hexCiphertext = encryptString(input.plain);
+
+    memcpy(arena + getPlaintextOffset(PAYLOAD_FORMAT_BINARY), input.plain.c_str(), payloadSize);
+    input.binaryFrameSize = encryptInPlace(arena, sizeof(arena), payloadSize, PAYLOAD_FORMAT_BINARY, true);
+    memcpy(input.binaryFrame, arena, input.binaryFrameSize);
+}
+
+/**
+ * Run one benchmark case and print its result as a JSON object
+ *
+ * @param benchCase Case to run
+ * @param rounds Number of ChaCha rounds
+ * @param iterations Number of timed iterations
+ * @param first Whether this is the first result in the array
+ */
+static void runCase(const BenchCase &benchCase, uint8_t rounds, uint32_t iterations, bool first)
+{
+    // Warm up caches and any lazily initialized state
+    benchCase.run();
+
+    heapAllocations = 0;
+    heapInUse = 0;
+    heapPeak = 0;
+    uint64_t cycles = 0;
+    uint64_t nanos = 0;
+
+    heapTracking = true;
+    for (uint32_t i = 0; i < iterations; i++)
+    {
+        if (benchCase.prepare != nullptr)
+        {
+            heapTracking = false;
+            benchCase.prepare();
+            heapTracking = true;
+        }
+
+        uint64_t startNanos = readNanos();
+        uint32_t startCycles = (uint32_t)readCycles();
+        benchCase.run();
+        cycles += (uint32_t)readCycles() - startCycles;
+        nanos += readNanos() - startNanos;
+    }
+    heapTracking = false;
+
+    Serial.printf("%s\n    {\"api\": \"%s\", \"rounds\": %u, \"payloadBytes\": %u, \"iterations\": %lu, "
+                  "\"nsPerByte\": %.3f, \"nsPerMessage\": %.1f, \"cyclesPerMessage\": %.1f, "
+                  "\"allocationsPerMessage\": %.2f, \"peakHeapBytes\": %u}",
+                  first ? "" : ",",
+                  benchCase.api, (unsigned)rounds, (unsigned)input.payloadSize, (unsigned long)iterations,
+                  (double)nanos / iterations / input.payloadSize,
+                  (double)nanos / iterations,
+                  (double)cycles / iterations,
+                  (double)heapAllocations / iterations,
+                  (unsigned)heapPeak);
+}
+
+/**
+ * Run the whole suite and print the results as a JSON document
+ *
+ * @param iterations Number of timed iterations per case
+ */
+static void runBenchmarks(uint32_t iterations)
+{
+    Serial.printf("{\n  \"platform\": \"%s\",\n  \"chachaKernel\": \"%s\",\n  \"results\": [",
+                  BENCH_PLATFORM, getChaChaKernelName(getChaChaKernel()));
+
+    bool first = true;
+    for (uint8_t rounds : roundCounts)
+    {
+        // Encrypt with the key the keyring derives for BENCH_DEVICE_ID
+        byte deviceKey[DEVICE_KEY_SIZE];
+        deriveDeviceKey(benchKey, sizeof(benchKey), BENCH_DEVICE_ID, deviceKey);
+        initChaChaCustom(deviceKey, sizeof(deviceKey), nullptr, nullptr, rounds);
+        simdCipher.setNumRounds(rounds);
+        simdCipher.setKey(deviceKey, sizeof(deviceKey));
+        keyring = new ChaChaKeyring(benchKey, sizeof(benchKey), 8, rounds);
+
+        for (size_t payloadSize : payloadSizes)
+        {
+            prepareInput(payloadSize);
+            for (const BenchCase &benchCase : benchCases)
+            {
+                runCase(benchCase, rounds, iterations, first);
+                first = false;
+            }
+        }
+
+        delete keyring;
+        keyring = nullptr;
+    }
+
+    Serial.printf("\n  ]\n}\n");
+}
+
+#if defined(ARDUINO_ARCH_ESP32)
+void setup()
+{
+    Serial.begin(115200);
+    delay(2000);
+    initChaCha();
+    runBenchmarks(BENCH_DEFAULT_ITERATIONS);
+}
+
+void loop()
+{
+    delay(1000);
+}
+#else
+int main(int argc, char **argv)
+{
+    uint32_t iterations = argc > 1 ? strtoul(argv[1], nullptr, 10) : BENCH_DEFAULT_ITERATIONS;
+    if (iterations == 0)
+    {
+        iterations = 1;
+    }
+
+    initChaCha();
+    runBenchmarks(iterations);
+    return 0;
+}
+#endif
@@ -0,0 +1,253 @@
+// Host (native) benchmark of the fix batch encodings
+//
+// Takes the fixes of a synthetic 5 Hz route through the UBX decoder and serializes them in
+// batches with every encoding, reporting bytes per fix and encode time and cycles. Columnar
+// batches are decoded again, checked to give back the same JSON as the original fixes, and
+// their decode throughput is compared with parsing the JSON batch with ArduinoJson:
+//
+//   pio run -e codec_native && .pio/build/codec_native/program [fixes] [iterations]
+//   pio run -e codec_esp32 -t upload -t monitor   # cycles from ESP.getCycleCount() on the device
+
+#include <Arduino.h>
+#include <ArduinoJson.h>
+#include <GpsFix.h>
+#include <JsonArena.h>
+#include <UbxGps.h>
+#include <GpsSource.h>
+#include <vector>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+#define CODEC_DEVICE_ID "lokatrack-codec-1"
+#define CODEC_BUFFER_SIZE 8192
+#define CODEC_MAX_BATCH 64
+#define CODEC_ESP32_FIXES 500
+#define CODEC_ESP32_ITERATIONS 10
+
+static uint8_t batchBuffer[CODEC_BUFFER_SIZE];
+static uint8_t jsonArenaBuffer[CODEC_BUFFER_SIZE * 4];
+
+/**
+ * Read the CPU cycle counter
+ *
+ * @return Current cycle count, or 0 if the platform has no cycle counter
+ */
+static uint64_t readCycles()
+{
+#if defined(ARDUINO_ARCH_ESP32)
+    return ESP.getCycleCount();
+#elif defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    return 0;
+#endif
+}
+
+/**
+ * Collect the fixes of a synthetic route, like readGpsFix() captures them on the device
+ *
+ * @param fixes Receives the fixes
+ * @param count Number of fixes to collect
+ */
+static void collectFixes(std::vector<GpsFix> &fixes, size_t count)
+{
+    GpsSyntheticSource source(GPS_SYNTHETIC_UBX, 5, 0, 1);
+    UbxGps ubxGps(UBX_EPOCH_NEO6);
+    uint8_t chunk[128];
+    uint32_t lastEpoch = 0;
+
+    while (fixes.size() < count)
+    {
+        ubxGps.feed(chunk, source.read(chunk, sizeof(chunk), 0));
+        if (ubxGps.getEpochCount() == lastEpoch)
+        {
+            continue;
+        }
+        lastEpoch = ubxGps.getEpochCount();
+
+        GpsFix fix = {};
+        fix.id = CODEC_DEVICE_ID;
+        fix.dummy = true;
+        if (ubxGps.getUtcTime(&fix.timestamp))
+        {
+            fix.valid |= GPS_FIX_HAS_TIME;
+        }
+        ubxGps.fillFix(fix);
+        fixes.push_back(fix);
+    }
+}
+
+/**
+ * Load a ring buffer with a batch of fixes
+ *
+ * @param batch Ring buffer to load
+ * @param fixes Fixes of the route
+ * @param start Index of the first fix of the batch
+ * @param size Number of fixes in the batch
+ */
+static void loadBatch(RingBuffer<GpsFix, CODEC_MAX_BATCH> &batch, const std::vector<GpsFix> &fixes, size_t start, size_t size)
+{
+    batch.pop(batch.size());
+    for (size_t i = 0; i < size; i++)
+    {
+        batch.push(fixes[(start + i) % fixes.size()]);
+    }
+}
+
+/**
+ * Check that a columnar batch decodes to the same JSON as the original fixes
+ *
+ * @param batch Original fixes
+ * @param length Length of the columnar batch in batchBuffer
+ * @return true if every fix matches, false otherwise
+ */
+static bool checkRoundTrip(const RingBuffer<GpsFix, CODEC_MAX_BATCH> &batch, size_t length)
+{
+    GpsFix decoded[CODEC_MAX_BATCH];
+    char strings[256];
+    size_t count = deserializeGpsFixColumns(batchBuffer, length, decoded, CODEC_MAX_BATCH, strings, sizeof(strings));
+    if (count != batch.size())
+    {
+        return false;
+    }
+
+    for (size_t i = 0; i < count; i++)
+    {
+        char expected[256];
+        char actual[256];
+        size_t expectedLength = serializeGpsFix(batch[i], FIX_ENCODING_JSON, (uint8_t *)expected, sizeof(expected));
+        size_t actualLength = serializeGpsFix(decoded[i], FIX_ENCODING_JSON, (uint8_t *)actual, sizeof(actual));
+        if (expectedLength == 0 || expectedLength != actualLength || memcmp(expected, actual, expectedLength) != 0)
+        {
+            Serial.printf("mismatch at fix %zu:\n  %.*s\n  %.*s\n", i, (int)expectedLength, expected, (int)actualLength, actual);
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * Run the benchmark and print the results
+ *
+ * @param fixCount Number of fixes of the route
+ * @param iterations Number of times each batch is encoded and decoded
+ * @return Number of batches that failed to encode or to decode back to the same fixes
+ */
+static unsigned long runBenchmarks(size_t fixCount, unsigned long iterations)
+{
+    std::vector<GpsFix> fixes;
+    collectFixes(fixes, fixCount);
+    Serial.printf("fixes: %zu from a synthetic 5 Hz route, %lu iterations\n", fixes.size(), iterations);
+
+    static const FixEncoding encodings[] = {FIX_ENCODING_JSON, FIX_ENCODING_BINARY, FIX_ENCODING_COLUMNAR};
+    static const char *encodingNames[] = {"json", "binary", "columnar"};
+    static const size_t batchSizes[] = {1, 5, 32};
+
+    RingBuffer<GpsFix, CODEC_MAX_BATCH> batch;
+    unsigned long failures = 0;
+    JsonArena jsonArena(jsonArenaBuffer, sizeof(jsonArenaBuffer));
+    JsonDocument doc(&jsonArena);
+
+    for (size_t batchSize : batchSizes)
+    {
+        for (size_t e = 0; e < sizeof(encodings) / sizeof(encodings[0]); e++)
+        {
+            uint64_t bytes = 0;
+            uint64_t encoded = 0;
+            unsigned long encodeTime = 0;
+            uint64_t encodeCycles = 0;
+            unsigned long decodeTime = 0;
+
+            for (size_t start = 0; start + batchSize <= fixes.size(); start += batchSize)
+            {
+                loadBatch(batch, fixes, start, batchSize);
+                size_t count = 0;
+                size_t length = 0;
+
+                unsigned long begin = micros();
+                uint64_t beginCycles = readCycles();
+                for (unsigned long i = 0; i < iterations; i++)
+                {
+                    length = serializeGpsFixBatch(batch, batchSize, encodings[e], batchBuffer, sizeof(batchBuffer), &count);
+                }
+                encodeCycles += readCycles() - beginCycles;
+                encodeTime += micros() - begin;
+                if (length == 0 || count != batchSize)
+                {
+                    failures++;
+                    continue;
+                }
+                bytes += length;
+                encoded += count;
+
+                if (encodings[e] == FIX_ENCODING_COLUMNAR)
+                {
+                    GpsFix decoded[CODEC_MAX_BATCH];
+                    char strings[256];
+                    begin = micros();
+                    for (unsigned long i = 0; i < iterations; i++)
+                    {
+                        deserializeGpsFixColumns(batchBuffer, length, decoded, CODEC_MAX_BATCH, strings, sizeof(strings));
+                    }
+                    decodeTime += micros() - begin;
+                    if (!checkRoundTrip(batch, length))
+                    {
+                        failures++;
+                    }
+                }
+                else if (encodings[e] == FIX_ENCODING_JSON)
+                {
+                    begin = micros();
+                    for (unsigned long i = 0; i < iterations; i++)
+                    {
+                        doc.clear();
+                        jsonArena.reset();
+                        deserializeJson(doc, (const char *)batchBuffer, length);
+                    }
+                    decodeTime += micros() - begin;
+                }
+            }
+
+            double perFix = encoded > 0 ? 1000.0 / (encoded * iterations) : 0.0;
+            Serial.printf("batch %2zu %-9s %7.2f bytes/fix, encode %7.1f ns/fix %7.1f cycles/fix", batchSize,
+                          encodingNames[e], encoded > 0 ? (double)bytes / encoded : 0.0, encodeTime * perFix,
+                          encodeCycles * perFix / 1000.0);
+            if (decodeTime > 0)
+            {
+                Serial.printf(", decode %7.1f ns/fix", decodeTime * perFix);
+            }
+            Serial.println();
+        }
+    }
+
+    Serial.printf("failures: %lu\n", failures);
+    return failures;
+}
+
+#if defined(ARDUINO_ARCH_ESP32)
+void setup()
+{
+    Serial.begin(115200);
+    delay(2000);
+    runBenchmarks(CODEC_ESP32_FIXES, CODEC_ESP32_ITERATIONS);
+}
+
+void loop()
+{
+    delay(1000);
+}
+#else
+int main(int argc, char **argv)
+{
+    size_t fixCount = argc > 1 ? strtoul(argv[1], nullptr, 10) : 5000;
+    unsigned long iterations = argc > 2 ? strtoul(argv[2], nullptr, 10) : 20;
+    if (fixCount == 0)
+    {
+        Serial.println("Expected at least one fix");
+        return 2;
+    }
+
+    return runBenchmarks(fixCount, iterations) == 0 ? 0 : 1;
+}
+#endif
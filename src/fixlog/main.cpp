@@ -0,0 +1,450 @@
+// Host (native) load test for the store-and-forward fix log
+//
+// Runs FixLog against a directory of the host file system through a simulated day of
+// outages, failed publishes and power losses, and checks that every fix that was not
+// dropped for lack of space is replayed exactly once and in order. Each power loss tears
+// the last record on flash, as a write cut short would. A second phase then tears the log
+// on purpose, round after round, and checks that every record before the tear is replayed
+// exactly once and that the torn tail is skipped as corrupt:
+//
+//   pio run -e fixlog_native && .pio/build/fixlog_native/program [fixes] [segmentSize] [maxSegments] [directory]
+
+#include <Arduino.h>
+#include <GpsFix.h>
+#include <FixLog.h>
+#include <dirent.h>
+#include <stdio.h>
+#include <unistd.h>
+
+#define LOAD_DEVICE_ID "lokatrack-load-1"
+#define LOAD_BATCH_SIZE 5
+#define LOAD_REPLAY_BATCH 50
+#define LOAD_PAYLOAD_SIZE 4096
+#define LOAD_TORN_ROUNDS 60
+
+// Layout of a record on flash, see FixLogRecordHeader
+#define LOAD_RECORD_HEADER_SIZE 8
+#define LOAD_RECORD_MAGIC 0x4C46
+
+// How the tail of a torn segment looks after the power comes back
+enum TearStyle
+{
+    TEAR_GARBAGE = 0,   // Cut, then random bytes
+    TEAR_BAD_CRC = 1,   // Cut, then a well-formed record with a wrong CRC
+    TEAR_TRUNCATED = 2, // Cut only
+    TEAR_STYLE_COUNT = 3
+};
+
+static uint8_t recordBuffer[FIX_LOG_MAX_RECORD_SIZE];
+static uint8_t batchBuffer[LOAD_PAYLOAD_SIZE + 1];
+
+/**
+ * Fill a fix with deterministic data, numbered through the satellites field
+ *
+ * @param fix Fix to fill
+ * @param index Index of the fix
+ */
+static void makeFix(GpsFix &fix, uint32_t index)
+{
+    fix = {};
+    fix.id = LOAD_DEVICE_ID;
+    fix.timestamp = 1735689600000ULL + index * 1000ULL; // 2025-01-01T00:00:00Z onwards
+    fix.lat = -62087634 + (int32_t)index * 123;
+    fix.lng = 1068455990 + (int32_t)index * 456;
+    fix.satellites = index;
+    fix.speed = 3000 + (index % 20) * 100;
+    fix.dummy = true;
+    fix.valid = GPS_FIX_HAS_LOCATION | GPS_FIX_HAS_SPEED | GPS_FIX_HAS_TIME;
+}
+
+/**
+ * Get the index of a serialized fix, see makeFix()
+ *
+ * @param record JSON record
+ * @param len Length of the record in bytes
+ * @return Index of the fix, -1 if it has none
+ */
+static long getFixIndex(const uint8_t *record, size_t len)
+{
+    char text[FIX_LOG_MAX_RECORD_SIZE + 1];
+    len = len < FIX_LOG_MAX_RECORD_SIZE ? len : FIX_LOG_MAX_RECORD_SIZE;
+    memcpy(text, record, len);
+    text[len] = '\0';
+    const char *field = strstr(text, "\"satellites\":");
+    return field != nullptr ? strtol(field + strlen("\"satellites\":"), nullptr, 10) : -1;
+}
+
+/**
+ * Cut the newest segment in the middle of its last record, as a power loss during a write would
+ *
+ * @param directory Log directory
+ * @param style What is left after the cut
+ * @param tornIndex Receives the index of the fix in the torn record
+ * @return true if a record was torn, false if there was none on flash
+ */
+static bool tearLastRecord(const char *directory, TearStyle style, long *tornIndex)
+{
+    // The newest segment has the highest sequence number
+    DIR *dir = opendir(directory);
+    if (dir == nullptr)
+    {
+        return false;
+    }
+    long newest = -1;
+    for (struct dirent *entry = readdir(dir); entry != nullptr; entry = readdir(dir))
+    {
+        char *end;
+        long seq = strtol(entry->d_name, &end, 16);
+        if (end != entry->d_name && strcmp(end, ".log") == 0 && seq > newest)
+        {
+            newest = seq;
+        }
+    }
+    closedir(dir);
+    if (newest < 0)
+    {
+        return false;
+    }
+
+    char path[FIX_LOG_PATH_SIZE + 16];
+    snprintf(path, sizeof(path), "%s/%08lx.log", directory, (unsigned long)newest);
+    FILE *file = fopen(path, "rb");
+    if (file == nullptr)
+    {
+        return false;
+    }
+
+    // Walk the records up to the last one
+    uint8_t header[LOAD_RECORD_HEADER_SIZE];
+    long lastStart = -1;
+    size_t lastLen = 0;
+    long position = 0;
+    while (fread(header, 1, sizeof(header), file) == sizeof(header))
+    {
+        size_t len = header[2] | (header[3] << 8);
+        if ((header[0] | (header[1] << 8)) != LOAD_RECORD_MAGIC || len == 0 || len > FIX_LOG_MAX_RECORD_SIZE ||
+            fread(recordBuffer, 1, len, file) != len)
+        {
+            break;
+        }
+        lastStart = position;
+        lastLen = len;
+        *tornIndex = getFixIndex(recordBuffer, len);
+        position += sizeof(header) + len;
+    }
+    fclose(file);
+    if (lastStart < 0)
+    {
+        return false;
+    }
+
+    // Cut anywhere inside the record, header included, but never at its end
+    long cut = lastStart + 1 + random(LOAD_RECORD_HEADER_SIZE + lastLen - 1);
+    if (truncate(path, cut) != 0)
+    {
+        return false;
+    }
+
+    file = fopen(path, "ab");
+    if (file == nullptr)
+    {
+        return false;
+    }
+    if (style == TEAR_GARBAGE)
+    {
+        for (long i = random(1, 64); i > 0; i--)
+        {
+            fputc((int)random(256), file);
+        }
+    }
+    else if (style == TEAR_BAD_CRC)
+    {
+        GpsFix fix;
+        makeFix(fix, 0);
+        size_t len = serializeGpsFix(fix, FIX_ENCODING_JSON, recordBuffer, sizeof(recordBuffer));
+        uint8_t badHeader[LOAD_RECORD_HEADER_SIZE] = {LOAD_RECORD_MAGIC & 0xFF, LOAD_RECORD_MAGIC >> 8,
+                                                      (uint8_t)len, (uint8_t)(len >> 8), 0xDE, 0xAD, 0xBE, 0xEF};
+        fwrite(badHeader, 1, sizeof(badHeader), file);
+        fwrite(recordBuffer, 1, len, file);
+    }
+    fclose(file);
+    return true;
+}
+
+/**
+ * Tear the log again and again and check what comes back
+ * Each round appends and flushes a run of fixes, tears the last one, reopens the log, appends
+ * a few more and replays everything. Every fix but the torn one must come back exactly once
+ * and in order, and the torn tail must be counted as corrupt.
+ *
+ * @param directory Log directory
+ * @param segmentSize Maximum size of a segment file in bytes
+ * @param maxSegments Maximum number of segment files
+ * @param rounds Number of tears
+ * @param stats Receives the fixes appended and replayed and the corrupt records over all rounds
+ * @return Number of failed checks
+ */
+static unsigned long runTornWrites(const char *directory, uint32_t segmentSize, uint16_t maxSegments, unsigned long rounds,
+                                   FixLogStats &stats)
+{
+    unsigned long failures = 0;
+    uint32_t nextIndex = 0;
+    stats = {};
+
+    // Keep each round well within the log, so no segment is dropped for space
+    long perRound = (long)(segmentSize / (FIX_LOG_MAX_RECORD_SIZE + LOAD_RECORD_HEADER_SIZE)) * (maxSegments > 3 ? maxSegments - 3 : 1);
+    perRound = perRound < 2 ? 2 : perRound > 200 ? 200 : perRound;
+
+    for (unsigned long round = 0; round < rounds; round++)
+    {
+        // Fixes on flash before the power loss, the torn one included. At least two, so the tear
+        // is behind a fix still to replay: a lone torn fix is discarded whole by begin()
+        FixLog *log = new FixLog(directory, segmentSize, maxSegments);
+        if (!log->begin())
+        {
+            delete log;
+            return failures + 1;
+        }
+        uint32_t first = nextIndex;
+        for (long i = random(2, perRound + 1); i > 0; i--)
+        {
+            GpsFix fix;
+            makeFix(fix, nextIndex++);
+            size_t len = serializeGpsFix(fix, FIX_ENCODING_JSON, recordBuffer, sizeof(recordBuffer));
+            if (len == 0 || !log->append(recordBuffer, len))
+            {
+                failures++;
+            }
+        }
+        if (!log->flush())
+        {
+            failures++;
+        }
+        delete log;
+
+        long torn = -1;
+        if (!tearLastRecord(directory, (TearStyle)(round % TEAR_STYLE_COUNT), &torn) || torn != (long)nextIndex - 1)
+        {
+            Serial.printf("Round %lu: the last fix on flash was not torn\n", round);
+            failures++;
+        }
+
+        // Fixes after the power comes back must not end up behind the torn tail
+        log = new FixLog(directory, segmentSize, maxSegments);
+        if (!log->begin())
+        {
+            delete log;
+            return failures + 1;
+        }
+        for (long i = random(1, perRound < 20 ? perRound + 1 : 20); i > 0; i--)
+        {
+            GpsFix fix;
+            makeFix(fix, nextIndex++);
+            size_t len = serializeGpsFix(fix, FIX_ENCODING_JSON, recordBuffer, sizeof(recordBuffer));
+            if (len == 0 || !log->append(recordBuffer, len))
+            {
+                failures++;
+            }
+        }
+
+        // Everything but the torn fix comes back, once and in order
+        uint32_t expected = first;
+        while (!log->empty())
+        {
+            size_t count = 0;
+            size_t len = log->peekBatch(FIX_ENCODING_JSON, LOAD_REPLAY_BATCH, batchBuffer, LOAD_PAYLOAD_SIZE, &count);
+            if (len == 0)
+            {
+                continue; // Only the torn tail was left in the segment
+            }
+            batchBuffer[len] = '\0';
+            for (const char *field = strstr((const char *)batchBuffer, "\"satellites\":"); field != nullptr;
+                 field = strstr(field + 1, "\"satellites\":"))
+            {
+                if ((long)expected == torn)
+                {
+                    expected++;
+                }
+                long index = strtol(field + strlen("\"satellites\":"), nullptr, 10);
+                if (index != (long)expected)
+                {
+                    Serial.printf("Round %lu: replayed fix %ld, expected %u\n", round, index, (unsigned)expected);
+                    failures++;
+                }
+                expected = index + 1;
+                stats.replayed++;
+            }
+            log->commitBatch();
+        }
+        if (expected != nextIndex)
+        {
+            Serial.printf("Round %lu: replay stopped at fix %u of %u\n", round, (unsigned)expected, (unsigned)nextIndex);
+            failures++;
+        }
+
+        const FixLogStats &roundStats = log->getStats();
+        if (roundStats.corruptRecords == 0 || roundStats.droppedSegments != 0)
+        {
+            Serial.printf("Round %lu: %u corrupt records, %u dropped segments\n", round,
+                          (unsigned)roundStats.corruptRecords, (unsigned)roundStats.droppedSegments);
+            failures++;
+        }
+        stats.appended = nextIndex;
+        stats.corruptRecords += roundStats.corruptRecords;
+        delete log;
+    }
+    return failures;
+}
+
+/**
+ * Remove the files of a previous run
+ *
+ * @param directory Log directory
+ */
+static void clearDirectory(const char *directory)
+{
+    char command[FIX_LOG_PATH_SIZE + 16];
+    snprintf(command, sizeof(command), "rm -rf '%s'", directory);
+    if (system(command) != 0)
+    {
+        Serial.println("Failed to clear the log directory");
+    }
+}
+
+int main(int argc, char **argv)
+{
+    unsigned long fixes = argc > 1 ? strtoul(argv[1], nullptr, 10) : 100000;
+    uint32_t segmentSize = argc > 2 ? strtoul(argv[2], nullptr, 10) : 16384;
+    uint16_t maxSegments = argc > 3 ? strtoul(argv[3], nullptr, 10) : 8;
+    const char *directory = argc > 4 ? argv[4] : "/tmp/lokatrack-fixlog";
+
+    clearDirectory(directory);
+    randomSeed(1);
+
+    FixLog *log = new FixLog(directory, segmentSize, maxSegments);
+    if (!log->begin())
+    {
+        return 2;
+    }
+
+    unsigned long failures = 0;
+    unsigned long replayed = 0;
+    unsigned long powerLosses = 0;
+    long lastReplayed = -1;
+    bool connected = true;
+    unsigned long appendMicros = 0;
+    unsigned long replayMicros = 0;
+    unsigned long batches = 0;
+    FixLogStats totals = {};
+
+    for (unsigned long i = 0; i < fixes || !log->empty(); i++)
+    {
+        // Outages of random length, and now and then a power loss
+        if (random(1000) < 5)
+        {
+            connected = !connected;
+        }
+        if (random(100000) < 5)
+        {
+            const FixLogStats &stats = log->getStats();
+            totals.appended += stats.appended;
+            totals.replayed += stats.replayed;
+            totals.droppedSegments += stats.droppedSegments;
+            totals.corruptRecords += stats.corruptRecords;
+            totals.flushes += stats.flushes;
+            delete log; // Buffered records are lost with the RAM
+            long torn;
+            tearLastRecord(directory, (TearStyle)(powerLosses % TEAR_STYLE_COUNT), &torn);
+            log = new FixLog(directory, segmentSize, maxSegments);
+            if (!log->begin())
+            {
+                return 2;
+            }
+            powerLosses++;
+        }
+
+        if (i < fixes && !connected)
+        {
+            // Spill a batch while offline
+            unsigned long start = micros();
+            GpsFix fix;
+            makeFix(fix, i);
+            size_t len = serializeGpsFix(fix, FIX_ENCODING_JSON, recordBuffer, sizeof(recordBuffer));
+            if (len == 0 || !log->append(recordBuffer, len))
+            {
+                failures++;
+            }
+            if (i % LOAD_BATCH_SIZE == LOAD_BATCH_SIZE - 1)
+            {
+                log->flush();
+            }
+            appendMicros += micros() - start;
+            continue;
+        }
+
+        if (!connected && i >= fixes)
+        {
+            connected = true;
+        }
+
+        // Replay one batch per pass while online, failing 5% of the publishes
+        unsigned long start = micros();
+        size_t count = 0;
+        size_t len = log->peekBatch(FIX_ENCODING_JSON, LOAD_REPLAY_BATCH, batchBuffer, LOAD_PAYLOAD_SIZE, &count);
+        if (len == 0 || random(100) < 5)
+        {
+            replayMicros += micros() - start;
+            continue;
+        }
+
+        // Walk the fix numbers of the batch without a full JSON parse
+        size_t found = 0;
+        batchBuffer[len] = '\0';
+        for (const char *field = strstr((const char *)batchBuffer, "\"satellites\":"); field != nullptr;
+             field = strstr(field + 1, "\"satellites\":"))
+        {
+            long index = strtol(field + strlen("\"satellites\":"), nullptr, 10);
+            if (index <= lastReplayed)
+            {
+                failures++; // Replayed twice or out of order
+            }
+            lastReplayed = index;
+            found++;
+        }
+        if (batchBuffer[0] != '[' || batchBuffer[len - 1] != ']' || found != count)
+        {
+            failures++;
+        }
+        log->commitBatch();
+        replayMicros += micros() - start;
+        replayed += count;
+        batches++;
+    }
+
+    const FixLogStats &stats = log->getStats();
+    totals.appended += stats.appended;
+    totals.replayed += stats.replayed;
+    totals.droppedSegments += stats.droppedSegments;
+    totals.corruptRecords += stats.corruptRecords;
+    totals.flushes += stats.flushes;
+
+    Serial.printf("fixes: %lu, spilled: %u, replayed: %lu in %lu batches\n", fixes, (unsigned)totals.appended, replayed, batches);
+    unsigned long lost = totals.appended - replayed;
+    Serial.printf("not replayed: %lu (dropped segments: %u, power losses: %lu, corrupt records: %u)\n",
+                  lost, (unsigned)totals.droppedSegments, powerLosses, (unsigned)totals.corruptRecords);
+    Serial.printf("flash writes: %u flushes\n", (unsigned)totals.flushes);
+    Serial.printf("append: %.2f us per fix, replay: %.2f us per fix\n",
+                  totals.appended > 0 ? (double)appendMicros / totals.appended : 0.0,
+                  replayed > 0 ? (double)replayMicros / replayed : 0.0);
+    delete log;
+
+    // Tear the log on purpose, in a fresh directory so no segment is dropped for space
+    clearDirectory(directory);
+    FixLogStats tornStats;
+    failures += runTornWrites(directory, segmentSize, maxSegments, LOAD_TORN_ROUNDS, tornStats);
+    Serial.printf("torn writes: %u rounds, %u of %u fixes replayed, corrupt records: %u\n", (unsigned)LOAD_TORN_ROUNDS,
+                  (unsigned)tornStats.replayed, (unsigned)tornStats.appended, (unsigned)tornStats.corruptRecords);
+
+    Serial.printf("failures: %lu\n", failures);
+    return failures == 0 ? 0 : 1;
+}
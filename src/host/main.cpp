@@ -0,0 +1,326 @@
+// Host (native) driver for the payload pipeline
+//
+// Runs the same serialize -> encrypt -> decode -> decrypt path as the device, without any
+// hardware, so it can be profiled with perf or valgrind:
+//
+//   pio run -e native && .pio/build/native/program [iterations] [binary|base64|hex|legacy]
+//
+// Every heap allocation is counted (HEAP_MONITOR_COUNT_ALLOCATIONS), and the run fails if
+// encryptInPlace() or encryptJsonInto() allocates. Before the pipeline runs, every ChaChaSimd
+// kernel the CPU supports is checked against the scalar ChaCha, and the run fails on a mismatch.
+
+#include <Arduino.h>
+#include <ArduinoJson.h>
+#include <ChaCha.h>
+#include <ChaCha20.h>
+#include <ChaChaSimd.h>
+#include <GpsFix.h>
+#include <HeapMonitor.h>
+#include <JsonArena.h>
+
+#define HOST_DEVICE_ID "lokatrack-host-1"
+#define HOST_PAYLOAD_SIZE 1024
+#define HOST_BATCH_SIZE 5
+#define HOST_JSON_ARENA_SIZE 8192
+#define HOST_KERNEL_CHECK_SIZE 1031 // 16 blocks and a partial one, two full AVX2 runs
+
+// Arena for the encrypted payload, reused for every iteration like on the device
+static uint8_t payloadBuffer[HOST_PAYLOAD_SIZE];
+
+// Output of encryptJsonInto() for the decrypted document
+static uint8_t jsonPayloadBuffer[HOST_PAYLOAD_SIZE];
+
+// Arena for the decrypted documents, reset after every batch instead of going through the heap
+static uint8_t jsonArenaBuffer[HOST_JSON_ARENA_SIZE];
+static JsonArena jsonArena(jsonArenaBuffer, sizeof(jsonArenaBuffer));
+
+// Fixes waiting to be published, oldest first
+static RingBuffer<GpsFix, 32> fixBuffer;
+
+/**
+ * Fill a fix with deterministic data along a short route
+ *
+ * @param fix Fix to fill
+ * @param index Index of the fix along the route
+ */
+static void makeFix(GpsFix &fix, uint32_t index)
+{
+    fix = {};
+    fix.id = HOST_DEVICE_ID;
+    fix.timestamp = 1735689600000ULL + index * 1000ULL; // 2025-01-01T00:00:00Z onwards
+    fix.lat = -62087634 + (int32_t)index * 123;
+    fix.lng = 1068455990 + (int32_t)index * 456;
+    fix.satellites = 7 + index % 4;
+    fix.hdop = 90 + (index % 10) * 10;
+    fix.alt = 1250 + (index % 7) * 100;
+    fix.speed = 3000 + (index % 20) * 100;
+    fix.dummy = true;
+    fix.valid = GPS_FIX_HAS_LOCATION | GPS_FIX_HAS_HDOP | GPS_FIX_HAS_ALTITUDE | GPS_FIX_HAS_SPEED | GPS_FIX_HAS_TIME;
+    fix.capturedAt = millis();
+}
+
+// Chunk sizes the kernel check encrypts in, cycled until the message is done, 0 ends a pattern
+static const uint16_t kernelCheckSplits[][4] = {
+    {HOST_KERNEL_CHECK_SIZE, 0},
+    {1, 0},
+    {64, 0},
+    {63, 65, 0},
+    {7, 129, 512, 0},
+    {3, 250, 0},
+};
+
+/**
+ * Compare one ChaChaSimd configuration with the scalar ChaCha
+ *
+ * @param rounds Number of ChaCha rounds
+ * @param keySize Size of the key in bytes (16 or 32)
+ * @param counter Initial block counter
+ * @param split Chunk sizes to encrypt in, see kernelCheckSplits
+ * @param inPlace true to encrypt in the input buffer, false to use a separate output
+ * @return Offset of the first mismatching byte, or HOST_KERNEL_CHECK_SIZE if the outputs match
+ */
+static size_t checkChaChaConfig(uint8_t rounds, size_t keySize, uint64_t counter, const uint16_t *split, bool inPlace)
+{
+    uint8_t key[32];
+    uint8_t iv[8];
+    uint8_t counterBytes[8];
+    uint8_t plain[HOST_KERNEL_CHECK_SIZE];
+    uint8_t expected[HOST_KERNEL_CHECK_SIZE];
+    uint8_t actual[HOST_KERNEL_CHECK_SIZE];
+    for (size_t i = 0; i < sizeof(key); i++)
+    {
+        key[i] = (uint8_t)(i * 7 + rounds);
+    }
+    for (size_t i = 0; i < sizeof(iv); i++)
+    {
+        iv[i] = (uint8_t)(0xA0 + i);
+        counterBytes[i] = (uint8_t)(counter >> (i * 8));
+    }
+    for (size_t i = 0; i < sizeof(plain); i++)
+    {
+        plain[i] = (uint8_t)(i * 31 + 5);
+    }
+
+    ChaCha scalar(rounds);
+    scalar.setKey(key, keySize);
+    scalar.setIV(iv, sizeof(iv));
+    scalar.setCounter(counterBytes, sizeof(counterBytes));
+    scalar.encrypt(expected, plain, sizeof(plain));
+
+    ChaChaSimd simd(rounds);
+    simd.setKey(key, keySize);
+    simd.setIV(iv, sizeof(iv));
+    simd.setCounter(counterBytes, sizeof(counterBytes));
+    if (inPlace)
+    {
+        memcpy(actual, plain, sizeof(plain));
+    }
+    size_t offset = 0;
+    for (size_t i = 0; offset < sizeof(plain); i = split[i + 1] == 0 ? 0 : i + 1)
+    {
+        size_t length = split[i] < sizeof(plain) - offset ? split[i] : sizeof(plain) - offset;
+        simd.encrypt(actual + offset, inPlace ? actual + offset : plain + offset, length);
+        offset += length;
+    }
+
+    for (size_t i = 0; i < sizeof(plain); i++)
+    {
+        if (actual[i] != expected[i])
+        {
+            return i;
+        }
+    }
+    return sizeof(plain);
+}
+
+/**
+ * Check every ChaChaSimd kernel the CPU supports against the scalar ChaCha
+ * Covers 8, 12 and 20 rounds, both key sizes, counters that carry into the high word or wrap
+ * in the middle of a multi-block run, and messages encrypted in uneven chunks.
+ *
+ * @return Number of mismatching configurations
+ */
+static unsigned long checkChaChaKernels()
+{
+    static const ChaChaKernel kernels[] = {CHACHA_KERNEL_PORTABLE, CHACHA_KERNEL_SSE2, CHACHA_KERNEL_AVX2};
+    static const uint8_t roundCounts[] = {8, 12, 20};
+    static const size_t keySizes[] = {16, 32};
+    static const uint64_t counters[] = {0, 0x00000000FFFFFFFDULL, 0x00000001FFFFFFFFULL, 0xFFFFFFFFFFFFFFFBULL};
+
+    ChaChaKernel selected = getChaChaKernel();
+    unsigned long mismatches = 0;
+    for (ChaChaKernel kernel : kernels)
+    {
+        if (!setChaChaKernel(kernel))
+        {
+            Serial.printf("chacha kernel %s: not supported, skipped\n", getChaChaKernelName(kernel));
+            continue;
+        }
+
+        unsigned long checked = 0;
+        unsigned long kernelMismatches = 0;
+        for (uint8_t rounds : roundCounts)
+        {
+            for (size_t keySize : keySizes)
+            {
+                for (uint64_t counter : counters)
+                {
+                    for (size_t s = 0; s < sizeof(kernelCheckSplits) / sizeof(kernelCheckSplits[0]); s++)
+                    {
+                        bool inPlace = s % 2 == 1;
+                        size_t offset = checkChaChaConfig(rounds, keySize, counter, kernelCheckSplits[s], inPlace);
+                        checked++;
+                        if (offset != HOST_KERNEL_CHECK_SIZE)
+                        {
+                            kernelMismatches++;
+                            Serial.printf("chacha kernel %s: mismatch at byte %zu (rounds %u, key %zu, counter %016llx, split %zu%s)\n",
+                                          getChaChaKernelName(kernel), offset, (unsigned)rounds, keySize,
+                                          (unsigned long long)counter, s, inPlace ? ", in place" : "");
+                        }
+                    }
+                }
+            }
+        }
+        Serial.printf("chacha kernel %s: %lu/%lu configurations match\n", getChaChaKernelName(kernel),
+                      checked - kernelMismatches, checked);
+        mismatches += kernelMismatches;
+    }
+    setChaChaKernel(selected);
+    return mismatches;
+}
+
+/**
+ * Parse a payload format name
+ *
+ * @param name Format name
+ * @param format Receives the parsed format
+ * @return true if the name is known, false otherwise
+ */
+static bool parsePayloadFormat(const char *name, PayloadFormat &format)
+{
+    if (strcmp(name, "binary") == 0)
+    {
+        format = PAYLOAD_FORMAT_BINARY;
+    }
+    else if (strcmp(name, "base64") == 0)
+    {
+        format = PAYLOAD_FORMAT_BASE64;
+    }
+    else if (strcmp(name, "hex") == 0)
+    {
+        format = PAYLOAD_FORMAT_HEX;
+    }
+    else if (strcmp(name, "legacy") == 0)
+    {
+        format = PAYLOAD_FORMAT_HEX_LEGACY;
+    }
+    else
+    {
+        return false;
+    }
+    return true;
+}
+
+int main(int argc, char **argv)
+{
+    unsigned long iterations = argc > 1 ? strtoul(argv[1], nullptr, 10) : 1;
+    PayloadFormat format = PAYLOAD_FORMAT_BINARY;
+    if (argc > 2 && !parsePayloadFormat(argv[2], format))
+    {
+        Serial.println("Unknown payload format, expected binary, base64, hex or legacy");
+        return 2;
+    }
+
+    unsigned long kernelMismatches = checkChaChaKernels();
+
+    initChaCha();
+    randomSeed(1);
+
+    uint8_t *plain = payloadBuffer + getPlaintextOffset(format);
+    size_t maxPlainLength = getMaxPlaintextSize(sizeof(payloadBuffer), format);
+    uint32_t allocationsBefore = HeapMonitor::getAllocationCount();
+    uint32_t encryptAllocations = 0;
+    unsigned long failures = kernelMismatches;
+    size_t payloadLength = 0;
+    size_t plainLength = 0;
+    size_t fixCount = 0;
+    unsigned long start = micros();
+
+    for (unsigned long i = 0; i < iterations; i++)
+    {
+        // The device fills the keystream from idle loop() passes between publishes
+        while (!prefetchKeystreamStep(256, true))
+        {
+        }
+
+        while (fixBuffer.size() < HOST_BATCH_SIZE)
+        {
+            GpsFix fix;
+            makeFix(fix, i * HOST_BATCH_SIZE + fixBuffer.size());
+            fixBuffer.push(fix);
+        }
+
+        plainLength = serializeGpsFixBatch(fixBuffer, HOST_BATCH_SIZE, FIX_ENCODING_JSON, plain, maxPlainLength, &fixCount);
+        String expected((const char *)plain, plainLength);
+
+        uint32_t allocations = HeapMonitor::getAllocationCount();
+        payloadLength = encryptInPlace(payloadBuffer, sizeof(payloadBuffer), plainLength, format, true);
+        encryptAllocations += HeapMonitor::getAllocationCount() - allocations;
+        if (payloadLength == 0 || decryptString(payloadBuffer, payloadLength) != expected)
+        {
+            failures++;
+        }
+
+        {
+            JsonDocument doc(&jsonArena);
+            if (!decryptJson(payloadBuffer, payloadLength, doc) || doc.size() != fixCount)
+            {
+                failures++;
+            }
+
+            // Re-encrypting the document must not touch the heap either
+            allocations = HeapMonitor::getAllocationCount();
+            size_t jsonPayloadLength = encryptJsonInto(doc, jsonPayloadBuffer, sizeof(jsonPayloadBuffer), format, false);
+            encryptAllocations += HeapMonitor::getAllocationCount() - allocations;
+            if (jsonPayloadLength == 0)
+            {
+                failures++;
+            }
+
+            // Decrypting in place consumes the frame, so it runs last
+            if (!decryptJsonInPlace(payloadBuffer, payloadLength, doc) || doc.size() != fixCount)
+            {
+                failures++;
+            }
+        }
+        jsonArena.reset();
+
+        fixBuffer.pop(fixCount);
+    }
+
+    unsigned long elapsed = micros() - start;
+
+#ifdef HEAP_MONITOR_COUNT_ALLOCATIONS
+    // The expected String allocates every iteration, so a zero count means the hooks are not linked
+    if (iterations > 0 && HeapMonitor::getAllocationCount() == allocationsBefore)
+    {
+        Serial.println("Heap allocations are not being counted");
+        failures++;
+    }
+#endif
+
+    Serial.printf("iterations: %lu\n", iterations);
+    Serial.printf("fixes per batch: %zu\n", fixCount);
+    Serial.printf("plaintext: %zu bytes, payload: %zu bytes\n", plainLength, payloadLength);
+    Serial.printf("elapsed: %lu us (%.2f us per batch)\n", elapsed, iterations > 0 ? (double)elapsed / iterations : 0.0);
+    Serial.printf("heap allocations: %u (in encryptInPlace/encryptJsonInto: %u)\n",
+                  (unsigned)(HeapMonitor::getAllocationCount() - allocationsBefore), (unsigned)encryptAllocations);
+    Serial.printf("JSON arena high-water: %zu/%zu bytes, failed allocations: %u\n", jsonArena.getHighWaterMark(),
+                  jsonArena.getCapacity(), (unsigned)jsonArena.getFailureCount());
+    KeystreamPrefetchStats prefetchStats = getKeystreamPrefetchStats();
+    Serial.printf("keystream prefetch hits/partial/misses: %u/%u/%u\n",
+                  (unsigned)prefetchStats.hits, (unsigned)prefetchStats.partialHits, (unsigned)prefetchStats.misses);
+    Serial.printf("failures: %lu\n", failures);
+
+    return failures == 0 && encryptAllocations == 0 && jsonArena.getFailureCount() == 0 ? 0 : 1;
+}
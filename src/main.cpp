@@ -4,6 +4,9 @@
 #include "pins_config.h"
 #include "wifi_config.h"
 #include "ntp_config.h"
+#if defined(USE_DEVICE_KEYS)
+#include "device_key.h" // Generated by scripts/device_key.py
+#endif
 
 #include <Arduino.h>
 #include <TinyGPSPlus.h>
@@ -15,13 +18,64 @@
 #include <TinyGsmClient.h>
 #endif
 #include <PubSubClient.h>
-#include <ArduinoJson.h>
 #include <ChaCha20.h>  // Include the encryption header
+#include <GpsFix.h>    // Include the fix record and its serializers
+#include <SpscQueue.h> // Include the lock-free queue between the GPS task and loop()
+#include <ConnectionManager.h> // Include the non-blocking connection state machine
+#ifndef USE_WIFI_CONNECTION
+#include <AtEngine.h> // Include the asynchronous AT command engine
+#endif
 #include <ESP32Time.h> // Include the RTC library
+#include <LittleFS.h>  // Include the flash file system
+#include <FixLog.h>    // Include the store-and-forward log for fixes taken while offline
+#include <MotionScheduler.h> // Include the scheduler deciding which fixes are worth publishing
+#include <TrackSimplifier.h> // Include the dead-reckoning simplification of the published track
+#include <EpochClock.h>      // Include the GPS-disciplined epoch clock timestamping the fixes
+#include <TimeArbiter.h>     // Include the choice between GPS and NTP time
+#include <UbxGps.h>          // Include the UBX binary protocol decoder
+#include <GpsSource.h>       // Include the replayed and synthetic GPS byte sources
+#include <PipelineStats.h>   // Include the per-stage timing of the fix pipeline
+#include <HeapMonitor.h>     // Include the periodic record of free heap and fragmentation
+#include <AsyncLog.h>        // Include the non-blocking log printed by its own task
+
+#if defined(USE_DEVICE_KEYS)
+// Compare two strings at compile time
+constexpr bool isSameString(const char *a, const char *b)
+{
+  while (*a != '\0' && *a == *b)
+  {
+    a++;
+    b++;
+  }
+  return *a == *b;
+}
+
+// A key derived for another device ID would be decrypted with the wrong key by the backend
+static_assert(isSameString(DEVICE_KEY_ID, MQTT_CLIENT_ID),
+              "include/device_key.h is for another MQTT_CLIENT_ID, rerun scripts/device_key.py");
+#endif
 
 // GPS Setup
+#ifdef USE_UBX_PROTOCOL
+UbxGps ubxGps(UBX_EPOCH_NEO6);     // Only used by the GPS task once it is started
+uint32_t ubxEpochTime = 0;         // millis() when the last epoch was completed
+uint32_t lastCapturedEpoch = 0;    // Last epoch seen by captureGpsFix()
+uint32_t lastDisciplinedEpoch = 0; // Last epoch seen by disciplineClock()
+bool ubxConfigured = false;        // Whether the receiver acknowledged the UBX configuration
+uint32_t lastUbxConfigAttempt = 0; // millis() of the last configureUbx() call
+#else
 TinyGPSPlus gps;
+#endif
 HardwareSerial gpsSerial(2); // Use Serial2 as `gpsSerial` for GPS
+#if GPS_SOURCE == GPS_SOURCE_REPLAY
+GpsReplaySource gpsSource(GPS_REPLAY_PATH, GPS_SOURCE_SPEED); // Replaces gpsSerial as the GPS task's input
+#elif GPS_SOURCE == GPS_SOURCE_SYNTHETIC
+#ifdef USE_UBX_PROTOCOL
+GpsSyntheticSource gpsSource(GPS_SYNTHETIC_UBX, GPS_SYNTHETIC_RATE, GPS_SOURCE_SPEED, GPS_SYNTHETIC_SEED);
+#else
+GpsSyntheticSource gpsSource(GPS_SYNTHETIC_NMEA, GPS_SYNTHETIC_RATE, GPS_SOURCE_SPEED, GPS_SYNTHETIC_SEED);
+#endif
+#endif
 
 // RTC Setup
 ESP32Time rtc(GMT_OFFSET);
@@ -30,6 +84,7 @@ ESP32Time rtc(GMT_OFFSET);
 // GSM Modem Setup
 HardwareSerial gsmAtSerial(1); // Use Serial1 as `gsmAtSerial` for AT commands
 TinyGsm modem(gsmAtSerial);
+AtEngine atEngine(gsmAtSerial); // Modem queries not covered by TinyGSM
 #endif
 
 // MQTT Client Setup
@@ -49,185 +104,275 @@ TinyGsmClient gsmClient(modem);
 PubSubClient mqttClient(gsmClient);
 #endif
 
-uint32_t lastPublishTime = 0;
+uint32_t lastFixTime = 0; // Only used by the GPS task
+
+// Decides which fixes are published, only used by the GPS task
+MotionScheduler motionScheduler({MOTION_MIN_DISTANCE, MOTION_MIN_HEADING_CHANGE, MOTION_HEADING_MIN_SPEED,
+                                 MOTION_STOPPED_SPEED, MOTION_FAST_SPEED, MOTION_SLOW_MIN_INTERVAL,
+                                 MOTION_FAST_MIN_INTERVAL, MOTION_HEARTBEAT_INTERVAL});
+
+// Drops the fixes the track can be predicted from, only used by the GPS task
+TrackSimplifier trackSimplifier(TRACK_TOLERANCE);
+
+// UTC time base of the fixes, disciplined by the GPS task and read by loop()
+EpochClock epochClock(CLOCK_STEP_THRESHOLD, CLOCK_MAX_SLEW);
+
+// Fixes captured by the GPS task, waiting to be picked up by loop()
+SpscQueue<GpsFix, FIX_QUEUE_CAPACITY> fixQueue;
+static_assert((uint64_t)FIX_QUEUE_CAPACITY * MOTION_FAST_MIN_INTERVAL >= CONNECTION_MAX_STALL,
+              "FIX_QUEUE_CAPACITY must hold the fixes captured while a connect step blocks loop()");
+
+// Receive buffer and FIFO overflows on gpsSerial, counted from the UART event task
+volatile uint32_t gpsUartOverflows = 0;
+
+// Fixes waiting to be published, oldest first (only used by loop())
+RingBuffer<GpsFix, FIX_BUFFER_CAPACITY> fixBuffer;
+
+#ifdef ENABLE_DIAGNOSTICS
+// Time spent in each stage of the fix pipeline, decoding is timed by the GPS task and the rest by loop()
+PipelineStats pipelineStats;
+
+// Plain JSON snapshot of the pipeline timing, built and published by loop()
+char diagnosticsBuffer[MQTT_MAX_DIAGNOSTICS_SIZE];
+uint32_t lastDiagnosticsTime = 0;
+uint32_t lastConnectCount = 0; // Connections already added to the reconnect stage
+#endif
+
+// Free heap and largest free block over time, sampled by loop()
+HeapMonitor heapMonitor(HEAP_MONITOR_INTERVAL);
 
-String getCurrentUTCTime();
+// Arena for the encrypted payload, reused for every publish
+uint8_t payloadBuffer[MQTT_MAX_PAYLOAD_SIZE];
+
+// Set once the cipher has its key, nothing is published before, as the unkeyed keystream is public
+bool encryptionReady = false;
+
+// Fixes that could not be published, kept on flash until the connection is back
+FixLog fixLog(FIX_LOG_DIR, FIX_LOG_SEGMENT_SIZE, FIX_LOG_MAX_SEGMENTS);
+// Logged fixes are stored one by one, columnar batches are kept in the packed binary encoding instead
+const FixEncoding fixLogEncoding = FIX_ENCODING == FIX_ENCODING_COLUMNAR ? FIX_ENCODING_BINARY : FIX_ENCODING;
+uint32_t lastReplayTime = 0;
+
+void acceptNtpTime();
+void updateTimeSource();
+void setRtcFromClock();
+void disciplineClock();
+bool configureUbx();
+bool configureUbxOutput();
+void retryUbxConfig();
+bool sendUbxConfig(const uint8_t *frame, size_t length);
+size_t readGpsBytes(uint8_t *buffer, size_t capacity);
+void printHeapStats();
+void recordReconnect();
+void publishDiagnostics();
+void readGpsFix(GpsFix &fix);
+void captureGpsFix();
+void gpsTask(void *parameter);
+void logTask(void *parameter);
+void onGpsReceiveError(hardwareSerial_error_t error);
+void drainFixQueue();
+bool isBatchDue();
 void publishGpsData();
+void spillFixes(size_t count);
+void replayFixLog();
+bool syncNtpTime();
 #ifndef USE_WIFI_CONNECTION
-void connectGprs();
-void syncNtpTime();
+void onCntpResponse(const char *line);
+void onCclkResponse(const char *line);
+#endif
+bool isMqttUp();
+ConnectionResult startMqtt();
+#ifndef USE_WIFI_CONNECTION
+bool isNetworkUp();
+ConnectionResult startNetwork();
+bool isGprsUp();
+ConnectionResult startGprs();
 #else
-void connectWifi();
-void syncNtpTime();
+bool isWifiUp();
+ConnectionResult startWifi();
+ConnectionResult pollWifi();
 #endif
 
-// NTP Time sync function for SIM800L
+// Connection layers, brought up in order and polled from loop()
 #ifndef USE_WIFI_CONNECTION
-void syncNtpTime()
+const ConnectionStep connectionSteps[] = {
+    {"network", isNetworkUp, startNetwork, nullptr, NETWORK_CONNECT_TIMEOUT, CONNECTION_CHECK_INTERVAL},
+    {"GPRS", isGprsUp, startGprs, nullptr, GPRS_CONNECT_TIMEOUT, CONNECTION_CHECK_INTERVAL},
+    {"MQTT", isMqttUp, startMqtt, nullptr, MQTT_CONNECT_TIMEOUT, CONNECTION_CHECK_INTERVAL},
+};
+#else
+const ConnectionStep connectionSteps[] = {
+    {"WiFi", isWifiUp, startWifi, pollWifi, WIFI_CONNECT_TIMEOUT, CONNECTION_CHECK_INTERVAL},
+    {"MQTT", isMqttUp, startMqtt, nullptr, MQTT_CONNECT_TIMEOUT, CONNECTION_CHECK_INTERVAL},
+};
+#endif
+const size_t CONNECTION_STEP_COUNT = sizeof(connectionSteps) / sizeof(connectionSteps[0]);
+const size_t LINK_STEP_INDEX = CONNECTION_STEP_COUNT - 2; // GPRS or WiFi, the last step below MQTT
+
+ConnectionManager connection(connectionSteps, CONNECTION_STEP_COUNT,
+                             {CONNECTION_BACKOFF_INITIAL, CONNECTION_BACKOFF_MAX, CONNECTION_BACKOFF_JITTER});
+
+// Steps of the NTP time sync
+enum NtpSyncStage : uint8_t
 {
-  Serial.print("Synchronizing time with NTP server: ");
-  Serial.print(NTP_SERVER);
-  Serial.print("...");
+  NTP_SYNC_START,
+  NTP_SYNC_SET_CONTEXT,
+  NTP_SYNC_SET_SERVER,
+  NTP_SYNC_REQUEST,
+  NTP_SYNC_READ_CLOCK
+};
 
-  // First make sure the GPRS is connected
-  if (!modem.isGprsConnected())
-  {
-    Serial.println("GPRS not connected. Cannot sync time.");
-    return;
-  }
+NtpSyncStage ntpSyncStage = NTP_SYNC_START;
+#ifndef USE_WIFI_CONNECTION
+int ntpSyncStatus = -1;   // Result reported by +CNTP
+bool ntpClockSet = false; // Set once +CCLK has been parsed into the RTC
+#else
+uint32_t ntpSyncStartedAt = 0;
+#endif
 
-  // SIM800L specific AT commands for NTP sync
-  gsmAtSerial.println("AT+CNTPCID=1"); // Set PDP context for NTP
-  delay(1000);
+bool timeSynced = false;  // Set once syncNtpTime() has run on the first link
+bool timeSyncing = false; // Set while syncNtpTime() is in progress
 
-  // Clear any pending responses
-  while (gsmAtSerial.available())
-  {
-    gsmAtSerial.read();
-  }
+// Picks the source of the wall-clock time, GPS first and NTP as a fallback (only used by loop())
+TimeArbiter timeArbiter(NTP_FALLBACK_DELAY);
+uint32_t firstValidPublishTime = 0; // millis() of the first published fix carrying a timestamp
 
-  // Set NTP server address and time zone
-  String ntpCommand = "AT+CNTP=\"" + String(NTP_SERVER) + "\"," + String(GMT_OFFSET / 3600);
-  gsmAtSerial.println(ntpCommand);
-  delay(1000);
+// NTP Time sync function for SIM800L
+#ifndef USE_WIFI_CONNECTION
+void onCntpResponse(const char *line)
+{
+  // +CNTP: 1 indicates success
+  ntpSyncStatus = atoi(line + strlen("+CNTP:"));
+}
 
-  // Read response
-  String response = "";
-  unsigned long timeout = millis() + 5000; // 5 second timeout
-  while (millis() < timeout)
+void onCclkResponse(const char *line)
+{
+  // Format +CCLK: "YY/MM/DD,HH:MM:SS±ZZ"
+  int year, month, day, hour, minute, second;
+  if (sscanf(line, "+CCLK: \"%d/%d/%d,%d:%d:%d", &year, &month, &day, &hour, &minute, &second) == 6)
   {
-    if (gsmAtSerial.available())
-    {
-      char c = gsmAtSerial.read();
-      response += c;
-      if (response.indexOf("OK") != -1)
-      {
-        break;
-      }
-    }
+    // Set the ESP32 RTC
+    rtc.setTime(second, minute, hour, day, month, 2000 + year); // Convert YY to YYYY
+    ntpClockSet = true;
   }
+}
 
-  if (response.indexOf("OK") == -1)
+bool syncNtpTime()
+{
+  AtResult result = atEngine.poll();
+  if (result == AT_PENDING)
   {
-    Serial.println("Failed to set NTP server!");
-    return;
+    return false;
   }
 
-  // Request time synchronization
-  gsmAtSerial.println("AT+CNTP");
-  delay(1000);
-
-  // Read response for +CNTP: 1 which indicates success
-  response = "";
-  timeout = millis() + 10000; // 10 second timeout
-  while (millis() < timeout)
+  switch (ntpSyncStage)
   {
-    if (gsmAtSerial.available())
+  case NTP_SYNC_START:
+    LOG_INFO("Synchronizing time with NTP server: %s...", NTP_SERVER);
+
+    // First make sure the GPRS is connected
+    if (!modem.isGprsConnected())
     {
-      char c = gsmAtSerial.read();
-      response += c;
-      if (response.indexOf("+CNTP: 1") != -1)
-      {
-        break;
-      }
+      LOG_WARN("GPRS not connected. Cannot sync time.");
+      return true;
     }
-  }
 
-  if (response.indexOf("+CNTP: 1") == -1)
+    // SIM800L specific AT commands for NTP sync
+    atEngine.send("AT+CNTPCID=1", 1000); // Set PDP context for NTP
+    ntpSyncStage = NTP_SYNC_SET_CONTEXT;
+    return false;
+
+  case NTP_SYNC_SET_CONTEXT:
   {
-    Serial.println("Failed to sync time!");
-    return;
+    // Set NTP server address and time zone
+    char ntpCommand[64];
+    snprintf(ntpCommand, sizeof(ntpCommand), "AT+CNTP=\"%s\",%d", NTP_SERVER, GMT_OFFSET / 3600);
+    atEngine.send(ntpCommand, 5000);
+    ntpSyncStage = NTP_SYNC_SET_SERVER;
+    return false;
   }
 
-  // Get the network time
-  gsmAtSerial.println("AT+CCLK?");
-  delay(1000);
-
-  // Read response with format +CCLK: "YY/MM/DD,HH:MM:SS±ZZ"
-  response = "";
-  timeout = millis() + 5000;
-  while (millis() < timeout)
-  {
-    if (gsmAtSerial.available())
+  case NTP_SYNC_SET_SERVER:
+    if (result != AT_OK)
     {
-      char c = gsmAtSerial.read();
-      response += c;
-      if (response.indexOf("+CCLK:") != -1 && response.indexOf("OK") != -1)
-      {
-        break;
-      }
+      LOG_WARN("Failed to set NTP server!");
+      break;
     }
-  }
 
-  // Parse the time from response
-  int cclkIndex = response.indexOf("+CCLK: \"");
-  if (cclkIndex != -1)
-  {
-    // Extract the time string
-    String timeStr = response.substring(cclkIndex + 8, response.indexOf("\"", cclkIndex + 8));
+    // Request time synchronization, the result is reported after OK
+    ntpSyncStatus = -1;
+    atEngine.send("AT+CNTP", 10000, onCntpResponse, "+CNTP:");
+    ntpSyncStage = NTP_SYNC_REQUEST;
+    return false;
 
-    // Parse the time components (YY/MM/DD,HH:MM:SS±ZZ)
-    int year = 2000 + timeStr.substring(0, 2).toInt(); // Convert YY to YYYY
-    int month = timeStr.substring(3, 5).toInt();
-    int day = timeStr.substring(6, 8).toInt();
-    int hour = timeStr.substring(9, 11).toInt();
-    int minute = timeStr.substring(12, 14).toInt();
-    int second = timeStr.substring(15, 17).toInt();
+  case NTP_SYNC_REQUEST:
+    if (result != AT_OK || ntpSyncStatus != 1)
+    {
+      LOG_WARN("Failed to sync time!");
+      break;
+    }
 
-    // Set the ESP32 RTC
-    rtc.setTime(second, minute, hour, day, month, year);
+    // Get the network time
+    ntpClockSet = false;
+    atEngine.send("AT+CCLK?", 5000, onCclkResponse);
+    ntpSyncStage = NTP_SYNC_READ_CLOCK;
+    return false;
 
-    Serial.println("Success!");
-    Serial.print("Current time: ");
-    Serial.print(rtc.getTime("%Y-%m-%d %H:%M:%S"));
-    Serial.println(" UTC");
-  }
-  else
-  {
-    Serial.println("Failed to get time!");
+  case NTP_SYNC_READ_CLOCK:
+    if (result != AT_OK || !ntpClockSet)
+    {
+      LOG_WARN("Failed to get time!");
+      break;
+    }
+
+    LOG_INFO("Time synchronized with NTP, current time: %s UTC", rtc.getTime("%Y-%m-%d %H:%M:%S").c_str());
+    acceptNtpTime();
+    break;
   }
+
+  ntpSyncStage = NTP_SYNC_START;
+  return true;
 }
 #else
 // NTP Time sync function for WiFi
-void syncNtpTime()
+bool syncNtpTime()
 {
-  Serial.print("Synchronizing time with NTP server: ");
-  Serial.print(NTP_SERVER);
-  Serial.print("...");
+  if (ntpSyncStage == NTP_SYNC_START)
+  {
+    LOG_INFO("Synchronizing time with NTP server: %s...", NTP_SERVER);
 
-  // Configure NTP server and timezone
-  configTime(GMT_OFFSET, DST_OFFSET, NTP_SERVER);
+    // Configure NTP server and timezone, the time is set in the background
+    configTime(GMT_OFFSET, DST_OFFSET, NTP_SERVER);
+    ntpSyncStartedAt = millis();
+    ntpSyncStage = NTP_SYNC_REQUEST;
+    return false;
+  }
 
-  // Wait for time to be set
-  time_t now = 0;
+  // Check whether the time has been set
+  time_t now = time(nullptr);
   struct tm timeinfo = {0};
-  int retry = 0;
-  const int retry_count = 10;
-
-  while (timeinfo.tm_year < (2022 - 1900) && ++retry < retry_count)
-  {
-    Serial.print(".");
-    delay(1000);
-    time(&now);
-    localtime_r(&now, &timeinfo);
-  }
+  localtime_r(&now, &timeinfo);
 
-  if (retry < retry_count)
+  if (timeinfo.tm_year >= (2022 - 1900))
   {
-    Serial.println("Success!");
-
     // Set the ESP32 RTC
     rtc.setTime(timeinfo.tm_sec, timeinfo.tm_min, timeinfo.tm_hour,
                 timeinfo.tm_mday, timeinfo.tm_mon + 1, timeinfo.tm_year + 1900);
 
-    Serial.print("Current time: ");
-    Serial.print(rtc.getTime("%Y-%m-%d %H:%M:%S"));
-    Serial.println(" UTC");
+    LOG_INFO("Time synchronized with NTP, current time: %s UTC", rtc.getTime("%Y-%m-%d %H:%M:%S").c_str());
+    acceptNtpTime();
+  }
+  else if (millis() - ntpSyncStartedAt >= NTP_SYNC_TIMEOUT)
+  {
+    LOG_WARN("Failed to sync time!");
   }
   else
   {
-    Serial.println("Failed to sync time!");
+    return false;
   }
+
+  ntpSyncStage = NTP_SYNC_START;
+  return true;
 }
 #endif
 
@@ -235,279 +380,838 @@ void setup()
 {
   // Initialize Serial Monitor
   Serial.begin(9600);
-  Serial.println();
-  Serial.print("Initializing Serial Monitor...");
   while (!Serial)
   {
     ; // Wait for serial port to connect
   }
-  Serial.println("Success!");
+
+  // Print the log from a low-priority task, logging only queues the messages
+  Serial.println();
+  if (xTaskCreate(logTask, "log", LOG_TASK_STACK_SIZE, nullptr, LOG_TASK_PRIORITY, nullptr) != pdPASS)
+  {
+    Serial.println("Failed to start the log task!");
+  }
+  LOG_INFO("Initializing Serial Monitor...Success!");
 
   // Initialize the encryption system
-  Serial.print("Initializing ChaCha20 encryption...");
+#if defined(USE_DEVICE_KEYS)
+  encryptionReady = initChaChaWithKey(DEVICE_KEY, sizeof(DEVICE_KEY));
+#else
   initChaCha();
-  Serial.println("Success!");
+  encryptionReady = true;
+#endif
+  if (encryptionReady)
+  {
+    LOG_INFO("Initializing ChaCha20 encryption...Success!");
+  }
+  else
+  {
+    LOG_ERROR("Initializing ChaCha20 encryption...Failed! Fixes are only logged to flash, nothing is published.");
+  }
+
+  // Mount the flash file system and resume the fixes left from before a reboot
+  if (LittleFS.begin(true) && fixLog.begin())
+  {
+    LOG_INFO("Initializing fix log...Success!");
+  }
+  else
+  {
+    LOG_ERROR("Initializing fix log...Failed!");
+  }
+
+#if GPS_SOURCE == GPS_SOURCE_REPLAY
+  // Open the recorded capture fed to the GPS task instead of the receiver's output
+  if (gpsSource.begin())
+  {
+    LOG_INFO("Opening GPS replay...Success!");
+  }
+  else
+  {
+    LOG_ERROR("Opening GPS replay...Failed!");
+  }
+#endif
+
+  // GPS time is expected from now on, NTP is only requested if it does not arrive in time
+  timeArbiter.begin(millis());
 
   // Initialize random seed for secure IV generation
   randomSeed(analogRead(0) + millis());
 
   // Initialize GPS module on gpsSerial
-  Serial.print("Initializing GPS Serial...");
+  gpsSerial.setRxBufferSize(GPS_RX_BUFFER_SIZE);
   gpsSerial.begin(GPS_BAUD, SERIAL_8N1, GPS_RX_PIN, GPS_TX_PIN);
-  Serial.println("Success!");
+  gpsSerial.onReceiveError(onGpsReceiveError);
+  LOG_INFO("Initializing GPS Serial...Success!");
+
+#if defined(USE_UBX_PROTOCOL) && GPS_SOURCE == GPS_SOURCE_UART
+  // Switch the receiver to UBX output at a higher baud and update rate
+  ubxConfigured = configureUbx();
+  lastUbxConfigAttempt = millis();
+  if (ubxConfigured)
+  {
+    LOG_INFO("Configuring GPS for UBX output...Success!");
+  }
+  else
+  {
+    // There is no NMEA decoder with USE_UBX_PROTOCOL, so the GPS task keeps retrying
+    LOG_ERROR("Configuring GPS for UBX output...Failed! Retrying from the GPS task.");
+  }
+#endif
+
+  // Decode GPS data on its own core, so blocking network calls in loop() cannot stall it
+  if (xTaskCreatePinnedToCore(gpsTask, "gps", GPS_TASK_STACK_SIZE, nullptr, GPS_TASK_PRIORITY, nullptr, GPS_TASK_CORE) == pdPASS)
+  {
+    LOG_INFO("Starting GPS task...Success!");
+  }
+  else
+  {
+    LOG_ERROR("Starting GPS task...Failed!");
+  }
 
 #ifndef USE_WIFI_CONNECTION
   // Initialize GSM Module on gsmAtSerial
-  Serial.print("Initializing GSM Serial...");
   gsmAtSerial.begin(GSM_BAUD, SERIAL_8N1, GSM_RX_PIN, GSM_TX_PIN);
   delay(3000); // Delay for modem stabilization
-  Serial.println("Success!");
+  LOG_INFO("Initializing GSM Serial...Success!");
 
-  Serial.print("Initializing modem...");
   if (!modem.init())
   { // Use init() instead of restart() for initial setup
-    Serial.println("Failed!");
-    Serial.print("Restarting modem...");
+    LOG_WARN("Initializing modem...Failed! Restarting modem...");
     modem.restart(); // Attempt restart if init fails
     // Consider adding a check here if restart also fails
   }
-  Serial.println("Success!");
-
-  connectGprs(); // Connect to GPRS
-
-  // Synchronize time with NTP server
-  Serial.println("Synchronizing time with NTP server...");
-  syncNtpTime();
+  LOG_INFO("Initializing modem...Success!");
 #else
-  connectWifi(); // Connect to WiFi
-
-  // Synchronize time with NTP server
-  Serial.println("Synchronizing time with NTP server...");
-  syncNtpTime();
+  WiFi.mode(WIFI_STA);
+  WiFi.setAutoReconnect(false); // Reconnects are driven by the connection manager
 #endif
 
-  Serial.print("Initializing MQTT client...");
   mqttClient.setServer(MQTT_BROKER, MQTT_PORT);
-  mqttClient.setBufferSize(1024); // Increase buffer size for large encrypted messages
+  mqttClient.setBufferSize(MQTT_BUFFER_SIZE); // Increase buffer size for large encrypted messages
+  mqttClient.setSocketTimeout(MQTT_SOCKET_TIMEOUT); // Bounds the wait for CONNACK, not the TCP connect
 #ifdef MQTT_SSL
 #ifdef USE_WIFI_CONNECTION
 #ifdef MQTT_INSECURE
   wifiClient.setInsecure(); // Skip certificate validation
-  Serial.println("Success! (using WiFi SSL - Insecure)");
+  LOG_INFO("Initializing MQTT client...Success! (using WiFi SSL - Insecure)");
 #else
   wifiClient.setCACert(MQTT_CA_CERT); // Set CA certificate for server validation
-  Serial.println("Success! (using WiFi SSL - Secure)");
+  LOG_INFO("Initializing MQTT client...Success! (using WiFi SSL - Secure)");
 #endif
 #else
 #ifdef MQTT_INSECURE
-  Serial.println("Success! (using GSM SSL - Insecure)");
+  LOG_INFO("Initializing MQTT client...Success! (using GSM SSL - Insecure)");
 #else
-  Serial.println("Success! (using GSM SSL - Secure)");
+  LOG_INFO("Initializing MQTT client...Success! (using GSM SSL - Secure)");
 #endif
 #endif
 #else
-  Serial.println("Success! (using non-SSL)");
+  LOG_INFO("Initializing MQTT client...Success! (using non-SSL)");
 #endif
 }
 
 void loop()
 {
-#ifndef USE_WIFI_CONNECTION
-  if (!modem.isGprsConnected())
+  // Pick up the fixes captured by the GPS task, even while the connection is down
+  drainFixQueue();
+
+  if (timeSyncing)
   {
-    Serial.println("GPRS disconnected. Reconnecting...");
-    connectGprs();
-    return;
+    // The time sync owns the modem's AT channel until it finishes
+    timeSyncing = !syncNtpTime();
   }
-#else
-  if (WiFi.status() != WL_CONNECTED)
+  // Bring the connection up one short step at a time, fixes keep buffering while it is down
+  else if (encryptionReady && connection.poll(millis()))
   {
-    Serial.println("WiFi disconnected. Reconnecting...");
-    connectWifi();
-    return;
-  }
+    mqttClient.loop();
+#ifdef ENABLE_DIAGNOSTICS
+    recordReconnect();
 #endif
 
-  if (!mqttClient.connected())
-  {
-    Serial.print("Connecting to MQTT broker...");
-    if (mqttClient.connect(MQTT_CLIENT_ID, MQTT_USERNAME, MQTT_PASSWORD))
+    if (isBatchDue())
+    {
+      publishGpsData();
+    }
+    // Catch up on the fixes taken while offline, at a capped rate so live fixes keep flowing
+    else if (!fixLog.empty() && millis() - lastReplayTime >= FIX_LOG_REPLAY_INTERVAL)
     {
-      Serial.println("Success!");
+      replayFixLog();
     }
-    else
+#ifdef ENABLE_DIAGNOSTICS
+    // Cumulative since boot, so a lost snapshot costs no data
+    else if (millis() - lastDiagnosticsTime >= DIAGNOSTICS_INTERVAL)
     {
-      Serial.print("Failed! Error code: ");
-      Serial.print(mqttClient.state());
-      Serial.println(", Retrying in 5 seconds...");
-      delay(5000); // Wait before retrying MQTT connection
+      publishDiagnostics();
     }
-    return; // Return to avoid publishing immediately after connection attempt
+#endif
+  }
+  else if (isBatchDue())
+  {
+    // Keep the fixes on flash until the connection is back
+    spillFixes(fixBuffer.size());
+  }
+
+  // Fall back to NTP if GPS time has not arrived by the time the first link is up
+  updateTimeSource();
+  if (!timeSynced && timeArbiter.isFallbackDue(millis()) && connection.isStepUp(LINK_STEP_INDEX))
+  {
+    timeSynced = true;
+    timeSyncing = true;
   }
-  mqttClient.loop();
 
-  while (gpsSerial.available() > 0)
+  // Use idle time to generate the keystream of the next publish
+  if (encryptionReady)
   {
-    gps.encode(gpsSerial.read());
+    prefetchKeystreamStep(KEYSTREAM_PREFETCH_STEP, true);
   }
 
-  if (mqttClient.connected() && (millis() - lastPublishTime > PUBLISH_INTERVAL))
+  if (heapMonitor.poll(millis()))
   {
-    publishGpsData();
+    printHeapStats();
   }
 
   delay(10);
 }
 
 #ifndef USE_WIFI_CONNECTION
-void connectGprs()
+bool isNetworkUp()
 {
-  Serial.print("Connecting to GPRS network...");
-  if (!modem.waitForNetwork())
+  return modem.isNetworkConnected();
+}
+
+ConnectionResult startNetwork()
+{
+  // Registration proceeds in the modem on its own, only its status is polled
+  return isNetworkUp() ? CONNECTION_UP : CONNECTION_PENDING;
+}
+
+bool isGprsUp()
+{
+  return modem.isGprsConnected();
+}
+
+ConnectionResult startGprs()
+{
+  LOG_INFO("Connecting to APN: %s", APN);
+  return modem.gprsConnect(APN, APN_USER, APN_PASSWORD) ? CONNECTION_UP : CONNECTION_FAILED;
+}
+#else
+bool isWifiUp()
+{
+  return WiFi.status() == WL_CONNECTED;
+}
+
+ConnectionResult startWifi()
+{
+  WiFi.disconnect();
+  WiFi.begin(WIFI_SSID, WIFI_PASSWORD);
+  return CONNECTION_PENDING;
+}
+
+ConnectionResult pollWifi()
+{
+  switch (WiFi.status())
+  {
+  case WL_CONNECTED:
+    return CONNECTION_UP;
+  case WL_CONNECT_FAILED:
+  case WL_NO_SSID_AVAIL:
+    return CONNECTION_FAILED;
+  default:
+    return CONNECTION_PENDING;
+  }
+}
+#endif
+
+bool isMqttUp()
+{
+  return mqttClient.connected();
+}
+
+ConnectionResult startMqtt()
+{
+#ifndef USE_WIFI_CONNECTION
+  // PubSubClient would open the socket with TinyGSM's 75 s default, open it with a short timeout instead
+  if (!gsmClient.connected() && !gsmClient.connect(MQTT_BROKER, MQTT_PORT, MQTT_TCP_CONNECT_TIMEOUT))
+  {
+    LOG_WARN("MQTT socket to %s:%d failed to open within %d s", MQTT_BROKER, MQTT_PORT, MQTT_TCP_CONNECT_TIMEOUT);
+    return CONNECTION_FAILED;
+  }
+#endif
+  if (mqttClient.connect(MQTT_CLIENT_ID, MQTT_USERNAME, MQTT_PASSWORD))
+  {
+    return CONNECTION_UP;
+  }
+  // A TLS handshake fails once the heap is too fragmented for its buffers
+  const HeapSample &heap = heapMonitor.sample(millis());
+  LOG_WARN("MQTT error code: %d, largest free block: %u bytes", mqttClient.state(), (unsigned)heap.largestFreeBlock);
+  return CONNECTION_FAILED;
+}
+
+void printHeapStats()
+{
+  const HeapSample &heap = heapMonitor.getLast();
+  LOG_INFO("Heap free/largest block/min ever: %u/%u/%u bytes (at boot: %u/%u, lowest largest block: %u)",
+           (unsigned)heap.freeHeap, (unsigned)heap.largestFreeBlock, (unsigned)heap.minFreeHeap,
+           (unsigned)heapMonitor.getFirst().freeHeap, (unsigned)heapMonitor.getFirst().largestFreeBlock,
+           (unsigned)heapMonitor.getLowestLargestFreeBlock());
+  LOG_INFO("Log messages/dropped/truncated: %u/%u/%u (ring high-water: %u/%u records)",
+           (unsigned)asyncLog.getWrittenCount(), (unsigned)asyncLog.getDroppedCount(),
+           (unsigned)asyncLog.getTruncatedCount(), (unsigned)asyncLog.getHighWaterMark(), (unsigned)LOG_RING_CAPACITY);
+}
+
+#ifdef ENABLE_DIAGNOSTICS
+void recordReconnect()
+{
+  if (connection.getConnectCount() == lastConnectCount)
   {
-    Serial.println("Failed!");
-    delay(10000);
     return;
   }
-  Serial.println("Success!");
+  lastConnectCount = connection.getConnectCount();
+  // Measured in milliseconds by the connection manager, far too long for the cycle counter
+  uint32_t connectTime = connection.getLastConnectTime();
+  pipelineStats.add(PIPELINE_RECONNECT, connectTime < UINT32_MAX / 1000 ? connectTime * 1000 : UINT32_MAX);
+}
+
+void publishDiagnostics()
+{
+  lastDiagnosticsTime = millis();
+  const HeapSample &heap = heapMonitor.getLast();
+
+  TextWriter writer(diagnosticsBuffer, sizeof(diagnosticsBuffer));
+  writer.write("{\"id\":\"", 7);
+  writer.write(MQTT_CLIENT_ID, sizeof(MQTT_CLIENT_ID) - 1);
+  writer.write("\",\"uptime\":", 11);
+  writer.writeUnsigned(lastDiagnosticsTime);
+  writer.write(",\"heap\":[", 9);
+  writer.writeUnsigned(heap.freeHeap);
+  writer.write(',');
+  writer.writeUnsigned(heap.largestFreeBlock);
+  writer.write(',');
+  writer.writeUnsigned(heap.minFreeHeap);
+  writer.write("],\"stages\":", 11);
+  pipelineStats.writeJson(writer);
+  writer.write('}');
 
-  Serial.print("Connecting to APN: ");
-  Serial.print(APN);
-  Serial.print("...");
-  if (!modem.gprsConnect(APN, APN_USER, APN_PASSWORD))
+  if (writer.overflowed())
   {
-    Serial.println("Failed!");
-    delay(10000);
+    LOG_WARN("Diagnostics snapshot does not fit in the MQTT buffer! Skipping it.");
     return;
   }
-  Serial.println("Success!");
+  if (!mqttClient.publish(MQTT_DIAGNOSTICS_TOPIC, (const uint8_t *)diagnosticsBuffer, writer.length()))
+  {
+    LOG_WARN("Failed to publish diagnostics.");
+  }
 }
 #endif
 
-#ifdef USE_WIFI_CONNECTION
-void connectWifi()
+void readGpsFix(GpsFix &fix)
 {
-  Serial.print("Connecting to WiFi...");
-  WiFi.begin(WIFI_SSID, WIFI_PASSWORD);
-  while (WiFi.status() != WL_CONNECTED)
+  // Add device ID using MQTT_CLIENT_ID from config.h
+  fix.id = MQTT_CLIENT_ID;
+  fix.valid = 0;
+
+  // Add timestamp from the epoch clock, taken when the fix was captured
+  if (epochClock.isSet())
   {
-    delay(1000);
-    Serial.print(".");
+    fix.timestamp = epochClock.now(fix.capturedAt);
+    fix.valid |= GPS_FIX_HAS_TIME;
   }
-  Serial.println("Success!");
+
+#ifdef USE_UBX_PROTOCOL
+  // Add GPS data from the last UBX epoch
+  ubxGps.fillFix(fix);
+#else
+  // Add GPS data
+  if (gps.location.isValid())
+  {
+    const RawDegrees &rawLat = gps.location.rawLat();
+    const RawDegrees &rawLng = gps.location.rawLng();
+    fix.lat = makeFixCoordinate(rawLat.deg, rawLat.billionths, rawLat.negative);
+    fix.lng = makeFixCoordinate(rawLng.deg, rawLng.billionths, rawLng.negative);
+    fix.valid |= GPS_FIX_HAS_LOCATION;
+  }
+
+  // Add satellites data
+  fix.satellites = gps.satellites.value();
+
+  // Add HDOP (Horizontal Dilution of Precision) data
+  if (gps.hdop.isValid())
+  {
+    fix.hdop = gps.hdop.value() > UINT16_MAX ? UINT16_MAX : gps.hdop.value();
+    fix.valid |= GPS_FIX_HAS_HDOP;
+  }
+
+  // Add altitude data
+  if (gps.altitude.isValid())
+  {
+    fix.alt = gps.altitude.value();
+    fix.valid |= GPS_FIX_HAS_ALTITUDE;
+  }
+
+  // Add speed data
+  if (gps.speed.isValid())
+  {
+    fix.speed = makeFixSpeed(gps.speed.value());
+    fix.valid |= GPS_FIX_HAS_SPEED;
+  }
+#endif
+
+#if defined(USE_DUMMY_GPS_DATA) || GPS_SOURCE != GPS_SOURCE_UART
+  fix.dummy = true;
+#else
+  fix.dummy = false;
+#endif
+}
+
+void captureGpsFix()
+{
+#if defined(USE_DUMMY_GPS_DATA) && GPS_SOURCE == GPS_SOURCE_UART
+  bool hasNewFix = true; // Capture even without a sky view
+#elif defined(USE_UBX_PROTOCOL)
+  bool hasNewFix = ubxGps.getEpochCount() != lastCapturedEpoch;
+  lastCapturedEpoch = ubxGps.getEpochCount();
+#else
+  bool hasNewFix = gps.location.isUpdated();
+#endif
+
+  if (!hasNewFix || (millis() - lastFixTime <= PUBLISH_INTERVAL))
+  {
+    return;
+  }
+
+  GpsFix fix = {};
+  fix.capturedAt = millis();
+  readGpsFix(fix);
+
+  // Skip fixes that add nothing to the track
+#ifdef USE_UBX_PROTOCOL
+  float course = 0;
+  bool hasCourse = ubxGps.getCourse(&course);
+#else
+  float course = gps.course.deg();
+  bool hasCourse = gps.course.isValid();
+#endif
+  MotionReason reason = motionScheduler.evaluate(fix, course, hasCourse, fix.capturedAt);
+  if (reason == MOTION_SUPPRESSED)
+  {
+    return;
+  }
+
+  // Distance alone is no reason to publish while the vehicle stays on its predicted track
+  if (!trackSimplifier.evaluate(fix, course, hasCourse, reason != MOTION_DISTANCE))
+  {
+    return;
+  }
+
+  // Only a queued fix moves the references of the scheduler and the simplifier, and resets the heartbeat
+  if (fixQueue.push(fix))
+  {
+    motionScheduler.accept();
+    trackSimplifier.accept();
+  }
+  lastFixTime = fix.capturedAt;
 }
+
+size_t readGpsBytes(uint8_t *buffer, size_t capacity)
+{
+#if GPS_SOURCE == GPS_SOURCE_UART
+  return gpsSerial.read(buffer, capacity);
+#else
+  return gpsSource.read(buffer, capacity, millis());
 #endif
+}
+
+void gpsTask(void *parameter)
+{
+  for (;;)
+  {
+#if defined(USE_UBX_PROTOCOL) && GPS_SOURCE == GPS_SOURCE_UART
+    retryUbxConfig();
+#endif
+    uint8_t chunk[GPS_READ_CHUNK_SIZE];
+    size_t length;
+    size_t received = 0;
+    // Bounded, so that an unpaced source cannot keep the task from capturing fixes
+    while (received < GPS_RX_BUFFER_SIZE && (length = readGpsBytes(chunk, sizeof(chunk))) > 0)
+    {
+      received += length;
+#ifdef ENABLE_DIAGNOSTICS
+      uint32_t decodeStart = PipelineStats::now();
+#endif
+#ifdef USE_UBX_PROTOCOL
+      // Frames are decoded in place, only a frame split across two reads is copied
+      if (ubxGps.feed(chunk, length) > 0)
+      {
+        ubxEpochTime = millis();
+      }
+#else
+      for (size_t i = 0; i < length; i++)
+      {
+        gps.encode(chunk[i]);
+      }
+#endif
+#ifdef ENABLE_DIAGNOSTICS
+      pipelineStats.addSince(PIPELINE_DECODE, decodeStart);
+#endif
+    }
+    disciplineClock();
+    captureGpsFix();
+    vTaskDelay(pdMS_TO_TICKS(GPS_TASK_POLL_INTERVAL));
+  }
+}
+
+void logTask(void *parameter)
+{
+  for (;;)
+  {
+    // Only waits for the serial port here, never in the tasks that logged
+    if (asyncLog.drain(Serial, LOG_RING_CAPACITY) == 0)
+    {
+      vTaskDelay(pdMS_TO_TICKS(LOG_DRAIN_INTERVAL));
+    }
+  }
+}
+
+void onGpsReceiveError(hardwareSerial_error_t error)
+{
+  if (error == UART_BUFFER_FULL_ERROR || error == UART_FIFO_OVF_ERROR)
+  {
+    gpsUartOverflows++;
+  }
+}
+
+void drainFixQueue()
+{
+  GpsFix fix;
+  while (fixQueue.pop(fix))
+  {
+    fixBuffer.push(fix);
+  }
+}
+
+bool isBatchDue()
+{
+  if (fixBuffer.empty())
+  {
+    return false;
+  }
+  return fixBuffer.size() >= FIX_BATCH_SIZE || (millis() - fixBuffer.front().capturedAt >= FIX_BATCH_MAX_AGE);
+}
 
 void publishGpsData()
 {
-  Serial.print("Number of satellites: ");
-  Serial.println(gps.satellites.value());
+  // Serialize the batch straight into the payload arena, right where encryptInPlace() expects the plaintext
+  uint8_t *plain = payloadBuffer + getPlaintextOffset(PAYLOAD_FORMAT);
+  size_t fixCount = 0;
+#ifdef ENABLE_DIAGNOSTICS
+  uint32_t stageStart = PipelineStats::now();
+#endif
+  size_t plainLength = serializeGpsFixBatch(fixBuffer, FIX_BATCH_SIZE, FIX_ENCODING, plain,
+                                            getMaxPlaintextSize(sizeof(payloadBuffer), PAYLOAD_FORMAT), &fixCount);
+#ifdef ENABLE_DIAGNOSTICS
+  pipelineStats.addSince(PIPELINE_SERIALIZE, stageStart);
+#endif
+  if (plainLength == 0)
+  {
+    LOG_WARN("Fix does not fit in the MQTT buffer! Dropping it.");
+    fixBuffer.pop(1);
+    return;
+  }
 
-  // Create JSON document
-  JsonDocument doc;
+  LOG_DEBUG("Number of satellites: %u", (unsigned)fixBuffer[fixCount - 1].satellites);
 
-  // Add device ID using MQTT_CLIENT_ID from config.h
-  doc["id"] = MQTT_CLIENT_ID;
+#ifdef USE_UBX_PROTOCOL
+  LOG_DEBUG("GPS UART overflows: %u, fix queue high-water: %u/%u, queue drops: %u, UBX epochs: %u, bad frames: %u",
+            (unsigned)gpsUartOverflows, (unsigned)fixQueue.highWaterMark(), (unsigned)fixQueue.capacity(),
+            (unsigned)fixQueue.droppedCount(), (unsigned)ubxGps.getEpochCount(), (unsigned)ubxGps.getErrorCount());
+#else
+  LOG_DEBUG("GPS UART overflows: %u, fix queue high-water: %u/%u, queue drops: %u", (unsigned)gpsUartOverflows,
+            (unsigned)fixQueue.highWaterMark(), (unsigned)fixQueue.capacity(), (unsigned)fixQueue.droppedCount());
+#endif
 
-  // Add timestamp from RTC
-  doc["timestamp"] = getCurrentUTCTime();
+  LOG_DEBUG("Fixes sent/suppressed: %u/%u (heartbeat: %u, speed band: %u, distance: %u, heading: %u)",
+            (unsigned)motionScheduler.getSentCount(), (unsigned)motionScheduler.getSuppressedCount(),
+            (unsigned)motionScheduler.getSentCount(MOTION_HEARTBEAT), (unsigned)motionScheduler.getSentCount(MOTION_SPEED_BAND),
+            (unsigned)motionScheduler.getSentCount(MOTION_DISTANCE), (unsigned)motionScheduler.getSentCount(MOTION_HEADING));
 
-  // Add GPS data
-  if (gps.location.isValid())
+  LOG_DEBUG("Track simplification kept/dropped: %u/%u (compression %.2f:1, tolerance %.2f m)",
+            (unsigned)trackSimplifier.getKeptCount(), (unsigned)trackSimplifier.getDroppedCount(),
+            trackSimplifier.getCompressionRatio(), (double)TRACK_TOLERANCE);
+
+#if defined(ENABLE_DIAGNOSTICS) && LOG_LEVEL >= LOG_LEVEL_DEBUG
+  char stageTimes[PIPELINE_STAGE_COUNT * 40];
+  size_t stageTimesLength = 0;
+  for (uint8_t stage = 0; stage < PIPELINE_STAGE_COUNT && stageTimesLength < sizeof(stageTimes); stage++)
   {
-    doc["lat"] = gps.location.lat();
-    doc["long"] = gps.location.lng();
+    stageTimesLength += snprintf(stageTimes + stageTimesLength, sizeof(stageTimes) - stageTimesLength, " %s %u/%u/%u",
+                                 PipelineStats::getStageName((PipelineStage)stage),
+                                 (unsigned)pipelineStats.getAverageTime((PipelineStage)stage),
+                                 (unsigned)pipelineStats.getPercentile((PipelineStage)stage, 99),
+                                 (unsigned)pipelineStats.get((PipelineStage)stage).maxTime);
   }
-  else
+  LOG_DEBUG("Pipeline avg/p99/max us:%s", stageTimes);
+#endif
+
+#ifdef PRINT_PLAIN_JSON
+  if (FIX_ENCODING == FIX_ENCODING_JSON)
   {
-    doc["lat"] = nullptr;
-    doc["long"] = nullptr;
+    // Written as it is, a batch is far longer than a formatted message
+    LOG_INFO("Plain JSON (%u bytes):", (unsigned)plainLength);
+    asyncLog.write(LOG_LEVEL_INFO, (const char *)plain, plainLength);
   }
+#endif
 
-  // Add satellites data
-  doc["satellites"] = gps.satellites.value();
+  // Encrypt the whole batch once, in place - this will automatically include IV and counter in the output
+  // With the keystream prefetched in loop() this is only an XOR
+#ifdef ENABLE_DIAGNOSTICS
+  stageStart = PipelineStats::now();
+#endif
+  size_t payloadLength = encryptInPlace(payloadBuffer, sizeof(payloadBuffer), plainLength, PAYLOAD_FORMAT, true);
+#ifdef ENABLE_DIAGNOSTICS
+  pipelineStats.addSince(PIPELINE_ENCRYPT, stageStart);
+#endif
 
-  // Add HDOP (Horizontal Dilution of Precision) data
-  if (gps.hdop.isValid())
+  KeystreamPrefetchStats prefetchStats = getKeystreamPrefetchStats();
+  LOG_DEBUG("Heap allocations: %u, keystream prefetch hits/partial/misses: %u/%u/%u, reconnects: %u, last connect: %u ms",
+            (unsigned)HeapMonitor::getAllocationCount(), (unsigned)prefetchStats.hits, (unsigned)prefetchStats.partialHits,
+            (unsigned)prefetchStats.misses, (unsigned)connection.getConnectCount(),
+            (unsigned)connection.getLastConnectTime());
+
+  // Only formatted for the log, fixes carry the integer timestamp
+  char isoTime[EPOCH_ISO_TIME_SIZE] = "";
+#if LOG_LEVEL >= LOG_LEVEL_WARN
+  formatIsoTime(epochClock.toEpoch(millis()), isoTime, sizeof(isoTime));
+#endif
+
+  // Publish encrypted data to MQTT
+#ifdef ENABLE_DIAGNOSTICS
+  // Timed with micros(), a stalled modem can block for longer than the cycle counter wraps
+  uint32_t publishStart = micros();
+#endif
+  bool published = mqttClient.publish(MQTT_PUBLISH_TOPIC, payloadBuffer, payloadLength);
+#ifdef ENABLE_DIAGNOSTICS
+  pipelineStats.add(PIPELINE_PUBLISH, micros() - publishStart);
+  if (published)
   {
-    doc["hdop"] = gps.hdop.hdop();
+    // Age of every fix of the batch, from capture to handing it to the MQTT client
+    uint32_t now = millis();
+    for (size_t i = 0; i < fixCount; i++)
+    {
+      uint32_t age = now - fixBuffer[i].capturedAt;
+      pipelineStats.add(PIPELINE_LATENCY, age < UINT32_MAX / 1000 ? age * 1000 : UINT32_MAX);
+    }
+  }
+#endif
+
+  if (published)
+  {
+    LOG_INFO("Published %u fixes as encrypted data (length: %u bytes) - %s", (unsigned)fixCount,
+             (unsigned)payloadLength, isoTime);
+
+    if (firstValidPublishTime == 0 && (fixBuffer[fixCount - 1].valid & GPS_FIX_HAS_TIME))
+    {
+      firstValidPublishTime = millis();
+      LOG_INFO("Time to first valid publish: %u ms (time from %s after %u ms)", (unsigned)firstValidPublishTime,
+               TimeArbiter::getSourceName(timeArbiter.getSource()), (unsigned)timeArbiter.getTimeToFirstSource());
+    }
+    fixBuffer.pop(fixCount);
   }
   else
   {
-    doc["hdop"] = nullptr;
+    LOG_WARN("Failed to publish %u fixes (length: %u bytes) - %s - Keeping the fixes on flash.", (unsigned)fixCount,
+             (unsigned)payloadLength, isoTime);
+    spillFixes(fixCount);
   }
+}
 
-  // Add altitude data
-  if (gps.altitude.isValid())
+void spillFixes(size_t count)
+{
+  uint8_t record[FIX_LOG_MAX_RECORD_SIZE];
+  size_t spilled = 0;
+  while (spilled < count && spilled < fixBuffer.size())
+  {
+    size_t recordLength = serializeGpsFix(fixBuffer[spilled], fixLogEncoding, record, sizeof(record));
+    if (recordLength == 0 || !fixLog.append(record, recordLength))
+    {
+      break; // Leave the rest in RAM
+    }
+    spilled++;
+  }
+
+  // One flash write per batch
+  fixLog.flush();
+  fixBuffer.pop(spilled);
+}
+
+void replayFixLog()
+{
+  lastReplayTime = millis();
+
+  // Read the oldest logged fixes straight into the payload arena, as one batch
+  uint8_t *plain = payloadBuffer + getPlaintextOffset(PAYLOAD_FORMAT);
+  size_t fixCount = 0;
+  size_t plainLength = fixLog.peekBatch(fixLogEncoding, FIX_LOG_REPLAY_BATCH, plain,
+                                        getMaxPlaintextSize(sizeof(payloadBuffer), PAYLOAD_FORMAT), &fixCount);
+  if (plainLength == 0)
+  {
+    return;
+  }
+
+  size_t payloadLength = encryptInPlace(payloadBuffer, sizeof(payloadBuffer), plainLength, PAYLOAD_FORMAT, true);
+
+  // The fixes stay in the log until the broker has them
+  if (mqttClient.publish(MQTT_PUBLISH_TOPIC, payloadBuffer, payloadLength))
   {
-    doc["alt"] = gps.altitude.meters();
+    fixLog.commitBatch();
+    LOG_INFO("Replaying %u logged fixes (length: %u bytes, segments left: %u) - Success!", (unsigned)fixCount,
+             (unsigned)payloadLength, (unsigned)fixLog.getSegmentCount());
   }
   else
   {
-    doc["alt"] = nullptr;
+    LOG_WARN("Replaying %u logged fixes (length: %u bytes, segments left: %u) - Failed!", (unsigned)fixCount,
+             (unsigned)payloadLength, (unsigned)fixLog.getSegmentCount());
   }
+}
 
-  // Add speed data
-  if (gps.speed.isValid())
+void acceptNtpTime()
+{
+  // GPS time may have arrived while NTP was in progress, it stays authoritative
+  updateTimeSource();
+  if (timeArbiter.offer(TIME_SOURCE_NTP, millis()))
   {
-    doc["speed"] = gps.speed.kmph();
+    epochClock.set((uint64_t)rtc.getEpoch() * 1000 + rtc.getMillis(), millis());
   }
   else
   {
-    doc["speed"] = nullptr;
+    setRtcFromClock();
+  }
+}
+
+void updateTimeSource()
+{
+  // Only the GPS task disciplines the clock, as soon as the receiver reports a valid date and time
+  if (epochClock.getDisciplineCount() > 0 && timeArbiter.offer(TIME_SOURCE_GPS, millis()))
+  {
+    setRtcFromClock();
+    LOG_INFO("Time set from GPS: %s UTC", rtc.getTime("%Y-%m-%d %H:%M:%S").c_str());
+  }
+}
+
+void setRtcFromClock()
+{
+  uint64_t epochMillis = epochClock.toEpoch(millis());
+  rtc.setTime(epochMillis / 1000, (epochMillis % 1000) * 1000); // The second argument is in microseconds
+}
+
+void disciplineClock()
+{
+#ifdef USE_UBX_PROTOCOL
+  uint64_t gpsTime;
+  if (ubxGps.getEpochCount() == lastDisciplinedEpoch || !ubxGps.getUtcTime(&gpsTime))
+  {
+    return;
   }
+  lastDisciplinedEpoch = ubxGps.getEpochCount();
 
-#ifdef USE_DUMMY_GPS_DATA
-  doc["dummy"] = true;
+  // The epoch is completed GPS_TIME_LATENCY after the time it reports
+  epochClock.discipline(gpsTime, ubxEpochTime - GPS_TIME_LATENCY);
 #else
-  doc["dummy"] = false;
+  if (!gps.time.isUpdated() || !gps.time.isValid() || !gps.date.isValid() || gps.date.year() < 2020)
+  {
+    return;
+  }
+
+  // The sentence carrying the time is decoded GPS_TIME_LATENCY after the time it reports
+  uint64_t gpsTime = makeEpochMillis(gps.date.year(), gps.date.month(), gps.date.day(), gps.time.hour(),
+                                     gps.time.minute(), gps.time.second(), gps.time.centisecond() * 10);
+  epochClock.discipline(gpsTime, millis() - gps.time.age() - GPS_TIME_LATENCY);
+  gps.time.value(); // Clear the updated flag
 #endif
+}
 
-  // Get plain JSON for debug
-  String plainJson;
-  serializeJson(doc, plainJson);
-  Serial.print("Plain JSON: ");
-  Serial.println(plainJson);
+#ifdef USE_UBX_PROTOCOL
+bool configureUbx()
+{
+  uint8_t frame[32];
 
-  // Encrypt the JSON document - this will automatically include IV and counter in the output
-  String encryptedData = encryptJson(doc);
+  // The receiver switches baud before it answers, so the port is configured at the power-on
+  // baud and again at the new one, which also covers a receiver that kept it across a reset
+  size_t length = buildUbxPortConfig(GPS_UBX_BAUD, frame, sizeof(frame));
+  gpsSerial.write(frame, length);
+  gpsSerial.flush();
+  delay(100);
+  gpsSerial.updateBaudRate(GPS_UBX_BAUD);
+  if (sendUbxConfig(frame, length) && configureUbxOutput())
+  {
+    return true;
+  }
 
-  // Publish encrypted data to MQTT
-  Serial.print("Publishing encrypted data (length: ");
-  Serial.print(encryptedData.length());
-  Serial.print(" bytes)");
+  // Back to the power-on baud, where a receiver that missed the port configuration still sends NMEA
+  gpsSerial.updateBaudRate(GPS_BAUD);
+  return false;
+}
+
+bool configureUbxOutput()
+{
+  uint8_t frame[32];
+  size_t length = buildUbxRateConfig(1000 / GPS_UBX_RATE, frame, sizeof(frame));
+  if (!sendUbxConfig(frame, length))
+  {
+    return false;
+  }
+
+  // Every part of an epoch, the NEO-6M has no NAV-PVT
+  const uint8_t navMessages[] = {UBX_NAV_POSLLH, UBX_NAV_SOL, UBX_NAV_DOP, UBX_NAV_VELNED, UBX_NAV_TIMEUTC};
+  for (size_t i = 0; i < sizeof(navMessages); i++)
+  {
+    length = buildUbxMessageRate(UBX_CLASS_NAV, navMessages[i], 1, frame, sizeof(frame));
+    if (!sendUbxConfig(frame, length))
+    {
+      return false;
+    }
+  }
+  return true;
+}
+
+void retryUbxConfig()
+{
+  if (ubxConfigured || millis() - lastUbxConfigAttempt < GPS_UBX_RETRY_INTERVAL)
+  {
+    return;
+  }
 
-  if (mqttClient.publish(MQTT_TOPIC, encryptedData.c_str()))
+  // Blocks the GPS task for up to a few seconds, while no fix can be decoded anyway
+  ubxConfigured = configureUbx();
+  lastUbxConfigAttempt = millis();
+  if (ubxConfigured)
   {
-    Serial.print(" - ");
-    Serial.print(millis());
-    Serial.print(" ms");
-    Serial.print(" - ");
-    Serial.print(getCurrentUTCTime());
-    Serial.print(" - ");
-    Serial.println("Success!");
-    lastPublishTime = millis();
+    LOG_INFO("Configuring GPS for UBX output...Success!");
   }
   else
   {
-    Serial.print(" - ");
-    Serial.print(millis());
-    Serial.print(" ms...");
-    Serial.print(" - ");
-    Serial.print(getCurrentUTCTime());
-    Serial.print(" - ");
-    Serial.println("Failed!");
+    LOG_WARN("Configuring GPS for UBX output...Failed! Retrying in %u s.", (unsigned)(GPS_UBX_RETRY_INTERVAL / 1000));
   }
 }
 
-String getCurrentUTCTime()
+bool sendUbxConfig(const uint8_t *frame, size_t length)
 {
-  String isoTimestamp = rtc.getTime("%Y-%m-%dT%H:%M:%S");
-  // Add milliseconds (approximate)
-  unsigned long msInThisSecond = millis() % 1000;
-  char msStr[5];
-  sprintf(msStr, ".%03lu", msInThisSecond);
-  isoTimestamp += msStr;
-  isoTimestamp += "Z"; // 'Z' indicates UTC timezone
-  return isoTimestamp;
-}
\ No newline at end of file
+  ubxGps.clearAck();
+  gpsSerial.write(frame, length);
+
+  uint32_t start = millis();
+  while (millis() - start < GPS_UBX_ACK_TIMEOUT)
+  {
+    uint8_t chunk[GPS_READ_CHUNK_SIZE];
+    ubxGps.feed(chunk, gpsSerial.read(chunk, sizeof(chunk)));
+
+    UbxAck ack = ubxGps.getAck(frame[2], frame[3]);
+    if (ack != UBX_ACK_NONE)
+    {
+      return ack == UBX_ACK_ACCEPTED;
+    }
+    delay(1);
+  }
+  return false;
+}
+#endif
@@ -0,0 +1,285 @@
+// Host (native) end-to-end benchmark of the fix pipeline
+//
+// Feeds a GPS source through the same stages as the device and prints the time spent in
+// each: decode (TinyGPSPlus for NMEA, UbxGps for UBX), serialize, encrypt and publish. The
+// source is a synthetic route, or a recorded capture replayed as fast as it is decoded.
+// Every decoded fix is published, without the motion scheduler, and publishing goes to a
+// sink standing in for PubSubClient, so that stage only covers handing the payload over:
+//
+//   pio run -e pipeline_native && .pio/build/pipeline_native/program [nmea|ubx] [fixes] [capture]
+
+#include <Arduino.h>
+#include <TinyGPSPlus.h>
+#include <ChaCha20.h>
+#include <GpsFix.h>
+#include <UbxGps.h>
+#include <EpochClock.h>
+#include <GpsSource.h>
+#include <PipelineStats.h>
+
+#define PIPELINE_DEVICE_ID "lokatrack-pipeline-1"
+#define PIPELINE_PAYLOAD_SIZE 1024
+#define PIPELINE_BATCH_SIZE 5
+#define PIPELINE_READ_CHUNK_SIZE 128
+#define PIPELINE_SYNTHETIC_RATE 5
+#define PIPELINE_SYNTHETIC_SEED 1
+
+// Arena for the encrypted payload, reused for every publish like on the device
+static uint8_t payloadBuffer[PIPELINE_PAYLOAD_SIZE];
+
+// Fixes waiting to be published, oldest first
+static RingBuffer<GpsFix, 32> fixBuffer;
+
+// Payloads handed to the sink
+static uint8_t sinkBuffer[PIPELINE_PAYLOAD_SIZE];
+static uint32_t sinkMessages = 0;
+static uint64_t sinkBytes = 0;
+
+static TinyGPSPlus gps;
+static UbxGps ubxGps(UBX_EPOCH_NEO6);
+static PipelineStats pipelineStats;
+
+/**
+ * Stand-in for mqttClient.publish(), copying the payload like PubSubClient copies it into its buffer
+ *
+ * @param payload Payload to publish
+ * @param length Length of the payload
+ * @return true if the payload was taken, false otherwise
+ */
+static bool publishPayload(const uint8_t *payload, size_t length)
+{
+    if (length > sizeof(sinkBuffer))
+    {
+        return false;
+    }
+    memcpy(sinkBuffer, payload, length);
+    sinkMessages++;
+    sinkBytes += length;
+    return true;
+}
+
+/**
+ * Fill a fix from the decoder, like readGpsFix() on the device
+ *
+ * @param fix Fix to fill
+ * @param ubx Whether the UBX decoder is used
+ */
+static void readFix(GpsFix &fix, bool ubx)
+{
+    fix = {};
+    fix.id = PIPELINE_DEVICE_ID;
+    fix.dummy = true;
+    fix.capturedAt = millis();
+
+    if (ubx)
+    {
+        if (ubxGps.getUtcTime(&fix.timestamp))
+        {
+            fix.valid |= GPS_FIX_HAS_TIME;
+        }
+        ubxGps.fillFix(fix);
+        return;
+    }
+
+    if (gps.date.isValid() && gps.time.isValid())
+    {
+        fix.timestamp = makeEpochMillis(gps.date.year(), gps.date.month(), gps.date.day(), gps.time.hour(),
+                                        gps.time.minute(), gps.time.second(), gps.time.centisecond() * 10);
+        fix.valid |= GPS_FIX_HAS_TIME;
+    }
+    if (gps.location.isValid())
+    {
+        const RawDegrees &rawLat = gps.location.rawLat();
+        const RawDegrees &rawLng = gps.location.rawLng();
+        fix.lat = makeFixCoordinate(rawLat.deg, rawLat.billionths, rawLat.negative);
+        fix.lng = makeFixCoordinate(rawLng.deg, rawLng.billionths, rawLng.negative);
+        fix.valid |= GPS_FIX_HAS_LOCATION;
+    }
+    fix.satellites = gps.satellites.value();
+    if (gps.hdop.isValid())
+    {
+        fix.hdop = gps.hdop.value() > UINT16_MAX ? UINT16_MAX : gps.hdop.value();
+        fix.valid |= GPS_FIX_HAS_HDOP;
+    }
+    if (gps.altitude.isValid())
+    {
+        fix.alt = gps.altitude.value();
+        fix.valid |= GPS_FIX_HAS_ALTITUDE;
+    }
+    if (gps.speed.isValid())
+    {
+        fix.speed = makeFixSpeed(gps.speed.value());
+        fix.valid |= GPS_FIX_HAS_SPEED;
+    }
+}
+
+/**
+ * Serialize, encrypt and publish the oldest buffered fixes, like publishGpsData() on the device
+ *
+ * @return true if the batch was published, false otherwise
+ */
+static bool publishBatch()
+{
+    // The device fills the keystream from idle loop() passes between publishes
+    while (!prefetchKeystreamStep(256, true))
+    {
+    }
+
+    uint8_t *plain = payloadBuffer + getPlaintextOffset(PAYLOAD_FORMAT_BINARY);
+    size_t fixCount = 0;
+    uint32_t stageStart = PipelineStats::now();
+    size_t plainLength = serializeGpsFixBatch(fixBuffer, PIPELINE_BATCH_SIZE, FIX_ENCODING_JSON, plain,
+                                              getMaxPlaintextSize(sizeof(payloadBuffer), PAYLOAD_FORMAT_BINARY), &fixCount);
+    pipelineStats.addSince(PIPELINE_SERIALIZE, stageStart);
+    if (plainLength == 0)
+    {
+        fixBuffer.pop(1);
+        return false;
+    }
+
+    stageStart = PipelineStats::now();
+    size_t payloadLength = encryptInPlace(payloadBuffer, sizeof(payloadBuffer), plainLength, PAYLOAD_FORMAT_BINARY, true);
+    pipelineStats.addSince(PIPELINE_ENCRYPT, stageStart);
+
+    stageStart = PipelineStats::now();
+    bool published = payloadLength > 0 && publishPayload(payloadBuffer, payloadLength);
+    pipelineStats.addSince(PIPELINE_PUBLISH, stageStart);
+
+    fixBuffer.pop(fixCount);
+    return published;
+}
+
+/**
+ * Run the pipeline until enough fixes were decoded
+ *
+ * @param source Source of the GPS bytes
+ * @param ubx Whether the bytes are decoded as UBX or as NMEA
+ * @param fixes Number of fixes to decode
+ * @param failures Receives the number of batches that could not be published
+ * @return Number of fixes decoded
+ */
+template <typename Source>
+static uint32_t runPipeline(Source &source, bool ubx, uint32_t fixes, uint32_t *failures)
+{
+    uint8_t chunk[PIPELINE_READ_CHUNK_SIZE];
+    uint32_t decoded = 0;
+    uint32_t lastEpoch = 0;
+    uint64_t bytes = 0;
+    uint64_t bytesAtLastFix = 0;
+
+    while (decoded < fixes)
+    {
+        size_t length = source.read(chunk, sizeof(chunk), millis());
+        bytes += length;
+        if (bytes - bytesAtLastFix > 1000000)
+        {
+            // A megabyte without a fix, the capture does not match the decoder
+            break;
+        }
+
+        uint32_t decodeStart = PipelineStats::now();
+        bool hasNewFix;
+        if (ubx)
+        {
+            ubxGps.feed(chunk, length);
+            hasNewFix = ubxGps.getEpochCount() != lastEpoch;
+            lastEpoch = ubxGps.getEpochCount();
+        }
+        else
+        {
+            for (size_t i = 0; i < length; i++)
+            {
+                gps.encode(chunk[i]);
+            }
+            hasNewFix = gps.location.isUpdated();
+        }
+        pipelineStats.addSince(PIPELINE_DECODE, decodeStart);
+
+        if (!hasNewFix)
+        {
+            continue;
+        }
+
+        GpsFix fix;
+        readFix(fix, ubx); // Reading the location also clears isUpdated()
+        fixBuffer.push(fix);
+        decoded++;
+        bytesAtLastFix = bytes;
+
+        if (fixBuffer.size() >= PIPELINE_BATCH_SIZE && !publishBatch())
+        {
+            (*failures)++;
+        }
+    }
+
+    while (!fixBuffer.empty())
+    {
+        if (!publishBatch())
+        {
+            (*failures)++;
+        }
+    }
+    return decoded;
+}
+
+int main(int argc, char **argv)
+{
+    bool ubx = argc > 1 && strcmp(argv[1], "ubx") == 0;
+    if (argc > 1 && !ubx && strcmp(argv[1], "nmea") != 0)
+    {
+        Serial.println("Unknown format, expected nmea or ubx");
+        return 2;
+    }
+    uint32_t fixes = argc > 2 ? strtoul(argv[2], nullptr, 10) : 10000;
+
+    initChaCha();
+    randomSeed(1);
+
+    uint32_t failures = 0;
+    uint32_t decoded;
+    unsigned long start = micros();
+    if (argc > 3)
+    {
+        GpsReplaySource replay(argv[3], 0);
+        if (!replay.begin())
+        {
+            Serial.println("Failed to open the capture!");
+            return 2;
+        }
+        decoded = runPipeline(replay, ubx, fixes, &failures);
+        Serial.printf("source: replay of %s, %u passes\n", argv[3], (unsigned)replay.getPassCount());
+    }
+    else
+    {
+        GpsSyntheticSource synthetic(ubx ? GPS_SYNTHETIC_UBX : GPS_SYNTHETIC_NMEA, PIPELINE_SYNTHETIC_RATE, 0,
+                                     PIPELINE_SYNTHETIC_SEED);
+        decoded = runPipeline(synthetic, ubx, fixes, &failures);
+        Serial.printf("source: synthetic route, %u epochs at %u Hz\n", (unsigned)synthetic.getEpochCount(),
+                      (unsigned)PIPELINE_SYNTHETIC_RATE);
+    }
+    unsigned long elapsed = micros() - start;
+
+    Serial.printf("decoder: %s\n", ubx ? "UbxGps" : "TinyGPSPlus");
+    Serial.printf("fixes: %u, messages: %u, payload bytes: %llu\n", (unsigned)decoded, (unsigned)sinkMessages,
+                  (unsigned long long)sinkBytes);
+    Serial.printf("elapsed: %lu us (%.2f us per fix)\n", elapsed, decoded > 0 ? (double)elapsed / decoded : 0.0);
+    for (uint8_t stage = 0; stage < PIPELINE_STAGE_COUNT; stage++)
+    {
+        const PipelineStageStats &stats = pipelineStats.get((PipelineStage)stage);
+        Serial.printf("%-10s passes: %8u, total: %10llu us, avg: %8.3f us, p50: %6u us, p99: %6u us, max: %6u us\n",
+                      PipelineStats::getStageName((PipelineStage)stage), (unsigned)stats.count,
+                      (unsigned long long)stats.totalTime, stats.count > 0 ? (double)stats.totalTime / stats.count : 0.0,
+                      (unsigned)pipelineStats.getPercentile((PipelineStage)stage, 50),
+                      (unsigned)pipelineStats.getPercentile((PipelineStage)stage, 99), (unsigned)stats.maxTime);
+    }
+
+    // The histograms as the device publishes them to MQTT_DIAGNOSTICS_TOPIC
+    char snapshot[512];
+    TextWriter writer(snapshot, sizeof(snapshot) - 1);
+    pipelineStats.writeJson(writer);
+    snapshot[writer.length()] = '\0';
+    Serial.printf("snapshot: %s%s\n", snapshot, writer.overflowed() ? " (truncated)" : "");
+    Serial.printf("failures: %u\n", (unsigned)failures);
+
+    return failures == 0 && decoded == fixes ? 0 : 1;
+}
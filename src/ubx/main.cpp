@@ -0,0 +1,341 @@
+// Host (native) replay of UBX captures through the UBX decoder
+//
+// With a capture file, e.g. recorded from the receiver's UART with a USB serial adapter
+// (cat /dev/ttyUSB0 > drive.ubx), the bytes are fed in chunks of random size like the UART
+// delivers them, and every epoch is printed as the fix record the device would publish.
+// Without one, a synthetic capture with NMEA noise and corrupted frames is generated and
+// every decoded epoch is checked against the values it was built from:
+//
+//   pio run -e ubx_native && .pio/build/ubx_native/program [capture.ubx] [maxChunk]
+
+#include <Arduino.h>
+#include <GpsFix.h>
+#include <UbxGps.h>
+#include <EpochClock.h>
+#include <stdio.h>
+#include <string.h>
+#include <vector>
+
+#define REPLAY_DEVICE_ID "lokatrack-replay-1"
+#define SYNTHETIC_EPOCHS 20000
+#define SYNTHETIC_PERIOD 200              // 5 Hz
+#define SYNTHETIC_START 1735689600000ULL  // 2025-01-01T00:00:00Z
+#define SYNTHETIC_ITOW 259218000UL        // GPS time of week of SYNTHETIC_START, with 18 leap seconds
+
+static void putU16(uint8_t *p, uint16_t value)
+{
+    p[0] = value;
+    p[1] = value >> 8;
+}
+
+static void putU32(uint8_t *p, uint32_t value)
+{
+    putU16(p, value);
+    putU16(p + 2, value >> 16);
+}
+
+/**
+ * Append a UBX frame to a capture
+ *
+ * @param capture Capture to append to
+ * @param messageClass Class of the message
+ * @param messageId ID of the message
+ * @param payload Payload of the message
+ * @param length Length of the payload
+ * @param corrupt Whether to break the checksum of the frame
+ */
+static void appendFrame(std::vector<uint8_t> &capture, uint8_t messageClass, uint8_t messageId, const uint8_t *payload, uint16_t length, bool corrupt)
+{
+    uint8_t frame[UBX_MAX_PAYLOAD_SIZE + UBX_FRAME_OVERHEAD];
+    size_t frameLength = buildUbxFrame(messageClass, messageId, payload, length, frame, sizeof(frame));
+    if (corrupt)
+    {
+        frame[UBX_HEADER_SIZE + length / 2] ^= 0x5A;
+    }
+    capture.insert(capture.end(), frame, frame + frameLength);
+}
+
+/**
+ * Get the fix the synthetic capture carries for an epoch
+ *
+ * @param index Index of the epoch
+ * @param solution Receives the expected solution
+ */
+static void makeSolution(uint32_t index, UbxSolution &solution)
+{
+    solution = {};
+    solution.iTOW = SYNTHETIC_ITOW + index * SYNTHETIC_PERIOD;
+    solution.lat = -62087634 + (int32_t)index * 123;
+    solution.lng = 1068455990 + (int32_t)index * 456;
+    solution.altitude = 12000 + (int32_t)(index % 500) * 10;
+    solution.groundSpeed = (index % 40) * 250; // Whole cm/s, as NAV-VELNED reports them
+    solution.heading = (int32_t)((index * 37) % 360) * 100000;
+    solution.hdop = 80 + index % 50;
+    solution.satellites = 4 + index % 9;
+    solution.fixType = index % 100 < 3 ? 2 : 3;
+    solution.fixOk = index % 250 != 7;
+    solution.timeValid = true;
+    solution.utcTime = SYNTHETIC_START + (uint64_t)index * SYNTHETIC_PERIOD;
+}
+
+/**
+ * Append the NAV-POSLLH, NAV-SOL, NAV-DOP, NAV-VELNED and NAV-TIMEUTC frames of one epoch
+ *
+ * @param capture Capture to append to
+ * @param solution Solution of the epoch
+ */
+static void appendEpoch(std::vector<uint8_t> &capture, const UbxSolution &solution)
+{
+    uint8_t payload[52];
+
+    memset(payload, 0, sizeof(payload));
+    putU32(payload, solution.iTOW);
+    putU32(payload + 4, solution.lng);
+    putU32(payload + 8, solution.lat);
+    putU32(payload + 12, solution.altitude + 28000);
+    putU32(payload + 16, solution.altitude);
+    appendFrame(capture, UBX_CLASS_NAV, UBX_NAV_POSLLH, payload, 28, false);
+
+    memset(payload, 0, sizeof(payload));
+    putU32(payload, solution.iTOW);
+    payload[10] = solution.fixType;
+    payload[11] = solution.fixOk ? 0x0D : 0x0C;
+    payload[47] = solution.satellites;
+    appendFrame(capture, UBX_CLASS_NAV, UBX_NAV_SOL, payload, 52, false);
+
+    memset(payload, 0, sizeof(payload));
+    putU32(payload, solution.iTOW);
+    putU16(payload + 12, solution.hdop);
+    appendFrame(capture, UBX_CLASS_NAV, UBX_NAV_DOP, payload, 18, false);
+
+    memset(payload, 0, sizeof(payload));
+    putU32(payload, solution.iTOW);
+    putU32(payload + 20, solution.groundSpeed / 10);
+    putU32(payload + 24, solution.heading);
+    appendFrame(capture, UBX_CLASS_NAV, UBX_NAV_VELNED, payload, 36, false);
+
+    uint64_t seconds = solution.utcTime / 1000;
+    memset(payload, 0, sizeof(payload));
+    putU32(payload, solution.iTOW);
+    putU32(payload + 8, (solution.utcTime % 1000) * 1000000);
+    putU16(payload + 12, 2025);
+    payload[14] = 1;
+    payload[15] = 1 + (seconds - SYNTHETIC_START / 1000) / 86400;
+    payload[16] = seconds / 3600 % 24;
+    payload[17] = seconds / 60 % 60;
+    payload[18] = seconds % 60;
+    payload[19] = 0x07;
+    appendFrame(capture, UBX_CLASS_NAV, UBX_NAV_TIMEUTC, payload, 20, false);
+}
+
+/**
+ * Build a synthetic capture of 5 Hz NEO-6M output
+ * NMEA sentences from before the receiver was configured, an ACK and corrupted frames
+ * are mixed in.
+ *
+ * @param capture Receives the capture
+ * @param corrupted Receives the number of corrupted frames
+ */
+static void makeCapture(std::vector<uint8_t> &capture, uint32_t *corrupted)
+{
+    const char *nmea = "$GPRMC,000000.00,A,0612.52580,S,10650.73594,E,0.004,,010125,,,A*6B\r\n";
+    uint8_t ack[2] = {UBX_CLASS_CFG, UBX_CFG_RATE};
+    uint8_t noise[18] = {};
+
+    *corrupted = 0;
+    capture.insert(capture.end(), nmea, nmea + strlen(nmea));
+    appendFrame(capture, UBX_CLASS_ACK, UBX_ACK_ACK, ack, sizeof(ack), false);
+
+    for (uint32_t i = 0; i < SYNTHETIC_EPOCHS; i++)
+    {
+        UbxSolution solution;
+        makeSolution(i, solution);
+        appendEpoch(capture, solution);
+
+        if (i % 37 == 0)
+        {
+            // A damaged copy of the next epoch's NAV-DOP, which must not start that epoch
+            putU32(noise, solution.iTOW + SYNTHETIC_PERIOD);
+            appendFrame(capture, UBX_CLASS_NAV, UBX_NAV_DOP, noise, sizeof(noise), true);
+            (*corrupted)++;
+        }
+        if (i % 101 == 0)
+        {
+            capture.insert(capture.end(), nmea, nmea + strlen(nmea));
+        }
+    }
+}
+
+/**
+ * Check that a decoded fix matches the solution it was built from
+ *
+ * @param fix Decoded fix
+ * @param expected Solution of the epoch
+ * @return true if the fix matches, false otherwise
+ */
+static bool checkFix(const GpsFix &fix, const UbxSolution &expected)
+{
+    bool located = expected.fixOk && expected.fixType >= 2;
+    uint32_t valid = GPS_FIX_HAS_HDOP;
+    if (located)
+    {
+        valid |= GPS_FIX_HAS_LOCATION | GPS_FIX_HAS_SPEED | (expected.fixType == 3 ? GPS_FIX_HAS_ALTITUDE : 0);
+    }
+
+    return fix.valid == valid && fix.satellites == expected.satellites && fix.hdop == expected.hdop &&
+           (!located || (fix.lat == expected.lat && fix.lng == expected.lng &&
+                         fix.speed == expected.groundSpeed * 36 / 100)) &&
+           (!(valid & GPS_FIX_HAS_ALTITUDE) || fix.alt == expected.altitude / 10);
+}
+
+/**
+ * Feed a capture to a decoder in chunks of random size
+ *
+ * @param ubx Decoder
+ * @param capture Capture to replay
+ * @param maxChunk Largest chunk in bytes
+ * @param onEpoch Called after every chunk that completed an epoch, or nullptr
+ * @return Time spent in feed() in microseconds
+ */
+static unsigned long replay(UbxGps &ubx, const std::vector<uint8_t> &capture, size_t maxChunk, void (*onEpoch)(const UbxGps &))
+{
+    unsigned long elapsed = 0;
+    size_t pos = 0;
+    while (pos < capture.size())
+    {
+        size_t chunk = 1 + random(maxChunk);
+        if (chunk > capture.size() - pos)
+        {
+            chunk = capture.size() - pos;
+        }
+
+        unsigned long start = micros();
+        size_t completed = ubx.feed(capture.data() + pos, chunk);
+        elapsed += micros() - start;
+
+        if (completed > 0 && onEpoch != nullptr)
+        {
+            onEpoch(ubx);
+        }
+        pos += chunk;
+    }
+    return elapsed;
+}
+
+static unsigned long checkedEpochs = 0;
+static unsigned long failures = 0;
+
+static void checkEpoch(const UbxGps &ubx)
+{
+    const UbxSolution &solution = ubx.getSolution();
+    uint32_t index = (solution.iTOW - SYNTHETIC_ITOW) / SYNTHETIC_PERIOD;
+
+    UbxSolution expected;
+    makeSolution(index, expected);
+
+    GpsFix fix = {};
+    ubx.fillFix(fix);
+    uint64_t utcTime = 0;
+    float course = 0;
+    bool hasCourse = ubx.getCourse(&course);
+    if (!checkFix(fix, expected) || !ubx.getUtcTime(&utcTime) || utcTime != expected.utcTime ||
+        hasCourse != expected.fixOk || (hasCourse && course != expected.heading * 1e-5f))
+    {
+        if (failures++ < 5)
+        {
+            Serial.printf("mismatch at epoch %lu\n", (unsigned long)index);
+        }
+    }
+    checkedEpochs++;
+}
+
+static void printEpoch(const UbxGps &ubx)
+{
+    GpsFix fix = {};
+    fix.id = REPLAY_DEVICE_ID;
+    ubx.fillFix(fix);
+    if (ubx.getUtcTime(&fix.timestamp))
+    {
+        fix.valid |= GPS_FIX_HAS_TIME;
+    }
+
+    uint8_t json[256];
+    size_t length = serializeGpsFix(fix, FIX_ENCODING_JSON, json, sizeof(json));
+    fwrite(json, 1, length, stdout);
+    fputc('\n', stdout);
+}
+
+/**
+ * Print the counters of a decoder
+ *
+ * @param ubx Decoder
+ * @param bytes Number of bytes fed
+ * @param elapsed Time spent in feed() in microseconds
+ */
+static void printStats(const UbxGps &ubx, size_t bytes, unsigned long elapsed)
+{
+    fprintf(stderr, "bytes: %lu, frames: %lu, epochs: %lu\n", (unsigned long)bytes,
+            (unsigned long)ubx.getFrameCount(), (unsigned long)ubx.getEpochCount());
+    fprintf(stderr, "bad frames: %lu, skipped bytes: %lu, frames split across reads: %lu\n",
+            (unsigned long)ubx.getErrorCount(), (unsigned long)ubx.getSkippedCount(), (unsigned long)ubx.getCarriedCount());
+    fprintf(stderr, "decode: %.2f ns per byte\n", bytes > 0 ? elapsed * 1000.0 / bytes : 0.0);
+}
+
+int main(int argc, char **argv)
+{
+    size_t maxChunk = argc > 2 ? strtoul(argv[2], nullptr, 10) : 64;
+    randomSeed(1);
+
+    if (argc > 1)
+    {
+        FILE *file = fopen(argv[1], "rb");
+        if (file == nullptr)
+        {
+            fprintf(stderr, "Error: cannot open %s\n", argv[1]);
+            return 2;
+        }
+        std::vector<uint8_t> capture;
+        uint8_t buffer[4096];
+        size_t length;
+        while ((length = fread(buffer, 1, sizeof(buffer), file)) > 0)
+        {
+            capture.insert(capture.end(), buffer, buffer + length);
+        }
+        fclose(file);
+
+        UbxGps ubx(UBX_EPOCH_NEO6);
+        unsigned long elapsed = replay(ubx, capture, maxChunk, printEpoch);
+        printStats(ubx, capture.size(), elapsed);
+        return 0;
+    }
+
+    std::vector<uint8_t> capture;
+    uint32_t corrupted;
+    makeCapture(capture, &corrupted);
+
+    // Byte by byte, every epoch is seen on its own and checked
+    UbxGps byteByByte(UBX_EPOCH_NEO6);
+    replay(byteByByte, capture, 1, checkEpoch);
+    if (byteByByte.getEpochCount() != SYNTHETIC_EPOCHS || checkedEpochs != SYNTHETIC_EPOCHS ||
+        byteByByte.getErrorCount() != corrupted || byteByByte.getAck(UBX_CLASS_CFG, UBX_CFG_RATE) != UBX_ACK_ACCEPTED)
+    {
+        Serial.printf("byte by byte: %lu epochs, %lu checked, %lu bad frames\n", (unsigned long)byteByByte.getEpochCount(),
+                      checkedEpochs, (unsigned long)byteByByte.getErrorCount());
+        failures++;
+    }
+
+    // In random chunks, the decoder must end in the same state
+    UbxGps chunked(UBX_EPOCH_NEO6);
+    unsigned long elapsed = replay(chunked, capture, maxChunk, nullptr);
+    if (chunked.getEpochCount() != byteByByte.getEpochCount() || chunked.getFrameCount() != byteByByte.getFrameCount() ||
+        chunked.getErrorCount() != byteByByte.getErrorCount() || chunked.getSolution().iTOW != byteByByte.getSolution().iTOW ||
+        chunked.getSolution().utcTime != byteByByte.getSolution().utcTime)
+    {
+        Serial.println("chunked replay differs from byte by byte replay");
+        failures++;
+    }
+
+    printStats(chunked, capture.size(), elapsed);
+    Serial.printf("failures: %lu\n", failures);
+    return failures == 0 ? 0 : 1;
+}